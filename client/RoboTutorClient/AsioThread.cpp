@@ -6,6 +6,9 @@ AsioThread::AsioThread(boost::asio::io_service & ios) :
 	ios_(ios), 
 	running_(true), client_(ascf::Client<Protocol>::create(ios_))
 {
+	image_.id       = 0;
+	image_.received = 0;
+
 	client_->message_handler = std::bind(&AsioThread::handleServerMessage, this, std::placeholders::_1, std::placeholders::_2);
 	client_->connect_handler = std::bind(&AsioThread::handleConnect, this, std::placeholders::_1, std::placeholders::_2);
 
@@ -71,8 +74,16 @@ void AsioThread::handleServerMessage(std::shared_ptr<ascf::Client<Protocol>> con
 		ppt_controller_.setSlide(message.slide().offset(), message.slide().relative());
 	}
 	
+	if (message.has_image_chunk()) {
+		handleImageChunk(message.image_chunk());
+	}
+
 	if (message.has_show_image()) {
-		ppt_controller_.createSlide("http://" + host_ + "/capture.jpg");
+		if (message.show_image().has_image()) {
+			showImage(message.show_image().image());
+		} else {
+			ppt_controller_.createSlide("http://" + host_ + "/capture.jpg");
+		}
 	}
 
 	if (message.has_fetch_turningpoint()) {
@@ -80,6 +91,43 @@ void AsioThread::handleServerMessage(std::shared_ptr<ascf::Client<Protocol>> con
 	}
 }
 
+// The first chunk of an image carries its size and starts a new image, replacing any unfinished one.
+// Chunks of an image that isn't being received or that don't fit are ignored.
+void AsioThread::handleImageChunk(ImageChunk const & chunk) {
+	if (chunk.has_size()) {
+		image_.id       = chunk.id();
+		image_.received = 0;
+		image_.data.assign(chunk.size(), '\0');
+	}
+
+	if (chunk.id() != image_.id || chunk.offset() > image_.data.size() || chunk.data().size() > image_.data.size() - chunk.offset()) {
+		emit log("[Warning] Ignoring unexpected camera image chunk.");
+		return;
+	}
+
+	std::copy(chunk.data().begin(), chunk.data().end(), image_.data.begin() + chunk.offset());
+	image_.received += chunk.data().size();
+}
+
+// Save a completely received image and put it on a new slide.
+// PowerPoint embeds the picture, so the same file can be reused for every image.
+void AsioThread::showImage(unsigned int id) {
+	if (id != image_.id || image_.received != image_.data.size()) {
+		emit log("[Warning] Camera image " + QString::number(id) + " was not received completely.");
+		return;
+	}
+
+	QString path = QDir::temp().filePath("robotutor_capture.jpg");
+	QFile file(path);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(image_.data.data(), image_.data.size()) != qint64(image_.data.size())) {
+		emit log("[Warning] Failed to save camera image to " + path + ".");
+		return;
+	}
+	file.close();
+
+	ppt_controller_.createSlide(QDir::toNativeSeparators(path).toStdString());
+}
+
 void AsioThread::handleConnect(std::shared_ptr<ascf::Client<Protocol>> connection, boost::system::error_code const & error) {
 	if (error) {
 		throw boost::system::system_error(error);
@@ -39,8 +39,18 @@ private:
 	std::shared_ptr<ascf::Client<Protocol>> client_;
 	QString turning_point_path_;
 
+	// Camera image being received in chunks.
+	struct PendingImage {
+		unsigned int id;
+		std::string data;
+		std::size_t received;
+	};
+	PendingImage image_;
+
 private:
 	void parseTpXml();
+	void handleImageChunk(ImageChunk const & chunk);
+	void showImage(unsigned int id);
 
 signals:
 	void setStatus(QString status);
@@ -0,0 +1,72 @@
+#include <cstdint>
+#include <new>
+
+#include "arena.hpp"
+
+
+namespace robotutor {
+	
+	namespace {
+		/// Align a pointer upwards.
+		/**
+		 * \param pointer The pointer to align.
+		 * \param alignment The alignment, must be a power of two.
+		 * \return The aligned pointer.
+		 */
+		char * alignUp(char * pointer, std::size_t alignment) {
+			std::uintptr_t address = reinterpret_cast<std::uintptr_t>(pointer);
+			address = (address + alignment - 1) & ~std::uintptr_t(alignment - 1);
+			return reinterpret_cast<char *>(address);
+		}
+	}
+	
+	/// Construct an arena.
+	/**
+	 * \param block_size The default size of a block in bytes.
+	 */
+	Arena::Arena(std::size_t block_size) :
+		block_size_(block_size) {}
+	
+	/// Release all memory blocks.
+	Arena::~Arena() {
+		while (head_) {
+			Block * next = head_->next;
+			::operator delete(head_);
+			head_ = next;
+		}
+	}
+	
+	/// Allocate memory from the arena.
+	/**
+	 * \param size The number of bytes to allocate.
+	 * \param alignment The required alignment, must be a power of two.
+	 * \return A pointer to the allocated memory.
+	 */
+	void * Arena::allocate(std::size_t size, std::size_t alignment) {
+		char * result = alignUp(cursor_, alignment);
+		if (!cursor_ || result + size > end_) {
+			grow_(size + alignment);
+			result = alignUp(cursor_, alignment);
+		}
+		
+		cursor_     = result + size;
+		allocated_ += size;
+		return result;
+	}
+	
+	/// Allocate a new block that can hold at least the given number of bytes.
+	/**
+	 * \param size The minimum number of usable bytes in the block.
+	 */
+	void Arena::grow_(std::size_t size) {
+		if (size < block_size_) size = block_size_;
+		
+		Block * block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+		block->next = head_;
+		head_       = block;
+		cursor_     = reinterpret_cast<char *>(block + 1);
+		end_        = cursor_ + size;
+		++blocks_;
+	}
+	
+}
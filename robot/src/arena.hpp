@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+
+
+namespace robotutor {
+	
+	/// Monotonic memory arena.
+	/**
+	 * Memory is handed out from large blocks by bumping a pointer.
+	 * Individual allocations are never freed,
+	 * all blocks are released at once when the arena is destroyed.
+	 * 
+	 * The arena does not call destructors of objects allocated in it.
+	 */
+	class Arena {
+		protected:
+			/// Header of a memory block.
+			struct Block {
+				/// The previously allocated block.
+				Block * next;
+			};
+			
+			/// The most recently allocated block.
+			Block * head_ = nullptr;
+			
+			/// The first free byte in the current block.
+			char * cursor_ = nullptr;
+			
+			/// The end of the current block.
+			char * end_ = nullptr;
+			
+			/// The default size of a block.
+			std::size_t block_size_;
+			
+			/// Total number of bytes handed out.
+			std::size_t allocated_ = 0;
+			
+			/// Total number of blocks allocated.
+			std::size_t blocks_ = 0;
+			
+		public:
+			/// Construct an arena.
+			/**
+			 * \param block_size The default size of a block in bytes.
+			 */
+			explicit Arena(std::size_t block_size = 16 * 1024);
+			
+			Arena(Arena const &)             = delete;
+			Arena & operator = (Arena const &) = delete;
+			
+			/// Release all memory blocks.
+			~Arena();
+			
+			/// Allocate memory from the arena.
+			/**
+			 * \param size The number of bytes to allocate.
+			 * \param alignment The required alignment, must be a power of two.
+			 * \return A pointer to the allocated memory.
+			 */
+			void * allocate(std::size_t size, std::size_t alignment);
+			
+			/// Get the total number of bytes handed out by the arena.
+			std::size_t allocated() const { return allocated_; }
+			
+			/// Get the number of blocks allocated by the arena.
+			std::size_t blocks() const { return blocks_; }
+			
+		protected:
+			/// Allocate a new block that can hold at least the given number of bytes.
+			/**
+			 * \param size The minimum number of usable bytes in the block.
+			 */
+			void grow_(std::size_t size);
+	};
+	
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace ascf {
+	
+	/// Pool of reusable string buffers.
+	/**
+	 * The pool keeps a reference to every buffer it handed out.
+	 * Once the pool holds the only reference again, nobody else can still be using the buffer,
+	 * so it is cleared and handed out again without allocating.
+	 * Buffers are checked round robin, so the oldest buffer is tried first.
+	 * Only a few buffers are checked per request, a pool full of busy buffers shouldn't make framing slower.
+	 */
+	class BufferPool {
+		protected:
+			/// Mutex protecting the buffer list.
+			std::mutex mutex_;
+			
+			/// All pooled buffers.
+			std::vector<std::shared_ptr<std::string>> buffers_;
+			
+			/// Index of the buffer to check first.
+			std::size_t next_ = 0;
+			
+			/// Maximum number of buffers to keep.
+			std::size_t max_buffers_;
+			
+			/// Maximum capacity of a buffer to keep.
+			std::size_t max_capacity_;
+			
+			/// Number of buffers to check before giving up.
+			static constexpr std::size_t max_probes_ = 4;
+			
+		public:
+			/// Construct a buffer pool.
+			/**
+			 * \param max_buffers The maximum number of buffers to keep.
+			 * \param max_capacity The maximum capacity of a buffer to keep, larger buffers are shrunk on reuse.
+			 */
+			explicit BufferPool(std::size_t max_buffers = 256, std::size_t max_capacity = 64 * 1024) :
+				max_buffers_(max_buffers),
+				max_capacity_(max_capacity) {}
+			
+			/// Get an empty buffer.
+			/**
+			 * If the checked buffers are in use and the pool is full, a fresh unpooled buffer is returned.
+			 * 
+			 * \return A shared pointer to an empty buffer.
+			 */
+			std::shared_ptr<std::string> acquire() {
+				std::lock_guard<std::mutex> lock(mutex_);
+				
+				for (std::size_t i = 0; i < buffers_.size() && i < max_probes_; ++i) {
+					std::size_t index = (next_ + i) % buffers_.size();
+					std::shared_ptr<std::string> & buffer = buffers_[index];
+					if (buffer.use_count() != 1) continue;
+					
+					next_ = index + 1;
+					if (buffer->capacity() > max_capacity_) {
+						std::string().swap(*buffer);
+					} else {
+						buffer->clear();
+					}
+					return buffer;
+				}
+				
+				auto buffer = std::make_shared<std::string>();
+				if (buffers_.size() < max_buffers_) buffers_.push_back(buffer);
+				return buffer;
+			}
+	};
+	
+}
@@ -36,7 +36,7 @@ namespace ascf {
 			 * \param ios The IO service to use.
 			 */
 			Client(typename BaseType::must_be_shared_ must_be_shared, boost::asio::io_service & ios) :
-				BaseType(must_be_shared, typename Protocol::Transport::socket(ios)),
+				BaseType(must_be_shared, ios, typename Protocol::Transport::socket(ios)),
 				extension_(*this) {}
 			
 			/// Virtual deconstructor.
@@ -62,13 +62,7 @@ namespace ascf {
 			 */
 			void connect(typename Protocol::Transport::endpoint const & endpoint, EventHandler callback = nullptr) {
 				auto handler = std::bind(&Client<Protocol>::handleConnect_, this, std::placeholders::_1, callback);
-				this->socket_.async_connect(endpoint, handler);
-			}
-			
-			/// Close the connection.
-			void close() {
-				BaseType::close();
-				extension_.handleClose();
+				this->socket_.async_connect(endpoint, this->strand_.wrap(handler));
 			}
 			
 			/// Connect to an endpoint.
@@ -136,6 +130,12 @@ namespace ascf {
 				this->asyncRead_();
 			}
 			
+			/// Close the socket.
+			void close_() override {
+				BaseType::close_();
+				extension_.handleClose();
+			}
+			
 			/// Handle messages by passing them to the user defined message handler.
 			/**
 			 * \param message The message to handle.
@@ -3,6 +3,10 @@
 #include <string>
 #include <memory>
 #include <functional>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <vector>
 
 #include <boost/asio.hpp>
 
@@ -13,6 +17,42 @@ namespace ascf {
 	template<typename Protocol> class ServerConnection;
 	template<typename Protocol> class Client;
 	
+	/// What to do with a message that would exceed the high-water mark of a connection.
+	enum class OverflowPolicy {
+		/// Drop the message, the connection stays open.
+		drop,
+		
+		/// Close the connection, which makes the pending read or write fail.
+		disconnect,
+	};
+	
+	/// Default high-water mark for outbound data of a connection in bytes.
+	constexpr std::size_t default_high_water_mark = 16 * 1024 * 1024;
+	
+	/// Default smallest read size in bytes.
+	constexpr std::size_t default_min_read_size = 1024;
+	
+	/// Default largest read size in bytes.
+	constexpr std::size_t default_max_read_size = 1024 * 1024;
+	
+	/// Default maximum size of an inbound message in bytes.
+	constexpr std::size_t default_max_frame_size = 16 * 1024 * 1024;
+	
+	/// Result of taking a message from a read buffer.
+	enum class ReadResult {
+		/// The buffer doesn't hold a complete message yet.
+		incomplete,
+		
+		/// A message was read and removed from the buffer.
+		message,
+		
+		/// The next frame is larger than the maximum frame size.
+		too_large,
+		
+		/// The next frame doesn't hold a valid message.
+		invalid,
+	};
+	
 	/// Default server extension that does nothing.
 	template<typename Protocol>
 	struct ServerExtension {
@@ -160,6 +200,11 @@ namespace ascf {
 	
 	
 	/// Connection class.
+	/**
+	 * All socket operations and handlers of a connection run on its strand,
+	 * and the setters change their settings on the strand too,
+	 * so the public functions may be called from any thread of the IO service.
+	 */
 	template<typename Protocol, bool IsServer>
 	class Connection : public std::enable_shared_from_this<Connection<Protocol, IsServer>> {
 		public:
@@ -173,12 +218,60 @@ namespace ascf {
 			/// The socket for communication.
 			typename Protocol::Transport::socket socket_;
 			
+			/// Strand serializing all work on the connection.
+			boost::asio::io_service::strand strand_;
+			
 			/// Protected struct to prevent direct use of constructor.
 			struct must_be_shared_ {};
 			
 			/// A buffer for reading from the connection.
 			StreamBuf read_buffer_;
 			
+			/// A framed message waiting to be written.
+			struct PendingWrite {
+				std::shared_ptr<std::string const> buffer;
+				EventHandler callback;
+			};
+			
+			/// Messages waiting for the current write to finish.
+			std::deque<PendingWrite> write_queue_;
+			
+			/// Messages in the write currently in flight.
+			std::vector<PendingWrite> writing_;
+			
+			/// Bytes queued or in flight.
+			std::atomic<std::size_t> pending_bytes_ { 0 };
+			
+			/// Maximum number of bytes queued or in flight, or 0 for no limit.
+			std::size_t high_water_mark_ = default_high_water_mark;
+			
+			/// What to do with a message that would exceed the high-water mark.
+			OverflowPolicy overflow_policy_ = OverflowPolicy::disconnect;
+			
+			/// Number of messages dropped because of the high-water mark.
+			std::atomic<std::size_t> dropped_ { 0 };
+			
+			/// Maximum size of an inbound message.
+			/**
+			 * Only written on the strand, but atomic so the getter can be called from any thread.
+			 */
+			std::atomic<std::size_t> max_frame_size_ { default_max_frame_size };
+			
+			/// Smallest size to prepare for a read.
+			/**
+			 * The read sizes are only written on the strand, but atomic so the getters can be called from any thread.
+			 */
+			std::atomic<std::size_t> min_read_size_ { default_min_read_size };
+			
+			/// Largest size to prepare for a read.
+			std::atomic<std::size_t> max_read_size_ { default_max_read_size };
+			
+			/// Size to prepare for the next read, adapted to how much the previous reads returned.
+			std::atomic<std::size_t> read_size_ { default_min_read_size };
+			
+			/// Size prepared for the read in flight.
+			std::size_t prepared_ = 0;
+			
 			// Delete copy/move constructor and assignment.
 			Connection(Connection const &)                     = delete;
 			Connection(Connection &&)                          = delete;
@@ -188,10 +281,12 @@ namespace ascf {
 		public:
 			/// Construct a connection.
 			/**
+			 * \param ios The IO service the socket belongs to.
 			 * \param socket The socket to use for the connection.
 			 */
-			explicit Connection(must_be_shared_, typename Protocol::Transport::socket && socket) :
-				socket_(std::forward<typename Protocol::Transport::socket>(socket)) {}
+			Connection(must_be_shared_, boost::asio::io_service & ios, typename Protocol::Transport::socket && socket) :
+				socket_(std::forward<typename Protocol::Transport::socket>(socket)),
+				strand_(ios) {}
 			
 			/// Deconstruct the connection.
 			virtual ~Connection() {}
@@ -204,6 +299,9 @@ namespace ascf {
 			/// Get a reference to the socket used by the connection.
 			typename Protocol::Transport::socket const & socket() const { return socket_; }
 			
+			/// Get the strand that all work on the connection runs on.
+			boost::asio::io_service::strand & strand() { return strand_; }
+			
 			/// Check if the connection is open.
 			/**
 			 * \param return True if the connetion is open and can be used.
@@ -211,55 +309,211 @@ namespace ascf {
 			bool isOpen() const { return socket_.is_open(); }
 			
 			/// Close the connection.
-			virtual void close() {
-				ErrorCode error;
-				socket_.shutdown(Protocol::Transport::socket::shutdown_type::shutdown_both, error);
-				socket_.close(error);
+			/**
+			 * The socket is closed on the strand of the connection,
+			 * so the connection may not be closed yet when this returns.
+			 */
+			void close() {
+				auto connection = this->shared_from_this();
+				strand_.dispatch([this, connection] () {
+					close_();
+				});
 			}
 			
 			/// Send a message over the connection.
 			/**
+			 * Messages are written in the order they are sent.
+			 * 
 			 * \param message The message (without trailing newline).
 			 */
 			void sendMessage(typename Details::WriteMessage const & message, EventHandler callback = nullptr) {
-				asyncWriteBuffer_(Protocol::frameMessage(message), callback);
+				sendBuffer_(Protocol::frameMessage(message), callback);
 			}
 			
+			/// Limit the amount of outbound data that may pile up for a slow peer.
+			/**
+			 * The limit is set on the strand of the connection,
+			 * so it applies to messages sent after this call from the same thread.
+			 * 
+			 * \param bytes The maximum number of bytes queued or in flight, or 0 for no limit.
+			 * \param policy What to do with a message that would exceed the limit.
+			 */
+			void highWaterMark(std::size_t bytes, OverflowPolicy policy) {
+				auto connection = this->shared_from_this();
+				strand_.dispatch([this, connection, bytes, policy] () {
+					high_water_mark_ = bytes;
+					overflow_policy_ = policy;
+				});
+			}
+			
+			/// Set the maximum size of an inbound message.
+			/**
+			 * A larger frame makes the read fail with error::message_size,
+			 * before any of it is buffered.
+			 * The size is set on the strand of the connection, so it applies from the next read on.
+			 * 
+			 * \param bytes The maximum size of a message, excluding the frame header.
+			 */
+			void maxFrameSize(std::size_t bytes) {
+				auto connection = this->shared_from_this();
+				strand_.dispatch([this, connection, bytes] () {
+					max_frame_size_ = bytes;
+				});
+			}
+			
+			/// Get the maximum size of an inbound message.
+			std::size_t maxFrameSize() const { return max_frame_size_; }
+			
+			/// Set the bounds for the size of a single read.
+			/**
+			 * The bounds are set on the strand of the connection, so they apply from the next read on.
+			 * 
+			 * \param min The smallest size to prepare for a read.
+			 * \param max The largest size to prepare for a read.
+			 */
+			void readSize(std::size_t min, std::size_t max) {
+				auto connection = this->shared_from_this();
+				strand_.dispatch([this, connection, min, max] () {
+					min_read_size_ = min;
+					max_read_size_ = std::max(min, max);
+					read_size_     = std::min(std::max(read_size_.load(), min), max_read_size_.load());
+				});
+			}
+			
+			/// Get the size prepared for the next read.
+			/**
+			 * Adapts to the reads between minReadSize() and maxReadSize().
+			 */
+			std::size_t readSize() const { return read_size_; }
+			
+			/// Get the smallest size to prepare for a read.
+			std::size_t minReadSize() const { return min_read_size_; }
+			
+			/// Get the largest size to prepare for a read.
+			std::size_t maxReadSize() const { return max_read_size_; }
+			
+			/// Get the number of bytes queued or in flight.
+			std::size_t pendingBytes() const { return pending_bytes_; }
+			
+			/// Get the number of messages dropped because of the high-water mark.
+			std::size_t dropped() const { return dropped_; }
+			
 		protected:
 			/// Get a shared pointer to this.
 			typename Details::SharedReal get_shared_() {
 				return Details::cast_shared(this->shared_from_this());
 			}
 			
+			/// Close the socket.
+			/**
+			 * Runs on the strand of the connection.
+			 */
+			virtual void close_() {
+				ErrorCode error;
+				socket_.shutdown(Protocol::Transport::socket::shutdown_type::shutdown_both, error);
+				socket_.close(error);
+			}
+			
+			/// Send a framed message from any thread.
+			/**
+			 * \param buffer A shared buffer holding the message size and contents.
+			 */
+			void sendBuffer_(std::shared_ptr<std::string const> buffer, EventHandler callback) {
+				auto connection = this->shared_from_this();
+				strand_.dispatch([this, connection, buffer, callback] () {
+					if (socket_.is_open()) {
+						asyncWriteBuffer_(buffer, callback);
+					} else if (callback) {
+						callback(get_shared_(), boost::asio::error::not_connected);
+					}
+				});
+			}
+			
 			/// Asynchronously send a buffer over the connection.
 			/**
+			 * Runs on the strand of the connection.
+			 * The buffer is queued if a write is already in flight.
+			 * 
 			 * \param buffer A shared buffer holding the message size and contents.
 			 */
 			void asyncWriteBuffer_(std::shared_ptr<std::string const> buffer, EventHandler callback) {
-				// Start the asynchronous write.
+				if (high_water_mark_ && pending_bytes_ + buffer->size() > high_water_mark_) {
+					++dropped_;
+					if (overflow_policy_ == OverflowPolicy::disconnect) {
+						// Only close the socket, the failing read or write reports the error as usual.
+						ErrorCode error;
+						socket_.shutdown(Protocol::Transport::socket::shutdown_type::shutdown_both, error);
+						socket_.close(error);
+					}
+					if (callback) callback(get_shared_(), boost::asio::error::no_buffer_space);
+					return;
+				}
+				
+				pending_bytes_ += buffer->size();
+				write_queue_.push_back(PendingWrite{buffer, callback});
+				if (writing_.empty()) asyncWriteQueue_();
+			}
+			
+			/// Write all queued buffers with a single write operation.
+			void asyncWriteQueue_() {
+				std::vector<boost::asio::const_buffer> buffers;
+				buffers.reserve(write_queue_.size());
+				for (auto & pending : write_queue_) {
+					buffers.push_back(boost::asio::buffer(*pending.buffer));
+					writing_.push_back(std::move(pending));
+				}
+				write_queue_.clear();
+				
 				auto connection = this->shared_from_this();
-				auto handler    = std::bind(&Connection<Protocol, IsServer>::handleWrite_, this, std::placeholders::_1, std::placeholders::_2, buffer, callback);
-				boost::asio::async_write(socket_, boost::asio::buffer(*buffer), handler);
+				boost::asio::async_write(socket_, buffers, strand_.wrap([this, connection] (ErrorCode const & error, std::size_t bytes_transferred) {
+					handleWrite_(error, bytes_transferred);
+				}));
 			}
 			
 			/// Start an asynchronous read operation.
+			/**
+			 * When the buffer holds the start of a frame, enough room for the rest of it is prepared,
+			 * so a large message doesn't take a round trip per kilobyte.
+			 */
 			void asyncRead_() {
+				std::size_t missing = std::min(Protocol::missingBytes(read_buffer_), max_read_size_.load());
+				prepared_ = std::max(read_size_.load(), missing);
+				
 				auto connection = this->shared_from_this();
-				auto handler    = std::bind(&Connection<Protocol, IsServer>::handleRead_, this, std::placeholders::_1, std::placeholders::_2);
-				socket_.async_read_some(read_buffer_.prepare(1024), handler);
+				socket_.async_read_some(read_buffer_.prepare(prepared_), strand_.wrap([this, connection] (ErrorCode const & error, std::size_t bytes_transferred) {
+					handleRead_(error, bytes_transferred);
+				}));
 			}
 			
 			/// Handle a write operation.
 			/**
+			 * Invokes the callbacks of all written messages and starts writing the messages queued meanwhile.
+			 * 
 			 * \param error             Describes the error that occured, if any did.
 			 * \param bytes_transferred The amount of bytes transferred for this operation.
 			 */
-			void handleWrite_(ErrorCode const & error, std::size_t bytes_transferred, std::shared_ptr<std::string const> buffer, EventHandler callback) {
-				if (callback) {
-					callback(get_shared_(), error);
-				} else if (error) {
-					throw typename Details::Error(get_shared_(), error);
+			void handleWrite_(ErrorCode const & error, std::size_t bytes_transferred) {
+				std::vector<PendingWrite> written;
+				written.swap(writing_);
+				
+				// Nothing else will be written after an error, so fail the queued messages too.
+				if (error) {
+					for (auto & pending : write_queue_) written.push_back(std::move(pending));
+					write_queue_.clear();
 				}
+				
+				bool unhandled = false;
+				for (auto & pending : written) {
+					pending_bytes_ -= pending.buffer->size();
+					if (pending.callback) {
+						pending.callback(get_shared_(), error);
+					} else {
+						unhandled = true;
+					}
+				}
+				if (error && unhandled) throw typename Details::Error(get_shared_(), error);
+				
+				if (!error && !write_queue_.empty() && writing_.empty()) asyncWriteQueue_();
 			}
 			
 			/// Handle a read operation.
@@ -274,8 +528,24 @@ namespace ascf {
 				// Otherwise check the received data for a whole message and process it.
 				} else {
 					read_buffer_.commit(bytes_transferred);
-					while (auto message = Protocol::template consumeMessage<typename Details::ReadMessage>(read_buffer_)) {
-						handleMessage_(std::move(*message));
+					
+					// Grow the read size while reads fill the buffer, shrink it when they use little of it.
+					std::size_t read_size = read_size_;
+					if (bytes_transferred == prepared_) {
+						read_size_ = std::min(read_size * 2, max_read_size_.load());
+					} else if (bytes_transferred < read_size / 4) {
+						read_size_ = std::max(read_size / 2, min_read_size_.load());
+					}
+					
+					// Parse straight from the read buffer, reusing one message object.
+					typename Details::ReadMessage message;
+					while (true) {
+						ReadResult result = Protocol::consumeMessage(read_buffer_, message, max_frame_size_);
+						if (result == ReadResult::incomplete) break;
+						if (result == ReadResult::too_large) throw typename Details::Error(get_shared_(), boost::asio::error::message_size);
+						if (result == ReadResult::invalid)   throw typename Details::Error(get_shared_(), boost::system::errc::make_error_code(boost::system::errc::bad_message));
+						handleMessage_(std::move(message));
+						message.Clear();
 					}
 					
 					// Get more data.
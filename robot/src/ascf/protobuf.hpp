@@ -4,8 +4,8 @@
 #include <memory>
 
 #include <boost/asio.hpp>
-#include <boost/optional.hpp>
 
+#include "buffer_pool.hpp"
 #include "connection.hpp"
 #include "client.hpp"
 #include "server.hpp"
@@ -24,62 +24,88 @@ namespace ascf {
 		typedef ::ascf::ServerConnectionExtension<Protocol> ServerConnectionExtension;
 		typedef ::ascf::ClientExtension<Protocol>           ClientExtension;
 		
+		/// Get the pool that frame buffers are taken from.
+		static BufferPool & pool() {
+			static BufferPool pool;
+			return pool;
+		}
+		
 		/// Frame a message by prefixing it with it's size.
 		/**
+		 * The message is serialized directly into a pooled buffer.
+		 * 
 		 * \param message The message to frame.
 		 * \return A buffer holding the message size in big endian, followed by the serialized message.
 		 */
 		template<typename MessageType>
 		static std::shared_ptr<std::string> frameMessage(MessageType const & message) {
 			unsigned int size = message.ByteSize();
-			auto buffer = std::make_shared<std::string>();
-			buffer->reserve(4 + size);
+			auto buffer = pool().acquire();
+			buffer->resize(4 + size);
+			unsigned char * data = reinterpret_cast<unsigned char *>(&(*buffer)[0]);
 			
 			// Add size in big endian.
-			buffer->push_back((size >> 3 * 8) & 0xff);
-			buffer->push_back((size >> 2 * 8) & 0xff);
-			buffer->push_back((size >> 1 * 8) & 0xff);
-			buffer->push_back((size >> 0 * 8) & 0xff);
+			data[0] = (size >> 3 * 8) & 0xff;
+			data[1] = (size >> 2 * 8) & 0xff;
+			data[2] = (size >> 1 * 8) & 0xff;
+			data[3] = (size >> 0 * 8) & 0xff;
 			
-			// Add the message.
-			message.AppendToString(buffer.get());
+			// Add the message, ByteSize() already cached the sizes of all sub messages.
+			message.SerializeWithCachedSizesToArray(data + 4);
 			
 			return buffer;
 		}
 		
+		/// Get the number of bytes needed to complete the next frame in the buffer.
+		/**
+		 * \param buffer The buffer to check.
+		 * \return The number of missing bytes, or 0 if the buffer holds a complete frame.
+		 */
+		static std::size_t missingBytes(boost::asio::streambuf const & buffer) {
+			if (buffer.size() < 4) return 4 - buffer.size();
+			
+			unsigned char const * data = boost::asio::buffer_cast<unsigned char const *>(buffer.data());
+			std::size_t size =
+				  (std::size_t(data[0]) << 3 * 8)
+				+ (std::size_t(data[1]) << 2 * 8)
+				+ (std::size_t(data[2]) << 1 * 8)
+				+ (std::size_t(data[3]) << 0 * 8);
+			return buffer.size() < 4 + size ? 4 + size - buffer.size() : 0;
+		}
+		
 		/// Consume a message from the buffer.
 		/**
+		 * The message is parsed in place from the buffer.
+		 * Missing required fields are not treated as an error.
+		 * 
 		 * \param buffer The buffer to read from.
-		 * \return The message, if the buffer contained a valid message.
+		 * \param message The message to parse into. Should be empty.
+		 * \param max_size The maximum size of a message.
+		 * \return The result, the message is only valid if it is ReadResult::message.
 		 */
 		template<typename MessageType>
-		static boost::optional<MessageType> consumeMessage(boost::asio::streambuf & buffer) {
+		static ReadResult consumeMessage(boost::asio::streambuf & buffer, MessageType & message, std::size_t max_size) {
 			// Buffer must contain atleast 4 bytes, the length of the message.
-			if (buffer.size() < 4) return false;
+			if (buffer.size() < 4) return ReadResult::incomplete;
 			
 			// Read message size in big endian.
 			unsigned char const * data = boost::asio::buffer_cast<unsigned char const *>(buffer.data());
-			unsigned int size =
-				  (data[0] << 3 * 8)
-				+ (data[1] << 2 * 8)
-				+ (data[2] << 1 * 8)
-				+ (data[3] << 0 * 8);
+			std::size_t size =
+				  (std::size_t(data[0]) << 3 * 8)
+				+ (std::size_t(data[1]) << 2 * 8)
+				+ (std::size_t(data[2]) << 1 * 8)
+				+ (std::size_t(data[3]) << 0 * 8);
+			
+			// Refuse oversized frames before waiting for them, a corrupt header would grow the buffer without limit.
+			if (size > max_size) return ReadResult::too_large;
 			
-			// Size of 0 means an empty (default constructed).
-			if (!size) {
-				buffer.consume(4);
-				return boost::make_optional(MessageType());
-				
 			// Make sure buffer contains the entire message.
-			} else if (buffer.size() >= 4 + size) {
-				boost::optional<MessageType> message((MessageType()));
-				message->ParseFromArray(reinterpret_cast<void const *>(&data[4]), size);
-				buffer.consume(4 + size);
-				return message;
-			// Buffer didn't contain a complete message.
-			} else {
-				return boost::optional<MessageType>();
-			}
+			if (buffer.size() < 4 + size) return ReadResult::incomplete;
+			
+			// A size of 0 means an empty (default constructed) message.
+			bool valid = message.ParsePartialFromArray(reinterpret_cast<void const *>(&data[4]), size);
+			buffer.consume(4 + size);
+			return valid ? ReadResult::message : ReadResult::invalid;
 		}
 	};
 	
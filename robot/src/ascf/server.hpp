@@ -4,6 +4,8 @@
 #include <functional>
 #include <list>
 #include <iterator>
+#include <mutex>
+#include <vector>
 
 #include <boost/asio.hpp>
 
@@ -45,9 +47,10 @@ namespace ascf {
 			 * \param socket The socket to use.
 			 */
 			ServerConnection(typename BaseType::must_be_shared_ must_be_shared, Server<Protocol> & server, typename Protocol::Transport::socket && socket) :
-				BaseType(must_be_shared, std::forward<typename Protocol::Transport::socket>(socket)),
+				BaseType(must_be_shared, server.ios(), std::forward<typename Protocol::Transport::socket>(socket)),
 				server_(server),
-				extension_(*this) {}
+				extension_(*this),
+				identifier_(server.connections_.end()) {}
 			
 			/// Virtual deconstructor.
 			virtual ~ServerConnection() {}
@@ -62,14 +65,22 @@ namespace ascf {
 			/// Get the server associated with the connection.
 			Server<Protocol> const & server() const { return server_; };
 			
-			/// Close the connection.
-			void close() {
-				BaseType::close();
+		protected:
+			/// Close the socket and unregister the connection.
+			/**
+			 * Safe to call more than once, for example when both a read and a write fail.
+			 */
+			void close_() override {
+				BaseType::close_();
+				{
+					std::lock_guard<std::mutex> lock(server_.mutex_);
+					if (identifier_ == server_.connections_.end()) return;
+					server_.connections_.erase(identifier_);
+					identifier_ = server_.connections_.end();
+				}
 				extension_.handleClose();
-				server_.connections_.erase(identifier_);
 			}
 			
-		protected:
 			/// Create a new server connection.
 			/**
 			 * \param server The server managing us.
@@ -125,9 +136,27 @@ namespace ascf {
 			/// Protocol defined extension.
 			typename Protocol::ServerExtension extension_;
 			
+			/// Mutex protecting the connection list, and the acceptor once the server listens.
+			std::mutex mutex_;
+			
 			/// List of open connections.
 			std::list<std::shared_ptr<ServerConnection<Protocol>>> connections_;
 			
+			/// High-water mark for new connections.
+			std::size_t high_water_mark_ = default_high_water_mark;
+			
+			/// Overflow policy for new connections.
+			OverflowPolicy overflow_policy_ = OverflowPolicy::disconnect;
+			
+			/// Maximum inbound message size for new connections.
+			std::size_t max_frame_size_ = default_max_frame_size;
+			
+			/// Smallest read size for new connections.
+			std::size_t min_read_size_ = default_min_read_size;
+			
+			/// Largest read size for new connections.
+			std::size_t max_read_size_ = default_max_read_size;
+			
 		public:
 			/// Construct a Server using the specified IO service and endpoint.
 			/**
@@ -148,6 +177,41 @@ namespace ascf {
 			/// Get a reference to the ASIO IO service.
 			boost::asio::io_service const & ios() const { return ios_; }
 			
+			/// Limit the amount of outbound data that may pile up for a slow client.
+			/**
+			 * Applies to connections accepted after the call.
+			 * The accept handler reads the setting without locking, so set it before the IO service runs.
+			 * 
+			 * \param bytes The maximum number of bytes queued or in flight per connection, or 0 for no limit.
+			 * \param policy What to do with a message that would exceed the limit.
+			 */
+			void highWaterMark(std::size_t bytes, OverflowPolicy policy) {
+				high_water_mark_ = bytes;
+				overflow_policy_ = policy;
+			}
+			
+			/// Set the maximum size of an inbound message.
+			/**
+			 * Applies to connections accepted after the call.
+			 * The accept handler reads the setting without locking, so set it before the IO service runs.
+			 * 
+			 * \param bytes The maximum size of a message, excluding the frame header.
+			 */
+			void maxFrameSize(std::size_t bytes) { max_frame_size_ = bytes; }
+			
+			/// Set the bounds for the size of a single read.
+			/**
+			 * Applies to connections accepted after the call.
+			 * The accept handler reads the setting without locking, so set it before the IO service runs.
+			 * 
+			 * \param min The smallest size to prepare for a read.
+			 * \param max The largest size to prepare for a read.
+			 */
+			void readSize(std::size_t min, std::size_t max) {
+				min_read_size_ = min;
+				max_read_size_ = max;
+			}
+			
 			/// Start listening for incoming connections.
 			/**
 			 * \param endpoint The local endpoint to bind to.
@@ -188,26 +252,58 @@ namespace ascf {
 				listen(boost::asio::ip::tcp::v6(), port);
 			}
 			
+			/// Get the local endpoint the server listens on.
+			/**
+			 * Tells the port the system picked when listening on port 0.
+			 */
+			typename Protocol::Transport::endpoint localEndpoint() const { return acceptor_.local_endpoint(); }
+			
 			/// Close the server.
 			/**
 			 * Stop listening to connections and clear all registered connections.
+			 * Safe to call while the IO service runs on other threads.
+			 * Connections that are still open forget their place in the list,
+			 * so closing them later doesn't erase from the cleared list.
 			 */
 			void close() {
+				std::lock_guard<std::mutex> lock(mutex_);
 				acceptor_.close();
+				for (auto & connection : connections_) connection->identifier_ = connections_.end();
 				connections_.clear();
 			}
 			
+			/// Get the connected clients.
+			/**
+			 * \return A snapshot of the connections.
+			 */
+			std::vector<std::shared_ptr<ServerConnection<Protocol>>> connections() {
+				std::lock_guard<std::mutex> lock(mutex_);
+				return std::vector<std::shared_ptr<ServerConnection<Protocol>>>(connections_.begin(), connections_.end());
+			}
+			
 			/// Send a message to all connected clients.
 			/**
+			 * The message is framed once and the buffer is shared between the connections.
+			 * 
 			 * \param message The message to send.
 			 */
 			void sendMessage(typename Protocol::ServerMessage const & message) {
+				// Work on a copy of the list, sending may close a connection which removes it from the list.
+				sendMessage(message, connections());
+			}
+			
+			/// Send a message to a group of connected clients.
+			/**
+			 * The message is framed once and the buffer is shared between the connections.
+			 * 
+			 * \param message The message to send.
+			 * \param connections The connections to send the message to.
+			 */
+			template<typename Connections>
+			void sendMessage(typename Protocol::ServerMessage const & message, Connections const & connections) {
 				auto buffer = Protocol::frameMessage(message);
-				
-				for (auto connection : connections_) {
-					if (connection->isOpen()) {
-						connection->asyncWriteBuffer_(buffer, nullptr);
-					}
+				for (auto & connection : connections) {
+					connection->sendBuffer_(buffer, nullptr);
 				}
 			}
 			
@@ -216,7 +312,10 @@ namespace ascf {
 			void asyncAccept_() {
 				std::shared_ptr<typename Protocol::Transport::socket> socket = std::make_shared<typename Protocol::Transport::socket>(ios_);
 				auto handler = std::bind(&Server<Protocol>::handleAccept_, this, socket, std::placeholders::_1);
-				acceptor_.async_accept(*socket, handler);
+				
+				// Once the server is closed, the aborted accept must not start a new one.
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (acceptor_.is_open()) acceptor_.async_accept(*socket, handler);
 			}
 			
 			/// Handle an accepted connection.
@@ -227,16 +326,24 @@ namespace ascf {
 			void handleAccept_(std::shared_ptr<typename Protocol::Transport::socket> socket, ErrorCode const & error) {
 				if (!error) {
 					auto connection = ServerConnection<Protocol>::create(*this, std::move(*socket));
+					connection->highWaterMark(high_water_mark_, overflow_policy_);
+					connection->maxFrameSize(max_frame_size_);
+					connection->readSize(min_read_size_, max_read_size_);
 					
 					if (extension_.handleAccept(connection)) {
 						// Register the connection.
-						connections_.push_back(connection);
-						connection->identifier_ = std::prev(connections_.end());
+						{
+							std::lock_guard<std::mutex> lock(mutex_);
+							connections_.push_back(connection);
+							connection->identifier_ = std::prev(connections_.end());
+						}
 						
 						if (on_accept) on_accept(connection);
 						
-						// Start the asynchronous read loop.
-						connection->start_();
+						// Start the asynchronous read loop on the strand of the connection.
+						connection->strand().dispatch([connection] () {
+							connection->start_();
+						});
 					}
 				}
 				
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "audio_level.hpp"
+
+
+namespace robotutor {
+	
+	namespace {
+		/// Full scale of a 16 bit sample.
+		float const full_scale = 32768;
+		
+		/// Accumulated sample statistics of one channel.
+		struct Accumulator {
+			/// The largest sample.
+			int max = 0;
+			
+			/// The smallest sample.
+			int min = 0;
+			
+			/// The sum of the squared samples.
+			std::uint64_t squares = 0;
+		};
+		
+		/// Add samples to the accumulators of their channels.
+		/**
+		 * \param samples The interleaved samples.
+		 * \param frames The number of samples per channel.
+		 * \param channels The number of channels.
+		 * \param accumulators One accumulator per channel.
+		 */
+		void accumulateScalar(std::int16_t const * samples, std::size_t frames, unsigned int channels, Accumulator * accumulators) {
+			for (std::size_t frame = 0; frame < frames; ++frame) {
+				for (unsigned int channel = 0; channel < channels; ++channel) {
+					int sample = *samples++;
+					Accumulator & accumulator = accumulators[channel];
+					accumulator.max      = std::max(accumulator.max, sample);
+					accumulator.min      = std::min(accumulator.min, sample);
+					accumulator.squares += std::uint64_t(sample * sample);
+				}
+			}
+		}
+		
+#ifdef __SSE2__
+		/// Add samples to the accumulators of their channels using SSE2.
+		/**
+		 * Works on eight samples at a time, so every lane always holds the same channel.
+		 * The squares are summed in pairs of the same channel with a multiply-add,
+		 * and widened to 64 bits before they are accumulated, so they never overflow.
+		 * 
+		 * \param samples The interleaved samples.
+		 * \param frames The number of samples per channel.
+		 * \param channels The number of channels, must be 1, 2 or 4.
+		 * \param accumulators One accumulator per channel.
+		 * \return The number of frames that were processed.
+		 */
+		std::size_t accumulateSse2(std::int16_t const * samples, std::size_t frames, unsigned int channels, Accumulator * accumulators) {
+			std::size_t const vectors = frames * channels / 8;
+			__m128i const zero = _mm_setzero_si128();
+			__m128i max        = _mm_set1_epi16(-32768);
+			__m128i min        = _mm_set1_epi16(32767);
+			__m128i squares_lo = zero;
+			__m128i squares_hi = zero;
+			
+			for (std::size_t i = 0; i < vectors; ++i) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(samples) + i);
+				max = _mm_max_epi16(max, x);
+				min = _mm_min_epi16(min, x);
+				
+				// Put samples of the same channel next to each other.
+				// The 32 bit lanes of the multiply-add then hold channel j % channels.
+				__m128i pairs = x;
+				if (channels == 2) {
+					pairs = _mm_shufflelo_epi16(pairs, _MM_SHUFFLE(3, 1, 2, 0));
+					pairs = _mm_shufflehi_epi16(pairs, _MM_SHUFFLE(3, 1, 2, 0));
+				} else if (channels == 4) {
+					pairs = _mm_unpacklo_epi16(x, _mm_srli_si128(x, 8));
+				}
+				
+				// Two squares sum to at most 2^31, which fits in an unsigned 32 bit lane.
+				__m128i sums = _mm_madd_epi16(pairs, pairs);
+				squares_lo = _mm_add_epi64(squares_lo, _mm_unpacklo_epi32(sums, zero));
+				squares_hi = _mm_add_epi64(squares_hi, _mm_unpackhi_epi32(sums, zero));
+			}
+			
+			alignas(16) std::int16_t  max_lanes[8];
+			alignas(16) std::int16_t  min_lanes[8];
+			alignas(16) std::uint64_t square_lanes[4];
+			_mm_store_si128(reinterpret_cast<__m128i *>(max_lanes), max);
+			_mm_store_si128(reinterpret_cast<__m128i *>(min_lanes), min);
+			_mm_store_si128(reinterpret_cast<__m128i *>(square_lanes),     squares_lo);
+			_mm_store_si128(reinterpret_cast<__m128i *>(square_lanes + 2), squares_hi);
+			
+			if (vectors) {
+				for (unsigned int lane = 0; lane < 8; ++lane) {
+					Accumulator & accumulator = accumulators[lane % channels];
+					accumulator.max = std::max<int>(accumulator.max, max_lanes[lane]);
+					accumulator.min = std::min<int>(accumulator.min, min_lanes[lane]);
+				}
+				for (unsigned int lane = 0; lane < 4; ++lane) {
+					accumulators[lane % channels].squares += square_lanes[lane];
+				}
+			}
+			
+			return vectors * 8 / channels;
+		}
+#endif
+		
+		/// Convert accumulated statistics to levels.
+		/**
+		 * \param accumulators The accumulated statistics, one per channel.
+		 * \param frames The number of samples per channel.
+		 * \param channels The number of channels.
+		 * \param levels Array receiving the level of every channel.
+		 */
+		void finish(Accumulator const * accumulators, std::size_t frames, unsigned int channels, ChannelLevel * levels) {
+			for (unsigned int channel = 0; channel < channels; ++channel) {
+				Accumulator const & accumulator = accumulators[channel];
+				levels[channel].peak = std::max(accumulator.max, -accumulator.min) / full_scale;
+				levels[channel].rms  = frames ? std::sqrt(double(accumulator.squares) / frames) / full_scale : 0;
+			}
+		}
+	}
+	
+	/// Measure the peak and RMS levels of interleaved 16 bit PCM samples.
+	/**
+	 * Uses SSE2 for one, two and four channels when it is available,
+	 * and falls back to measureLevelsScalar() otherwise.
+	 * 
+	 * \param samples The interleaved samples.
+	 * \param frames The number of samples per channel.
+	 * \param channels The number of channels.
+	 * \param levels Array receiving the level of every channel.
+	 */
+	void measureLevels(std::int16_t const * samples, std::size_t frames, unsigned int channels, ChannelLevel * levels) {
+#ifdef __SSE2__
+		if (channels == 1 || channels == 2 || channels == 4) {
+			Accumulator accumulators[4];
+			std::size_t done = accumulateSse2(samples, frames, channels, accumulators);
+			accumulateScalar(samples + done * channels, frames - done, channels, accumulators);
+			finish(accumulators, frames, channels, levels);
+			return;
+		}
+#endif
+		measureLevelsScalar(samples, frames, channels, levels);
+	}
+	
+	/// Measure the peak and RMS levels of interleaved 16 bit PCM samples, without SIMD.
+	/**
+	 * \param samples The interleaved samples.
+	 * \param frames The number of samples per channel.
+	 * \param channels The number of channels.
+	 * \param levels Array receiving the level of every channel.
+	 */
+	void measureLevelsScalar(std::int16_t const * samples, std::size_t frames, unsigned int channels, ChannelLevel * levels) {
+		std::vector<Accumulator> accumulators(channels);
+		accumulateScalar(samples, frames, channels, accumulators.data());
+		finish(accumulators.data(), frames, channels, levels);
+	}
+	
+	/// Construct an audio level tracker.
+	/**
+	 * \param sample_rate The sample rate of the buffers, in Hz.
+	 */
+	AudioLevel::AudioLevel(unsigned int sample_rate) :
+		sample_rate_(sample_rate) {}
+	
+	/// Process a buffer.
+	/**
+	 * The state is reset if the number of channels changes.
+	 * 
+	 * \param samples The interleaved samples.
+	 * \param frames The number of samples per channel.
+	 * \param channels The number of channels.
+	 * \param now The time the buffer was recorded.
+	 */
+	void AudioLevel::process(std::int16_t const * samples, std::size_t frames, unsigned int channels, Clock::time_point now) {
+		if (channels != channels_.size()) {
+			channels_.assign(channels, Channel());
+			levels_.resize(channels);
+		}
+		measureLevels(samples, frames, channels, levels_.data());
+		
+		// Weight of the new buffer in the moving average, based on its duration.
+		double duration = double(frames) / sample_rate_;
+		double tau      = std::chrono::duration<double>(smoothing).count();
+		float alpha     = tau > 0 ? 1 - std::exp(-duration / tau) : 1;
+		
+		for (unsigned int i = 0; i < channels; ++i) {
+			Channel & channel = channels_[i];
+			channel.level     = levels_[i];
+			channel.smoothed += alpha * (channel.level.rms - channel.smoothed);
+			
+			if (channel.noisy && channel.smoothed < off_threshold) {
+				channel.noisy = false;
+			} else if (!channel.noisy && channel.smoothed >= on_threshold) {
+				channel.noisy = true;
+			}
+			
+			if (channel.noisy && now - channel.last_event >= min_interval) {
+				channel.last_event = now;
+				if (on_noise) on_noise(i, channel.smoothed);
+			}
+		}
+	}
+	
+	/// Forget the state of all channels.
+	void AudioLevel::reset() {
+		channels_.clear();
+		levels_.clear();
+	}
+	
+}
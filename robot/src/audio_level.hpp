@@ -0,0 +1,144 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace robotutor {
+	
+	/// Level of one channel of an audio buffer.
+	/**
+	 * Levels are fractions of full scale, so a full scale square wave has a peak and RMS level of 1.
+	 */
+	struct ChannelLevel {
+		/// The largest absolute sample value.
+		float peak = 0;
+		
+		/// The root mean square of the samples.
+		float rms = 0;
+	};
+	
+	/// Measure the peak and RMS levels of interleaved 16 bit PCM samples.
+	/**
+	 * Uses SSE2 for one, two and four channels when it is available,
+	 * and falls back to measureLevelsScalar() otherwise.
+	 * 
+	 * \param samples The interleaved samples.
+	 * \param frames The number of samples per channel.
+	 * \param channels The number of channels.
+	 * \param levels Array receiving the level of every channel.
+	 */
+	void measureLevels(std::int16_t const * samples, std::size_t frames, unsigned int channels, ChannelLevel * levels);
+	
+	/// Measure the peak and RMS levels of interleaved 16 bit PCM samples, without SIMD.
+	/**
+	 * \param samples The interleaved samples.
+	 * \param frames The number of samples per channel.
+	 * \param channels The number of channels.
+	 * \param levels Array receiving the level of every channel.
+	 */
+	void measureLevelsScalar(std::int16_t const * samples, std::size_t frames, unsigned int channels, ChannelLevel * levels);
+	
+	/// Tracks the sound level of audio buffers and reports noise.
+	/**
+	 * The RMS level of every channel is smoothed with an exponential moving average.
+	 * A channel becomes noisy when its smoothed level reaches the on threshold,
+	 * and only becomes quiet again when it drops below the lower off threshold.
+	 * While a channel is noisy, on_noise is invoked at most once per minimum interval.
+	 * 
+	 * Not thread safe, buffers should be processed from one thread.
+	 */
+	class AudioLevel {
+		public:
+			typedef std::chrono::steady_clock Clock;
+			
+			/// Callback for noise, receives the channel and its smoothed RMS level.
+			typedef std::function<void (unsigned int channel, float level)> NoiseHandler;
+			
+			/// State of one channel.
+			struct Channel {
+				/// The level of the channel in the last buffer.
+				ChannelLevel level;
+				
+				/// The smoothed RMS level.
+				float smoothed = 0;
+				
+				/// True if the channel is noisy.
+				bool noisy = false;
+				
+				/// The time of the last noise event.
+				Clock::time_point last_event;
+			};
+			
+			/// Called from process() when a channel is noisy.
+			NoiseHandler on_noise;
+			
+			/// Smoothed RMS level at which a channel becomes noisy.
+			float on_threshold = 0.05;
+			
+			/// Smoothed RMS level below which a noisy channel becomes quiet again.
+			float off_threshold = 0.03;
+			
+			/// Time constant of the moving average, or zero to disable smoothing.
+			std::chrono::milliseconds smoothing { 500 };
+			
+			/// Minimum time between noise events of a channel.
+			std::chrono::milliseconds min_interval { 1000 };
+			
+		protected:
+			/// The sample rate of the buffers.
+			unsigned int sample_rate_;
+			
+			/// The state of every channel.
+			std::vector<Channel> channels_;
+			
+			/// Scratch space for measuring a buffer.
+			std::vector<ChannelLevel> levels_;
+			
+		public:
+			/// Construct an audio level tracker.
+			/**
+			 * \param sample_rate The sample rate of the buffers, in Hz.
+			 */
+			AudioLevel(unsigned int sample_rate);
+			
+			/// Process a buffer.
+			/**
+			 * The state is reset if the number of channels changes.
+			 * 
+			 * \param samples The interleaved samples.
+			 * \param frames The number of samples per channel.
+			 * \param channels The number of channels.
+			 * \param now The time the buffer was recorded.
+			 */
+			void process(std::int16_t const * samples, std::size_t frames, unsigned int channels, Clock::time_point now = Clock::now());
+			
+			/// Get the state of the channels.
+			/**
+			 * \return The state of every channel seen in the last buffer.
+			 */
+			std::vector<Channel> const & channels() const { return channels_; }
+			
+			/// Get the sample rate.
+			/**
+			 * \return The sample rate in Hz.
+			 */
+			unsigned int sampleRate() const { return sample_rate_; }
+			
+			/// Set the sample rate.
+			/**
+			 * Also forgets the state of all channels.
+			 * 
+			 * \param sample_rate The sample rate of the buffers, in Hz.
+			 */
+			void sampleRate(unsigned int sample_rate) {
+				sample_rate_ = sample_rate;
+				reset();
+			}
+			
+			/// Forget the state of all channels.
+			void reset();
+	};
+	
+}
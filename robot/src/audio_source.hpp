@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace robotutor {
+	
+	/// Interface for sources of recorded audio.
+	/**
+	 * Sources deliver buffers of interleaved 16 bit PCM samples from their own thread.
+	 * The handler may be replaced at any time, the source never calls an old handler after it was replaced.
+	 */
+	class AudioSource {
+		public:
+			/// Callback for recorded buffers, receives the interleaved samples, the number of samples per channel and the number of channels.
+			typedef std::function<void (std::int16_t const * samples, std::size_t frames, unsigned int channels)> BufferHandler;
+			
+		protected:
+			/// Mutex protecting the handler.
+			std::mutex handler_mutex_;
+			
+			/// The handler for recorded buffers.
+			BufferHandler handler_;
+			
+		public:
+			/// Virtual destructor.
+			virtual ~AudioSource() {}
+			
+			/// Get the sample rate of the buffers.
+			/**
+			 * \return The sample rate in Hz.
+			 */
+			virtual unsigned int sampleRate() const = 0;
+			
+			/// Set the handler for recorded buffers.
+			/**
+			 * \param handler The handler, or a null function to stop receiving buffers.
+			 */
+			void onBuffer(BufferHandler handler) {
+				std::lock_guard<std::mutex> lock(handler_mutex_);
+				handler_ = std::move(handler);
+			}
+			
+		protected:
+			/// Pass a recorded buffer to the handler.
+			/**
+			 * \param samples The interleaved samples.
+			 * \param frames The number of samples per channel.
+			 * \param channels The number of channels.
+			 */
+			void deliver_(std::int16_t const * samples, std::size_t frames, unsigned int channels) {
+				std::lock_guard<std::mutex> lock(handler_mutex_);
+				if (handler_) handler_(samples, frames, channels);
+			}
+	};
+	
+}
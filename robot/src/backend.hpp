@@ -0,0 +1,102 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "tts_backend.hpp"
+
+namespace AL {
+	class ALBroker;
+}
+
+namespace boost {
+	namespace asio {
+		class io_service;
+	}
+}
+
+namespace robotutor {
+	
+	/// Interface to the services of the robot that the engines and plugins use.
+	/**
+	 * The naoqi backend talks to a real robot.
+	 * The simulated backend models the same services without one,
+	 * so scripts can be run and measured on any machine.
+	 */
+	class Backend {
+		public:
+			/// Callback for behaviors and sounds that started.
+			typedef std::function<void ()> StartHandler;
+			
+			/// Callback for finished behaviors.
+			typedef std::function<void ()> DoneHandler;
+			
+			/// Virtual destructor.
+			virtual ~Backend() {}
+			
+			/// Get the broker to communicate with naoqi.
+			/**
+			 * \return The broker, or a null pointer if the backend doesn't use naoqi.
+			 */
+			virtual boost::shared_ptr<AL::ALBroker> broker() const { return nullptr; }
+			
+			/// Create the text-to-speech backend.
+			/**
+			 * \param ios The IO service to use for events.
+			 * \return The text-to-speech backend.
+			 */
+			virtual boost::shared_ptr<TtsBackend> createTts(boost::asio::io_service & ios) = 0;
+			
+			/// Get the names of all installed behaviors.
+			virtual std::vector<std::string> installedBehaviors() = 0;
+			
+			/// Prepare a behavior so it starts without delay when it is run.
+			/**
+			 * Only called for installed behaviors, callers check the behavior catalog first.
+			 * Must not wait for the robot, it is called from the strand of the script engine.
+			 * 
+			 * \param name The name of the behavior.
+			 */
+			virtual void preloadBehavior(std::string const & name) { (void) name; }
+			
+			/// Run a behavior that has been sent to the clients.
+			/**
+			 * Clients acknowledge behaviors they run themselves.
+			 * Backends that run behaviors without a client call the handlers when the motion starts and once the behavior is done.
+			 * 
+			 * \param name The name of the behavior.
+			 * \param on_start Callback to invoke when the motion starts.
+			 * \param on_done Callback to invoke when the behavior is done.
+			 */
+			virtual void runBehavior(std::string const & name, StartHandler on_start, DoneHandler on_done) = 0;
+			
+			/// Load a sound file ahead of time, so playing it doesn't have to wait for it.
+			/**
+			 * Every call must be matched by a call to unloadSound().
+			 * 
+			 * \param file The path of the file on the robot.
+			 */
+			virtual void preloadSound(std::string const & file) { (void) file; }
+			
+			/// Release a sound file loaded with preloadSound().
+			/**
+			 * The file stays loaded until every preloadSound() call for it has been matched.
+			 * 
+			 * \param file The path of the file on the robot.
+			 */
+			virtual void unloadSound(std::string const & file) { (void) file; }
+			
+			/// Play a sound file.
+			/**
+			 * \param file The path of the file on the robot.
+			 * \param on_start Callback to invoke when the sound starts playing, may be empty.
+			 */
+			virtual void playSound(std::string const & file, StartHandler on_start) = 0;
+			
+			/// Stop all playing sounds.
+			virtual void stopSounds() = 0;
+	};
+	
+}
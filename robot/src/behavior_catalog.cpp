@@ -0,0 +1,72 @@
+#include <algorithm>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include "behavior_catalog.hpp"
+
+
+namespace robotutor {
+	
+	/// Construct a behavior catalog.
+	/**
+	 * \param source Function to fetch the installed behaviors from.
+	 */
+	BehaviorCatalog::BehaviorCatalog(Source source) :
+		source_(source) {}
+	
+	/// Fetch the installed behaviors now.
+	void BehaviorCatalog::refresh() {
+		behaviors_ = source_();
+		std::sort(behaviors_.begin(), behaviors_.end());
+		behaviors_.erase(std::unique(behaviors_.begin(), behaviors_.end()), behaviors_.end());
+		loaded_ = true;
+	}
+	
+	/// Get all behaviors, sorted by name.
+	std::vector<std::string> const & BehaviorCatalog::behaviors() {
+		if (!loaded_) refresh();
+		return behaviors_;
+	}
+	
+	/// Check if a behavior is installed.
+	/**
+	 * \param name The name of the behavior.
+	 * \return True if the behavior is in the catalog.
+	 */
+	bool BehaviorCatalog::contains(std::string const & name) {
+		std::vector<std::string> const & all = behaviors();
+		return std::binary_search(all.begin(), all.end(), name);
+	}
+	
+	/// Get the range of behaviors starting with a prefix.
+	/**
+	 * \param prefix The prefix.
+	 * \return The begin and end iterator of the range.
+	 */
+	std::pair<BehaviorCatalog::Iterator, BehaviorCatalog::Iterator> BehaviorCatalog::match(std::string const & prefix) {
+		std::vector<std::string> const & all = behaviors();
+		
+		// Every name with the prefix sorts at or after the prefix itself, and they are all adjacent.
+		Iterator begin = std::lower_bound(all.begin(), all.end(), prefix);
+		Iterator end   = std::partition_point(begin, all.end(), [&prefix] (std::string const & name) {
+			return boost::starts_with(name, prefix);
+		});
+		return {begin, end};
+	}
+	
+	/// Pick a random behavior starting with a prefix.
+	/**
+	 * \param prefix The prefix.
+	 * \param generator The random number generator to use.
+	 * \return The picked behavior, or a null pointer if no behavior matches.
+	 */
+	std::string const * BehaviorCatalog::random(std::string const & prefix, boost::random::mt19937 & generator) {
+		std::pair<Iterator, Iterator> range = match(prefix);
+		if (range.first == range.second) return nullptr;
+		
+		boost::random::uniform_int_distribution<std::size_t> distribution(0, range.second - range.first - 1);
+		return &*(range.first + distribution(generator));
+	}
+	
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/random/mersenne_twister.hpp>
+
+namespace robotutor {
+	
+	/// Sorted list of installed behaviors.
+	/**
+	 * The list is fetched from the source once and kept until it is invalidated,
+	 * so looking up behaviors doesn't need a round trip to the behavior manager.
+	 * All behaviors with a given prefix form a contiguous range of the sorted list,
+	 * which is found with a binary search.
+	 */
+	class BehaviorCatalog {
+		public:
+			/// Function returning the names of all installed behaviors.
+			typedef std::function<std::vector<std::string> ()> Source;
+			
+			/// Iterator over behavior names.
+			typedef std::vector<std::string>::const_iterator Iterator;
+			
+		protected:
+			/// Function to fetch the behaviors from.
+			Source source_;
+			
+			/// The sorted behavior names.
+			std::vector<std::string> behaviors_;
+			
+			/// True if the behaviors have been fetched since the last invalidation.
+			bool loaded_ = false;
+			
+		public:
+			/// Construct a behavior catalog.
+			/**
+			 * \param source Function to fetch the installed behaviors from.
+			 */
+			explicit BehaviorCatalog(Source source);
+			
+			/// Fetch the installed behaviors now.
+			void refresh();
+			
+			/// Mark the catalog as outdated.
+			/**
+			 * The behaviors are fetched again on the next lookup.
+			 */
+			void invalidate() { loaded_ = false; }
+			
+			/// Get all behaviors, sorted by name.
+			std::vector<std::string> const & behaviors();
+			
+			/// Check if a behavior is installed.
+			/**
+			 * \param name The name of the behavior.
+			 * \return True if the behavior is in the catalog.
+			 */
+			bool contains(std::string const & name);
+			
+			/// Get the range of behaviors starting with a prefix.
+			/**
+			 * \param prefix The prefix.
+			 * \return The begin and end iterator of the range.
+			 */
+			std::pair<Iterator, Iterator> match(std::string const & prefix);
+			
+			/// Pick a random behavior starting with a prefix.
+			/**
+			 * \param prefix The prefix.
+			 * \param generator The random number generator to use.
+			 * \return The picked behavior, or a null pointer if no behavior matches.
+			 */
+			std::string const * random(std::string const & prefix, boost::random::mt19937 & generator);
+	};
+	
+}
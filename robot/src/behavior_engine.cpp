@@ -1,8 +1,7 @@
+#include <iostream>
 #include <vector>
 
-#include <boost/algorithm/string/predicate.hpp>
 #include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_int_distribution.hpp>
 #include <boost/asio/io_service.hpp>
 
 #include "behavior_engine.hpp"
@@ -19,20 +18,23 @@ namespace robotutor {
 	 */
 	BehaviorJob::BehaviorJob(std::string const & name, EventHandler on_done, EventHandler on_start) :
 		name_(name),
-		on_start_(on_done),
+		on_start_(on_start),
 		on_done_(on_done),
 		id_(0) {}
 	
 	/// Construct the behaviour engine.
 	/**
 	 * \param ios The IO service to use.
-	 * \param broker The ALBroker to use for communicating with naoqi.
+	 * \param backend The backend to fetch installed behaviors from and run behaviors with.
 	 * \param random Random number generator to use.
 	 */
-	BehaviorEngine::BehaviorEngine(ScriptEngine * engine, boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker, boost::random::mt19937 & random) :
+	BehaviorEngine::BehaviorEngine(ScriptEngine * engine, boost::asio::io_service & ios, boost::shared_ptr<Backend> backend, boost::random::mt19937 & random) :
 		engine(engine),
 		ios_(ios),
-		bm_(broker),
+		backend_(backend),
+		catalog_([this] () { return backend_->installedBehaviors(); }),
+		timer_(ios),
+		timeout_(boost::posix_time::milliseconds(BEHAVIOR_TIMEOUT)),
 		random_(random) {}
 	
 	
@@ -42,6 +44,7 @@ namespace robotutor {
 	 */
 	void BehaviorEngine::enqueue(BehaviorJob const & job) {
 		queue_.push_back(job);
+		queue_.back().queued_ = Stats::Clock::now();
 		//std::cout << "Enqueing job " << job.name_ << ", size " << queue_.size() << std::endl;
 		if (queue_.size() == 1) {
 			unqueue_();
@@ -51,21 +54,28 @@ namespace robotutor {
 	/// Queue a random behavior.
 	/**
 	 * \param prefix The prefix to select behaviors from.
+	 * \return False if no installed behavior has the prefix.
 	 */
-	void BehaviorEngine::enqueueRandom(std::string const & prefix) {
-		std::vector<std::string> installed = bm_.getInstalledBehaviors();
-		std::vector<std::string> matching;
-		for (auto const & behavior : installed) {
-			if (boost::starts_with(behavior, prefix)) matching.push_back(behavior);
+	bool BehaviorEngine::enqueueRandom(std::string const & prefix) {
+		std::string const * behavior = catalog_.random(prefix, random_);
+		if (!behavior) {
+			std::cerr << "No installed behavior starts with `" << prefix << "'." << std::endl;
+			return false;
 		}
-		
-		boost::random::uniform_int_distribution<> range(0, matching.size() - 1);
-		enqueue(matching[range(random_)]);
+		enqueue(*behavior);
+		return true;
 	}
 	
-	/// Join any background threads created by the engine.
-	void BehaviorEngine::join() {
-		if (wait_thread_.joinable()) wait_thread_.join();
+	/// Acknowledge that a job has finished.
+	/**
+	 * Acknowledgements for jobs that are no longer running are ignored.
+	 * 
+	 * \param id The ID of the job, or 0 for the running job.
+	 */
+	void BehaviorEngine::acknowledge(unsigned int id) {
+		if (queue_.empty() || (id && queue_.front().id_ != id)) return;
+		timer_.cancel();
+		onJobDone_();
 	}
 	
 	/// Drop all queued jobs.
@@ -78,39 +88,37 @@ namespace robotutor {
 	
 	/// Process the head of the queue.
 	/**
-	 * The job remains at the head of the queue until it finished.
+	 * The job remains at the head of the queue until it is acknowledged or times out.
 	 */
 	void BehaviorEngine::unqueue_() {
 		BehaviorJob & job = queue_.front();
+		job.id_      = ++last_id_;
+		job.started_ = Stats::Clock::now();
+		engine->stats.behavior_wait.record(job.started_ - job.queued_);
 		
 		// Call the start handler.
 		if (job.on_start_) job.on_start_();
 		
 		RobotMessage message;
 		message.mutable_behaviorcmd()->set_behaviorname(job.name_);
+		message.mutable_behaviorcmd()->set_id(job.id_);
 		engine->server.sendMessage(message);
 		
+		// Backends that run behaviors themselves acknowledge them like a client would.
+		Stats & stats = engine->stats;
+		Stats::Clock::time_point queued = job.queued_;
+		auto on_start = [&stats, queued] () { stats.motion_start.record(Stats::Clock::now() - queued); };
+		backend_->runBehavior(job.name_, on_start, engine->strand().wrap(std::bind(&BehaviorEngine::acknowledge, this, job.id_)));
 		
-		// If the behavior can be found, execute it.
-		//std::cerr << "Trying to execute " << job.name_ << "." << std::endl;
-		//if (bm_.isBehaviorInstalled(job.name_)) {
-		//	job.id_ = bm_.post.runBehavior(job.name_);
-			
-			// Start a new wait thread.
-			join();
-			wait_thread_ = std::thread(std::bind(&BehaviorEngine::wait_, this));
-		
-		// Otherwise, immediately call the done handler.
-		//} else {
-			//if (job.on_done_) job.on_done_();
-			//std::cout << "Immediately call the done handler because behavior was not found." << std::endl;
-		//	onJobDone_();
+		timer_.expires_from_now(timeout_);
+		timer_.async_wait(engine->strand().wrap(std::bind(&BehaviorEngine::onTimeout_, this, std::placeholders::_1, job.id_)));
 	}
 	
 	/// Called when a job finished.
 	void BehaviorEngine::onJobDone_() {
 		// Invoke the done handler and pop the job.
 		BehaviorJob & job = queue_.front();
+		engine->stats.behavior_duration.record(Stats::Clock::now() - job.started_);
 		if (job.on_done_) job.on_done_();
 		queue_.pop_front();
 		
@@ -125,22 +133,18 @@ namespace robotutor {
 		}
 	}
 	
-	/// Wait for the current job to finish.
-	void BehaviorEngine::wait_() {
-		while (!engine->behavior_done) {
-		}
-		engine->behavior_done = false;
-		ios_.post(std::bind(&BehaviorEngine::onJobDone_, this));
-		
-		// If timeout is reached, then stop the behavior and drop the rest of the queue.
-		/*if (bm_.wait(queue_.front().id_, BEHAVIOR_TIMEOUT)) {
-			std::cerr << "Behavior timeout reached! Dropping queue." << std::endl;
-			bm_.stop(queue_.front().id_);
-			std::cerr << "Clearing queue!" << std::endl;
-			queue_.clear();
-		}
-		else {*/
-		//}
+	/// Called when the timer for a job expired.
+	/**
+	 * The job is considered done and the rest of the queue is dropped,
+	 * so a client that stopped responding can not hold up the script.
+	 * 
+	 * \param error The error that occured, if any.
+	 * \param id The ID of the job.
+	 */
+	void BehaviorEngine::onTimeout_(boost::system::error_code const & error, unsigned int id) {
+		if (error || queue_.empty() || queue_.front().id_ != id) return;
+		std::cerr << "Behavior `" << queue_.front().name_ << "' was not acknowledged in time. Dropping queue." << std::endl;
+		drop();
+		onJobDone_();
 	}
 }
-
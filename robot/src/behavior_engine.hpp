@@ -3,13 +3,16 @@
 #include <string>
 #include <deque>
 #include <functional>
-#include <thread>
 
 #include <boost/signal.hpp>
 #include <boost/random/mersenne_twister.hpp>
+#include <boost/asio/deadline_timer.hpp>
 
-#include <alproxies/albehaviormanagerproxy.h>
+#include "backend.hpp"
+#include "behavior_catalog.hpp"
+#include "stats.hpp"
 
+/// Default time in milliseconds to wait for a behavior to be acknowledged.
 #define BEHAVIOR_TIMEOUT 10000
 
 namespace boost {
@@ -42,8 +45,14 @@ namespace robotutor {
 			 */
 			EventHandler on_done_;
 			
-			/// The ID from the behavior manager proxy.
-			int id_;
+			/// The ID sent to the client, to match the acknowledgement against.
+			unsigned int id_;
+			
+			/// The time the job was queued.
+			Stats::Clock::time_point queued_;
+			
+			/// The time the job was sent.
+			Stats::Clock::time_point started_;
 			
 		public:
 			/// Construct a behavior job.
@@ -72,11 +81,20 @@ namespace robotutor {
 			/// Job queue.
 			std::deque<BehaviorJob> queue_;
 			
-			/// Behavior manager to use.
-			AL::ALBehaviorManagerProxy bm_;
+			/// The backend to fetch installed behaviors from and run behaviors with.
+			boost::shared_ptr<Backend> backend_;
+			
+			/// Installed behaviors, fetched from the backend.
+			BehaviorCatalog catalog_;
+			
+			/// Timer to give up on the current job.
+			boost::asio::deadline_timer timer_;
 			
-			/// Thread to wait for job completion.
-			std::thread wait_thread_;
+			/// Time to wait for a job to be acknowledged.
+			boost::posix_time::time_duration timeout_;
+			
+			/// The ID of the last started job.
+			unsigned int last_id_ = 0;
 			
 			/// Random number generator.
 			boost::random::mt19937 & random_;
@@ -85,10 +103,10 @@ namespace robotutor {
 			/// Construct the behaviour engine.
 			/**
 			 * \param ios The IO service to use.
-			 * \param broker The ALBroker to use for communicating with naoqi.
+			 * \param backend The backend to fetch installed behaviors from and run behaviors with.
 			 * \param random Random number generator to use.
 			 */
-			BehaviorEngine(ScriptEngine * engine, boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker, boost::random::mt19937 & random);
+			BehaviorEngine(ScriptEngine * engine, boost::asio::io_service & ios, boost::shared_ptr<Backend> backend, boost::random::mt19937 & random);
 			
 			/// Get the number of queued jobs.
 			unsigned int queued() { return queue_.size(); }
@@ -102,8 +120,12 @@ namespace robotutor {
 			/// Queue a random behavior.
 			/**
 			 * \param prefix The prefix to select behaviors from.
+			 * \return False if no installed behavior has the prefix.
 			 */
-			void enqueueRandom(std::string const & prefix);
+			bool enqueueRandom(std::string const & prefix);
+			
+			/// Get the catalog of installed behaviors.
+			BehaviorCatalog & catalog() { return catalog_; }
 			
 			/// Queue a job for execution.
 			/**
@@ -114,8 +136,24 @@ namespace robotutor {
 				enqueue(BehaviorJob(args...));
 			}
 			
-			/// Join any background threads created by the behavior engine.
-			void join();
+			/// Get the time to wait for a job to be acknowledged.
+			boost::posix_time::time_duration timeout() const { return timeout_; }
+			
+			/// Set the time to wait for a job to be acknowledged.
+			/**
+			 * Only affects jobs started after the call.
+			 * 
+			 * \param timeout The new timeout.
+			 */
+			void timeout(boost::posix_time::time_duration timeout) { timeout_ = timeout; }
+			
+			/// Acknowledge that a job has finished.
+			/**
+			 * Acknowledgements for jobs that are no longer running are ignored.
+			 * 
+			 * \param id The ID of the job, or 0 for the running job.
+			 */
+			void acknowledge(unsigned int id);
 			
 			/// Drop all queued jobs.
 			/**
@@ -133,8 +171,12 @@ namespace robotutor {
 			/// Called when a job finished.
 			void onJobDone_();
 			
-			/// Wait for the current job to finish.
-			void wait_();
+			/// Called when the timer for a job expired.
+			/**
+			 * \param error The error that occured, if any.
+			 * \param id The ID of the job.
+			 */
+			void onTimeout_(boost::system::error_code const & error, unsigned int id);
 			
 	};
 	
@@ -0,0 +1,669 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/random/mersenne_twister.hpp>
+
+#include "bench_suite.hpp"
+#include "audio_level.hpp"
+#include "behavior_catalog.hpp"
+#include "event_queue.hpp"
+#include "program.hpp"
+#include "robotutor_protocol.hpp"
+#include "script.hpp"
+#include "script_engine.hpp"
+#include "script_generator.hpp"
+#include "script_loader.hpp"
+#include "script_parser.hpp"
+#include "simulated_backend.hpp"
+#include "simulated_clock.hpp"
+#include "stats.hpp"
+
+
+namespace robotutor {
+	
+	namespace {
+		/// Keeps the compiler from optimizing away a computed value.
+		volatile std::uint64_t sink;
+		
+		/// Stream buffer that discards everything written to it.
+		struct NullBuffer : public std::streambuf {
+			int overflow(int c) { return traits_type::not_eof(c); }
+		};
+		
+		/// Time an operation and report the fastest of a few rounds.
+		/**
+		 * \param operations The number of operations one call of the function does.
+		 * \param function The function to time.
+		 * \return The fastest time per operation in nanoseconds.
+		 */
+		double nanoseconds(std::size_t operations, std::function<void ()> const & function) {
+			double best = 0;
+			for (int round = 0; round < 5; ++round) {
+				auto start = std::chrono::steady_clock::now();
+				function();
+				double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / operations;
+				if (!round || elapsed < best) best = elapsed;
+			}
+			return best;
+		}
+		
+		/// Command that does nothing, for the commands of generated scripts.
+		struct Stub : public command::Command {
+			std::string name_;
+			
+			Stub(ScriptEngine & engine, command::Command * parent, std::string const & name) :
+				Command(engine, parent, nullptr),
+				name_(name) {}
+			
+			std::string name() const { return name_; }
+			
+			bool step() { return done_(); }
+		};
+		
+		/// Register stubs for the commands of generated scripts.
+		/**
+		 * \param engine The script engine to register the commands with.
+		 */
+		void addStubs(ScriptEngine & engine) {
+			for (char const * name : {"bench mark", "behavior", "slide", "sound", "random behavior"}) {
+				std::string command = name;
+				engine.factory.add(command, [command] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList &&) -> command::Command * {
+					return script.create<Stub>(parent, command);
+				});
+			}
+		}
+		
+		/// Command ending a run.
+		struct Done : public command::Command {
+			std::function<void ()> on_done;
+			
+			Done(ScriptEngine & engine, command::Command * parent, std::function<void ()> on_done) :
+				Command(engine, parent, nullptr),
+				on_done(on_done) {}
+			
+			std::string name() const { return "bench done"; }
+			
+			bool step() {
+				on_done();
+				return done_();
+			}
+		};
+		
+		/// Shared state of the commands replayed by the interpreter benchmark.
+		struct Replay {
+			/// Lower the commands into the compiled program, or leave them to the tree walker.
+			bool lower = true;
+			
+			/// The number of commands run.
+			std::uint64_t commands = 0;
+		};
+		
+		/// Command running its children in order, like the execute command.
+		struct Sequence : public command::Command {
+			Replay & replay;
+			std::size_t next = 0;
+			
+			Sequence(ScriptEngine & engine, command::Command * parent, Replay & replay) :
+				Command(engine, parent, nullptr),
+				replay(replay) {}
+			
+			std::string name() const { return "sequence"; }
+			
+			/// Run the loaded program from the start.
+			void run() { continue_(); }
+			
+			bool step() {
+				if (next < children.size()) {
+					setNext_(children[next++]);
+					return true;
+				}
+				next = 0;
+				return done_();
+			}
+			
+			bool compile(command::Compiler & compiler) {
+				if (!replay.lower) return false;
+				for (auto child : children) compiler.compile(child);
+				return true;
+			}
+		};
+		
+		/// Command choosing one of its children in turn, like a turningpoint choice.
+		struct Pick : public command::Command {
+			Replay & replay;
+			std::size_t turn = 0;
+			int choice = 0;
+			bool entered = false;
+			
+			Pick(ScriptEngine & engine, command::Command * parent, Replay & replay) :
+				Command(engine, parent, nullptr),
+				replay(replay) {}
+			
+			std::string name() const { return "pick"; }
+			
+			bool step() {
+				if (!entered) {
+					++replay.commands;
+					choice = turn++ % children.size();
+					if (!replay.lower) {
+						entered = true;
+						setNext_(children[choice]);
+						return true;
+					}
+				}
+				entered = false;
+				return done_();
+			}
+			
+			bool compile(command::Compiler & compiler) {
+				if (!replay.lower) return false;
+				compiler.emit(command::Opcode::call, this);
+				compiler.branch(this);
+				return true;
+			}
+			
+			int branch() const { return choice; }
+		};
+		
+		/// Command at the end of a branch.
+		struct Leaf : public command::Command {
+			Replay & replay;
+			
+			Leaf(ScriptEngine & engine, command::Command * parent, Replay & replay) :
+				Command(engine, parent, nullptr),
+				replay(replay) {}
+			
+			std::string name() const { return "leaf"; }
+			
+			bool step() {
+				++replay.commands;
+				return done_();
+			}
+		};
+		
+		/// Create a tree of pick commands with a leaf at the end of every branch.
+		/**
+		 * \param script The script owning the commands.
+		 * \param parent The parent of the tree.
+		 * \param replay The shared state of the commands.
+		 * \param depth The number of pick commands on every path through the tree.
+		 * \param fanout The number of children of every pick command.
+		 * \return The root of the tree.
+		 */
+		command::Command * createTree(command::Script & script, command::Command * parent, Replay & replay, unsigned int depth, unsigned int fanout) {
+			if (!depth) return script.create<Leaf>(parent, replay);
+			auto pick = script.create<Pick>(parent, replay);
+			for (unsigned int i = 0; i < fanout; ++i) pick->children.push_back(createTree(script, pick, replay, depth - 1, fanout));
+			return pick;
+		}
+		
+		/// Run a script of pick trees a number of times, and report the commands run per second of running time.
+		/**
+		 * Loading the script compiles it, which is not part of the running time.
+		 * 
+		 * \param engine The script engine.
+		 * \param replay The shared state of the commands.
+		 * \param trees The number of trees in the script.
+		 * \param depth The depth of every tree.
+		 * \param fanout The fanout of every tree.
+		 * \return The commands run per second.
+		 */
+		double commandsPerSecond(ScriptEngine & engine, Replay & replay, unsigned int trees, unsigned int depth, unsigned int fanout) {
+			auto script = std::make_shared<command::Script>(engine);
+			auto root   = script->create<Sequence>(nullptr, replay);
+			for (unsigned int i = 0; i < trees; ++i) root->children.push_back(createTree(*script, root, replay, depth, fanout));
+			script->root(root);
+			
+			double seconds = 0;
+			replay.commands = 0;
+			for (int round = 0; round < 200; ++round) {
+				engine.load(script);
+				auto start = std::chrono::steady_clock::now();
+				root->run();
+				seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+			engine.load(nullptr);
+			return replay.commands / seconds;
+		}
+		
+		/// A micro benchmark, writing its results as JSON fields.
+		struct MicroBenchmark {
+			char const * name;
+			void (*function)(std::ostream & out);
+		};
+		
+		/// Command lookup in the factory, for registered and unknown names.
+		void benchFactory(std::ostream & out) {
+			boost::asio::io_service ios;
+			ScriptEngine engine(ios, boost::make_shared<SimulatedBackend>(ios), 0);
+			std::vector<std::string> names;
+			for (int i = 0; i < 64; ++i) names.push_back("command " + std::to_string(i));
+			for (auto const & name : names) engine.factory.add(name, nullptr);
+			
+			std::size_t const rounds = 20000;
+			out << "\"hit_ns\": " << nanoseconds(rounds * names.size(), [&] () {
+				std::uint64_t found = 0;
+				for (std::size_t i = 0; i < rounds; ++i) for (auto const & name : names) found += engine.factory.has(name);
+				sink = found;
+			});
+			out << ", \"miss_ns\": " << nanoseconds(rounds, [&] () {
+				std::uint64_t found = 0;
+				for (std::size_t i = 0; i < rounds; ++i) found += engine.factory.has("unknown command");
+				sink = found;
+			});
+		}
+		
+		/// Loading a parsed script into the engine and unloading it again, with the allocations per command.
+		void benchLoad(std::ostream & out) {
+			boost::asio::io_service ios;
+			ScriptEngine engine(ios, boost::make_shared<SimulatedBackend>(ios), 0);
+			addStubs(engine);
+			std::string image    = parseScriptImage(generateScript(500, 2));
+			std::size_t commands = loadScriptImage(engine, image)->size();
+			
+			std::size_t const rounds = 100;
+			AllocationCount before = AllocationCount::now();
+			double load = nanoseconds(rounds, [&] () {
+				for (std::size_t i = 0; i < rounds; ++i) {
+					engine.load(loadScriptImage(engine, image));
+					engine.load(nullptr);
+				}
+			});
+			// The timing helper runs the function five times.
+			AllocationCount used = AllocationCount::now() - before;
+			out << "\"commands\": " << commands;
+			out << ", \"load_unload_ns\": " << load;
+			out << ", \"ns_per_command\": " << load / commands;
+			out << ", \"allocations_per_command\": " << double(used.count) / (5 * rounds) / commands;
+			out << ", \"bytes_per_command\": " << double(used.bytes) / (5 * rounds) / commands;
+		}
+		
+		/// Parsing the script.txt corpus repeated a thousand times, and creating its commands through the factory.
+		/**
+		 * script.txt is looked for in the working directory and its parent,
+		 * so this runs from the root of the repository as well as from the robot directory.
+		 */
+		void benchCorpus(std::ostream & out) {
+			std::ifstream stream;
+			for (char const * path : {"script.txt", "../script.txt"}) {
+				stream.clear();
+				stream.open(path);
+				if (stream) break;
+			}
+			if (!stream) {
+				out << "\"missing\": \"script.txt\"";
+				return;
+			}
+			std::ostringstream buffer;
+			buffer << stream.rdbuf();
+			std::string text;
+			text.reserve(1000 * (buffer.str().size() + 1));
+			for (int i = 0; i < 1000; ++i) text += buffer.str() + "\n";
+			
+			boost::asio::io_service ios;
+			ScriptEngine engine(ios, boost::make_shared<SimulatedBackend>(ios), 0);
+			for (auto const & name : commandNames(buffer.str())) {
+				if (engine.factory.has(name)) continue;
+				engine.factory.add(name, [name] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList &&) -> command::Command * {
+					return script.create<Stub>(parent, name);
+				});
+			}
+			
+			std::string image;
+			double parse = nanoseconds(1, [&] () { image = parseScriptImage(text); });
+			std::size_t commands = loadScriptImage(engine, image)->size();
+			
+			AllocationCount before = AllocationCount::now();
+			double load = nanoseconds(1, [&] () { engine.load(loadScriptImage(engine, image)); });
+			AllocationCount used = AllocationCount::now() - before;
+			engine.load(nullptr);
+			
+			double parse_and_load = nanoseconds(1, [&] () { engine.load(parseScript(engine, text)); });
+			engine.load(nullptr);
+			
+			out << "\"bytes\": " << text.size();
+			out << ", \"commands\": " << commands;
+			out << ", \"parse_mb_per_second\": " << text.size() / parse * 1e3;
+			out << ", \"load_ns_per_command\": " << load / commands;
+			out << ", \"load_allocations_per_command\": " << double(used.count) / 5 / commands;
+			out << ", \"parse_and_load_mb_per_second\": " << text.size() / parse_and_load * 1e3;
+		}
+		
+		/// Commands run per second by the compiled program and by the tree walker, on a branchy and on a deep script.
+		void benchInterpreter(std::ostream & out) {
+			boost::asio::io_service ios;
+			ScriptEngine engine(ios, boost::make_shared<SimulatedBackend>(ios), 0);
+			Replay replay;
+			
+			struct Shape {
+				char const * name;
+				unsigned int trees;
+				unsigned int depth;
+				unsigned int fanout;
+			};
+			Shape const shapes[] = {{"branchy", 64, 6, 2}, {"deep", 1, 1024, 1}};
+			bool first = true;
+			for (auto const & shape : shapes) {
+				replay.lower = true;
+				double program = commandsPerSecond(engine, replay, shape.trees, shape.depth, shape.fanout);
+				replay.lower = false;
+				double tree = commandsPerSecond(engine, replay, shape.trees, shape.depth, shape.fanout);
+				out << (first ? "" : ", ") << "\"" << shape.name << "_program_steps_per_second\": " << program;
+				out << ", \"" << shape.name << "_tree_walker_steps_per_second\": " << tree;
+				first = false;
+			}
+		}
+		
+		/// Bookmark latency of a running script, alone and while a 5 MB script is parsed on two threads.
+		/**
+		 * The control plugin parses on two threads and only loads the image on the strand of the engine,
+		 * so the latency of the running script should stay the same while a large script is parsed.
+		 */
+		void benchParseJitter(std::ostream & out) {
+			std::string large;
+			while (large.size() < 5000000) large += generateScript(1000, 1);
+			std::string const image = parseScriptImage(generateScript(100, 4) + "{bench done}");
+			
+			bool first = true;
+			for (bool parsing : {false, true}) {
+				boost::asio::io_service ios;
+				ScriptEngine engine(ios, boost::make_shared<SimulatedBackend>(ios, 400), 0);
+				addStubs(engine);
+				std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(ios));
+				engine.factory.add("bench done", [&work] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList &&) -> command::Command * {
+					return script.create<Done>(parent, [&work] () { work.reset(); });
+				});
+				engine.load(loadScriptImage(engine, image));
+				
+				std::atomic<bool> running { true };
+				std::atomic<unsigned int> parses { 0 };
+				std::vector<std::thread> parsers;
+				for (int i = 0; parsing && i < 2; ++i) {
+					parsers.emplace_back([&] () {
+						while (running) {
+							sink = parseScriptImage(large).size();
+							++parses;
+						}
+					});
+				}
+				
+				engine.strand().post([&engine] () { engine.start(); });
+				ios.run();
+				running = false;
+				for (auto & parser : parsers) parser.join();
+				
+				Histogram const & latency = engine.stats.bookmark_latency;
+				char const * name = parsing ? "parsing" : "idle";
+				out << (first ? "" : ", ") << "\"" << name << "\": {\"bookmarks\": " << latency.count();
+				out << ", \"p50_us\": " << latency.percentile(0.5) << ", \"p99_us\": " << latency.percentile(0.99) << ", \"max_us\": " << latency.max();
+				if (parsing) out << ", \"parses\": " << parses;
+				out << "}";
+				first = false;
+			}
+		}
+		
+		/// Overhead per sentence of the speech path, with a simulated TTS on a virtual clock.
+		/**
+		 * Every sentence still goes through the speech engine, the TTS strand and the timers of the simulation,
+		 * including the bookmarks of the embedded commands.
+		 * The virtual clock skips the time the sentences take to speak, so only the work is measured.
+		 */
+		void benchTtsOverhead(std::ostream & out) {
+			std::string const image = parseScriptImage(generateScript(2000, 2) + "{bench done}");
+			boost::asio::io_service ios;
+			auto clock = boost::make_shared<SimulatedClock>(ios);
+			ScriptEngine engine(ios, boost::make_shared<SimulatedBackend>(clock), 0);
+			addStubs(engine);
+			std::unique_ptr<boost::asio::io_service::work> work;
+			engine.factory.add("bench done", [&work] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList &&) -> command::Command * {
+				return script.create<Done>(parent, [&work] () { work.reset(); });
+			});
+			
+			std::size_t sentences = 0;
+			double sentence = nanoseconds(1, [&] () {
+				engine.stats.reset();
+				engine.load(loadScriptImage(engine, image));
+				ios.reset();
+				work.reset(new boost::asio::io_service::work(ios));
+				engine.strand().post([&engine] () { engine.start(); });
+				clock->run();
+				engine.stop();
+				engine.join();
+				sentences = engine.stats.speech_duration.count();
+			}) / sentences;
+			out << "\"sentences\": " << sentences;
+			out << ", \"bookmarks\": " << engine.stats.bookmark_latency.count();
+			out << ", \"sentence_ns\": " << sentence;
+		}
+		
+		/// Deliver events from four producer threads to a consumer thread running an IO service.
+		/**
+		 * Writes the events per second of the fastest round and the latency from push to handling over all rounds.
+		 * 
+		 * \param out The stream to write the results to.
+		 * \param events The number of events per round, over all producers.
+		 * \param produce Function called on a producer thread with the IO service and the latency histogram, to push one event.
+		 */
+		template<typename Produce>
+		void benchProducers(std::ostream & out, std::size_t events, Produce produce) {
+			Histogram latency;
+			double event_ns = nanoseconds(events, [&] () {
+				boost::asio::io_service ios;
+				std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(ios));
+				std::thread consumer([&ios] () { ios.run(); });
+				std::vector<std::thread> producers;
+				for (int p = 0; p < 4; ++p) {
+					producers.emplace_back([&] () {
+						for (std::size_t i = 0; i < events / 4; ++i) produce(ios, latency);
+					});
+				}
+				for (auto & producer : producers) producer.join();
+				work.reset();
+				consumer.join();
+			});
+			out << "{\"events_per_second\": " << 1e9 / event_ns;
+			out << ", \"p50_us\": " << latency.percentile(0.5) << ", \"p99_us\": " << latency.percentile(0.99) << ", \"max_us\": " << latency.max() << "}";
+		}
+		
+		/// Pushing events and draining them in batches, from one thread and from four at the same time.
+		/**
+		 * The four producers retry when the queue is full, the number of full pushes is reported next to the time.
+		 * As a baseline, the four producers also post every event to the IO service on its own.
+		 */
+		void benchEventQueue(std::ostream & out) {
+			std::size_t const events = 1 << 20;
+			EventQueue<int> queue(256);
+			out << "\"single_producer_ns\": " << nanoseconds(events, [&] () {
+				std::uint64_t sum = 0;
+				for (std::size_t i = 0; i < events; i += 64) {
+					bool wake = false;
+					for (int j = 0; j < 64; ++j) wake |= queue.push(j);
+					if (wake) queue.drain([&sum] (int event) { sum += event; });
+				}
+				sink = sum;
+			});
+			
+			// Events carry the time they were pushed at.
+			EventQueue<Stats::Clock::time_point> timed(256);
+			out << ", \"four_producers\": ";
+			benchProducers(out, events, [&timed] (boost::asio::io_service & ios, Histogram & latency) {
+				// Retry when the queue is full, so every event is delivered.
+				bool wake;
+				while (!timed.tryPush(Stats::Clock::now(), wake)) std::this_thread::yield();
+				if (wake) ios.post([&timed, &latency] () {
+					timed.drain([&latency] (Stats::Clock::time_point pushed) { latency.record(Stats::Clock::now() - pushed); });
+				});
+			});
+			out << ", \"four_producers_full_per_round\": " << timed.dropped() / 5;
+			
+			out << ", \"four_producers_post_per_event\": ";
+			benchProducers(out, events, [] (boost::asio::io_service & ios, Histogram & latency) {
+				Stats::Clock::time_point pushed = Stats::Clock::now();
+				ios.post([&latency, pushed] () { latency.record(Stats::Clock::now() - pushed); });
+			});
+		}
+		
+		/// Peak and RMS levels of four channel audio, with and without SIMD.
+		void benchLevels(std::ostream & out) {
+			std::size_t const frames   = 16000;
+			unsigned int const channels = 4;
+			std::vector<std::int16_t> samples(frames * channels);
+			boost::random::mt19937 random(3);
+			for (auto & sample : samples) sample = std::int16_t(random());
+			std::vector<ChannelLevel> levels(channels);
+			
+			double bytes = samples.size() * sizeof(std::int16_t);
+			double simd = nanoseconds(1, [&] () {
+				for (int i = 0; i < 100; ++i) measureLevels(samples.data(), frames, channels, levels.data());
+			}) / 100;
+			double scalar = nanoseconds(1, [&] () {
+				for (int i = 0; i < 100; ++i) measureLevelsScalar(samples.data(), frames, channels, levels.data());
+			}) / 100;
+			out << "\"simd_mb_per_second\": " << bytes / simd * 1e3;
+			out << ", \"scalar_mb_per_second\": " << bytes / scalar * 1e3;
+		}
+		
+		/// Picking random behaviors with a prefix and checking if a behavior is installed.
+		void benchCatalog(std::ostream & out) {
+			std::vector<std::string> behaviors;
+			for (int group = 0; group < 10; ++group) {
+				for (int i = 0; i < 100; ++i) behaviors.push_back("robotutor/group" + std::to_string(group) + "/Behavior" + std::to_string(i));
+			}
+			BehaviorCatalog catalog([&behaviors] () { return behaviors; });
+			boost::random::mt19937 random(5);
+			
+			std::size_t const rounds = 100000;
+			out << "\"behaviors\": " << behaviors.size();
+			out << ", \"random_ns\": " << nanoseconds(rounds, [&] () {
+				std::uint64_t length = 0;
+				for (std::size_t i = 0; i < rounds; ++i) length += catalog.random("robotutor/group4/", random)->size();
+				sink = length;
+			});
+			out << ", \"contains_ns\": " << nanoseconds(rounds, [&] () {
+				std::uint64_t found = 0;
+				for (std::size_t i = 0; i < rounds; ++i) found += catalog.contains(behaviors[i % behaviors.size()]);
+				sink = found;
+			});
+		}
+		
+		/// Recording a sample in a histogram.
+		void benchHistogram(std::ostream & out) {
+			Histogram histogram;
+			std::size_t const rounds = 1000000;
+			out << "\"record_ns\": " << nanoseconds(rounds, [&] () {
+				for (std::size_t i = 0; i < rounds; ++i) histogram.record(std::uint64_t(i & 0xffff));
+			});
+		}
+		
+		/// Framing a message and reading it back, from a stream buffer and over a loopback socket.
+		void benchFraming(std::ostream & out) {
+			RobotMessage message;
+			message.mutable_behaviorcmd()->set_behaviorname("robotutor/generic/Capisce");
+			message.mutable_behaviorcmd()->set_id(42);
+			boost::asio::streambuf buffer;
+			RobotMessage read;
+			
+			std::size_t const rounds = 100000;
+			out << "\"frame_ns\": " << nanoseconds(rounds, [&] () {
+				for (std::size_t i = 0; i < rounds; ++i) sink = Protocol::frameMessage(message)->size();
+			});
+			out << ", \"frame_and_read_ns\": " << nanoseconds(rounds, [&] () {
+				for (std::size_t i = 0; i < rounds; ++i) {
+					auto frame = Protocol::frameMessage(message);
+					buffer.sputn(frame->data(), frame->size());
+					Protocol::consumeMessage(buffer, read, 1024);
+				}
+			});
+			
+			// The same message over a loopback socket, sent by a server connection and read by a plain socket.
+			std::size_t const messages = 1000000;
+			std::promise<SharedServerConnection> accepted;
+			Loopback loopback([&accepted] (Server & server) {
+				server.on_accept = [&accepted] (SharedServerConnection connection) { accepted.set_value(connection); };
+			});
+			boost::asio::io_service reader_ios;
+			boost::asio::ip::tcp::socket socket(reader_ios);
+			socket.connect(loopback.endpoint());
+			SharedServerConnection connection = accepted.get_future().get();
+			
+			auto start = std::chrono::steady_clock::now();
+			std::thread reader([&] () {
+				boost::asio::streambuf input;
+				RobotMessage received;
+				std::size_t count = 0;
+				boost::system::error_code error;
+				while (count < messages && !error) {
+					input.commit(socket.read_some(input.prepare(64 * 1024), error));
+					while (Protocol::consumeMessage(input, received, 1024) == ascf::ReadResult::message) ++count;
+				}
+				sink = count;
+			});
+			for (std::size_t i = 0; i < messages; ++i) {
+				// Keep at most a megabyte queued, like a client that keeps up would.
+				while (connection->pendingBytes() > (1 << 20)) std::this_thread::yield();
+				connection->sendMessage(message);
+			}
+			reader.join();
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			out << ", \"loopback_messages\": " << sink;
+			out << ", \"loopback_ns\": " << seconds * 1e9 / messages;
+			out << ", \"loopback_mb_per_second\": " << Protocol::frameMessage(message)->size() * messages / seconds / 1e6;
+		}
+		
+		MicroBenchmark const benchmarks[] = {
+			{"factory",     benchFactory},
+			{"load",        benchLoad},
+			{"corpus",      benchCorpus},
+			{"interpreter", benchInterpreter},
+			{"parse_jitter", benchParseJitter},
+			{"tts_overhead", benchTtsOverhead},
+			{"event_queue", benchEventQueue},
+			{"levels",      benchLevels},
+			{"catalog",     benchCatalog},
+			{"histogram",   benchHistogram},
+			{"framing",     benchFraming},
+		};
+	}
+	
+	/// Run the micro benchmarks of robotutor-bench and print the results as JSON.
+	/**
+	 * \param filters Only run benchmarks whose name starts with one of these, or all benchmarks if empty.
+	 * \return The exit status.
+	 */
+	int runMicroBenchmarks(std::vector<std::string> const & filters) {
+		// The engines log to standard output, keep it for the results.
+		NullBuffer null_buffer;
+		std::ostream out(std::cout.rdbuf(&null_buffer));
+		
+		out << "{";
+		bool first = true;
+		for (auto const & benchmark : benchmarks) {
+			std::string name = benchmark.name;
+			if (filters.size() && std::none_of(filters.begin(), filters.end(), [&name] (std::string const & filter) { return name.compare(0, filter.size(), filter) == 0; })) continue;
+			
+			out << (first ? "\n" : ",\n") << "  \"" << name << "\": {";
+			benchmark.function(out);
+			out << "}" << std::flush;
+			first = false;
+		}
+		out << "\n}" << std::endl;
+		
+		std::cout.rdbuf(out.rdbuf());
+		return 0;
+	}
+	
+}
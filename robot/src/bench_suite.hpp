@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+
+#include "robotutor_protocol.hpp"
+
+namespace robotutor {
+	
+	/// Allocation counters of robotutor-bench at some point in time.
+	/**
+	 * robotutor-bench replaces the global operator new to count every allocation of the process.
+	 */
+	struct AllocationCount {
+		std::uint64_t count;
+		std::uint64_t bytes;
+		
+		/// Get the current allocation counters.
+		static AllocationCount now();
+		
+		AllocationCount operator - (AllocationCount const & other) const {
+			return {count - other.count, bytes - other.bytes};
+		}
+	};
+	
+	/// Find the names of all commands used in a script.
+	/**
+	 * Follows the parser closely enough to find the names, without validating the script.
+	 */
+	std::set<std::string> commandNames(std::string const & script);
+	
+	/// Run an IO service until it is stopped, closing connections whose handlers failed like the server does.
+	void runIo(boost::asio::io_service & ios);
+	
+	/// A server on the loopback interface, with its IO service running on its own threads.
+	struct Loopback {
+		boost::asio::io_service ios;
+		Server server;
+		std::unique_ptr<boost::asio::io_service::work> work;
+		std::vector<std::thread> threads;
+		
+		/// Start listening on a free port.
+		/**
+		 * \param configure Function to configure the server before it listens, or a null function.
+		 * \param thread_count The number of threads running the IO service.
+		 */
+		explicit Loopback(std::function<void (Server &)> configure = nullptr, unsigned int thread_count = 1) :
+			server(ios),
+			work(new boost::asio::io_service::work(ios))
+		{
+			if (configure) configure(server);
+			server.listen(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+			for (unsigned int i = 0; i < thread_count; ++i) threads.emplace_back([this] () { runIo(ios); });
+		}
+		
+		~Loopback() {
+			work.reset();
+			ios.stop();
+			for (auto & thread : threads) thread.join();
+		}
+		
+		/// Get the endpoint to connect to.
+		boost::asio::ip::tcp::endpoint endpoint() const { return server.localEndpoint(); }
+	};
+	
+	/// Run the self-checks of robotutor-bench.
+	/**
+	 * Every check exercises the behavior one change to the engine promised,
+	 * without a robot, talking to clients over loopback where needed.
+	 * 
+	 * \param filters Only run checks whose name starts with one of these, or all checks if empty.
+	 * \return The exit status, zero if all checks passed.
+	 */
+	int runTests(std::vector<std::string> const & filters);
+	
+	/// Run the micro benchmarks of robotutor-bench and print the results as JSON.
+	/**
+	 * \param filters Only run benchmarks whose name starts with one of these, or all benchmarks if empty.
+	 * \return The exit status.
+	 */
+	int runMicroBenchmarks(std::vector<std::string> const & filters);
+	
+}
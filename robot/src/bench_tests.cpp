@@ -0,0 +1,1150 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/random/mersenne_twister.hpp>
+
+#include "bench_suite.hpp"
+#include "audio_level.hpp"
+#include "behavior_catalog.hpp"
+#include "core_commands.hpp"
+#include "event_queue.hpp"
+#include "plugin.hpp"
+#include "program.hpp"
+#include "robotutor_protocol.hpp"
+#include "script.hpp"
+#include "script_cache.hpp"
+#include "script_engine.hpp"
+#include "script_generator.hpp"
+#include "script_image.hpp"
+#include "script_loader.hpp"
+#include "simulated_backend.hpp"
+#include "simulated_clock.hpp"
+#include "simulated_tts.hpp"
+#include "sound_level_stream.hpp"
+#include "stats.hpp"
+
+
+namespace robotutor {
+	
+	namespace {
+		/// Fail the running check if a condition doesn't hold.
+		void check(bool condition, std::string const & message) {
+			if (!condition) throw std::runtime_error(message);
+		}
+		
+		/// Stream buffer that discards everything written to it.
+		struct NullBuffer : public std::streambuf {
+			int overflow(int c) { return traits_type::not_eof(c); }
+		};
+		
+		/// Command recording the text of its argument when it runs.
+		struct Record : public command::Command {
+			std::vector<std::string> & log;
+			std::string text;
+			
+			Record(ScriptEngine & engine, command::Command * parent, std::vector<std::string> & log, std::string text) :
+				Command(engine, parent, nullptr),
+				log(log),
+				text(text) {}
+			
+			std::string name() const { return "record"; }
+			
+			bool step() {
+				log.push_back(text);
+				return done_();
+			}
+		};
+		
+		/// Command queueing a behavior, without the behavior plugin.
+		struct Act : public command::Command {
+			std::string behavior;
+			
+			Act(ScriptEngine & engine, command::Command * parent, std::string behavior) :
+				Command(engine, parent, nullptr),
+				behavior(behavior) {}
+			
+			std::string name() const { return "act"; }
+			
+			bool step() {
+				engine.behavior.enqueue(behavior);
+				return done_();
+			}
+		};
+		
+		/// Command waiting for a simulated capture, like the show image command of the presentation plugin.
+		struct Capture : public command::Command {
+			std::vector<std::function<void ()>> & pending;
+			std::vector<std::string> & log;
+			std::string text;
+			bool requested = false;
+			
+			Capture(ScriptEngine & engine, command::Command * parent, std::vector<std::function<void ()>> & pending, std::vector<std::string> & log, std::string text) :
+				Command(engine, parent, nullptr),
+				pending(pending),
+				log(log),
+				text(text) {}
+			
+			std::string name() const { return "capture"; }
+			
+			bool step() {
+				if (!requested) {
+					requested = true;
+					pending.push_back(asyncContinue_());
+					return false;
+				}
+				log.push_back(text);
+				return done_();
+			}
+		};
+		
+		/// Command ending a run.
+		struct Finish : public command::Command {
+			std::function<void ()> on_done;
+			
+			Finish(ScriptEngine & engine, command::Command * parent, std::function<void ()> on_done) :
+				Command(engine, parent, nullptr),
+				on_done(on_done) {}
+			
+			std::string name() const { return "finish"; }
+			
+			bool step() {
+				engine.stop(on_done);
+				setNext_(parent);
+				return false;
+			}
+		};
+		
+		/// A script engine on its own IO service and a virtual clock, with commands to record what a script did.
+		struct Run {
+			boost::asio::io_service ios;
+			boost::shared_ptr<SimulatedClock> clock { boost::make_shared<SimulatedClock>(ios) };
+			boost::shared_ptr<Backend> backend;
+			std::unique_ptr<ScriptEngine> engine;
+			std::unique_ptr<boost::asio::io_service::work> work;
+			boost::asio::deadline_timer timer { ios };
+			
+			/// Arguments of record commands in the order they ran.
+			std::vector<std::string> log;
+			
+			/// Function creating the backend of a run.
+			typedef std::function<boost::shared_ptr<Backend> (boost::shared_ptr<SimulatedClock> clock)> BackendFactory;
+			
+			/// Construct a run.
+			/**
+			 * \param make_backend Function creating the backend on the clock of the run, or empty for a simulated backend.
+			 */
+			explicit Run(BackendFactory make_backend = nullptr) :
+				backend(make_backend ? make_backend(clock) : boost::make_shared<SimulatedBackend>(clock)),
+				engine(new ScriptEngine(ios, backend, 0))
+			{
+				engine->factory.add("record", [this] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList && arguments) -> command::Command * {
+					return script.create<Record>(parent, log, arguments.size() ? arguments[0].text : "");
+				});
+				engine->factory.add("act", [] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList && arguments) -> command::Command * {
+					return script.create<Act>(parent, arguments.size() ? arguments[0].text : "");
+				});
+				engine->factory.add("lazy", [this] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList && arguments) -> command::Command * {
+					// Never asks for the commands of its argument.
+					return script.create<Record>(parent, log, arguments.size() ? arguments[0].text : "");
+				});
+				engine->factory.add("finish", [this] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList &&) -> command::Command * {
+					return script.create<Finish>(parent, [this] () {
+						work.reset();
+						timer.cancel();
+					});
+				});
+			}
+			
+			~Run() {
+				engine->join();
+			}
+			
+			/// Run a script until it finishes.
+			/**
+			 * \param text The script, a finish command is appended.
+			 * \param timeout Time after which the run is aborted.
+			 * \return True if the script finished in time.
+			 */
+			bool run(std::string const & text, boost::posix_time::time_duration timeout = boost::posix_time::seconds(10)) {
+				engine->load(parseScript(*engine, text + "\n{finish}"));
+				bool finished = true;
+				ios.reset();
+				work.reset(new boost::asio::io_service::work(ios));
+				timer.expires_from_now(timeout);
+				timer.async_wait([this, &finished] (boost::system::error_code const & error) {
+					if (error) return;
+					finished = false;
+					ios.stop();
+				});
+				engine->strand().post([this] () { engine->start(); });
+				clock->run();
+				engine->load(nullptr);
+				return finished;
+			}
+		};
+		
+		/// Text-to-speech backend reporting more events than the speech engine can queue, right from say().
+		struct FloodTts : public TtsBackend {
+			int last_id = 0;
+			
+			int say(std::string const &) override {
+				int id = ++last_id;
+				for (int i = 0; i < 1000; ++i) if (on_bookmark) on_bookmark(0);
+				if (on_done) on_done(id);
+				return id;
+			}
+			
+			void stop(int) override {}
+		};
+		
+		/// Simulated backend speaking with a FloodTts.
+		struct FloodBackend : public SimulatedBackend {
+			using SimulatedBackend::SimulatedBackend;
+			
+			boost::shared_ptr<TtsBackend> createTts(boost::asio::io_service &) override {
+				return boost::make_shared<FloodTts>();
+			}
+		};
+		
+		/// Builder recording the argument texts of an image.
+		struct ArgumentTexts : public image::Builder {
+			std::vector<std::string> texts;
+			
+			void speech(boost::string_ref, std::vector<std::uint32_t> const &) override {}
+			void command(boost::string_ref, std::size_t) override {}
+			void argument(boost::string_ref text, char const *, std::size_t) override { texts.push_back(text.to_string()); }
+			void frame(std::size_t) override {}
+		};
+		
+		/// Write an image as script text.
+		std::string imageText(std::string const & image) {
+			std::ostringstream stream;
+			image::write(stream, image.data(), image.size());
+			return stream.str();
+		}
+		
+		/// Comments are not part of argument text, and arguments only get commands when asked.
+		void testArguments() {
+			ArgumentTexts texts;
+			std::string image = parseScriptImage("{lazy|left # a comment\n right|two}");
+			image::read(image.data(), image.size(), texts);
+			check(texts.texts.size() == 2, "expected 2 arguments");
+			check(texts.texts[0].find("comment") == std::string::npos && texts.texts[0].find('#') == std::string::npos, "comment in argument text: " + texts.texts[0]);
+			
+			Run run;
+			auto lazy = parseScript(*run.engine, "{lazy|One. Two. Three. {record|x}}");
+			check(lazy->size() == 1, "argument of a command that ignores it created commands");
+			auto eager = parseScript(*run.engine, "{execute|One. Two. Three.}");
+			check(eager->size() == 5, "execute didn't create the frame and sentences of its argument");
+		}
+		
+		/// Commands are placed in the arena of their script.
+		void testArena() {
+			Run run;
+			auto script = parseScript(*run.engine, "One. Two. {record|a} Three.");
+			check(script->size() >= 4, "commands missing");
+			check(script->arena().allocated() >= script->size() * sizeof(command::Command), "commands not allocated from the arena");
+			check(script->arena().blocks() == 1, "small script used more than one arena block");
+		}
+		
+		/// Scripts compile to a flat program with one speak instruction per sentence.
+		void testProgram() {
+			Run run;
+			auto script = parseScript(*run.engine, "One. Two. {execute|Three. Four.}");
+			command::Program program = command::compile(script->root());
+			std::size_t speaks = std::count_if(program.begin(), program.end(), [] (command::Instruction const & instruction) {
+				return instruction.op == command::Opcode::speak;
+			});
+			check(speaks == 4, "expected 4 speak instructions, got " + std::to_string(speaks));
+		}
+		
+		/// Scripts are cached by content hash, corrupt cache files are parsed again.
+		void testCache() {
+			boost::filesystem::path directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+			struct Cleanup {
+				boost::filesystem::path path;
+				~Cleanup() { boost::system::error_code error; boost::filesystem::remove_all(path, error); }
+			} cleanup{directory};
+			
+			Run run;
+			ScriptCache cache(directory.string());
+			std::string text = "Hello there. {record|a} How are you?";
+			std::ostringstream first, second, third;
+			first << *cache.load(*run.engine, text);
+			check(boost::filesystem::exists(cache.path(text)), "cache file not written");
+			second << *cache.load(*run.engine, text);
+			check(first.str() == second.str(), "cached script differs from the parsed script");
+			check(cache.path(text) != cache.path(text + " "), "different scripts share a cache file");
+			
+			std::ofstream(cache.path(text), std::ios::binary | std::ios::trunc) << "garbage";
+			third << *cache.load(*run.engine, text);
+			check(first.str() == third.str(), "corrupt cache file was not parsed again");
+		}
+		
+		/// Embedded commands run at their bookmarks, in order, and the script finishes.
+		void testSpeech() {
+			Run run;
+			check(run.run("First {record|1} sentence {record|2}. Second {record|3} one. {record|4} Third."), "script didn't finish");
+			check(run.log == std::vector<std::string>({"1", "2", "3", "4"}), "embedded commands ran out of order");
+			check(run.engine->stats.speech_duration.count() == 3, "expected 3 finished sentences");
+			check(run.engine->stats.bookmark_latency.count() >= 3, "bookmarks were not delivered");
+		}
+		
+		/// Behaviors run on the simulated backend and complete without a client.
+		void testBehaviors() {
+			Run run;
+			auto & simulated = static_cast<SimulatedBackend &>(*run.backend);
+			simulated.behavior_load_time = boost::posix_time::milliseconds(0);
+			simulated.behavior_duration  = boost::posix_time::milliseconds(10);
+			check(run.run("{act|robotutor/generic/Capisce} This sentence takes a while to say. {act|robotutor/generic/SpreadBoth} And so does this one, to be sure."), "script didn't finish");
+			check(run.engine->stats.behavior_duration.count() == 2, "expected 2 finished behaviors");
+		}
+		
+		/// The catalog finds behaviors by name and prefix without asking the backend again.
+		void testCatalog() {
+			unsigned int fetches = 0;
+			BehaviorCatalog catalog([&fetches] () {
+				++fetches;
+				return std::vector<std::string>{"b/two", "a/one", "b/one", "c", "b/two"};
+			});
+			check(catalog.contains("b/one") && !catalog.contains("b/"), "contains() is wrong");
+			auto range = catalog.match("b/");
+			check(range.second - range.first == 2, "expected 2 behaviors with prefix b/");
+			
+			boost::random::mt19937 random(1);
+			for (int i = 0; i < 100; ++i) {
+				std::string const * behavior = catalog.random("b/", random);
+				check(behavior && behavior->compare(0, 2, "b/") == 0, "random behavior without the prefix");
+			}
+			check(!catalog.random("d", random), "random behavior for an unknown prefix");
+			check(fetches == 1, "catalog fetched the behaviors more than once");
+			catalog.invalidate();
+			catalog.contains("c");
+			check(fetches == 2, "invalidated catalog wasn't fetched again");
+		}
+		
+		/// Histograms put samples in power of two buckets, step histograms are shared per name.
+		void testHistogram() {
+			Histogram histogram;
+			for (std::uint64_t value : {0, 1, 3, 1000}) histogram.record(value);
+			check(histogram.count() == 4 && histogram.sum() == 1004 && histogram.max() == 1000, "wrong totals");
+			check(histogram.bucket(0) == 1 && histogram.bucket(1) == 1 && histogram.bucket(2) == 1 && histogram.bucket(10) == 1, "wrong buckets");
+			
+			Stats stats;
+			check(&stats.steps("speech") == &stats.steps("speech") && &stats.steps("speech") != &stats.steps("slide"), "step histograms not shared per name");
+		}
+		
+		/// Framed messages read back the same, oversized frames are refused before they arrive.
+		void testFraming() {
+			RobotMessage message;
+			message.mutable_behaviorcmd()->set_behaviorname("robotutor/generic/Capisce");
+			message.mutable_behaviorcmd()->set_id(42);
+			auto frame = Protocol::frameMessage(message);
+			
+			boost::asio::streambuf buffer;
+			std::ostream stream(&buffer);
+			stream.write(frame->data(), 3);
+			RobotMessage read;
+			check(Protocol::consumeMessage(buffer, read, 1024) == ascf::ReadResult::incomplete, "partial header not incomplete");
+			stream.write(frame->data() + 3, frame->size() - 3);
+			check(Protocol::consumeMessage(buffer, read, 4) == ascf::ReadResult::too_large, "oversized frame accepted");
+			check(Protocol::consumeMessage(buffer, read, 1024) == ascf::ReadResult::message, "frame not read");
+			check(read.SerializeAsString() == message.SerializeAsString() && buffer.size() == 0, "frame read back differently");
+		}
+		
+		/// The SIMD level kernel matches the scalar one.
+		void testLevels() {
+			boost::random::mt19937 random(7);
+			std::vector<std::int16_t> samples(4 * 1001);
+			for (auto & sample : samples) sample = std::int16_t(random());
+			samples[5] = -32768;
+			for (unsigned int channels = 1; channels <= 4; ++channels) {
+				std::vector<ChannelLevel> simd(channels), scalar(channels);
+				std::size_t frames = samples.size() / channels;
+				measureLevels(samples.data(), frames, channels, simd.data());
+				measureLevelsScalar(samples.data(), frames, channels, scalar.data());
+				for (unsigned int i = 0; i < channels; ++i) {
+					check(simd[i].peak == scalar[i].peak, "peak differs for " + std::to_string(channels) + " channels");
+					check(std::fabs(simd[i].rms - scalar[i].rms) <= 1e-4 * scalar[i].rms, "rms differs for " + std::to_string(channels) + " channels");
+				}
+			}
+		}
+		
+		/// The factory finds every registered command and nothing else.
+		void testFactory() {
+			Run run;
+			for (int i = 0; i < 500; ++i) run.engine->factory.add("command " + std::to_string(i), nullptr);
+			for (int i = 0; i < 500; ++i) check(run.engine->factory.has("command " + std::to_string(i)), "registered command not found");
+			check(run.engine->factory.has("record") && !run.engine->factory.has("command 500") && !run.engine->factory.has(""), "lookup found unregistered commands");
+		}
+		
+		/// Scripts written from an image parse back to the same script, truncated images are rejected.
+		void testRoundTrip() {
+			for (std::string text : {generateScript(300, 2), std::string("Escaped \\{ \\| \\} \\# text. {a|b {c|d}|\\|}")}) {
+				std::string written = imageText(parseScriptImage(text));
+				check(imageText(parseScriptImage(written)) == written, "text changed after parsing and writing it again");
+			}
+			
+			// A prefix ending after a whole command is a valid image, any other prefix must be rejected.
+			std::string image = parseScriptImage("One. {a|b}");
+			for (std::size_t size = 0; size < image.size(); ++size) {
+				try {
+					ArgumentTexts texts;
+					image::read(image.data(), size, texts);
+				} catch (std::exception const &) {
+					continue;
+				}
+				check(size && imageText(image.substr(0, size)).size() < imageText(image).size(), "truncated image read as the whole script");
+			}
+			bool failed = false;
+			try {
+				imageText(image.substr(0, image.size() - 1));
+			} catch (std::exception const &) {
+				failed = true;
+			}
+			check(failed, "image with a truncated last operation accepted");
+		}
+		
+		/// The simulated backend knows the shipped behaviors and reads behavior lists.
+		void testSimulatedBackend() {
+			boost::asio::io_service ios;
+			SimulatedBackend backend(ios);
+			auto installed = backend.installedBehaviors();
+			check(std::find(installed.begin(), installed.end(), "robotutor/generic/Capisce") != installed.end(), "default behaviors missing");
+			
+			std::istringstream list("# comment\n\nrobotutor/a 100\nrobotutor/b\n");
+			backend.loadBehaviors(list);
+			check(backend.behaviors.size() == 2, "expected 2 behaviors");
+			check(backend.behaviors["robotutor/a"] == boost::posix_time::milliseconds(100) && backend.behaviors["robotutor/b"].is_special(), "wrong durations");
+			
+			std::istringstream invalid("robotutor/a soon\n");
+			bool failed = false;
+			try {
+				backend.loadBehaviors(invalid);
+			} catch (std::exception const &) {
+				failed = true;
+			}
+			check(failed, "invalid duration accepted");
+		}
+		
+		/// A virtual clock fires timers in order without waiting for them, and times simulated speech exactly.
+		void testSimulatedClock() {
+			boost::asio::io_service ios;
+			auto clock = boost::make_shared<SimulatedClock>(ios);
+			boost::posix_time::ptime start = clock->now();
+			std::vector<std::pair<int, boost::posix_time::time_duration>> fired;
+			auto record = [&] (int event) { fired.emplace_back(event, clock->now() - start); };
+			
+			clock->at(start + boost::posix_time::hours(1), [&] () { record(1); });
+			std::uint64_t cancelled = clock->at(start + boost::posix_time::seconds(10), [&] () { record(2); });
+			clock->at(start + boost::posix_time::seconds(1), [&] () { record(3); });
+			clock->cancel(cancelled);
+			
+			// 300 ms synthesis, 60 ms per character and the pause.
+			SimulatedTts tts(ios, clock);
+			tts.on_bookmark = [&] (int bookmark) { record(10 + bookmark); };
+			tts.on_done     = [&] (int) { record(20); };
+			tts.say("ab\\mrk=1\\cd\\pau=100\\e");
+			
+			auto real_start = std::chrono::steady_clock::now();
+			clock->run();
+			check(std::chrono::steady_clock::now() - real_start < std::chrono::seconds(1), "virtual clock waited in real time");
+			
+			using boost::posix_time::milliseconds;
+			std::vector<std::pair<int, boost::posix_time::time_duration>> expected = {
+				{11, milliseconds(420)}, {20, milliseconds(700)}, {3, milliseconds(1000)}, {1, milliseconds(3600000)},
+			};
+			check(fired == expected, "timers fired at the wrong virtual time or in the wrong order");
+		}
+		
+		/// Concurrent producers lose no events, except by counting them as dropped.
+		/**
+		 * Drains run on two consumer threads, so each drain must count its events before another one can start.
+		 */
+		void testEventQueue() {
+			boost::asio::io_service ios;
+			EventQueue<std::pair<int, int>> queue(64);
+			int const producers = 4;
+			int const events    = 50000;
+			std::vector<int> last(producers, -1);
+			std::size_t handled = 0;
+			std::atomic<std::size_t> counted { 0 };
+			bool ordered = true;
+			auto drain = [&] () {
+				counted += queue.drain([&] (std::pair<int, int> const & event) {
+					if (event.second <= last[event.first]) ordered = false;
+					last[event.first] = event.second;
+					++handled;
+				});
+			};
+			
+			std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(ios));
+			std::vector<std::thread> consumers;
+			for (int c = 0; c < 2; ++c) consumers.emplace_back([&ios] () { ios.run(); });
+			std::vector<std::thread> threads;
+			for (int p = 0; p < producers; ++p) {
+				threads.emplace_back([&, p] () {
+					for (int i = 0; i < events; ++i) if (queue.push({p, i})) ios.post(drain);
+				});
+			}
+			for (auto & thread : threads) thread.join();
+			work.reset();
+			for (auto & consumer : consumers) consumer.join();
+			
+			check(ordered, "events of one producer were reordered");
+			check(handled + queue.dropped() == std::size_t(producers * events), "events lost without being counted");
+			check(counted == handled, "drains returned the wrong number of events");
+		}
+		
+		/// Done events that don't fit in the queue still finish their job.
+		void testLostDone() {
+			Run run([] (boost::shared_ptr<SimulatedClock> clock) { return boost::make_shared<FloodBackend>(clock); });
+			check(run.run("One. Two. Three.", boost::posix_time::seconds(5)), "script hung on a lost done event");
+			check(run.engine->speech->droppedEvents() > 0, "the queue never overflowed");
+		}
+		
+		/// A capture that completes after the engine stopped or loaded another script doesn't continue it.
+		void testPendingCapture() {
+			Run run;
+			ScriptEngine & engine = *run.engine;
+			std::vector<std::function<void ()>> captures;
+			engine.factory.add("capture", [&] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList && arguments) -> command::Command * {
+				return script.create<Capture>(parent, captures, run.log, arguments.size() ? arguments[0].text : "");
+			});
+			auto poll = [&run] () {
+				run.ios.reset();
+				run.ios.poll();
+			};
+			auto start = [&] (std::string const & text) {
+				engine.load(parseScript(engine, text));
+				engine.strand().post([&engine] () { engine.start(); });
+				poll();
+			};
+			
+			start("{capture|one}{record|after one}");
+			check(captures.size() == 1, "capture wasn't requested");
+			engine.strand().post([&engine] () { engine.stop(); });
+			poll();
+			engine.join();
+			engine.load(nullptr);
+			captures[0]();
+			poll();
+			check(run.log.empty(), "a capture continued a stopped script");
+			
+			start("{capture|two}{record|after two}");
+			check(captures.size() == 2, "capture of the new script wasn't requested");
+			captures[0]();
+			poll();
+			check(run.log.empty(), "a capture of the old script continued the new script");
+			captures[1]();
+			poll();
+			check(run.log == std::vector<std::string>({"two", "after two"}), "the new script didn't continue after its capture");
+		}
+		
+		/// Wait until a condition holds.
+		/**
+		 * \param condition The condition to wait for.
+		 * \param timeout The time to wait at most.
+		 * \return True if the condition holds.
+		 */
+		bool waitFor(std::function<bool ()> condition, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+			auto deadline = std::chrono::steady_clock::now() + timeout;
+			while (!condition()) {
+				if (std::chrono::steady_clock::now() > deadline) return false;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			return true;
+		}
+		
+		/// Client socket that is only read when the check asks for it.
+		struct SlowReader {
+			boost::asio::io_service ios;
+			boost::asio::ip::tcp::socket socket { ios };
+			boost::asio::streambuf buffer;
+			
+			/// Connect to a server, with a small receive buffer so writes to it back up soon.
+			explicit SlowReader(boost::asio::ip::tcp::endpoint const & endpoint) {
+				socket.open(endpoint.protocol());
+				socket.set_option(boost::asio::socket_base::receive_buffer_size(4096));
+				socket.connect(endpoint);
+			}
+			
+			/// Read the next message.
+			/**
+			 * \param message The message to read into.
+			 * \return False if the connection ended first.
+			 */
+			bool read(RobotMessage & message) {
+				while (true) {
+					ascf::ReadResult result = Protocol::consumeMessage(buffer, message, ascf::default_max_frame_size);
+					if (result == ascf::ReadResult::message) return true;
+					check(result == ascf::ReadResult::incomplete, "received an invalid frame");
+					
+					boost::system::error_code error;
+					std::size_t read = socket.read_some(buffer.prepare(4096), error);
+					if (error) return false;
+					buffer.commit(read);
+				}
+			}
+		};
+		
+		/// Outcome of the messages sent to a slow reader.
+		struct SendLog {
+			std::mutex mutex;
+			std::vector<boost::system::error_code> results;
+			
+			/// Count the results matching a condition.
+			std::size_t count(std::function<bool (boost::system::error_code const &)> condition) {
+				std::lock_guard<std::mutex> lock(mutex);
+				return std::count_if(results.begin(), results.end(), condition);
+			}
+			
+			/// Get the number of results.
+			std::size_t size() {
+				std::lock_guard<std::mutex> lock(mutex);
+				return results.size();
+			}
+		};
+		
+		/// Send numbered messages of about 512 bytes over a connection, without reading them.
+		/**
+		 * \param connection The connection to send over.
+		 * \param log The log receiving the result of every message.
+		 * \param messages The number of messages to send.
+		 * \return True if the connection was still open after the last send was handled.
+		 */
+		bool sendNumbered(SharedServerConnection connection, SendLog & log, unsigned int messages) {
+			RobotMessage message;
+			message.mutable_behaviorcmd()->set_behaviorname(std::string(512, 'x'));
+			for (unsigned int i = 0; i < messages; ++i) {
+				message.mutable_behaviorcmd()->set_id(i);
+				connection->sendMessage(message, [&log] (SharedServerConnection, boost::system::error_code const & error) {
+					std::lock_guard<std::mutex> lock(log.mutex);
+					log.results.push_back(error);
+				});
+			}
+			
+			// Sends are handled on the strand in order, so this runs after all of them.
+			std::promise<bool> open;
+			connection->strand().post([&open, connection] () { open.set_value(connection->isOpen()); });
+			return open.get_future().get();
+		}
+		
+		/// Wait for the connection accepted by a loopback server.
+		SharedServerConnection accept(std::promise<SharedServerConnection> & accepted) {
+			auto future = accepted.get_future();
+			check(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready, "connection not accepted");
+			return future.get();
+		}
+		
+		/// Messages to a slow reader stay in order, are dropped or disconnect at the high-water mark, and every send gets its callback.
+		void testWriteQueue() {
+			unsigned int const messages = 2000;
+			
+			// Drop messages over the high-water mark and keep the connection.
+			{
+				std::promise<SharedServerConnection> accepted;
+				Loopback loopback([&accepted] (Server & server) {
+					server.highWaterMark(32 * 1024, ascf::OverflowPolicy::drop);
+					server.on_accept = [&accepted] (SharedServerConnection connection) {
+						connection->socket().set_option(boost::asio::socket_base::send_buffer_size(4096));
+						accepted.set_value(connection);
+					};
+				});
+				SlowReader reader(loopback.endpoint());
+				SharedServerConnection connection = accept(accepted);
+				
+				SendLog log;
+				check(sendNumbered(connection, log, messages), "dropping messages closed the connection");
+				std::size_t dropped = connection->dropped();
+				check(dropped > 0, "the high-water mark was never reached");
+				check(log.count([] (boost::system::error_code const & error) { return error == boost::asio::error::no_buffer_space; }) == dropped, "dropped messages did not fail their callback");
+				
+				RobotMessage message;
+				int last = -1;
+				for (std::size_t i = 0; i < messages - dropped; ++i) {
+					check(reader.read(message), "connection ended after " + std::to_string(i) + " messages");
+					check(int(message.behaviorcmd().id()) > last, "messages were reordered");
+					last = message.behaviorcmd().id();
+				}
+				check(waitFor([&] () { return log.size() == messages; }), "not every send got its callback");
+				check(log.count([] (boost::system::error_code const & error) { return !error; }) == messages - dropped, "delivered messages did not succeed");
+				check(connection->pendingBytes() == 0, "bytes still pending after everything was written");
+			}
+			
+			// Disconnect at the high-water mark, failing every message that was still queued.
+			{
+				std::promise<SharedServerConnection> accepted;
+				Loopback loopback([&accepted] (Server & server) {
+					server.highWaterMark(32 * 1024, ascf::OverflowPolicy::disconnect);
+					server.on_accept = [&accepted] (SharedServerConnection connection) {
+						connection->socket().set_option(boost::asio::socket_base::send_buffer_size(4096));
+						accepted.set_value(connection);
+					};
+				});
+				SlowReader reader(loopback.endpoint());
+				SharedServerConnection connection = accept(accepted);
+				
+				SendLog log;
+				check(!sendNumbered(connection, log, messages), "the connection stayed open over the high-water mark");
+				check(waitFor([&] () { return log.size() == messages; }), "not every send got its callback");
+				check(log.count([] (boost::system::error_code const & error) { return error == boost::asio::error::no_buffer_space; }) == 1, "expected one message over the high-water mark");
+				std::size_t written = log.count([] (boost::system::error_code const & error) { return !error; });
+				std::size_t failed  = log.count([] (boost::system::error_code const & error) {
+					return error && error != boost::asio::error::no_buffer_space && error != boost::asio::error::not_connected;
+				});
+				check(failed > 0, "queued messages did not fail after the write error");
+				
+				RobotMessage message;
+				int last = -1;
+				std::size_t received = 0;
+				while (reader.read(message)) {
+					check(int(message.behaviorcmd().id()) > last, "messages were reordered");
+					last = message.behaviorcmd().id();
+					++received;
+				}
+				check(received <= written, "received messages that failed to send");
+				check(waitFor([&] () { return loopback.server.connections().empty(); }), "closed connection still registered");
+			}
+		}
+		
+		/// One large frame followed by many small ones arrive intact, while the read size adapts within its bounds.
+		void testReadSize() {
+			std::size_t const min_read = 1024;
+			std::size_t const max_read = 64 * 1024;
+			unsigned int const small   = 2000;
+			
+			std::string large(3 * 1024 * 1024 + 17, ' ');
+			boost::random::mt19937 random(11);
+			for (auto & c : large) c = char('a' + random() % 26);
+			
+			std::mutex mutex;
+			std::vector<ClientMessage> received;
+			std::size_t smallest = max_read;
+			std::size_t largest  = 0;
+			Loopback loopback([&] (Server & server) {
+				server.readSize(min_read, max_read);
+				server.maxFrameSize(large.size() + 1024);
+				server.on_message = [&] (SharedServerConnection connection, ClientMessage && message) {
+					std::lock_guard<std::mutex> lock(mutex);
+					smallest = std::min(smallest, connection->readSize());
+					largest  = std::max(largest, connection->readSize());
+					received.push_back(std::move(message));
+				};
+			});
+			
+			// Write everything at once, so reads see the large frame followed by runs of small frames.
+			std::string frames;
+			ClientMessage message;
+			message.mutable_run()->set_script(large);
+			frames += *Protocol::frameMessage(message);
+			for (unsigned int i = 0; i < small; ++i) {
+				message.Clear();
+				message.mutable_behaviorcmd()->set_id(i);
+				frames += *Protocol::frameMessage(message);
+			}
+			boost::asio::io_service ios;
+			boost::asio::ip::tcp::socket socket(ios);
+			socket.connect(loopback.endpoint());
+			boost::asio::write(socket, boost::asio::buffer(frames));
+			
+			check(waitFor([&] () { std::lock_guard<std::mutex> lock(mutex); return received.size() == small + 1; }), "not every message arrived");
+			std::lock_guard<std::mutex> lock(mutex);
+			check(received[0].run().script() == large, "the large message arrived damaged");
+			for (unsigned int i = 0; i < small; ++i) {
+				check(received[i + 1].has_behaviorcmd() && received[i + 1].behaviorcmd().id() == i, "small message " + std::to_string(i) + " arrived damaged or out of order");
+			}
+			check(smallest >= min_read && largest <= max_read, "read size left [" + std::to_string(min_read) + ", " + std::to_string(max_read) + "]: " + std::to_string(smallest) + " to " + std::to_string(largest));
+			check(largest > min_read, "read size never grew for the large frame");
+		}
+		
+		/// Every subscriber of a sound level stream gets the peak levels at its own rate, until it unsubscribes.
+		/**
+		 * The audio is fed in chunks that don't line up with the blocks of the stream,
+		 * with the loudest channel changing between blocks.
+		 */
+		void testLevelStream() {
+			unsigned int const sample_rate = 16000;
+			unsigned int const blocks      = 100;
+			std::size_t const block_frames = sample_rate / SoundLevelStream::base_rate;
+			
+			// Weak, so the connections don't outlive the IO service of the server.
+			std::mutex mutex;
+			std::vector<std::weak_ptr<ServerConnection>> connections;
+			Loopback loopback([&] (Server & server) {
+				server.on_accept = [&] (SharedServerConnection connection) {
+					std::lock_guard<std::mutex> lock(mutex);
+					connections.push_back(connection);
+				};
+			});
+			
+			// Connect one at a time, so the accepted connections are in the order of the readers.
+			std::vector<std::unique_ptr<SlowReader>> readers;
+			for (unsigned int i = 0; i < 3; ++i) {
+				readers.emplace_back(new SlowReader(loopback.endpoint()));
+				check(waitFor([&] () { std::lock_guard<std::mutex> lock(mutex); return connections.size() == i + 1; }), "connection not accepted");
+			}
+			
+			// Two channels of constant magnitude, so the level of every block is known up front.
+			std::vector<std::uint32_t> levels;
+			std::vector<std::int16_t> samples;
+			for (unsigned int block = 0; block < blocks; ++block) {
+				std::uint32_t loud  = (block * 37) % 900 + 50;
+				std::uint32_t quiet = loud / 2;
+				std::int16_t left   = std::int16_t(std::lround((block % 2 ? quiet : loud) * 32.768));
+				std::int16_t right  = std::int16_t(std::lround((block % 2 ? loud : quiet) * 32.768));
+				for (std::size_t frame = 0; frame < block_frames; ++frame) {
+					int sign = frame % 2 ? -1 : 1;
+					samples.push_back(sign * left);
+					samples.push_back(sign * right);
+				}
+				levels.push_back(loud);
+			}
+			
+			SoundLevelStream stream(sample_rate);
+			stream.subscribe(connections[0].lock(), 50, 0);
+			stream.subscribe(connections[1].lock(), 10, 2);
+			stream.subscribe(connections[2].lock(), 25, 5);
+			check(stream.subscribers() == 3, "not every client subscribed");
+			
+			std::size_t const chunk = 77;
+			std::size_t const total = samples.size() / 2;
+			unsigned int before_unsubscribe = 0;
+			for (std::size_t frame = 0; frame < total; frame += chunk) {
+				if (frame <= total / 2 && frame + chunk > total / 2) {
+					before_unsubscribe = frame / block_frames;
+					stream.subscribe(connections[2].lock(), 0, 0);
+					check(stream.subscribers() == 2, "client didn't unsubscribe");
+				}
+				stream.process(samples.data() + 2 * frame, std::min(chunk, total - frame), 2);
+			}
+			
+			// The peak of every window of blocks, in batches.
+			auto expected = [&] (unsigned int decimation, unsigned int batch, unsigned int count) {
+				std::vector<std::vector<std::uint32_t>> result;
+				for (unsigned int i = 0; i + decimation <= count; i += decimation) {
+					if (result.empty() || result.back().size() == batch) result.emplace_back();
+					result.back().push_back(*std::max_element(levels.begin() + i, levels.begin() + i + decimation));
+				}
+				if (!result.empty() && result.back().size() < batch) result.pop_back();
+				return result;
+			};
+			
+			// A marker after the levels, since the connections stay open.
+			RobotMessage marker;
+			marker.set_fetch_turningpoint(true);
+			for (auto & connection : connections) connection.lock()->sendMessage(marker);
+			
+			auto received = [&] (SlowReader & reader, unsigned int rate) {
+				std::vector<std::vector<std::uint32_t>> result;
+				RobotMessage message;
+				while (reader.read(message) && message.has_sound_levels()) {
+					check(message.sound_levels().rate() == rate, "levels sent at rate " + std::to_string(message.sound_levels().rate()) + " instead of " + std::to_string(rate));
+					result.emplace_back(message.sound_levels().levels().begin(), message.sound_levels().levels().end());
+				}
+				check(message.has_fetch_turningpoint(), "connection ended before the marker");
+				return result;
+			};
+			
+			check(received(*readers[0], 50) == expected(1, SoundLevelStream::default_batch, blocks), "levels at the base rate are wrong");
+			check(received(*readers[1], 10) == expected(5, 2, blocks), "downsampled levels are wrong");
+			check(received(*readers[2], 25) == expected(2, 5, before_unsubscribe), "levels before unsubscribing are wrong, or kept coming after it");
+		}
+		
+		/// Plugin answering every behavior command with the same ID, checking that it only runs on the engine strand.
+		struct Echo : public Plugin {
+			/// Last ID seen per connection, to check that messages of one client stay in order.
+			std::map<ServerConnection *, int> last;
+			
+			/// Number of messages handled.
+			std::size_t handled = 0;
+			
+			/// Set when a handler runs next to another one or off the engine strand.
+			std::atomic<bool> overlapped { false };
+			
+			/// Set when a client's messages were reordered.
+			bool reordered = false;
+			
+			/// True while a handler runs.
+			std::atomic<bool> busy { false };
+			
+			explicit Echo(ScriptEngine & engine) : Plugin(engine) {}
+			
+			void handleMessage(SharedServerConnection connection, ClientMessage const & message) override {
+				if (!message.has_behaviorcmd()) return;
+				if (busy.exchange(true) || !engine.strand().running_in_this_thread()) overlapped = true;
+				
+				int id = message.behaviorcmd().id();
+				auto previous = last.find(connection.get());
+				if (previous != last.end() && id != previous->second + 1) reordered = true;
+				last[connection.get()] = id;
+				++handled;
+				
+				RobotMessage reply;
+				reply.mutable_behaviorcmd()->set_id(id);
+				connection->sendMessage(reply);
+				busy = false;
+			}
+		};
+		
+		/// Many clients talk to the engine at once over loopback, with the IO service running on several threads.
+		/**
+		 * Messages hop from the strands of the connections to the strand of the engine and the replies hop back,
+		 * so every message of every client must be handled on the engine strand, one at a time and in order.
+		 */
+		void testClients() {
+			unsigned int const clients  = 8;
+			unsigned int const messages = 2000;
+			
+			boost::asio::io_service ios;
+			ScriptEngine engine(ios, boost::make_shared<SimulatedBackend>(ios, 100), 0);
+			auto echo = std::make_shared<Echo>(engine);
+			engine.addPlugin(echo);
+			engine.server.listen(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+			std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(ios));
+			std::vector<std::thread> threads;
+			for (int i = 0; i < 4; ++i) threads.emplace_back([&ios] () { runIo(ios); });
+			
+			boost::asio::io_service client_ios;
+			std::unique_ptr<boost::asio::io_service::work> client_work(new boost::asio::io_service::work(client_ios));
+			for (int i = 0; i < 2; ++i) threads.emplace_back([&client_ios] () { runIo(client_ios); });
+			
+			std::vector<SharedClient> connections;
+			std::vector<std::unique_ptr<std::atomic<unsigned int>>> replies;
+			std::atomic<bool> reply_order { true };
+			for (unsigned int c = 0; c < clients; ++c) {
+				replies.emplace_back(new std::atomic<unsigned int> { 0 });
+				std::atomic<unsigned int> & received = *replies.back();
+				SharedClient client = Client::create(client_ios);
+				client->on_message = [&received, &reply_order] (SharedClient, RobotMessage && message) {
+					if (message.behaviorcmd().id() != received) reply_order = false;
+					++received;
+				};
+				std::promise<boost::system::error_code> connected;
+				client->connect(engine.server.localEndpoint(), [&connected] (SharedClient, boost::system::error_code const & error) {
+					connected.set_value(error);
+				});
+				check(!connected.get_future().get(), "client failed to connect");
+				connections.push_back(client);
+			}
+			
+			// All clients send at the same time.
+			std::vector<std::thread> senders;
+			for (auto & client : connections) {
+				senders.emplace_back([client, messages] () {
+					ClientMessage message;
+					for (unsigned int i = 0; i < messages; ++i) {
+						message.mutable_behaviorcmd()->set_id(i);
+						client->sendMessage(message);
+					}
+				});
+			}
+			for (auto & sender : senders) sender.join();
+			
+			bool done = waitFor([&] () {
+				return std::all_of(replies.begin(), replies.end(), [messages] (std::unique_ptr<std::atomic<unsigned int>> const & received) { return *received == messages; });
+			}, std::chrono::milliseconds(20000));
+			
+			for (auto & client : connections) client->close();
+			client_work.reset();
+			work.reset();
+			std::promise<void> idle;
+			engine.strand().post([&idle] () { idle.set_value(); });
+			idle.get_future().wait();
+			engine.server.close();
+			client_ios.stop();
+			ios.stop();
+			for (auto & thread : threads) thread.join();
+			
+			check(done, "not every message got its reply");
+			check(!echo->overlapped, "plugin handlers ran concurrently or off the engine strand");
+			check(!echo->reordered, "messages of a client were reordered on the way to the engine");
+			check(reply_order, "replies to a client were reordered");
+			check(echo->handled == clients * messages, "handled " + std::to_string(echo->handled) + " messages");
+		}
+		
+		/// The control plugin runs, pauses, resumes and stops scripts without blocking the engine strand.
+		/**
+		 * The IO service runs on a single thread, so waiting for the engine on its strand would hang the check.
+		 * The plugin is loaded from lib/control.so, so the check must run from the directory holding robotutor-bench.
+		 */
+		void testControl() {
+			boost::filesystem::path directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+			struct Cleanup {
+				boost::filesystem::path path;
+				~Cleanup() { boost::system::error_code error; boost::filesystem::remove_all(path, error); }
+			} cleanup{directory};
+			
+			boost::asio::io_service ios;
+			ScriptEngine engine(ios, boost::make_shared<SimulatedBackend>(ios, 20), 0);
+			engine.cache_directory = directory.string();
+			check(engine.loadPlugin("lib/control.so"), "failed to load lib/control.so");
+			engine.server.listen(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+			std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(ios));
+			std::thread thread([&ios] () { runIo(ios); });
+			
+			std::mutex mutex;
+			std::vector<ScriptStatus::State> states;
+			std::atomic<unsigned int> stats { 0 };
+			SharedClient client = Client::create(ios);
+			client->on_message = [&] (SharedClient, RobotMessage && message) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (message.has_scriptstatus()) states.push_back(message.scriptstatus().state());
+				if (message.has_stats()) ++stats;
+			};
+			std::promise<boost::system::error_code> connected;
+			client->connect(engine.server.localEndpoint(), [&connected] (SharedClient, boost::system::error_code const & error) {
+				connected.set_value(error);
+			});
+			check(!connected.get_future().get(), "client failed to connect");
+			
+			// A stats request is answered on the engine strand, so an answer shows the strand isn't blocked.
+			auto responsive = [&] () {
+				unsigned int before = stats;
+				ClientMessage message;
+				message.mutable_stats();
+				client->sendMessage(message);
+				return waitFor([&] () { return stats > before; });
+			};
+			auto loaded = [&] (std::size_t count) {
+				return waitFor([&] () {
+					std::lock_guard<std::mutex> lock(mutex);
+					return std::count(states.begin(), states.end(), ScriptStatus::LOADED) == int(count);
+				});
+			};
+			
+			std::string script;
+			for (int i = 0; i < 50; ++i) script += "Sentence number " + std::to_string(i) + ".\n";
+			ClientMessage run;
+			run.mutable_run()->set_script(script);
+			ClientMessage pause;
+			pause.mutable_pause();
+			ClientMessage resume;
+			resume.mutable_resume();
+			ClientMessage stop;
+			stop.mutable_stop();
+			
+			client->sendMessage(run);
+			check(loaded(1) && waitFor([&] () { return engine.started(); }), "script did not start");
+			client->sendMessage(pause);
+			check(responsive() && waitFor([&] () { return !engine.started(); }), "pause blocked the engine");
+			client->sendMessage(resume);
+			check(waitFor([&] () { return engine.started(); }), "resume did not start the script again");
+			client->sendMessage(run);
+			check(loaded(2) && responsive() && engine.started(), "replacing a running script blocked the engine");
+			client->sendMessage(stop);
+			check(responsive() && waitFor([&] () { return !engine.started(); }), "stop blocked the engine");
+			
+			// The handler of the last stop is code of the plugin, so let it run before the plugin is unloaded.
+			client->close();
+			engine.join();
+			std::promise<void> idle;
+			engine.strand().post([&idle] () { idle.set_value(); });
+			idle.get_future().wait();
+			work.reset();
+			engine.server.close();
+			ios.stop();
+			thread.join();
+		}
+		
+		/// A self-check.
+		struct Test {
+			char const * name;
+			void (*function)();
+		};
+		
+		Test const tests[] = {
+			{"parser/arguments",  testArguments},
+			{"parser/round-trip", testRoundTrip},
+			{"script/arena",      testArena},
+			{"script/program",    testProgram},
+			{"script/cache",      testCache},
+			{"engine/speech",     testSpeech},
+			{"engine/behaviors",  testBehaviors},
+			{"engine/catalog",    testCatalog},
+			{"engine/factory",    testFactory},
+			{"engine/lost-done",  testLostDone},
+			{"engine/capture",    testPendingCapture},
+			{"stats/histogram",   testHistogram},
+			{"net/framing",       testFraming},
+			{"net/write-queue",   testWriteQueue},
+			{"net/read-size",     testReadSize},
+			{"net/clients",       testClients},
+			{"plugin/control",    testControl},
+			{"audio/levels",      testLevels},
+			{"audio/stream",      testLevelStream},
+			{"sim/backend",       testSimulatedBackend},
+			{"sim/clock",         testSimulatedClock},
+			{"queue/events",      testEventQueue},
+		};
+	}
+	
+	/// Run an IO service until it is stopped, closing connections whose handlers failed like the server does.
+	void runIo(boost::asio::io_service & ios) {
+		while (!ios.stopped()) {
+			try {
+				ios.run();
+			} catch (ServerError const & e) {
+				e.connection->close();
+			} catch (ClientError const & e) {
+				e.connection->close();
+			}
+		}
+	}
+	
+	/// Run the self-checks of robotutor-bench.
+	/**
+	 * Every check exercises the behavior one change to the engine promised,
+	 * without a robot, talking to clients over loopback where needed.
+	 * 
+	 * \param filters Only run checks whose name starts with one of these, or all checks if empty.
+	 * \return The exit status, zero if all checks passed.
+	 */
+	int runTests(std::vector<std::string> const & filters) {
+		// The engines log to standard output, keep it for the results.
+		NullBuffer null_buffer;
+		std::ostream out(std::cout.rdbuf(&null_buffer));
+		
+		unsigned int run    = 0;
+		unsigned int failed = 0;
+		for (auto const & test : tests) {
+			std::string name = test.name;
+			if (filters.size() && std::none_of(filters.begin(), filters.end(), [&name] (std::string const & filter) { return name.compare(0, filter.size(), filter) == 0; })) continue;
+			
+			++run;
+			try {
+				test.function();
+				out << "ok   " << name << std::endl;
+			} catch (std::exception const & e) {
+				++failed;
+				out << "FAIL " << name << ": " << e.what() << std::endl;
+			}
+		}
+		
+		std::cout.rdbuf(out.rdbuf());
+		std::cout << run - failed << " of " << run << " checks passed." << std::endl;
+		return failed ? 1 : 0;
+	}
+	
+}
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <iterator>
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "camera_service.hpp"
+
+
+namespace robotutor {
+	
+	/// Construct the service and start the capture thread.
+	/**
+	 * \param source The source to grab images from.
+	 */
+	CameraService::CameraService(std::unique_ptr<CameraSource> source) :
+		source_(std::move(source)),
+		parameters_{CV_IMWRITE_JPEG_QUALITY, 0}
+	{
+		thread_ = std::thread(&CameraService::run_, this);
+	}
+	
+	/// Stop the capture thread.
+	/**
+	 * Requests that haven't been served are dropped without invoking their handler.
+	 */
+	CameraService::~CameraService() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopped_ = true;
+		}
+		condition_.notify_all();
+		if (thread_.joinable()) thread_.join();
+	}
+	
+	/// Capture an image.
+	/**
+	 * \param format The format to encode the image in.
+	 * \param handler The callback to invoke with the image.
+	 */
+	void CameraService::capture(ImageFormat const & format, CaptureHandler handler) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			requests_.emplace_back(format, std::move(handler));
+		}
+		condition_.notify_one();
+	}
+	
+	/// Serve capture requests until the service is stopped.
+	void CameraService::run_() {
+		std::vector<std::pair<ImageFormat, CaptureHandler>> requests;
+		
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				condition_.wait(lock, [this] () { return stopped_ || !requests_.empty(); });
+				if (stopped_) return;
+				requests.swap(requests_);
+			}
+			
+			// Group the requests by format, so every format is encoded only once.
+			std::stable_sort(requests.begin(), requests.end(), [] (std::pair<ImageFormat, CaptureHandler> const & a, std::pair<ImageFormat, CaptureHandler> const & b) {
+				return a.first < b.first;
+			});
+			
+			bool grabbed = grab_();
+			for (auto i = requests.begin(); i != requests.end(); ++i) {
+				if (i == requests.begin() || std::prev(i)->first < i->first) {
+					if (!grabbed || !encode_(i->first)) image_.jpeg.clear();
+				}
+				i->second(image_);
+			}
+			requests.clear();
+		}
+	}
+	
+	/// Grab a frame.
+	/**
+	 * \return True if a frame was grabbed.
+	 */
+	bool CameraService::grab_() {
+		try {
+			if (!source_->grab(frame_)) {
+				std::cerr << "Failed to grab camera image." << std::endl;
+				return false;
+			}
+			image_.captured = std::chrono::system_clock::now();
+			return true;
+		} catch (std::exception const & e) {
+			std::cerr << "Failed to grab camera image: " << e.what() << std::endl;
+			return false;
+		}
+	}
+	
+	/// Encode the last grabbed frame.
+	/**
+	 * The frame is scaled down to fit in the requested size, keeping its aspect ratio.
+	 * 
+	 * \param format The format to encode the frame in.
+	 * \return True if the frame was encoded.
+	 */
+	bool CameraService::encode_(ImageFormat const & format) {
+		double scale = 1;
+		if (format.width  > 0) scale = std::min(scale, double(format.width)  / frame_.cols);
+		if (format.height > 0) scale = std::min(scale, double(format.height) / frame_.rows);
+		
+		cv::Mat const * frame = &frame_;
+		if (scale < 1) {
+			cv::resize(frame_, scaled_, cv::Size(std::max(1, int(frame_.cols * scale)), std::max(1, int(frame_.rows * scale))), 0, 0, cv::INTER_AREA);
+			frame = &scaled_;
+		}
+		
+		try {
+			parameters_[1] = format.quality;
+			if (!cv::imencode(".jpg", *frame, image_.jpeg, parameters_)) {
+				std::cerr << "Failed to encode camera image." << std::endl;
+				return false;
+			}
+		} catch (std::exception const & e) {
+			std::cerr << "Failed to encode camera image: " << e.what() << std::endl;
+			return false;
+		}
+		
+		image_.width  = frame->cols;
+		image_.height = frame->rows;
+		return true;
+	}
+	
+}
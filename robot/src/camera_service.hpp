@@ -0,0 +1,138 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "camera_source.hpp"
+
+namespace robotutor {
+	
+	/// Format to encode a captured image in.
+	struct ImageFormat {
+		/// Maximum width of the image, or 0 for the width of the camera.
+		int width = 0;
+		
+		/// Maximum height of the image, or 0 for the height of the camera.
+		int height = 0;
+		
+		/// JPEG quality, from 0 to 100.
+		int quality = 80;
+		
+		/// Order formats, so requests for the same format can be grouped.
+		bool operator < (ImageFormat const & other) const {
+			return std::make_tuple(width, height, quality) < std::make_tuple(other.width, other.height, other.quality);
+		}
+	};
+	
+	/// A captured and encoded image.
+	struct EncodedImage {
+		/// The JPEG data, empty if the capture failed.
+		std::vector<unsigned char> jpeg;
+		
+		/// The width of the encoded image.
+		int width = 0;
+		
+		/// The height of the encoded image.
+		int height = 0;
+		
+		/// The time the frame was grabbed.
+		std::chrono::system_clock::time_point captured;
+	};
+	
+	/// Service that captures JPEG images on a background thread.
+	/**
+	 * Capture requests are queued and served by a single capture thread,
+	 * so grabbing and encoding never block the thread that asked for the image.
+	 * Requests that queued up while the thread was busy are all served from the same frame,
+	 * which is scaled and encoded once for every distinct format.
+	 * 
+	 * The frames and the JPEG buffer are kept between captures,
+	 * so steady state capturing doesn't allocate.
+	 */
+	class CameraService {
+		public:
+			/// Callback for a finished capture.
+			/**
+			 * Invoked from the capture thread.
+			 * The image is only valid during the call.
+			 */
+			typedef std::function<void (EncodedImage const & image)> CaptureHandler;
+			
+		protected:
+			/// The source to grab images from.
+			std::unique_ptr<CameraSource> source_;
+			
+			/// The last grabbed frame.
+			cv::Mat frame_;
+			
+			/// The last grabbed frame, scaled down to the requested format.
+			cv::Mat scaled_;
+			
+			/// Parameters for the JPEG encoder.
+			std::vector<int> parameters_;
+			
+			/// The last encoded image.
+			EncodedImage image_;
+			
+			/// Mutex protecting the request queue.
+			std::mutex mutex_;
+			
+			/// Signalled when a request is queued or the service is stopped.
+			std::condition_variable condition_;
+			
+			/// Queued capture requests.
+			std::vector<std::pair<ImageFormat, CaptureHandler>> requests_;
+			
+			/// True if the service is stopping.
+			bool stopped_ = false;
+			
+			/// The capture thread.
+			std::thread thread_;
+			
+		public:
+			/// Construct the service and start the capture thread.
+			/**
+			 * \param source The source to grab images from.
+			 */
+			CameraService(std::unique_ptr<CameraSource> source);
+			
+			/// Stop the capture thread.
+			/**
+			 * Requests that haven't been served are dropped without invoking their handler.
+			 */
+			~CameraService();
+			
+			/// Capture an image.
+			/**
+			 * \param format The format to encode the image in.
+			 * \param handler The callback to invoke with the image.
+			 */
+			void capture(ImageFormat const & format, CaptureHandler handler);
+			
+		protected:
+			/// Serve capture requests until the service is stopped.
+			void run_();
+			
+			/// Grab a frame.
+			/**
+			 * \return True if a frame was grabbed.
+			 */
+			bool grab_();
+			
+			/// Encode the last grabbed frame.
+			/**
+			 * \param format The format to encode the frame in.
+			 * \return True if the frame was encoded.
+			 */
+			bool encode_(ImageFormat const & format);
+	};
+	
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+namespace cv {
+	class Mat;
+}
+
+namespace robotutor {
+	
+	/// Interface for sources of camera images used by the camera service.
+	/**
+	 * Sources are only used from the capture thread of the camera service,
+	 * so they don't need to be thread safe.
+	 */
+	class CameraSource {
+		public:
+			/// Virtual destructor.
+			virtual ~CameraSource() {}
+			
+			/// Grab a frame.
+			/**
+			 * The frame is only reallocated if its size or type changes,
+			 * so a caller that keeps passing the same frame doesn't allocate for every image.
+			 * 
+			 * \param frame The frame to write the image to, in BGR colorspace.
+			 * \return True if an image was grabbed.
+			 */
+			virtual bool grab(cv::Mat & frame) = 0;
+	};
+	
+}
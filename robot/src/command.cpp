@@ -42,6 +42,25 @@ namespace robotutor {
 			engine.continue_();
 		}
 		
+		/// Get a function that continues the script engine when an asynchronous operation completed.
+		/**
+		 * The function can be called from any thread, it continues on the strand of the engine.
+		 * It does nothing if the engine stopped, loaded another script or moved past this command in the meantime,
+		 * so a late completion never touches a released command or resumes another script.
+		 * 
+		 * \return The function to call on completion.
+		 */
+		std::function<void ()> Command::asyncContinue_() {
+			ScriptEngine & engine   = this->engine;
+			Command * command       = this;
+			unsigned int generation = engine.generation();
+			return [&engine, command, generation] () {
+				engine.strand().post([&engine, command, generation] () {
+					if (engine.generation() == generation && engine.current() == command && engine.started()) engine.continue_();
+				});
+			};
+		}
+		
 		/// Should be called when the command is done.
 		/**
 		 * Sets the current command of the engine to the parent of this command.
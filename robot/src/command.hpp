@@ -1,29 +1,84 @@
 #pragma once
+#include <functional>
 #include <string>
 #include <vector>
 #include <ostream>
-#include <memory>
+#include <cstddef>
+#include <utility>
 
 
 namespace robotutor {
 	
 	class ScriptEngine;
 	class Plugin;
+	class Histogram;
 	
 	/// Namespace to contain all commands.
 	namespace command {
 		
 		class Command;
+		class Compiler;
 		class Factory;
+		class Script;
 		
-		/// Shared pointer for executables.
-		typedef std::shared_ptr<Command> SharedPtr;
+		/// Argument list, containing pointers to commands.
+		/**
+		 * The commands are owned by the script they belong to.
+		 */
+		typedef std::vector<Command *> CommandList;
 		
-		/// Argument list, containing shared pointers to commands.
-		typedef std::vector<SharedPtr> CommandList;
+		/// Argument for a command, as read from a script.
+		/**
+		 * Arguments are parsed together with the rest of the script,
+		 * but the commands of an argument are only created when the command asks for them with script().
+		 * Commands that take plain values should use the text instead, which costs nothing extra.
+		 */
+		struct Argument {
+			/// The literal text of the argument, excluding embedded commands and comments.
+			std::string text;
+			
+			/// Construct an argument.
+			/**
+			 * \param text The literal text of the argument.
+			 * \param owner The script that will own the commands of the argument.
+			 * \param image The script image of the argument.
+			 * \param size The size of the image in bytes.
+			 */
+			Argument(std::string text, Script & owner, char const * image, std::size_t size) :
+				text(std::move(text)),
+				owner_(&owner),
+				image_(image),
+				size_(size) {}
+			
+			/// Get the argument parsed as script.
+			/**
+			 * The commands are created on the first call.
+			 * The image of the argument points into the image being loaded,
+			 * so this may only be called while the command is being created.
+			 *
+			 * \return The root command of the argument.
+			 */
+			Command * script();
+			
+		protected:
+			/// The script that will own the commands of the argument.
+			Script * owner_;
+			
+			/// The script image of the argument.
+			char const * image_;
+			
+			/// The size of the image in bytes.
+			std::size_t size_;
+			
+			/// The root command of the argument, once created.
+			Command * script_ = nullptr;
+		};
+		
+		/// List of arguments for a command.
+		typedef std::vector<Argument> ArgumentList;
 		
 		/// Base class for executables.
-		class Command : public std::enable_shared_from_this<Command> {
+		class Command {
 			public:
 				/// The associated script engine.
 				ScriptEngine & engine;
@@ -37,6 +92,12 @@ namespace robotutor {
 				/// Arguments for the command.
 				CommandList children;
 				
+				/// Histogram of the step durations of the command, shared by all commands with the same name.
+				/**
+				 * Set when the command is created, or by the script engine on the first step.
+				 */
+				Histogram * steps = nullptr;
+				
 				/// Construct a command without arguments.
 				Command(ScriptEngine & engine, Command * parent, Plugin * plugin) :
 					engine(engine),
@@ -72,6 +133,37 @@ namespace robotutor {
 				 */
 				virtual std::string name() const = 0;
 				
+				/// Lower the command into a compiled program.
+				/**
+				 * Commands that don't override this are executed through a call instruction,
+				 * which runs step() on the command tree as usual.
+				 * 
+				 * \param compiler The compiler to emit instructions with.
+				 * \return True if the command emitted its own instructions.
+				 */
+				virtual bool compile(Compiler & compiler) { (void) compiler; return false; }
+				
+				/// Get the case to take for a branch instruction emitted for this command.
+				/**
+				 * \return The index of the child to execute, or a negative number to execute none.
+				 */
+				virtual int branch() const { return -1; }
+				
+				/// Prepare what the command needs to start without delay, like loading a file.
+				/**
+				 * Called by the script engine when the command comes within the prefetch window,
+				 * before it knows whether the command will run.
+				 * 
+				 * \return True if evict() should be called when the command is no longer upcoming.
+				 */
+				virtual bool prefetch() { return false; }
+				
+				/// Release what prefetch() prepared.
+				/**
+				 * Called once the script engine moved past the command, whether it ran or not.
+				 */
+				virtual void evict() {}
+				
 			protected:
 				/// Set the next command to be executed.
 				/**
@@ -85,6 +177,16 @@ namespace robotutor {
 				 */
 				void continue_();
 				
+				/// Get a function that continues the script engine when an asynchronous operation completed.
+				/**
+				 * The function can be called from any thread, it continues on the strand of the engine.
+				 * It does nothing if the engine stopped, loaded another script or moved past this command in the meantime,
+				 * so a late completion never touches a released command or resumes another script.
+				 * 
+				 * \return The function to call on completion.
+				 */
+				std::function<void ()> asyncContinue_();
+				
 				/// Should be called when the command is done.
 				/**
 				 * Sets the current command of the engine to the parent of this command.
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <stdexcept>
 
 #include "command_factory.hpp"
 #include "core_commands.hpp"
+#include "script_engine.hpp"
 
 
 namespace robotutor {
@@ -18,14 +20,114 @@ namespace robotutor {
 		
 		/// Create a command.
 		/**
+		 * The command gets the step histogram of its name, unless the creator already set one.
+		 * 
+		 * \param script The script that will own the command.
+		 * \param parent The parent command.
 		 * \param name The name of the command.
 		 * \param args The argument list for the command.
+		 * \return The created command.
 		 */
-		std::shared_ptr<Command> Factory::create(Command * parent, std::string const & name, std::vector<std::string> && args) {
-			CreatorMap::iterator creator = creators_.find(name);
-			if (creator == creators_.end()) throw std::runtime_error("Command `" + name + "' not found.");
-			Entry const & entry = creator->second;
-			return entry.creator(engine_, parent, entry.plugin, std::move(args));
+		Command * Factory::create(Script & script, Command * parent, boost::string_ref name, ArgumentList && args) {
+			Entry const * entry = find_(name);
+			if (!entry) throw std::runtime_error("Command `" + name.to_string() + "' not found.");
+			Command * command = entry->creator(script, parent, entry->plugin, std::move(args));
+			if (!command->steps) command->steps = entry->steps;
+			return command;
+		}
+		
+		/// Register a creator.
+		/**
+		 * Registering a name that is already known replaces the old creator.
+		 * The step histogram for the name is resolved here, so creating commands never has to look it up.
+		 * 
+		 * \param name The name of the command.
+		 * \param creator The creator function to instantiate the command.
+		 * \param plugin The plugin of the command.
+		 */
+		void Factory::add(std::string const & name, Creator creator, Plugin * plugin) {
+			std::size_t hash = hash_(name);
+			if (!slots_.empty()) {
+				std::uint32_t & index = slots_[slot_(name, hash)];
+				if (index) {
+					Entry & entry  = entries_[index - 1];
+					entry.creator  = std::move(creator);
+					entry.plugin   = plugin;
+					return;
+				}
+			}
+			
+			entries_.push_back(Entry{name, hash, std::move(creator), plugin, &engine_.stats.steps(name)});
+			
+			// Keep the load factor at or below one half, so probe sequences stay short.
+			if (entries_.size() * 2 > slots_.size()) {
+				rehash_(std::max<std::size_t>(16, slots_.size() * 2));
+			} else {
+				slots_[slot_(name, hash)] = entries_.size();
+			}
+		}
+		
+		/// Remove all registered commands.
+		/**
+		 * The creators may be code of plugins, so this must be done before the plugins are unloaded.
+		 */
+		void Factory::clear() {
+			entries_.clear();
+			slots_.clear();
+		}
+		
+		/// Hash a command name.
+		/**
+		 * Uses FNV-1a, which is cheap for the short names commands have.
+		 * 
+		 * \param name The name to hash.
+		 * \return The hash of the name.
+		 */
+		std::size_t Factory::hash_(boost::string_ref name) {
+			std::uint64_t hash = 14695981039346656037ull;
+			for (char c : name) {
+				hash ^= static_cast<unsigned char>(c);
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
+		
+		/// Find the slot for a name.
+		/**
+		 * \param name The name to look for.
+		 * \param hash The hash of the name.
+		 * \return The slot holding the name, or the empty slot where it should be inserted.
+		 */
+		std::size_t Factory::slot_(boost::string_ref name, std::size_t hash) const {
+			std::size_t mask = slots_.size() - 1;
+			for (std::size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+				std::uint32_t index = slots_[slot];
+				if (!index) return slot;
+				Entry const & entry = entries_[index - 1];
+				if (entry.hash == hash && entry.name.size() == name.size() && name.compare(entry.name) == 0) return slot;
+			}
+		}
+		
+		/// Find a registered command.
+		/**
+		 * \param name The name of the command.
+		 * \return The entry of the command, or a null pointer if the name is unknown.
+		 */
+		Factory::Entry const * Factory::find_(boost::string_ref name) const {
+			if (slots_.empty()) return nullptr;
+			std::uint32_t index = slots_[slot_(name, hash_(name))];
+			return index ? &entries_[index - 1] : nullptr;
+		}
+		
+		/// Rebuild the hash table with a new number of slots.
+		/**
+		 * \param size The new number of slots, must be a power of two.
+		 */
+		void Factory::rehash_(std::size_t size) {
+			slots_.assign(size, 0);
+			for (std::size_t i = 0; i < entries_.size(); ++i) {
+				slots_[slot_(entries_[i].name, entries_[i].hash)] = i + 1;
+			}
 		}
 		
 	}
@@ -1,8 +1,12 @@
 #pragma once
+#include <cstdint>
 #include <vector>
-#include <map>
+#include <string>
 #include <functional>
-#include <memory>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "command.hpp"
 
 
 namespace robotutor {
@@ -15,24 +19,45 @@ namespace robotutor {
 		class Command;
 		
 		/// Create a command from a name and an argument list.
+		/**
+		 * Command names are interned when they are registered.
+		 * Lookups go through an open addressing hash table with linear probing,
+		 * so resolving a name never allocates and usually costs a single string compare.
+		 */
 		class Factory {
 			protected:
 				/// Function type for creator functions.
-				typedef std::function<std::shared_ptr<Command> (ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments)> Creator;
+				typedef std::function<Command * (Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments)> Creator;
 				
+				/// A registered command.
 				struct Entry {
+					/// The interned name of the command.
+					std::string name;
+					
+					/// The hash of the name.
+					std::size_t hash;
+					
+					/// The creator function.
 					Creator creator;
+					
+					/// The plugin of the command.
 					Plugin * plugin;
+					
+					/// The step histogram of the command, resolved when the command is registered.
+					Histogram * steps;
 				};
 				
 				/// The script engine to create commands for.
 				ScriptEngine & engine_;
 				
-				/// Map type for the creator map.
-				typedef std::map<std::string, Entry> CreatorMap;
+				/// The registered commands, in order of registration.
+				std::vector<Entry> entries_;
 				
-				/// Map holding creator functions.
-				CreatorMap creators_;
+				/// Hash table holding indices into entries_, offset by one so that zero marks an empty slot.
+				/**
+				 * The size is always a power of two and at least twice the number of entries.
+				 */
+				std::vector<std::uint32_t> slots_;
 				
 			public:
 				/// Construct a command factory.
@@ -43,20 +68,32 @@ namespace robotutor {
 				
 				/// Create a command.
 				/**
+				 * \param script The script that will own the command.
 				 * \param parent The parent command.
+				 * \param name The name of the command.
 				 * \param args The argument list for the command.
+				 * \return The created command.
+				 */
+				Command * create(Script & script, Command * parent, boost::string_ref name, ArgumentList && args);
+				
+				/// Check if a command is registered.
+				/**
+				 * \param name The name of the command.
+				 * \return True if a command with the given name is registered.
 				 */
-				std::shared_ptr<Command> create(Command * parent, std::string const & name, std::vector<std::string> && args);
+				bool has(boost::string_ref name) const {
+					return find_(name) != nullptr;
+				}
 				
 				/// Register a creator.
 				/**
+				 * Registering a name that is already known replaces the old creator.
+				 * 
 				 * \param name The name of the command.
 				 * \param creator The creator function to instantiate the command.
 				 * \param plugin The plugin of the command.
 				 */
-				void add(std::string const & name, Creator creator, Plugin * plugin = nullptr) {
-					creators_[name] = {creator, plugin};
-				}
+				void add(std::string const & name, Creator creator, Plugin * plugin = nullptr);
 				
 				/// Register a command.
 				/**
@@ -66,6 +103,41 @@ namespace robotutor {
 				void add(Plugin * plugin = nullptr) {
 					add(T::static_name(), &T::create, plugin);
 				}
+				
+				/// Remove all registered commands.
+				/**
+				 * The creators may be code of plugins, so this must be done before the plugins are unloaded.
+				 */
+				void clear();
+				
+			protected:
+				/// Hash a command name.
+				/**
+				 * \param name The name to hash.
+				 * \return The hash of the name.
+				 */
+				static std::size_t hash_(boost::string_ref name);
+				
+				/// Find the slot for a name.
+				/**
+				 * \param name The name to look for.
+				 * \param hash The hash of the name.
+				 * \return The slot holding the name, or the empty slot where it should be inserted.
+				 */
+				std::size_t slot_(boost::string_ref name, std::size_t hash) const;
+				
+				/// Find a registered command.
+				/**
+				 * \param name The name of the command.
+				 * \return The entry of the command, or a null pointer if the name is unknown.
+				 */
+				Entry const * find_(boost::string_ref name) const;
+				
+				/// Rebuild the hash table with a new number of slots.
+				/**
+				 * \param size The new number of slots, must be a power of two.
+				 */
+				void rehash_(std::size_t size);
 		};
 	}
 }
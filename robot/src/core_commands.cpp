@@ -2,36 +2,101 @@
 
 #include "core_commands.hpp"
 #include "script_engine.hpp"
-#include "script_parser.hpp"
+#include "script.hpp"
+#include "program.hpp"
+#include "parser_common.hpp"
 
 namespace robotutor {
 	namespace command {
 		
+		namespace {
+			/// Append a number in decimal notation to a string.
+			/**
+			 * \param output The string to append to.
+			 * \param value The number.
+			 */
+			void appendNumber(std::string & output, unsigned int value) {
+				char digits[10];
+				int length = 0;
+				do {
+					digits[length++] = char('0' + value % 10);
+					value /= 10;
+				} while (value);
+				while (length) output.push_back(digits[--length]);
+			}
+		}
+		
 		/// Execute one step.
 		bool Execute::step() {
 			if (next < children.size()) {
-				setNext_(children[next++].get());
+				setNext_(children[next++]);
 				return true;
 			} else {
 				return done_();
 			}
 		}
 		
+		/// Lower the command into a compiled program.
+		/**
+		 * The children are compiled in sequence, so no instructions are needed for the command itself.
+		 * 
+		 * \param compiler The compiler to emit instructions with.
+		 * \return True.
+		 */
+		bool Execute::compile(Compiler & compiler) {
+			for (auto child : children) compiler.compile(child);
+			return true;
+		}
+		
 		/// Write the command to a stream.
 		/**
 		 * \param stream The stream to write to.
 		 */
 		void Speech::write(std::ostream & stream) const {
-			stream << text;
-			for (auto & child : children) stream << "\n" << *child;
+			// Put every embedded command back at its offset, so the output parses to the same command.
+			std::size_t position = 0;
+			for (auto const & mark : marks) {
+				parser::writeText(stream, boost::string_ref(text).substr(position, mark.offset - position));
+				stream << *children[mark.command];
+				position = mark.offset;
+			}
+			parser::writeText(stream, boost::string_ref(text).substr(position));
+		}
+		
+		/// Get the text with TTS bookmarks inserted for the embedded commands.
+		/**
+		 * The markup is generated when first needed and kept until a different base is requested.
+		 * 
+		 * \param base Offset to add to the bookmark numbers.
+		 * \return The text with bookmarks, valid until the next call.
+		 */
+		std::string const & Speech::markup(unsigned int base) const {
+			if (markup_valid_ && markup_base_ == base) return markup_;
+			
+			// Reuse the buffer, so regenerating the markup for another base rarely allocates.
+			markup_.clear();
+			markup_.reserve(text.size() + marks.size() * 16);
+			std::size_t position = 0;
+			for (std::size_t i = 0; i < marks.size(); ++i) {
+				markup_.append(text, position, marks[i].offset - position);
+				markup_ += "\\mrk=";
+				appendNumber(markup_, base + i + 1);
+				markup_ += '\\';
+				position = marks[i].offset;
+			}
+			markup_.append(text, position, std::string::npos);
+			
+			markup_base_  = base;
+			markup_valid_ = true;
+			return markup_;
 		}
 		
 		/// Create the command.
-		SharedPtr Execute::create(ScriptEngine & engine, Command * parent, Plugin *, std::vector<std::string> && arguments) {
-			auto result = std::make_shared<Execute>(engine, parent);
-			for (auto const & argument : arguments) {
-				result->children.push_back(parseScript(engine, argument));
-				result->children.back()->parent = result.get();
+		Command * Execute::create(Script & script, Command * parent, Plugin *, ArgumentList && arguments) {
+			auto result = script.create<Execute>(parent);
+			for (auto & argument : arguments) {
+				result->children.push_back(argument.script());
+				result->children.back()->parent = result;
 			}
 			return result;
 		}
@@ -54,8 +119,9 @@ namespace robotutor {
 				} else {
 					auto on_bookmark = std::bind(&Speech::onBookmark, this, std::placeholders::_1);
 					auto on_done     = std::bind(&Speech::onDone    , this, std::placeholders::_1);
-					engine.speech->say(*this, on_bookmark, on_done);
+					// The engine may already deliver events of a job queued ahead from inside say().
 					synthesized = true;
+					engine.speech->say(*this, on_bookmark, on_done);
 					return false;
 				}
 				
@@ -66,7 +132,7 @@ namespace robotutor {
 			// There are delayed commands to execute.
 			} else if (delayed.size()) {
 				setNext_(delayed.front());
-				delayed.pop_front();
+				delayed.erase(delayed.begin());
 				return true;
 				
 			// This command is totally done, we can go to our parent.
@@ -75,9 +141,27 @@ namespace robotutor {
 			}
 		}
 		
+		/// Lower the command into a compiled program.
+		/**
+		 * Embedded commands are still dispatched by the bookmarks of the sentence.
+		 * 
+		 * \param compiler The compiler to emit instructions with.
+		 * \return True.
+		 */
+		bool Speech::compile(Compiler & compiler) {
+			compiler.emit(Opcode::speak, this);
+			return true;
+		}
+		
 		/// Called when a bookmark is encountered.
+		/**
+		 * Bookmarks that don't belong to an embedded command are ignored.
+		 * 
+		 * \param bookmark The number of the bookmark, starting at 1.
+		 */
 		void Speech::onBookmark(unsigned int bookmark) {
-			setNext_(children[bookmark - 1].get());
+			if (bookmark == 0 || bookmark > marks.size()) return;
+			setNext_(children[marks[bookmark - 1].command]);
 			continue_();
 		}
 		
@@ -87,9 +171,9 @@ namespace robotutor {
 		}
 		
 		/// Create a stop command.
-		SharedPtr Stop::create(ScriptEngine & engine, Command * parent, Plugin *, std::vector<std::string> && arguments) {
+		Command * Stop::create(Script & script, Command * parent, Plugin *, ArgumentList && arguments) {
 			if (arguments.size()) throw std::runtime_error("Command `" + static_name() + "' takes zero arguments.");
-			return std::make_shared<Stop>(engine, parent);
+			return script.create<Stop>(parent);
 		}
 		
 		/// Run the command.
@@ -101,5 +185,15 @@ namespace robotutor {
 			setNext_(parent);
 			return false;
 		}
+		
+		/// Lower the command into a compiled program.
+		/**
+		 * \param compiler The compiler to emit instructions with.
+		 * \return True.
+		 */
+		bool Stop::compile(Compiler & compiler) {
+			compiler.emit(Opcode::stop, this);
+			return true;
+		}
 	}
 }
@@ -1,7 +1,7 @@
 #pragma once
+#include <cstdint>
 #include <string>
-#include <deque>
-#include <memory>
+#include <vector>
 #include <ostream>
 
 #include "command.hpp"
@@ -27,7 +27,7 @@ namespace robotutor {
 				next(0) {}
 			
 			/// Create the command.
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin *, std::vector<std::string> && arguments);
+			static Command * create(Script & script, Command * parent, Plugin *, ArgumentList && arguments);
 			
 			/// The name of the command.
 			static std::string static_name() { return "execute"; }
@@ -40,6 +40,13 @@ namespace robotutor {
 			
 			/// Execute one step.
 			bool step();
+			
+			/// Lower the command into a compiled program.
+			/**
+			 * \param compiler The compiler to emit instructions with.
+			 * \return True.
+			 */
+			bool compile(Compiler & compiler);
 		};
 		
 		/// Text command.
@@ -48,9 +55,24 @@ namespace robotutor {
 		 * the embedded commands are executed when a bookmark is encountered.
 		 */
 		struct Speech : public Command {
-			/// The text to say.
+			/// Position of an embedded command in the text.
+			struct Mark {
+				/// Offset in the text at which the command is triggered.
+				std::uint32_t offset;
+				
+				/// Index of the command in the children.
+				std::uint32_t command;
+			};
+			
+			/// The text to say, without bookmarks.
 			std::string text;
 			
+			/// Embedded commands, sorted by offset.
+			/**
+			 * Bookmark n of the sentence triggers mark n - 1.
+			 */
+			std::vector<Mark> marks;
+			
 			/// Last executed bookmark.
 			unsigned int mark;
 			
@@ -58,7 +80,10 @@ namespace robotutor {
 			bool synthesized;
 			
 			/// Queue for delayed commands.
-			std::deque<Command *> delayed;
+			/**
+			 * Rarely used, so kept as a vector that doesn't allocate while empty.
+			 */
+			std::vector<Command *> delayed;
 			
 			/// Construct a sentence command.
 			Speech(ScriptEngine & engine, Command * parent, std::string const & text = "") :
@@ -73,7 +98,21 @@ namespace robotutor {
 			 */
 			std::string name() const { return "speech"; }
 			
+			/// Get the text with TTS bookmarks inserted for the embedded commands.
+			/**
+			 * The markup is generated when first needed and kept until a different base is requested.
+			 * 
+			 * \param base Offset to add to the bookmark numbers.
+			 * \return The text with bookmarks, valid until the next call.
+			 */
+			std::string const & markup(unsigned int base) const;
+			
 			/// Called when a bookmark is encountered.
+			/**
+			 * Bookmarks that don't belong to an embedded command are ignored.
+			 * 
+			 * \param bookmark The number of the bookmark, starting at 1.
+			 */
 			void onBookmark(unsigned int bookmark);
 			
 			/// Called when the speech engine finished saying us.
@@ -91,6 +130,23 @@ namespace robotutor {
 			 * \param stream The stream to write to.
 			 */
 			void write(std::ostream & stream) const;
+			
+			/// Lower the command into a compiled program.
+			/**
+			 * \param compiler The compiler to emit instructions with.
+			 * \return True.
+			 */
+			bool compile(Compiler & compiler);
+			
+		protected:
+			/// Buffer holding the generated markup.
+			mutable std::string markup_;
+			
+			/// Bookmark base the markup was generated for.
+			mutable unsigned int markup_base_ = 0;
+			
+			/// True if the markup buffer is up to date.
+			mutable bool markup_valid_ = false;
 		};
 		
 		/// Command to stop the program execution.
@@ -101,7 +157,7 @@ namespace robotutor {
 				Command(engine, parent, nullptr) {}
 			
 			/// Create a stop command.
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin *, std::vector<std::string> && arguments);
+			static Command * create(Script & script, Command * parent, Plugin *, ArgumentList && arguments);
 			
 			/// The name of the command.
 			static std::string static_name() { return "stop"; }
@@ -117,6 +173,13 @@ namespace robotutor {
 			 * \param engine The script engine to use for executing the command.
 			 */
 			bool step();
+			
+			/// Lower the command into a compiled program.
+			/**
+			 * \param compiler The compiler to emit instructions with.
+			 * \return True.
+			 */
+			bool compile(Compiler & compiler);
 		};
 	}
 }
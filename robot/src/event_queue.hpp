@@ -0,0 +1,197 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+
+namespace robotutor {
+	
+	/// Bounded lock-free queue to hand events from producer threads to one consumer.
+	/**
+	 * Pushing an event never allocates or locks, so it is safe to do from audio and NAOqi callback threads.
+	 * Any number of threads may push at the same time, they claim slots with a compare-and-swap on the tail.
+	 * When the queue is full, new events are dropped and counted instead of blocking the producer.
+	 * 
+	 * The queue keeps track of whether a drain is pending,
+	 * so producers only have to wake the consumer for the first event of a batch.
+	 * 
+	 * Drains may run on any thread, the queue makes sure they never overlap.
+	 */
+	template<typename T>
+	class EventQueue {
+		protected:
+			/// Space to keep the indices of the producers and consumer on separate cache lines.
+			static std::size_t const cache_line = 64;
+			
+			/// A slot holding one event.
+			struct Slot {
+				/// Index of the push that may write the slot, plus one once the event is written.
+				std::atomic<std::size_t> sequence;
+				
+				/// The event.
+				T event;
+			};
+			
+			/// Storage for the events, the size is a power of two.
+			std::unique_ptr<Slot[]> slots_;
+			
+			/// The number of slots.
+			std::size_t size_;
+			
+			/// Mask to turn an index into a slot.
+			std::size_t mask_;
+			
+			/// True if a drain is pending.
+			std::atomic<bool> scheduled_;
+			
+			/// Number of events dropped because the queue was full.
+			std::atomic<std::size_t> dropped_;
+			
+			char padding0_[cache_line];
+			
+			/// Index of the next event to read, only touched by drains.
+			std::size_t head_ = 0;
+			
+			char padding1_[cache_line];
+			
+			/// Index of the next slot to claim, shared by the producers.
+			std::atomic<std::size_t> tail_;
+			
+			char padding2_[cache_line];
+			
+		public:
+			/// Construct an event queue.
+			/**
+			 * \param capacity The maximum number of queued events, rounded up to a power of two.
+			 */
+			explicit EventQueue(std::size_t capacity) :
+				scheduled_(false),
+				dropped_(0),
+				tail_(0)
+			{
+				size_ = 1;
+				while (size_ < capacity) size_ *= 2;
+				mask_ = size_ - 1;
+				slots_.reset(new Slot[size_]);
+				for (std::size_t i = 0; i < size_; ++i) slots_[i].sequence.store(i, std::memory_order_relaxed);
+			}
+			
+			EventQueue(EventQueue const &)             = delete;
+			EventQueue & operator = (EventQueue const &) = delete;
+			
+			/// Get the maximum number of queued events.
+			std::size_t capacity() const { return size_; }
+			
+			/// Get the number of events dropped because the queue was full.
+			std::size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+			
+			/// Add an event to the queue.
+			/**
+			 * May be called from any thread.
+			 * If the queue is full the event is dropped.
+			 * 
+			 * \param event The event to add.
+			 * \return True if the consumer should be woken up to drain the queue.
+			 */
+			bool push(T const & event) {
+				bool wake = false;
+				tryPush(event, wake);
+				return wake;
+			}
+			
+			/// Add an event to the queue, reporting whether it fit.
+			/**
+			 * May be called from any thread.
+			 * If the queue is full the event is dropped and counted, and no wakeup is requested.
+			 * 
+			 * \param event The event to add.
+			 * \param wake Set to true if the consumer should be woken up to drain the queue.
+			 * \return False if the queue was full.
+			 */
+			bool tryPush(T const & event, bool & wake) {
+				std::size_t tail = tail_.load(std::memory_order_relaxed);
+				Slot * slot;
+				while (true) {
+					slot = &slots_[tail & mask_];
+					std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+					if (sequence == tail) {
+						if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) break;
+					} else if (sequence < tail) {
+						// The slot still holds the event of the previous lap.
+						dropped_.fetch_add(1, std::memory_order_relaxed);
+						wake = false;
+						return false;
+					} else {
+						// Another producer claimed the slot first.
+						tail = tail_.load(std::memory_order_relaxed);
+					}
+				}
+				
+				slot->event = event;
+				slot->sequence.store(tail + 1, std::memory_order_release);
+				wake = this->wake();
+				return true;
+			}
+			
+			/// Request a drain without pushing an event.
+			/**
+			 * For producers that keep state next to the queue that the consumer checks after draining.
+			 * Update the state before calling this, the drain is guaranteed to see it.
+			 * 
+			 * \return True if the consumer should be woken up to drain the queue.
+			 */
+			bool wake() {
+				return !scheduled_.exchange(true, std::memory_order_acq_rel);
+			}
+			
+			/// Take all queued events and pass them to a handler.
+			/**
+			 * Only call in response to a wakeup requested by push() or wake().
+			 * The wakeup stays pending until the drain finds the queue empty,
+			 * so events pushed while draining are handled by the same drain and only one drain runs at a time.
+			 * 
+			 * Events are handled in the order their slots were claimed.
+			 * A slot claimed by a producer that hasn't written it yet ends the drain,
+			 * the producer wakes the consumer again once it is written.
+			 * 
+			 * If the handler throws, the remaining events are handled by the drain for the next pushed event.
+			 * 
+			 * \param handler Function to call with every event.
+			 * \return The number of events handled.
+			 */
+			template<typename Handler>
+			std::size_t drain(Handler && handler) {
+				struct Guard {
+					std::atomic<bool> & scheduled;
+					bool active;
+					~Guard() { if (active) scheduled.store(false, std::memory_order_release); }
+				} guard{scheduled_, true};
+				
+				std::size_t start   = head_;
+				std::size_t handled = 0;
+				while (true) {
+					Slot & slot = slots_[head_ & mask_];
+					if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) {
+						// Release the wakeup, then look again for an event written before the producer saw it released.
+						// Once the wakeup is released another drain may move the head, so count the events first.
+						handled = head_ - start;
+						guard.active = false;
+						scheduled_.exchange(false, std::memory_order_acq_rel);
+						if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) break;
+						
+						// Take the wakeup back, unless a producer already requested a new one.
+						if (scheduled_.exchange(true, std::memory_order_acq_rel)) break;
+						guard.active = true;
+						continue;
+					}
+					
+					T event = slot.event;
+					slot.sequence.store(head_ + size_, std::memory_order_release);
+					++head_;
+					handler(event);
+				}
+				return handled;
+			}
+	};
+	
+}
@@ -0,0 +1,187 @@
+#include <exception>
+#include <iostream>
+
+#include <alcommon/albroker.h>
+
+#include "naoqi_backend.hpp"
+#include "naoqi_tts.hpp"
+
+
+namespace robotutor {
+	
+	/// Construct the backend.
+	/**
+	 * \param broker The broker to communicate with naoqi.
+	 */
+	NaoqiBackend::NaoqiBackend(boost::shared_ptr<AL::ALBroker> broker) :
+		broker_(broker),
+		behavior_manager_(broker),
+		loader_work_(new boost::asio::io_service::work(loader_)),
+		loader_thread_([this] () { loader_.run(); }),
+		playback_work_(new boost::asio::io_service::work(playback_)),
+		playback_thread_([this] () { playback_.run(); }) {}
+	
+	/// Destroy the backend.
+	/**
+	 * Waits for queued sounds to finish playing and for the loader to finish pending loads and unloads.
+	 */
+	NaoqiBackend::~NaoqiBackend() {
+		// Finished sounds unload their file on the loader, so stop the playback thread first.
+		playback_work_.reset();
+		playback_thread_.join();
+		loader_work_.reset();
+		loader_thread_.join();
+	}
+	
+	/// Create a text-to-speech backend using ALTextToSpeech.
+	/**
+	 * \param ios The IO service to use for events.
+	 * \return The text-to-speech backend.
+	 */
+	boost::shared_ptr<TtsBackend> NaoqiBackend::createTts(boost::asio::io_service & ios) {
+		(void) ios;
+		return AL::ALModule::createModule<NaoqiTts>(broker_, "RTISE");
+	}
+	
+	/// Get the names of all installed behaviors.
+	std::vector<std::string> NaoqiBackend::installedBehaviors() {
+		return behavior_manager_.getInstalledBehaviors();
+	}
+	
+	/// Let the behavior manager load a behavior in the background.
+	/**
+	 * \param name The name of the behavior.
+	 */
+	void NaoqiBackend::preloadBehavior(std::string const & name) {
+		behavior_manager_.post.preloadBehavior(name);
+	}
+	
+	/// Run a behavior that has been sent to the clients.
+	/**
+	 * Does nothing, the clients run the behavior and acknowledge it when they are done.
+	 * 
+	 * \param name The name of the behavior.
+	 * \param on_start Callback to invoke when the motion starts.
+	 * \param on_done Callback to invoke when the behavior is done.
+	 */
+	void NaoqiBackend::runBehavior(std::string const & name, StartHandler on_start, DoneHandler on_done) {
+		(void) name;
+		(void) on_start;
+		(void) on_done;
+	}
+	
+	/// Load a sound file in the background.
+	/**
+	 * Errors are reported on the console, playing the file then loads it again.
+	 * 
+	 * \param file The path of the file on the robot.
+	 */
+	void NaoqiBackend::preloadSound(std::string const & file) {
+		AL::ALAudioPlayerProxy & player = player_();
+		std::lock_guard<std::mutex> lock(player_mutex_);
+		Sound & sound = sounds_[file];
+		if (sound.users++) return;
+		
+		auto id  = std::make_shared<std::promise<int>>();
+		sound.id = id->get_future().share();
+		loader_.post([&player, file, id] () {
+			try {
+				id->set_value(player.loadFile(file));
+			} catch (std::exception const & e) {
+				std::cerr << "Failed to load sound `" << file << "': " << e.what() << std::endl;
+				id->set_value(-1);
+			}
+		});
+	}
+	
+	/// Unload a preloaded sound file in the background.
+	/**
+	 * Doesn't wait for the file to be loaded, the loader unloads it after loading it.
+	 * 
+	 * \param file The path of the file on the robot.
+	 */
+	void NaoqiBackend::unloadSound(std::string const & file) {
+		AL::ALAudioPlayerProxy & player = player_();
+		std::shared_future<int> id;
+		{
+			std::lock_guard<std::mutex> lock(player_mutex_);
+			auto sound = sounds_.find(file);
+			if (sound == sounds_.end() || --sound->second.users) return;
+			id = sound->second.id;
+			sounds_.erase(sound);
+		}
+		
+		// The load was posted to the loader first, so the ID is ready by the time this runs.
+		loader_.post([&player, file, id] () {
+			int loaded = id.get();
+			if (loaded < 0) return;
+			try {
+				player.unloadFile(loaded);
+			} catch (std::exception const & e) {
+				std::cerr << "Failed to unload sound `" << file << "': " << e.what() << std::endl;
+			}
+		});
+	}
+	
+	/// Play a sound file.
+	/**
+	 * Preloaded files are played by ID, other files and files that failed to preload are loaded first.
+	 * Returns right away, the sound is played on the playback thread after the sounds queued before it.
+	 * The start handler is invoked from the playback thread right before the sound starts.
+	 * A preloaded file stays loaded until it is done playing.
+	 * 
+	 * \param file The path of the file on the robot.
+	 * \param on_start Callback to invoke when the sound starts playing, may be empty.
+	 */
+	void NaoqiBackend::playSound(std::string const & file, StartHandler on_start) {
+		AL::ALAudioPlayerProxy & player = player_();
+		std::shared_future<int> id;
+		{
+			std::lock_guard<std::mutex> lock(player_mutex_);
+			auto sound = sounds_.find(file);
+			if (sound != sounds_.end()) {
+				++sound->second.users;
+				id = sound->second.id;
+			}
+		}
+		
+		unsigned int generation = sound_generation_;
+		playback_.post([this, &player, file, id, on_start, generation] () {
+			if (generation == sound_generation_) {
+				try {
+					// Waits for the loader if the file is still being preloaded.
+					int preloaded = id.valid() ? id.get() : -1;
+					if (preloaded >= 0) {
+						if (on_start) on_start();
+						player.play(preloaded);
+					} else {
+						int loaded = player.loadFile(file);
+						if (on_start) on_start();
+						player.play(loaded);
+						player.unloadFile(loaded);
+					}
+				} catch (std::exception const & e) {
+					std::cerr << "Failed to play sound `" << file << "': " << e.what() << std::endl;
+				}
+			}
+			if (id.valid()) unloadSound(file);
+		});
+	}
+	
+	/// Stop all playing sounds.
+	/**
+	 * Sounds that are queued but haven't started yet are skipped.
+	 */
+	void NaoqiBackend::stopSounds() {
+		++sound_generation_;
+		player_().stopAll();
+	}
+	
+	/// Get the audio player, creating it if needed.
+	AL::ALAudioPlayerProxy & NaoqiBackend::player_() {
+		std::lock_guard<std::mutex> lock(player_mutex_);
+		if (!audio_player_) audio_player_.reset(new AL::ALAudioPlayerProxy(broker_));
+		return *audio_player_;
+	}
+	
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <atomic>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <boost/asio/io_service.hpp>
+
+#include <alproxies/albehaviormanagerproxy.h>
+#include <alproxies/alaudioplayerproxy.h>
+
+#include "backend.hpp"
+
+namespace robotutor {
+	
+	/// Backend using the naoqi modules of a robot.
+	/**
+	 * Behaviors are run and acknowledged by the clients, so the backend only lists them.
+	 */
+	class NaoqiBackend : public Backend {
+		protected:
+			/// The broker to communicate with naoqi.
+			boost::shared_ptr<AL::ALBroker> broker_;
+			
+			/// Behavior manager to list installed behaviors with.
+			AL::ALBehaviorManagerProxy behavior_manager_;
+			
+			/// Mutex protecting the audio player.
+			std::mutex player_mutex_;
+			
+			/// Audio player, created when the first sound is played.
+			std::unique_ptr<AL::ALAudioPlayerProxy> audio_player_;
+			
+			/// A preloaded sound file.
+			struct Sound {
+				/// The ID from the audio player, available once the file is loaded, or -1 if loading failed.
+				std::shared_future<int> id;
+				
+				/// Number of unmatched preloadSound() calls, and of plays that haven't finished.
+				unsigned int users = 0;
+			};
+			
+			/// Preloaded sound files.
+			std::map<std::string, Sound> sounds_;
+			
+			/// IO service loading and unloading sound files in order, off the strand of the script engine.
+			boost::asio::io_service loader_;
+			
+			/// Keeps the loader running until the backend is destroyed.
+			std::unique_ptr<boost::asio::io_service::work> loader_work_;
+			
+			/// Thread running the loader.
+			std::thread loader_thread_;
+			
+			/// Incremented by stopSounds(), so sounds that haven't started yet are skipped.
+			std::atomic<unsigned int> sound_generation_ { 0 };
+			
+			/// IO service playing sound files one after another, off the strand of the script engine.
+			boost::asio::io_service playback_;
+			
+			/// Keeps the playback thread running until the backend is destroyed.
+			std::unique_ptr<boost::asio::io_service::work> playback_work_;
+			
+			/// Thread playing sound files.
+			std::thread playback_thread_;
+			
+		public:
+			/// Construct the backend.
+			/**
+			 * \param broker The broker to communicate with naoqi.
+			 */
+			explicit NaoqiBackend(boost::shared_ptr<AL::ALBroker> broker);
+			
+			/// Destroy the backend.
+			/**
+			 * Waits for queued sounds to finish playing and for the loader to finish pending loads and unloads.
+			 */
+			~NaoqiBackend();
+			
+			/// Get the broker to communicate with naoqi.
+			boost::shared_ptr<AL::ALBroker> broker() const override { return broker_; }
+			
+			/// Create a text-to-speech backend using ALTextToSpeech.
+			/**
+			 * \param ios The IO service to use for events.
+			 * \return The text-to-speech backend.
+			 */
+			boost::shared_ptr<TtsBackend> createTts(boost::asio::io_service & ios) override;
+			
+			/// Get the names of all installed behaviors.
+			std::vector<std::string> installedBehaviors() override;
+			
+			/// Let the behavior manager load a behavior in the background.
+			/**
+			 * \param name The name of the behavior.
+			 */
+			void preloadBehavior(std::string const & name) override;
+			
+			/// Run a behavior that has been sent to the clients.
+			/**
+			 * Does nothing, the clients run the behavior and acknowledge it when they are done.
+			 * 
+			 * \param name The name of the behavior.
+			 * \param on_start Callback to invoke when the motion starts.
+			 * \param on_done Callback to invoke when the behavior is done.
+			 */
+			void runBehavior(std::string const & name, StartHandler on_start, DoneHandler on_done) override;
+			
+			/// Load a sound file in the background.
+			/**
+			 * Errors are reported on the console, playing the file then loads it again.
+			 * 
+			 * \param file The path of the file on the robot.
+			 */
+			void preloadSound(std::string const & file) override;
+			
+			/// Unload a preloaded sound file in the background.
+			/**
+			 * Doesn't wait for the file to be loaded, the loader unloads it after loading it.
+			 * 
+			 * \param file The path of the file on the robot.
+			 */
+			void unloadSound(std::string const & file) override;
+			
+			/// Play a sound file.
+			/**
+			 * Preloaded files are played by ID, other files and files that failed to preload are loaded first.
+			 * Returns right away, the sound is played on the playback thread after the sounds queued before it.
+			 * The start handler is invoked from the playback thread right before the sound starts.
+			 * A preloaded file stays loaded until it is done playing.
+			 * 
+			 * \param file The path of the file on the robot.
+			 * \param on_start Callback to invoke when the sound starts playing, may be empty.
+			 */
+			void playSound(std::string const & file, StartHandler on_start) override;
+			
+			/// Stop all playing sounds.
+			/**
+			 * Sounds that are queued but haven't started yet are skipped.
+			 */
+			void stopSounds() override;
+			
+		protected:
+			/// Get the audio player, creating it if needed.
+			AL::ALAudioPlayerProxy & player_();
+	};
+	
+}
@@ -0,0 +1,49 @@
+#include <alvalue/alvalue.h>
+#include <alvision/alvisiondefinitions.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "naoqi_camera.hpp"
+
+
+namespace robotutor {
+	
+	/// Construct the source and subscribe to the camera.
+	/**
+	 * \param broker The broker to use.
+	 * \param name The name to subscribe with.
+	 * \param resolution The ALVideoDevice resolution to grab images at.
+	 * \param fps The frame rate to request from the camera.
+	 */
+	NaoqiCamera::NaoqiCamera(boost::shared_ptr<AL::ALBroker> broker, std::string const & name, int resolution, int fps) :
+		camera_(broker)
+	{
+		client_ = camera_.subscribeCamera(name, 0, resolution, AL::kBGRColorSpace, fps);
+	}
+	
+	/// Unsubscribe from the camera.
+	NaoqiCamera::~NaoqiCamera() {
+		camera_.unsubscribe(client_);
+	}
+	
+	/// Grab a frame.
+	/**
+	 * The image is copied out of the ALValue before it is released,
+	 * into the frame of the caller if it already has the right size.
+	 * 
+	 * \param frame The frame to write the image to, in BGR colorspace.
+	 * \return True if an image was grabbed.
+	 */
+	bool NaoqiCamera::grab(cv::Mat & frame) {
+		AL::ALValue image = camera_.getImageRemote(client_);
+		if (!image.isArray() || image.getSize() < 7) return false;
+		
+		int width  = image[0];
+		int height = image[1];
+		cv::Mat(height, width, CV_8UC3, const_cast<void *>(image[6].GetBinary())).copyTo(frame);
+		
+		camera_.releaseImage(client_);
+		return true;
+	}
+	
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include <alproxies/alvideodeviceproxy.h>
+
+#include "camera_source.hpp"
+
+namespace AL {
+	class ALBroker;
+}
+
+namespace robotutor {
+	
+	/// Camera source using ALVideoDevice.
+	/**
+	 * The camera is subscribed for the lifetime of the source,
+	 * so grabbing a frame doesn't have to wait for the camera to start up.
+	 */
+	class NaoqiCamera : public CameraSource {
+		protected:
+			/// Video device proxy to grab images with.
+			AL::ALVideoDeviceProxy camera_;
+			
+			/// Name of the subscription, as returned by ALVideoDevice.
+			std::string client_;
+			
+		public:
+			/// Construct the source and subscribe to the camera.
+			/**
+			 * \param broker The broker to use.
+			 * \param name The name to subscribe with.
+			 * \param resolution The ALVideoDevice resolution to grab images at.
+			 * \param fps The frame rate to request from the camera.
+			 */
+			NaoqiCamera(boost::shared_ptr<AL::ALBroker> broker, std::string const & name, int resolution, int fps);
+			
+			/// Unsubscribe from the camera.
+			virtual ~NaoqiCamera();
+			
+			/// Grab a frame.
+			/**
+			 * \param frame The frame to write the image to, in BGR colorspace.
+			 * \return True if an image was grabbed.
+			 */
+			bool grab(cv::Mat & frame) override;
+	};
+	
+}
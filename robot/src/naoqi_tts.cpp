@@ -0,0 +1,103 @@
+#include <alcommon/albroker.h>
+#include <alproxies/almemoryproxy.h>
+
+#include "naoqi_tts.hpp"
+
+
+namespace robotutor {
+	
+	/// Construct the backend.
+	/**
+	 * \param broker The broker to use.
+	 * \param name The name of the module.
+	 */
+	NaoqiTts::NaoqiTts(boost::shared_ptr<AL::ALBroker> broker, std::string const & name) :
+		AL::ALModule(broker, name)
+	{
+		setModuleDescription("RoboTutor Interrupting Speech Engine");
+		
+		functionName("onBookmark", getName(), "Handle bookmarks.");
+		BIND_METHOD(NaoqiTts::onBookmark);
+		
+		functionName("onStatus", getName(), "Handle job status changes.");
+		BIND_METHOD(NaoqiTts::onStatus);
+	}
+	
+	/// Deconstruct the backend.
+	NaoqiTts::~NaoqiTts() {
+		if (memory_) {
+			memory_->unsubscribeToEvent("ALTextToSpeech/CurrentBookMark", getName());
+			memory_->unsubscribeToEvent("ALTextToSpeech/Status", getName());
+		}
+	}
+	
+	/// Initialize the module.
+	void NaoqiTts::init() {
+		memory_ = getParentBroker()->getMemoryProxy();
+		tts_ = AL::ALTextToSpeechProxy(getParentBroker());
+		tts_.enableNotifications();
+		
+		memory_->subscribeToEvent("ALTextToSpeech/CurrentBookMark", getName(), "onBookmark");
+		memory_->subscribeToEvent("ALTextToSpeech/Status",          getName(), "onStatus");
+	}
+	
+	/// Queue a text to be spoken.
+	/**
+	 * ALTextToSpeech speaks posted texts in order, so a text queued while another one is playing
+	 * starts without waiting for a round trip through the script engine.
+	 * 
+	 * \param text The text, which may contain TTS markup and bookmarks.
+	 * \return The ID of the job.
+	 */
+	int NaoqiTts::say(std::string const & text) {
+		int job = tts_.post.say(text);
+		std::lock_guard<std::mutex> lock(mutex_);
+		// The status event may have beaten us here for very short texts.
+		if (!finished_.erase(job)) jobs_.insert(job);
+		
+		// Anything older is a job of some other module, task IDs only go up.
+		finished_.erase(finished_.begin(), finished_.lower_bound(job));
+		return job;
+	}
+	
+	/// Stop a job, whether it is being spoken or still queued.
+	/**
+	 * \param job The ID of the job.
+	 */
+	void NaoqiTts::stop(int job) {
+		tts_.stop(job);
+	}
+	
+	/// Block until all queued jobs have finished.
+	void NaoqiTts::join() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		condition_.wait(lock, [this] () { return jobs_.empty(); });
+	}
+	
+	/// Called when a bookmark is encountered.
+	void NaoqiTts::onBookmark(std::string const & eventName, int const & value, std::string const & subscriberIndentifier) {
+		if (on_bookmark) on_bookmark(value);
+	}
+	
+	/// Called when the status of a job changes.
+	/**
+	 * ALTextToSpeech reports "enqueued", "started", "thrown", "stopped" and "done".
+	 * The last three all mean the job is finished.
+	 * 
+	 * \param value Pair of the job ID and the new status.
+	 */
+	void NaoqiTts::onStatus(std::string const & eventName, AL::ALValue const & value, std::string const & subscriberIndentifier) {
+		int job            = value[0];
+		std::string status = value[1];
+		if (status != "done" && status != "stopped" && status != "thrown") return;
+		
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!jobs_.erase(job)) finished_.insert(job);
+		}
+		condition_.notify_all();
+		
+		if (on_done) on_done(job);
+	}
+	
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include <alcommon/almodule.h>
+#include <alproxies/altexttospeechproxy.h>
+
+#include "tts_backend.hpp"
+
+namespace AL {
+	class ALBroker;
+	class ALMemoryProxy;
+}
+
+namespace robotutor {
+	
+	/// Text-to-speech backend using ALTextToSpeech.
+	/**
+	 * Bookmarks and job completion are both received through ALMemory events,
+	 * so no thread has to block on the TTS proxy.
+	 */
+	class NaoqiTts : public AL::ALModule, public TtsBackend {
+		protected:
+			/// Memory proxy to receive callbacks.
+			boost::shared_ptr<AL::ALMemoryProxy> memory_;
+			
+			/// TTS proxy to do the actual synthesizing.
+			AL::ALTextToSpeechProxy tts_;
+			
+			/// Mutex protecting the job sets.
+			/**
+			 * Only needed for join(), the event handlers themselves take no lock.
+			 * onStatus() holds it for a few set operations, contending only with say() and join().
+			 */
+			std::mutex mutex_;
+			
+			/// Signalled when a job finished.
+			std::condition_variable condition_;
+			
+			/// Jobs that haven't finished yet.
+			std::set<int> jobs_;
+			
+			/// Jobs that finished before say() returned their ID.
+			std::set<int> finished_;
+			
+		public:
+			/// Construct the backend.
+			/**
+			 * \param broker The broker to use.
+			 * \param name The name of the module.
+			 */
+			NaoqiTts(boost::shared_ptr<AL::ALBroker> broker, std::string const & name);
+			
+			/// Deconstruct the backend.
+			virtual ~NaoqiTts();
+			
+			/// Initialize the module.
+			void init();
+			
+			/// Queue a text to be spoken.
+			/**
+			 * \param text The text, which may contain TTS markup and bookmarks.
+			 * \return The ID of the job.
+			 */
+			int say(std::string const & text);
+			
+			/// Stop a job, whether it is being spoken or still queued.
+			/**
+			 * \param job The ID of the job.
+			 */
+			void stop(int job);
+			
+			/// Block until all queued jobs have finished.
+			void join();
+			
+			/// Called when a bookmark is encountered.
+			void onBookmark(std::string const & eventName, int const & value, std::string const & subscriberIndentifier);
+			
+			/// Called when the status of a job changes.
+			/**
+			 * \param value Pair of the job ID and the new status.
+			 */
+			void onStatus(std::string const & eventName, AL::ALValue const & value, std::string const & subscriberIndentifier);
+	};
+	
+}
@@ -1,3 +1,5 @@
+#include <cstdint>
+
 #include <boost/asio/io_service.hpp>
 
 #include <alcommon/alproxy.h>
@@ -7,23 +9,37 @@
 
 namespace robotutor {
 	
+	static_assert(sizeof(AL_SOUND_FORMAT) == sizeof(std::int16_t), "Sound samples should be 16 bit.");
+	
 	/// Construct a noise detector.
 	NoiseDetector::NoiseDetector(boost::shared_ptr<AL::ALBroker> broker, std::string const & name) :
-		AL::ALSoundExtractor(broker, name)
+		AL::ALSoundExtractor(broker, name),
+		level(16000),
+		events_(64)
 	{
 		setModuleDescription("RoboTutor Noise Detection Module");
-		threshold = 150;
+		level.on_noise = [this] (unsigned int channel, float noise) {
+			if (events_.push({channel, noise})) {
+				ios_->post([this] () {
+					events_.drain([this] (NoiseEvent const & event) {
+						on_noise(event.channel, event.level);
+					});
+				});
+			}
+		};
 	}
 	
-	/// Create a noise detector.
+	/// Create a noise detector and start detection.
 	/**
 	 * \param ios The IO service to use.
 	 * \param broker The broker to use for naoqi communication.
 	 * \param name The name of the module.
+	 * \param channels AL::FRONTCHANNEL or another single channel, or AL::ALLCHANNELS for all four microphones.
 	 */
-	boost::shared_ptr<NoiseDetector> NoiseDetector::create(boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker, std::string const & name) {
+	boost::shared_ptr<NoiseDetector> NoiseDetector::create(boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker, std::string const & name, int channels) {
 		auto result = AL::ALModule::createModule<NoiseDetector>(broker, name);
 		result->ios_ = &ios;
+		result->start(channels);
 		return result;
 	}
 	
@@ -32,34 +48,32 @@ namespace robotutor {
 		stopDetection();
 	}
 	
-	/// Initialize the audio device and start detection.
-	void NoiseDetector::init() {
-		audioDevice->callVoid("setClientPreferences", getName(), 16000, (int)AL::FRONTCHANNEL, 0 );
+	/// Configure the audio device and start detection.
+	/**
+	 * A single channel is recorded at 16000 Hz, all channels are recorded interleaved at 48000 Hz.
+	 * 
+	 * \param channels The channel configuration to request from ALAudioDevice.
+	 */
+	void NoiseDetector::start(int channels) {
+		unsigned int sample_rate = channels == AL::ALLCHANNELS ? 48000 : 16000;
+		level.sampleRate(sample_rate);
+		
+		audioDevice->callVoid("setClientPreferences", getName(), int(sample_rate), channels, 0);
 		startDetection();
 	}
 	
 	/// Process sound data.
 	/**
 	 * This function will be automatically called by the module ALAudioDevice
-	 * every 170ms with the appropriate audio buffer (front channel at 16000Hz).
+	 * every 170ms with the appropriate audio buffer.
 	 * 
 	 * \param channels The number of channels in the buffer.
 	 * \param samples  The number of samples per channel in the buffer.
 	 * \param time     The time when the buffer was created.
 	 */
 	void NoiseDetector::process(const int & channels, const int & samples, const AL_SOUND_FORMAT * buffer, const AL::ALValue & time) {
-		// Compute the maximum value of the front microphone signal.
-		int max = 0;
-		for (int i = 0 ; i < samples; i++) {
-			if (buffer[i] > max) max = buffer[i];
-		}
-		
-		std::cout << max << std::endl;
-		
-		// Emit the signal if the noise level exceeds the threshold.
-		if(max >= threshold) ios_->post([this, max] () {
-			on_noise(max);
-		});
+		level.process(reinterpret_cast<std::int16_t const *>(buffer), samples, channels);
+		deliver_(reinterpret_cast<std::int16_t const *>(buffer), samples, channels);
 	}
 	
 }
@@ -8,6 +8,10 @@
 #include <alcommon/almodule.h>
 #include <alaudio/alsoundextractor.h>
 
+#include "audio_level.hpp"
+#include "audio_source.hpp"
+#include "event_queue.hpp"
+
 
 namespace boost {
 	namespace asio {
@@ -24,20 +28,40 @@ namespace robotutor {
 	
 	/// The noise detector monitors the recorded sound level.
 	/**
-	 * When the noise level exceeds a given threshold, a signal is emitted.
+	 * The level of every recorded channel is tracked by an AudioLevel.
+	 * When a channel gets noisy, a signal is emitted from the IO service,
+	 * at most once per minimum interval of the audio level.
+	 * Noise events are handed from the audio thread to the IO service through a lock-free queue.
+	 * 
+	 * The recorded buffers are passed on to the buffer handler of the audio source.
 	 */
-	class NoiseDetector : public AL::ALSoundExtractor {
+	class NoiseDetector : public AL::ALSoundExtractor, public AudioSource {
 		public:
-			/// The threshold, in DB?
-			int threshold;
+			/// The audio level tracker, which holds the thresholds and smoothing settings.
+			/**
+			 * Only touched from the audio thread after detection started.
+			 */
+			AudioLevel level;
 			
-			/// Signal emitted when the noise level exceeds the threshold.
-			boost::signal<void (int noiseLevel)> on_noise;
+			/// Signal emitted when the noise level of a channel exceeds the threshold.
+			boost::signal<void (unsigned int channel, float level)> on_noise;
 			
 		protected:
+			/// A noise event waiting to be emitted.
+			struct NoiseEvent {
+				/// The channel that got noisy.
+				unsigned int channel;
+				
+				/// The smoothed level of the channel.
+				float level;
+			};
+			
 			/// The IO service to use.
 			boost::asio::io_service * ios_;
 			
+			/// Noise events waiting to be emitted from the IO service.
+			EventQueue<NoiseEvent> events_;
+			
 		public:
 			/// Construct a noise detector.
 			/**
@@ -46,27 +70,42 @@ namespace robotutor {
 			 */
 			NoiseDetector(boost::shared_ptr<AL::ALBroker> broker, std::string const & name);
 			
-			/// Create a noise detector.
+			/// Create a noise detector and start detection.
 			/**
 			 * \param ios The IO service to use.
 			 * \param broker The broker to use for naoqi communication.
 			 * \param name The name of the module.
+			 * \param channels AL::FRONTCHANNEL or another single channel, or AL::ALLCHANNELS for all four microphones.
 			 */
-			static boost::shared_ptr<NoiseDetector> create(boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker, std::string const & name);
+			static boost::shared_ptr<NoiseDetector> create(boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker, std::string const & name, int channels = AL::FRONTCHANNEL);
 			
 			/// Deconstructor.
 			~NoiseDetector();
 			
+			/// Get the sample rate of the buffers.
+			/**
+			 * \return The sample rate in Hz.
+			 */
+			unsigned int sampleRate() const override { return level.sampleRate(); }
+			
+			/// Get the number of noise events dropped because the event queue was full.
+			std::size_t droppedEvents() const { return events_.dropped(); }
+			
 			/// Deleter.
 			void unsubscribe() {stopDetection();}
 			
-			/// Initialize the audio device and start detection.
-			void init();
+			/// Configure the audio device and start detection.
+			/**
+			 * A single channel is recorded at 16000 Hz, all channels are recorded interleaved at 48000 Hz.
+			 * 
+			 * \param channels The channel configuration to request from ALAudioDevice.
+			 */
+			void start(int channels);
 			
 			/// Process sound data.
 			/**
 			 * This function will be automatically called by the module ALAudioDevice
-			 * every 170ms with the appropriate audio buffer (front channel at 16000Hz).
+			 * every 170ms with the appropriate audio buffer.
 			 * \param channels The number of channels in the buffer.
 			 * \param samples  The number of samples per channel in the buffer.
 			 * \param time     The time when the buffer was created.
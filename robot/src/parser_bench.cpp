@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "script_image.hpp"
+#include "script_parser.hpp"
+#include "script_generator.hpp"
+
+
+using namespace robotutor;
+
+namespace {
+	/// Builder that only counts what it reads, including the contents of arguments.
+	struct CountingBuilder : public image::Builder {
+		std::size_t sentences = 0;
+		std::size_t commands  = 0;
+		std::size_t arguments = 0;
+		
+		void speech(boost::string_ref, std::vector<std::uint32_t> const &) override { ++sentences; }
+		
+		void command(boost::string_ref, std::size_t) override { ++commands; }
+		
+		void argument(boost::string_ref, char const * data, std::size_t size) override {
+			++arguments;
+			image::read(data, size, *this);
+		}
+		
+		void frame(std::size_t) override {}
+	};
+	
+	/// Benchmark options.
+	struct Options {
+		unsigned int generated = 500;
+		unsigned int embedded  = 0;
+		unsigned int repeat    = 20;
+		unsigned int depth     = 4096;
+		std::vector<std::string> files;
+	};
+	
+	void help() {
+		std::cout << "Robotutor parser benchmark\n";
+		std::cout << "Usage: robotutor-bench-parser <options> [script-file...]\n";
+		std::cout << "Parses scripts into images and reads the images back, without a script engine, and prints the results as JSON.\n";
+		std::cout << "Options:\n";
+		std::cout << "-h Print this help message.\n";
+		std::cout << "-g <sentences> Sentences in the generated script, 0 to skip it (default 500).\n";
+		std::cout << "-c <commands> Extra commands embedded in every generated sentence (default 0).\n";
+		std::cout << "-r <count> Number of times to parse and read every script, the fastest run is reported (default 20).\n";
+		std::cout << "-d <depth> Deepest nesting of the depth sweep, which doubles the depth from 1, 0 to skip it (default 4096).\n";
+	}
+	
+	/// Parse and read one script a number of times, and write the fastest results as JSON.
+	/**
+	 * \param out The stream to write the results to.
+	 * \param options The benchmark options.
+	 * \param name The name of the script.
+	 * \param text The script.
+	 */
+	void bench(std::ostream & out, Options const & options, std::string const & name, std::string const & text) {
+		double parse_seconds = 0;
+		double read_seconds  = 0;
+		std::string image;
+		CountingBuilder counts;
+		for (unsigned int i = 0; i < options.repeat; ++i) {
+			auto start = std::chrono::steady_clock::now();
+			image = parseScriptImage(text);
+			auto parsed = std::chrono::steady_clock::now();
+			counts = CountingBuilder();
+			image::read(image.data(), image.size(), counts);
+			auto read = std::chrono::steady_clock::now();
+			
+			double parse = std::chrono::duration<double>(parsed - start).count();
+			double load  = std::chrono::duration<double>(read - parsed).count();
+			parse_seconds = i ? std::min(parse_seconds, parse) : parse;
+			read_seconds  = i ? std::min(read_seconds, load) : load;
+		}
+		
+		out << "    {\n";
+		out << "      \"name\": \"" << name << "\",\n";
+		out << "      \"bytes\": " << text.size() << ",\n";
+		out << "      \"image_bytes\": " << image.size() << ",\n";
+		out << "      \"sentences\": " << counts.sentences << ", \"commands\": " << counts.commands << ", \"arguments\": " << counts.arguments << ",\n";
+		out << "      \"parse\": {\"seconds\": " << parse_seconds << ", \"mb_per_second\": " << (parse_seconds > 0 ? text.size() / parse_seconds / 1e6 : 0) << "},\n";
+		out << "      \"read\": {\"seconds\": " << read_seconds << ", \"mb_per_second\": " << (read_seconds > 0 ? image.size() / read_seconds / 1e6 : 0) << "}\n";
+		out << "    }";
+	}
+	
+	/// Parse scripts nested to increasing depths, and write the fastest parse time per byte for every depth as JSON.
+	/**
+	 * \param out The stream to write the results to.
+	 * \param options The benchmark options.
+	 */
+	void benchDepth(std::ostream & out, Options const & options) {
+		std::size_t const size = 1 << 20;
+		bool first = true;
+		for (unsigned int depth = 1; depth <= options.depth; depth *= 2) {
+			std::string text = generateNestedScript(depth, size);
+			double seconds = 0;
+			for (unsigned int i = 0; i < options.repeat; ++i) {
+				auto start = std::chrono::steady_clock::now();
+				std::string image = parseScriptImage(text);
+				double parse = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				seconds = i ? std::min(seconds, parse) : parse;
+			}
+			
+			out << (first ? "\n" : ",\n");
+			out << "    {\"depth\": " << depth << ", \"bytes\": " << text.size() << ", \"ns_per_byte\": " << seconds * 1e9 / text.size() << "}";
+			first = false;
+		}
+	}
+}
+
+int main(int argc, char ** argv) {
+	Options options;
+	
+	int i = 1;
+	while (i < argc && argv[i][0] == '-') {
+		switch (argv[i][1]) {
+			case 'h':
+			case 'H':
+				help();
+				return 1;
+			case 'g':
+			case 'G':
+				options.generated = std::atoi(argv[++i]);
+				break;
+			case 'c':
+			case 'C':
+				options.embedded = std::atoi(argv[++i]);
+				break;
+			case 'r':
+			case 'R':
+				options.repeat = std::max(1, std::atoi(argv[++i]));
+				break;
+			case 'd':
+			case 'D':
+				options.depth = std::atoi(argv[++i]);
+				break;
+		}
+		i++;
+	}
+	for (; i < argc; ++i) options.files.push_back(argv[i]);
+	
+	if (options.files.empty() && !options.generated && !options.depth) {
+		help();
+		return 1;
+	}
+	
+	std::ostringstream out;
+	out << "{\n";
+	out << "  \"scripts\": [\n";
+	
+	bool first = true;
+	try {
+		for (auto const & file : options.files) {
+			std::ifstream stream(file);
+			if (!stream.good()) throw std::runtime_error("Failed to read `" + file + "'.");
+			std::stringstream buffer;
+			buffer << stream.rdbuf();
+			
+			if (!first) out << ",\n";
+			bench(out, options, file, buffer.str());
+			first = false;
+		}
+		
+		if (options.generated) {
+			if (!first) out << ",\n";
+			bench(out, options, "generated", generateScript(options.generated, options.embedded));
+		}
+		
+		out << "\n  ],\n";
+		out << "  \"depth_sweep\": [";
+		benchDepth(out, options);
+	} catch (std::exception const & e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return -1;
+	}
+	
+	out << "\n  ]\n";
+	out << "}\n";
+	std::cout << out.str() << std::flush;
+	return 0;
+}
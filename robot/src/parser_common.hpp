@@ -1,5 +1,8 @@
+#include <ostream>
 #include <string>
 
+#include <boost/utility/string_ref.hpp>
+
 #ifndef ROBOTUTOR_PARSER_COMMON_HPP_
 #define ROBOTUTOR_PARSER_COMMON_HPP_
 
@@ -84,6 +87,23 @@ namespace robotutor {
 			triml(s);
 			trimr(s);
 		}
+		
+		/// Write plain text in script syntax.
+		/**
+		 * Curly brackets and pipe symbols are escaped with a backslash.
+		 * A trailing backslash can't be followed by anything that would turn it into an escape,
+		 * so it gets a space appended.
+		 * 
+		 * \param stream The stream to write to.
+		 * \param text The text to write.
+		 */
+		inline void writeText(std::ostream & stream, boost::string_ref text) {
+			for (char c : text) {
+				if (c == '{' || c == '}' || c == '|') stream << '\\';
+				stream << c;
+			}
+			if (!text.empty() && text.back() == '\\') stream << ' ';
+		}
 	}
 }
 
@@ -0,0 +1,64 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "script_image.hpp"
+#include "script_parser.hpp"
+
+
+namespace {
+	/// Write an image as script text.
+	std::string writeImage(std::string const & image) {
+		std::ostringstream stream;
+		robotutor::image::write(stream, image.data(), image.size());
+		return stream.str();
+	}
+	
+	/// Report a failed check and abort, so the fuzzer keeps the input.
+	void fail(std::string const & message, std::string const & input) {
+		std::cerr << message << "\nInput: " << input << std::endl;
+		std::abort();
+	}
+}
+
+/// Fuzz the script parser and the image format.
+/**
+ * Only needs the parser and the image reader, no script engine or plugins.
+ * Any input the parser accepts has to give a well formed image,
+ * and writing that image as text and parsing it again has to give the same text.
+ * 
+ * \param data The input.
+ * \param size The size of the input.
+ * \return Always 0.
+ */
+extern "C" int LLVMFuzzerTestOneInput(std::uint8_t const * data, std::size_t size) {
+	std::string input(reinterpret_cast<char const *>(data), size);
+	
+	std::string image;
+	try {
+		image = robotutor::parseScriptImage(input);
+	} catch (std::exception const &) {
+		// Rejecting input is fine.
+		return 0;
+	}
+	
+	std::string text;
+	try {
+		text = writeImage(image);
+	} catch (std::exception const & e) {
+		fail(std::string("Parser wrote a malformed image: ") + e.what(), input);
+	}
+	
+	std::string again;
+	try {
+		again = writeImage(robotutor::parseScriptImage(text));
+	} catch (std::exception const & e) {
+		fail(std::string("Written script doesn't parse: ") + e.what() + "\nWritten: " + text, input);
+	}
+	
+	if (again != text) fail("Written script doesn't round trip.\nWritten: " + text + "\nAgain:   " + again, input);
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <boost/random/mersenne_twister.hpp>
+
+
+extern "C" int LLVMFuzzerTestOneInput(std::uint8_t const * data, std::size_t size);
+
+void help() {
+	std::cout << "Robotutor parser fuzz driver\n";
+	std::cout << "Usage: robotutor-fuzz-parser <options> [input-file...]\n";
+	std::cout << "Runs the parser fuzz target on the input files and on random inputs.\n";
+	std::cout << "Options:\n";
+	std::cout << "-h Print this help message.\n";
+	std::cout << "-n <count> Number of random inputs to run (default 10000).\n";
+	std::cout << "-s <seed> Seed for the random inputs (default 1).\n";
+}
+
+/// Generate a random input.
+/**
+ * The input is mostly made of characters that mean something to the parser,
+ * so most inputs reach deep into it.
+ * 
+ * \param random The random number generator.
+ * \return The input.
+ */
+std::string randomInput(boost::random::mt19937 & random) {
+	static char const alphabet[] = "{}{}||\\\\#\n .!?;ab cd";
+	std::string input;
+	std::size_t length = random() % 64;
+	for (std::size_t i = 0; i < length; ++i) {
+		if (random() % 16 == 0) {
+			input.push_back(char(random() % 256));
+		} else {
+			input.push_back(alphabet[random() % (sizeof(alphabet) - 1)]);
+		}
+	}
+	return input;
+}
+
+/// Run the parser fuzz target without libFuzzer.
+/**
+ * Runs the target on the given files and on a number of random inputs.
+ * Build the target with -fsanitize=fuzzer and without this driver to fuzz it for real.
+ */
+int main(int argc, char ** argv) {
+	unsigned long count = 10000;
+	unsigned long seed  = 1;
+	
+	int i = 1;
+	while (i < argc && argv[i][0] == '-') {
+		switch (argv[i][1]) {
+			case 'h':
+			case 'H':
+				help();
+				return 1;
+			case 'n':
+			case 'N':
+				count = std::strtoul(argv[++i], nullptr, 10);
+				break;
+			case 's':
+			case 'S':
+				seed = std::strtoul(argv[++i], nullptr, 10);
+				break;
+		}
+		i++;
+	}
+	
+	for (; i < argc; ++i) {
+		std::ifstream stream(argv[i], std::ios::binary);
+		if (!stream.good()) {
+			std::cerr << "Failed to read `" << argv[i] << "'." << std::endl;
+			return -1;
+		}
+		std::stringstream buffer;
+		buffer << stream.rdbuf();
+		std::string input = buffer.str();
+		LLVMFuzzerTestOneInput(reinterpret_cast<std::uint8_t const *>(input.data()), input.size());
+	}
+	
+	boost::random::mt19937 random(seed);
+	for (unsigned long n = 0; n < count; ++n) {
+		std::string input = randomInput(random);
+		LLVMFuzzerTestOneInput(reinterpret_cast<std::uint8_t const *>(input.data()), input.size());
+	}
+	
+	std::cout << "Ran " << count << " random inputs." << std::endl;
+	return 0;
+}
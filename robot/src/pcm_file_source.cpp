@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "pcm_file_source.hpp"
+
+
+namespace robotutor {
+	
+	/// Load a PCM file and start replaying it.
+	/**
+	 * \param path The path of the file.
+	 * \param sample_rate The sample rate of the file, in Hz.
+	 * \param channels The number of channels in the file.
+	 * \param buffer The duration of one buffer.
+	 */
+	PcmFileSource::PcmFileSource(std::string const & path, unsigned int sample_rate, unsigned int channels, std::chrono::milliseconds buffer) :
+		sample_rate_(sample_rate),
+		channels_(channels),
+		buffer_frames_(std::max<std::size_t>(1, sample_rate * buffer.count() / 1000))
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file.good()) throw std::runtime_error("Failed to open PCM file `" + path + "'.");
+		
+		std::vector<char> bytes{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+		std::size_t frames = bytes.size() / 2 / channels_;
+		if (!frames) throw std::runtime_error("PCM file `" + path + "' holds no samples.");
+		
+		samples_.resize(frames * channels_);
+		for (std::size_t i = 0; i < samples_.size(); ++i) {
+			samples_[i] = std::int16_t(std::uint8_t(bytes[2 * i]) | std::uint8_t(bytes[2 * i + 1]) << 8);
+		}
+		
+		thread_ = std::thread(&PcmFileSource::run_, this);
+	}
+	
+	/// Stop the replay.
+	PcmFileSource::~PcmFileSource() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopped_ = true;
+		}
+		condition_.notify_all();
+		if (thread_.joinable()) thread_.join();
+	}
+	
+	/// Replay the file until the source is stopped.
+	/**
+	 * A buffer that would run past the end of the file is cut short,
+	 * the next buffer starts at the beginning again.
+	 */
+	void PcmFileSource::run_() {
+		std::size_t const frames   = samples_.size() / channels_;
+		std::size_t position       = 0;
+		auto deadline              = std::chrono::steady_clock::now();
+		
+		while (true) {
+			std::size_t count = std::min(buffer_frames_, frames - position);
+			deadline += std::chrono::microseconds(count * 1000000 / sample_rate_);
+			
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				if (condition_.wait_until(lock, deadline, [this] () { return stopped_; })) return;
+			}
+			
+			deliver_(samples_.data() + position * channels_, count, channels_);
+			position = (position + count) % frames;
+		}
+	}
+	
+}
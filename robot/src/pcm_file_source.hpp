@@ -0,0 +1,70 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_source.hpp"
+
+namespace robotutor {
+	
+	/// Audio source that replays a recorded PCM file in real time.
+	/**
+	 * The file holds raw interleaved 16 bit little endian samples, without any header.
+	 * It is replayed from a background thread in buffers of fixed duration,
+	 * paced by the clock so the replay doesn't drift, and starts over when it reaches the end.
+	 */
+	class PcmFileSource : public AudioSource {
+		protected:
+			/// The samples of the file.
+			std::vector<std::int16_t> samples_;
+			
+			/// The sample rate of the file.
+			unsigned int sample_rate_;
+			
+			/// The number of channels in the file.
+			unsigned int channels_;
+			
+			/// The number of samples per channel in one buffer.
+			std::size_t buffer_frames_;
+			
+			/// Mutex protecting the stopped flag.
+			std::mutex mutex_;
+			
+			/// Signalled when the source is stopped.
+			std::condition_variable condition_;
+			
+			/// True if the source is stopping.
+			bool stopped_ = false;
+			
+			/// The replay thread.
+			std::thread thread_;
+			
+		public:
+			/// Load a PCM file and start replaying it.
+			/**
+			 * \param path The path of the file.
+			 * \param sample_rate The sample rate of the file, in Hz.
+			 * \param channels The number of channels in the file.
+			 * \param buffer The duration of one buffer.
+			 */
+			PcmFileSource(std::string const & path, unsigned int sample_rate, unsigned int channels, std::chrono::milliseconds buffer = std::chrono::milliseconds(170));
+			
+			/// Stop the replay.
+			~PcmFileSource();
+			
+			/// Get the sample rate of the buffers.
+			/**
+			 * \return The sample rate in Hz.
+			 */
+			unsigned int sampleRate() const override { return sample_rate_; }
+			
+		protected:
+			/// Replay the file until the source is stopped.
+			void run_();
+	};
+	
+}
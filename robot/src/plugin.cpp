@@ -7,15 +7,13 @@ extern "C" {
 namespace robotutor {
 	
 	/// Descontruct a plugin.
-	/**
-	 * Closes the handle using dlclose().
-	 */
-	Plugin::~Plugin() {
-		if (handle_) dlclose(handle_);
-	}
+	Plugin::~Plugin() {}
 	
 	/// Create a plugin from a file.
 	/**
+	 * The returned pointer closes the file using dlclose() after deleting the plugin,
+	 * since the destructor of the plugin is code from the file.
+	 * 
 	 * \param file The file containing the plugin.
 	 * \param engine The script engine the plugin is for.
 	 */
@@ -24,10 +22,11 @@ namespace robotutor {
 		if (handle) {
 			auto create_plugin = reinterpret_cast<createPlugin>(dlsym(handle, "createPlugin"));
 			if (create_plugin) {
-				std::shared_ptr<Plugin> plugin(create_plugin(engine));
-				if (plugin) {
-					plugin->handle_ = handle;
-					return plugin;
+				if (Plugin * plugin = create_plugin(engine)) {
+					return std::shared_ptr<Plugin>(plugin, [handle] (Plugin * plugin) {
+						delete plugin;
+						dlclose(handle);
+					});
 				}
 			}
 			dlclose(handle);
@@ -19,10 +19,6 @@ namespace robotutor {
 		/// Signature of function that must be exported by plugins.
 		typedef Plugin * (*createPlugin) (ScriptEngine & engine);
 		
-		private:
-			/// The handle returned by dlopen.
-			void * handle_ = nullptr;
-			
 		public:
 			/// The script engine.
 			ScriptEngine & engine;
@@ -38,13 +34,13 @@ namespace robotutor {
 			Plugin & operator=(Plugin const &) = delete;
 			
 			/// Descontruct a plugin.
-			/**
-			 * Closes the handle using dlclose().
-			 */
 			virtual ~Plugin();
 			
 			/// Create a plugin from a file.
 			/**
+			 * The returned pointer closes the file using dlclose() after deleting the plugin,
+			 * since the destructor of the plugin is code from the file.
+			 * 
 			 * \param file The file containing the plugin.
 			 * \param engine The script engine the plugin is for.
 			 */
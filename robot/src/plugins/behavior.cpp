@@ -1,3 +1,4 @@
+#include <iostream>
 #include <string>
 #include <stdexcept>
 #include <memory>
@@ -5,6 +6,7 @@
 
 #include "../plugin.hpp"
 #include "../command.hpp"
+#include "../script.hpp"
 #include "../script_engine.hpp"
 
 namespace robotutor {
@@ -19,15 +21,24 @@ namespace robotutor {
 				Command(engine, parent, plugin),
 				behavior(behavior) {}
 			
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() != 1) throw std::runtime_error("Command `" + static_name() + "' expects 1 argument.");
-				return std::make_shared<Behavior>(engine, parent, plugin, arguments[0]);
+				return script.create<Behavior>(parent, plugin, arguments[0].text);
 			}
 			
 			static std::string static_name() { return "behavior"; }
 			
 			std::string name() const { return static_name(); }
 			
+			bool prefetch() {
+				if (!engine.behavior.catalog().contains(behavior)) {
+					std::cerr << "Behavior `" << behavior << "' is not installed." << std::endl;
+				} else {
+					engine.backend->preloadBehavior(behavior);
+				}
+				return false;
+			}
+			
 			bool step() {
 				engine.behavior.enqueue(behavior);
 				return done_();
@@ -43,9 +54,9 @@ namespace robotutor {
 				Command(engine, parent, plugin),
 				prefix(prefix) {}
 			
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() != 1) throw std::runtime_error("Command `" + static_name() + "' expects 1 argument.");
-				return std::make_shared<Behavior>(engine, parent, plugin, arguments[0]);
+				return script.create<RandomBehavior>(parent, plugin, arguments[0].text);
 			}
 			
 			static std::string static_name() { return "random behavior"; }
@@ -1,18 +1,75 @@
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
 
 #include "../plugin.hpp"
 #include "../script_engine.hpp"
 #include "../robotutor_protocol.hpp"
-#include "../script_parser.hpp"
+#include "../script_cache.hpp"
+#include "../script_loader.hpp"
 
 namespace robotutor {
 	
 	/// Plugin to react to control 
 	struct ControlPlugin : public Plugin {
+		/// Number of threads parsing scripts.
+		static unsigned int const parse_workers = 2;
+		
+		/// Cache of parsed scripts.
+		ScriptCache cache;
+		
+		/// IO service for the threads parsing scripts.
+		/**
+		 * Scripts are parsed away from the main IO service,
+		 * so parsing a large script doesn't stall network and speech events.
+		 */
+		boost::asio::io_service parse_ios;
+		
+		/// Keeps the parse threads running while there is nothing to parse.
+		std::unique_ptr<boost::asio::io_service::work> parse_work;
+		
+		/// Threads parsing scripts.
+		std::vector<std::thread> parse_threads;
+		
+		/// Number of the most recent script request.
+		/**
+		 * A parse still in flight is cancelled as soon as a newer request comes in.
+		 */
+		std::atomic<unsigned int> generation { 0 };
+		
+		/// True while the engine is stopping.
+		/**
+		 * Only used on the strand of the engine.
+		 */
+		bool stopping = false;
+		
+		/// Functions to run on the strand of the engine once it stopped, in order.
+		std::vector<std::function<void ()>> after_stop;
+		
 		ControlPlugin(ScriptEngine & engine) :
-			Plugin(engine) {}
+			Plugin(engine),
+			cache(engine.cache_directory),
+			parse_work(new boost::asio::io_service::work(parse_ios))
+		{
+			for (unsigned int i = 0; i < parse_workers; ++i) {
+				parse_threads.emplace_back([this] () { parse_ios.run(); });
+			}
+		}
+		
+		~ControlPlugin() {
+			++generation;
+			parse_work.reset();
+			parse_ios.stop();
+			for (auto & thread : parse_threads) thread.join();
+		}
 		
 		/// Process server messages.
 		/**
@@ -25,62 +82,209 @@ namespace robotutor {
 		}
 		
 		/// Handle script messages.
+		/**
+		 * The script is parsed by a parse thread, and loaded and run on the strand of the engine when done.
+		 */
 		void handleScriptMessage(SharedServerConnection connection, ClientMessage const & message) {
-			if (message.has_run()) {
-				std::shared_ptr<command::Command> script;
-				
-				// Check if there is a script to parse.
-				try {
-					if (message.run().has_script()) {
-						script = parseScript(engine, message.run().script());
-					} else if (message.run().has_file()) {
-						std::ifstream stream(message.run().file());
-						if (!stream.good()) throw std::runtime_error("Failed to open file `" + message.run().file() + "'.");
-						script =  parseScript(engine, stream);
-					}
-				} catch (std::exception const & e) {
-					std::cout << "Error parsing script: " << e.what() << std::endl;
-				}
-				
-				// Run the parsed script.
-				if (script) {
-					std::cout << "Script parsed." << std::endl;
-					std::cout << *script << std::endl;
-					// If the engine is busy, stop it and wait for everything to finish before running the new script.
-					if (engine.started()) {
-						engine.stop();
-						engine.join();
-						engine.ios().post([this, script] () {
-							engine.load(script);
-							engine.start();
-						});
-						
-					// If the engine wasn't busy, just run the script.
-					} else {
-						engine.load(script);
-						engine.start();
-					}
-				}
+			if (message.has_run() && (message.run().has_script() || message.run().has_file())) {
+				unsigned int id = ++generation;
+				Run run = message.run();
+				parse_ios.post([this, connection, run, id] () {
+					parseScript_(connection, run, id);
+				});
 			}
 		}
 		
 		/// Handle control messages.
 		void handleControlMessage(SharedServerConnection connection, ClientMessage const & message) {
 			if (message.has_stop()) {
-				engine.stop();
-				engine.join();
-				engine.load(nullptr);
+				++generation;
+				stopEngine_([this] () { engine.load(nullptr); });
 			} else if (message.has_pause()) {
-				engine.stop();
-				engine.join();
+				stopEngine_();
 			} else if (message.has_resume()) {
-				engine.start();
+				afterStop_([this] () { engine.start(); });
 			} else if (message.has_behaviorcmd()) {
-				std::cout << "We received from Junchao: " << message.behaviorcmd().succes() << std::endl;
-				engine.behavior_done = true;
+				BehaviorCommand const & behavior = message.behaviorcmd();
+				engine.behavior.acknowledge(behavior.has_id() ? behavior.id() : 0);
+			} else if (message.has_stats()) {
+				sendStats_(connection, message.stats().reset());
+			}
+		}
+		
+	protected:
+		/// Parse a script into an image.
+		/**
+		 * Runs on a parse thread.
+		 * Only the image is produced here, the commands are created on the strand of the engine,
+		 * since the command creators of plugins may touch engine state.
+		 * 
+		 * \param connection The connection that requested the script.
+		 * \param run The run request.
+		 * \param id The number of the request.
+		 */
+		void parseScript_(SharedServerConnection connection, Run const & run, unsigned int id) {
+			ScriptCache::Image image;
+			
+			try {
+				std::string text;
+				if (run.has_script()) {
+					text = run.script();
+				} else {
+					std::ifstream stream(run.file());
+					if (!stream.good()) throw std::runtime_error("Failed to open file `" + run.file() + "'.");
+					std::stringstream buffer;
+					buffer << stream.rdbuf();
+					text = buffer.str();
+				}
+				
+				// Report progress in steps of ten percent, and give up when a newer request came in.
+				unsigned int reported = 0;
+				image = cache.image(text, [&] (std::size_t parsed, std::size_t total) {
+					if (generation != id) return false;
+					unsigned int percent = parsed * 100 / total;
+					if (percent >= reported + 10) {
+						reported = percent;
+						sendStatus_(connection, ScriptStatus::PARSING, percent);
+					}
+					return true;
+				});
+				
+			} catch (std::exception const & e) {
+				std::cout << "Error parsing script: " << e.what() << std::endl;
+				sendStatus_(connection, ScriptStatus::FAILED, 0, e.what());
+				return;
+			}
+			
+			if (!image.owner || generation != id) {
+				sendStatus_(connection, ScriptStatus::CANCELLED);
+				return;
+			}
+			
+			std::cout << "Script parsed." << std::endl;
+			
+			engine.strand().post([this, connection, image, id] () {
+				runScript_(connection, image, id);
+			});
+		}
+		
+		/// Load and run a parsed script.
+		/**
+		 * Runs on the strand of the engine.
+		 * 
+		 * \param connection The connection that requested the script.
+		 * \param image The image of the parsed script.
+		 * \param id The number of the request.
+		 */
+		void runScript_(SharedServerConnection connection, ScriptCache::Image const & image, unsigned int id) {
+			// A newer request came in while the script was being handed over.
+			if (generation != id) {
+				sendStatus_(connection, ScriptStatus::CANCELLED);
+				return;
+			}
+			
+			command::ScriptPtr script;
+			try {
+				script = loadScriptImage(engine, image.data, image.size);
+			} catch (std::exception const & e) {
+				std::cout << "Error loading script: " << e.what() << std::endl;
+				sendStatus_(connection, ScriptStatus::FAILED, 0, e.what());
+				return;
+			}
+			if (engine.verbose) std::cout << *script << std::endl;
+			
+			sendStatus_(connection, ScriptStatus::LOADED, 100);
+			
+			// Behaviors may have been installed since the last script, fetch them again when they are needed.
+			engine.behavior.catalog().invalidate();
+			
+			// If the engine is busy, stop it and let everything finish before running the new script.
+			auto run = [this, script] () {
+				engine.load(script);
+				engine.start();
+			};
+			if (engine.started()) {
+				stopEngine_(run);
+				
+			// If the engine wasn't busy, just run the script.
+			} else {
+				afterStop_(run);
+			}
+		}
+		
+		/// Stop the engine without blocking its strand.
+		/**
+		 * Runs on the strand of the engine.
+		 * Waiting for the engine to stop could deadlock the strand,
+		 * since the speech and behavior engines may need it to finish.
+		 * 
+		 * \param then Function to run on the strand once the engine stopped, or a null function.
+		 */
+		void stopEngine_(std::function<void ()> then = nullptr) {
+			if (then) after_stop.push_back(then);
+			if (stopping) return;
+			
+			stopping = true;
+			engine.stop([this] () {
+				stopping = false;
+				std::vector<std::function<void ()>> functions;
+				functions.swap(after_stop);
+				for (auto & function : functions) function();
+			});
+		}
+		
+		/// Run a function once the engine stopped.
+		/**
+		 * Runs on the strand of the engine.
+		 * The function runs right away if the engine isn't stopping,
+		 * otherwise after everything that was already waiting for the engine to stop.
+		 * 
+		 * \param function The function to run.
+		 */
+		void afterStop_(std::function<void ()> function) {
+			if (stopping) {
+				after_stop.push_back(function);
+			} else {
+				function();
 			}
 		}
 		
+		/// Send the engine statistics to a client.
+		/**
+		 * \param connection The connection to send the statistics to.
+		 * \param reset If true, the statistics are reset after taking the snapshot.
+		 */
+		void sendStats_(SharedServerConnection connection, bool reset) {
+			RobotMessage message;
+			engine.stats.visit([&message] (std::string const & name, Histogram const & histogram) {
+				HistogramReport & report = *message.mutable_stats()->add_histograms();
+				report.set_name(name);
+				report.set_count(histogram.count());
+				report.set_sum(histogram.sum());
+				report.set_max(histogram.max());
+				for (unsigned int i = 0; i < Histogram::buckets; ++i) report.add_buckets(histogram.bucket(i));
+			});
+			if (reset) engine.stats.reset();
+			connection->sendMessage(message);
+		}
+		
+		/// Send the status of a script request to a client.
+		/**
+		 * Can be called from any thread, the connection serializes the write itself.
+		 * 
+		 * \param connection The connection to send the status to.
+		 * \param state The state of the request.
+		 * \param progress The parse progress in percent.
+		 * \param error The error message for a failed request.
+		 */
+		void sendStatus_(SharedServerConnection connection, ScriptStatus::State state, unsigned int progress = 0, std::string const & error = "") {
+			RobotMessage message;
+			message.mutable_scriptstatus()->set_state(state);
+			message.mutable_scriptstatus()->set_progress(progress);
+			if (!error.empty()) message.mutable_scriptstatus()->set_error(error);
+			connection->sendMessage(message);
+		}
+		
 	};
 	
 	/// Register the plugin with a script engine.
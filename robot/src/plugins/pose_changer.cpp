@@ -12,6 +12,7 @@
 #include <boost/random/uniform_int_distribution.hpp>
 
 #include "../command.hpp"
+#include "../script.hpp"
 #include "../plugin.hpp"
 #include "../script_engine.hpp"
 
@@ -76,7 +77,7 @@ namespace robotutor {
 				boost::random::uniform_int_distribution<unsigned int> distribution(min, max);
 				unsigned int timeout = distribution(engine_.random);
 				timer_.expires_from_now(boost::posix_time::milliseconds(timeout));
-				timer_.async_wait(std::bind(&PoseChanger::handleTimeout_, this, std::placeholders::_1));
+				timer_.async_wait(engine_.strand().wrap(std::bind(&PoseChanger::handleTimeout_, this, std::placeholders::_1)));
 			}
 			
 			/// Handle a timeout.
@@ -111,9 +112,9 @@ namespace robotutor {
 			EnablePoseChanger(ScriptEngine & engine, Command * parent, Plugin * plugin) :
 				Command(engine, parent, plugin) {}
 			
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() != 0) throw std::runtime_error("Command `" + static_name() + "' expects 0 arguments.");
-				return std::make_shared<EnablePoseChanger>(engine, parent, plugin);
+				return script.create<EnablePoseChanger>(parent, plugin);
 			}
 			
 			static std::string static_name() { return "enable pose changer"; }
@@ -131,9 +132,9 @@ namespace robotutor {
 			DisablePoseChanger(ScriptEngine & engine, Command * parent, Plugin * plugin) :
 				Command(engine, parent, plugin) {}
 			
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() != 0) throw std::runtime_error("Command `" + static_name() + "' expects 0 arguments.");
-				return std::make_shared<DisablePoseChanger>(engine, parent, plugin);
+				return script.create<DisablePoseChanger>(parent, plugin);
 			}
 			
 			static std::string static_name() { return "disable pose changer"; }
@@ -154,9 +155,9 @@ namespace robotutor {
 				Command(engine, parent, plugin),
 				prefix(prefix) {}
 			
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() != 1) throw std::runtime_error("Command `" + static_name() + "' expects 1 arguments.");
-				return std::make_shared<PoseChangerPrefix>(engine, parent, plugin, arguments[0]);
+				return script.create<PoseChangerPrefix>(parent, plugin, arguments[0].text);
 			}
 			
 			static std::string static_name() { return "pose prefix"; }
@@ -1,17 +1,24 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
 #include <utility>
 #include <memory>
+#include <vector>
 
-#include <alproxies/alvideodeviceproxy.h>
-#include <alvision/alimage.h>
 #include <alvision/alvisiondefinitions.h>
 
-#include <opencv2/core/core.hpp>
-#include <opencv2/highgui/highgui.hpp>
-
 #include "../plugin.hpp"
 #include "../command.hpp"
+#include "../script.hpp"
 #include "../script_engine.hpp"
 #include "../parser_common.hpp"
+#include "../camera_service.hpp"
+#include "../naoqi_camera.hpp"
+#include "../simulated_camera.hpp"
 
 namespace robotutor {
 	
@@ -47,28 +54,21 @@ namespace robotutor {
 			return result;
 		}
 		
-		/// Grab an image from the NAO camera.
+		/// Create the camera source for the presentation plugin.
 		/**
-		 * The image is saved to "/var/www/capture.jpg".
-		 * \param broker The broker to communicate with naoqi.
+		 * Without a connection to naoqi, a simulated camera is used.
+		 * 
+		 * \param broker The broker to communicate with naoqi, may be null.
+		 * \return The camera source.
 		 */
-		void grabImage(boost::shared_ptr<AL::ALBroker> broker) {
-			
-			// The camera proxy.
-			AL::ALVideoDeviceProxy camera_proxy(broker);
-			
-			// Subscribe a client image requiring 320*240 and BGR colorspace.
-			const std::string client_name = camera_proxy.subscribeCamera("RoboTutorCamera", 0, AL::k4VGA, AL::kBGRColorSpace, 5);
-			cv::Mat image                 = cv::Mat(cv::Size(1280, 960), CV_8UC3);
-			AL::ALValue al_image          = camera_proxy.getImageRemote(client_name);
-			image.data                    = (uchar*) al_image[6].GetBinary();
-			
-			camera_proxy.releaseImage(client_name);
-			cv::imwrite("/var/www/capture.jpg", image);
-			camera_proxy.unsubscribe(client_name);
+		std::unique_ptr<CameraSource> createCameraSource(boost::shared_ptr<AL::ALBroker> broker) {
+			if (broker) return std::unique_ptr<CameraSource>(new NaoqiCamera(broker, "RoboTutorCamera", AL::k4VGA, 5));
+			return std::unique_ptr<CameraSource>(new SimulatedCamera(1280, 960));
 		}
 	}
 	
+	struct PresentationPlugin;
+	
 	namespace command {
 		
 		/// Command to go to a different slide.
@@ -90,12 +90,12 @@ namespace robotutor {
 			
 			std::string name() const { return static_name(); }
 			
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() == 0) {
-					return std::make_shared<Slide>(engine, parent, plugin, 1, true);
+					return script.create<Slide>(parent, plugin, 1, true);
 				} else if (arguments.size() == 1) {
-					std::pair<int, bool> offset = parseOffset(arguments[0]);
-					return std::make_shared<Slide>(engine, parent, plugin, offset.first, offset.second);
+					std::pair<int, bool> offset = parseOffset(arguments[0].text);
+					return script.create<Slide>(parent, plugin, offset.first, offset.second);
 				} else {
 					throw std::runtime_error("Command `" + static_name() + "' expects 0 or 1 arguments.");
 				}
@@ -112,7 +112,11 @@ namespace robotutor {
 		};
 		
 		
+		/// Command to show a camera image on the clients.
 		struct ShowImage : public Command {
+			/// True if the image capture has been requested.
+			bool requested = false;
+			
 			/// Construct a show image command.
 			/**
 			 * \param parent The parent command.
@@ -121,9 +125,9 @@ namespace robotutor {
 			ShowImage(ScriptEngine & engine, Command * parent, Plugin * plugin) :
 				Command(engine, parent, plugin) {}
 			
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() == 0) {
-					return std::make_shared<ShowImage>(engine, parent, plugin);
+					return script.create<ShowImage>(parent, plugin);
 				} else {
 					throw std::runtime_error("Command `" + static_name() + "' expects 0 arguments.");
 				}
@@ -133,25 +137,178 @@ namespace robotutor {
 			
 			std::string name() const { return static_name(); }
 			
-			bool step() {
-				grabImage(engine.broker);
-				
-				RobotMessage msg;
-				msg.mutable_show_image();
-				engine.server.sendMessage(msg);
-				
-				return done_();
-			}
+			bool step();
 		};
 	}
 	
 	struct PresentationPlugin : public Plugin {
-		PresentationPlugin(ScriptEngine & engine) : Plugin(engine) {
+		/// Maximum size of the image data in one message.
+		static std::size_t const chunk_size = 32 * 1024;
+		
+		/// Path the image in the default format is also written to.
+		/**
+		 * Clients that don't understand image chunks download the image from the web server of the robot.
+		 */
+		static char const * fallback_path() { return "/var/www/capture.jpg"; }
+		
+		/// Camera service capturing images for the show image command.
+		CameraService camera;
+		
+		/// Image formats requested by the clients.
+		/**
+		 * Only used on the strand of the engine.
+		 * Clients that didn't request a format get the default format.
+		 */
+		std::map<std::weak_ptr<ServerConnection>, ImageFormat, std::owner_less<std::weak_ptr<ServerConnection>>> formats;
+		
+		/// ID of the last image sent to the clients.
+		std::atomic<unsigned int> last_image { 0 };
+		
+		PresentationPlugin(ScriptEngine & engine) :
+			Plugin(engine),
+			camera(createCameraSource(engine.broker))
+		{
 			engine.factory.add<command::Slide>(this);
 			engine.factory.add<command::ShowImage>(this);
 		}
+		
+		/// Handle image settings from clients.
+		/**
+		 * \param connection The connection that sent the message.
+		 * \param message The message.
+		 */
+		void handleMessage(SharedServerConnection connection, ClientMessage const & message) override {
+			if (!message.has_image_settings()) return;
+			ImageSettings const & settings = message.image_settings();
+			
+			ImageFormat format;
+			format.width  = settings.width();
+			format.height = settings.height();
+			if (settings.has_quality()) format.quality = std::min(100u, std::max(1u, settings.quality()));
+			formats[connection] = format;
+		}
+		
+		/// Capture an image and send it to all clients.
+		/**
+		 * Clients are grouped by the format they requested,
+		 * so an image is encoded and framed once for every group.
+		 * The default format is always captured, since it is also written to fallback_path().
+		 * 
+		 * \param done Callback invoked from the capture thread when all groups have been sent the image.
+		 */
+		void showImage(std::function<void ()> done) {
+			std::map<ImageFormat, std::vector<SharedServerConnection>> groups;
+			
+			// The default format is always captured, for the fallback path.
+			groups[ImageFormat()];
+			for (auto & connection : engine.server.connections()) {
+				auto format = formats.find(connection);
+				groups[format == formats.end() ? ImageFormat() : format->second].push_back(connection);
+			}
+			
+			// Forget the formats of clients that are gone.
+			for (auto i = formats.begin(); i != formats.end();) {
+				if (i->first.expired()) {
+					i = formats.erase(i);
+				} else {
+					++i;
+				}
+			}
+			
+			auto remaining = std::make_shared<std::atomic<std::size_t>>(groups.size());
+			for (auto & group : groups) {
+				auto connections = std::make_shared<std::vector<SharedServerConnection>>(std::move(group.second));
+				bool fallback = !(ImageFormat() < group.first) && !(group.first < ImageFormat());
+				camera.capture(group.first, [this, connections, remaining, done, fallback] (EncodedImage const & image) {
+					if (!image.jpeg.empty()) {
+						if (fallback) writeFallback_(image);
+						if (!connections->empty()) sendImage_(image, *connections);
+					}
+					if (--*remaining == 0) done();
+				});
+			}
+		}
+		
+	protected:
+		/// Write an image to the fallback path.
+		/**
+		 * The image is written under a temporary name and renamed when complete,
+		 * so a client never downloads a partial image.
+		 * 
+		 * \param image The image.
+		 */
+		void writeFallback_(EncodedImage const & image) {
+			std::string temporary = std::string(fallback_path()) + ".tmp";
+			{
+				std::ofstream stream(temporary, std::ios::binary | std::ios::trunc);
+				stream.write(reinterpret_cast<char const *>(image.jpeg.data()), image.jpeg.size());
+				stream.close();
+				if (stream.fail()) {
+					std::remove(temporary.c_str());
+					return;
+				}
+			}
+			if (std::rename(temporary.c_str(), fallback_path()) != 0) std::remove(temporary.c_str());
+		}
+		
+		/// Send an image to a group of clients.
+		/**
+		 * The image is sent in chunks, followed by a show image message with the ID of the image.
+		 * Only the first chunk carries the size, dimensions and capture time of the image.
+		 * 
+		 * \param image The image.
+		 * \param connections The clients to send the image to.
+		 */
+		void sendImage_(EncodedImage const & image, std::vector<SharedServerConnection> const & connections) {
+			unsigned int id = ++last_image;
+			
+			RobotMessage message;
+			ImageChunk & chunk = *message.mutable_image_chunk();
+			chunk.set_id(id);
+			chunk.set_size(image.jpeg.size());
+			chunk.set_width(image.width);
+			chunk.set_height(image.height);
+			chunk.set_captured(std::chrono::duration_cast<std::chrono::microseconds>(image.captured.time_since_epoch()).count());
+			
+			for (std::size_t offset = 0; offset < image.jpeg.size(); offset += chunk_size) {
+				chunk.set_offset(offset);
+				chunk.set_data(image.jpeg.data() + offset, std::min(chunk_size, image.jpeg.size() - offset));
+				engine.server.sendMessage(message, connections);
+				
+				if (offset == 0) {
+					chunk.clear_size();
+					chunk.clear_width();
+					chunk.clear_height();
+					chunk.clear_captured();
+				}
+			}
+			
+			RobotMessage show;
+			show.mutable_show_image()->set_image(id);
+			engine.server.sendMessage(show, connections);
+		}
 	};
 	
+	namespace command {
+		
+		/// Capture a camera image and send it to the clients.
+		/**
+		 * The image is captured and sent from the capture thread of the camera service.
+		 * The script continues on the strand of the engine when that is done,
+		 * unless the engine stopped or loaded another script in the meantime.
+		 */
+		bool ShowImage::step() {
+			if (!requested) {
+				requested = true;
+				static_cast<PresentationPlugin *>(plugin)->showImage(asyncContinue_());
+				return false;
+			}
+			
+			requested = false;
+			return done_();
+		}
+	}
+	
 	extern "C" Plugin * createPlugin(ScriptEngine & engine) {
 		return new PresentationPlugin(engine);
 	}
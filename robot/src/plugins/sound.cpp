@@ -2,18 +2,14 @@
 #include <stdexcept>
 #include <memory>
 
-#include <alproxies/alaudioplayerproxy.h>
-
 #include "../plugin.hpp"
 #include "../command.hpp"
+#include "../script.hpp"
 #include "../script_engine.hpp"
 
 namespace robotutor {
 	
 	struct SoundPlugin : public Plugin {
-		/// Behavior manager to use.
-		AL::ALAudioPlayerProxy player;
-
 		SoundPlugin(ScriptEngine & engine);
 	};
 
@@ -21,10 +17,6 @@ namespace robotutor {
 
 		struct SoundCommand : public command::Command {
 			SoundCommand(ScriptEngine & engine, Command * parent, Plugin * plugin) : Command(engine, parent, plugin) {}
-			
-			SoundPlugin * sound_plugin() {
-				return static_cast<SoundPlugin *>(plugin);
-			}
 		};
 		
 		/// Command to run a behavior.
@@ -36,17 +28,28 @@ namespace robotutor {
 				SoundCommand(engine, parent, plugin),
 				file(file) {}
 			
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() != 1) throw std::runtime_error("Command `" + static_name() + "' expects 1 argument.");
-				return std::make_shared<PlaySound>(engine, parent, plugin, arguments[0]);
+				return script.create<PlaySound>(parent, plugin, arguments[0].text);
 			}
 			
 			static std::string static_name() { return "sound"; }
 			
 			std::string name() const { return static_name(); }
 			
+			bool prefetch() {
+				engine.backend->preloadSound(file);
+				return true;
+			}
+			
+			void evict() {
+				engine.backend->unloadSound(file);
+			}
+			
 			bool step() {
-				sound_plugin()->player.playFile(file);
+				Stats & stats = engine.stats;
+				Stats::Clock::time_point fired = Stats::Clock::now();
+				engine.backend->playSound(file, [&stats, fired] () { stats.sound_start.record(Stats::Clock::now() - fired); });
 				return done_();
 			}
 		};
@@ -57,25 +60,24 @@ namespace robotutor {
 			StopSound(ScriptEngine & engine, Command * parent, Plugin * plugin) :
 				SoundCommand(engine, parent, plugin) {}
 			
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() != 0) throw std::runtime_error("Command `" + static_name() + "' expects 0 argument.");
-				return std::make_shared<StopSound>(engine, parent, plugin);
+				return script.create<StopSound>(parent, plugin);
 			}
 			
-			static std::string static_name() { return "random behavior"; }
+			static std::string static_name() { return "stop sound"; }
 			
 			std::string name() const { return static_name(); }
 			
 			bool step() {
-				sound_plugin()->player.stopAll();
+				engine.backend->stopSounds();
 				return done_();
 			}
 		};
 	}
 
 	SoundPlugin::SoundPlugin(ScriptEngine & engine) :
-		Plugin(engine),
-		player(engine.broker)
+		Plugin(engine)
 	{
 		engine.factory.add<command::PlaySound>(this);
 		engine.factory.add<command::StopSound>(this);
@@ -0,0 +1,45 @@
+#include <iostream>
+#include <memory>
+
+#include "../plugin.hpp"
+#include "../script_engine.hpp"
+#include "../sound_level_stream.hpp"
+
+namespace robotutor {
+	
+	/// Plugin to stream the recorded sound level to clients that subscribe to it.
+	struct SoundLevelPlugin : public Plugin {
+		/// The stream, or a null pointer if the engine has no audio source.
+		std::unique_ptr<SoundLevelStream> stream;
+		
+		SoundLevelPlugin(ScriptEngine & engine) : Plugin(engine) {
+			if (!engine.audio) return;
+			stream.reset(new SoundLevelStream(engine.audio->sampleRate()));
+			engine.audio->onBuffer([this] (std::int16_t const * samples, std::size_t frames, unsigned int channels) {
+				stream->process(samples, frames, channels);
+			});
+		}
+		
+		~SoundLevelPlugin() {
+			if (engine.audio) engine.audio->onBuffer(nullptr);
+		}
+		
+		/// Handle sound level subscriptions.
+		/**
+		 * \param connection The connection that sent the message.
+		 * \param message The message.
+		 */
+		void handleMessage(SharedServerConnection connection, ClientMessage const & message) override {
+			if (!message.has_sound_levels()) return;
+			if (!stream) {
+				std::cout << "Sound level requested, but there is no audio source." << std::endl;
+				return;
+			}
+			stream->subscribe(connection, message.sound_levels().rate(), message.sound_levels().batch());
+		}
+	};
+	
+	extern "C" Plugin * createPlugin(ScriptEngine & engine) {
+		return new SoundLevelPlugin(engine);
+	}
+}
@@ -9,8 +9,9 @@
 
 #include "../plugin.hpp"
 #include "../command.hpp"
+#include "../script.hpp"
+#include "../program.hpp"
 #include "../script_engine.hpp"
-#include "../script_parser.hpp"
 #include "../robotutor_protocol.hpp"
 
 namespace robotutor {
@@ -28,6 +29,9 @@ namespace robotutor {
 				/// The branch to take.
 				int branch_ = -1;
 				
+				/// True if the branch is taken by the compiled program instead of by the command itself.
+				bool compiled_ = false;
+				
 			public:
 				TurningPointCommand(ScriptEngine & engine, Command * parent, Plugin * plugin) :
 					Command(engine, parent, plugin) {}
@@ -50,8 +54,8 @@ namespace robotutor {
 					// Handle the results.
 					} else if (!executed_) {
 						executed_ = true;
-						if (branch_ >= 0 && branch_ < children.size()) {
-							setNext_(children[branch_].get());
+						if (!compiled_ && branch_ >= 0 && branch_ < int(children.size())) {
+							setNext_(children[branch_]);
 							return true;
 						}
 					}
@@ -60,6 +64,26 @@ namespace robotutor {
 					return done_();
 				}
 				
+				/// Lower the command into a compiled program.
+				/**
+				 * The command is called to fetch the results, after which the program branches to the chosen child.
+				 * 
+				 * \param compiler The compiler to emit instructions with.
+				 * \return True.
+				 */
+				virtual bool compile(Compiler & compiler) {
+					compiled_ = true;
+					compiler.emit(Opcode::call, this);
+					compiler.branch(this);
+					return true;
+				}
+				
+				/// Get the branch to take.
+				/**
+				 * \return The index of the child to execute, or a negative number to execute none.
+				 */
+				virtual int branch() const { return branch_; }
+				
 			protected:
 				/// Request turningpoint results from server.
 				void requestResults_() {
@@ -77,11 +101,11 @@ namespace robotutor {
 				TurningPointCommand(engine, parent, plugin) {}
 			
 			/// Create the command.
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
-				auto result = std::make_shared<TurningPointChoice>(engine, parent, plugin);
-				for (auto const & argument : arguments) {
-					result->children.push_back(parseScript(engine, argument));
-					result->children.back()->parent = result.get();
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
+				auto result = script.create<TurningPointChoice>(parent, plugin);
+				for (auto & argument : arguments) {
+					result->children.push_back(argument.script());
+					result->children.back()->parent = result;
 				}
 				return result;
 			}
@@ -137,7 +161,7 @@ namespace robotutor {
 				use_string(use_string) {}
 			
 			/// Create the command.
-			static SharedPtr create(ScriptEngine & engine, Command * parent, Plugin * plugin, std::vector<std::string> && arguments) {
+			static Command * create(Script & script, Command * parent, Plugin * plugin, ArgumentList && arguments) {
 				if (arguments.size() < 2 || arguments.size() > 4) throw std::runtime_error("Command `" + static_name() + "' command expects 2 to 4 arguments.");
 				
 				int index;
@@ -146,17 +170,17 @@ namespace robotutor {
 				
 				// First argument can be an int or string identifying the correct answer.
 				try {
-					index = boost::lexical_cast<int>(arguments[0]);
+					index = boost::lexical_cast<int>(arguments[0].text);
 				} catch (boost::bad_lexical_cast const &) {
 					use_string = true;
-					answer     = arguments[0];
+					answer     = arguments[0].text;
 				}
 				
 				// The remaining arguments are alternatives to execute depending on the results.
-				auto result = std::make_shared<TurningPointQuiz>(engine, parent, plugin, index, answer, use_string);
+				auto result = script.create<TurningPointQuiz>(parent, plugin, index, answer, use_string);
 				for (auto argument = arguments.begin()+1; argument != arguments.end(); ++argument) {
-					result->children.push_back(parseScript(engine, *argument));
-					result->children.back()->parent = result.get();
+					result->children.push_back(argument->script());
+					result->children.back()->parent = result;
 				}
 				return result;
 			}
@@ -0,0 +1,77 @@
+#include "program.hpp"
+#include "command.hpp"
+
+
+namespace robotutor {
+	
+	namespace command {
+		
+		/// Compile a command.
+		/**
+		 * \param command The command to compile.
+		 */
+		void Compiler::compile(Command * command) {
+			if (!command->compile(*this)) emit(Opcode::call, command);
+		}
+		
+		/// Emit an instruction.
+		/**
+		 * \param op The opcode.
+		 * \param command The command the instruction operates on.
+		 * \param offset The jump offset or number of cases.
+		 * \return The index of the emitted instruction.
+		 */
+		std::size_t Compiler::emit(Opcode op, Command * command, int offset) {
+			program_.push_back({op, offset, command});
+			return program_.size() - 1;
+		}
+		
+		/// Let a previously emitted jump target the next instruction to be emitted.
+		/**
+		 * \param instruction The index of the jump instruction.
+		 */
+		void Compiler::patch(std::size_t instruction) {
+			program_[instruction].offset = program_.size() - instruction;
+		}
+		
+		/// Emit a branch that executes one of the children of a command.
+		/**
+		 * The children are compiled as cases of the branch.
+		 * Command::branch() chooses the case at run time.
+		 * 
+		 * \param command The command to branch on.
+		 */
+		void Compiler::branch(Command * command) {
+			std::size_t cases = command->children.size();
+			emit(Opcode::branch, command, cases);
+			
+			// Jump table, followed by the jump taken when no valid case was chosen.
+			std::vector<std::size_t> table;
+			for (std::size_t i = 0; i < cases; ++i) table.push_back(emit(Opcode::jump));
+			std::vector<std::size_t> exits;
+			exits.push_back(emit(Opcode::jump));
+			
+			// The cases themselves, each jumping past the others when done.
+			for (std::size_t i = 0; i < cases; ++i) {
+				patch(table[i]);
+				compile(command->children[i]);
+				exits.push_back(emit(Opcode::jump));
+			}
+			
+			for (auto exit : exits) patch(exit);
+		}
+		
+		/// Compile a command tree.
+		/**
+		 * \param root The root of the command tree.
+		 * \return The compiled program.
+		 */
+		Program compile(Command * root) {
+			Program program;
+			Compiler compiler(program);
+			if (root) compiler.compile(root);
+			return program;
+		}
+		
+	}
+}
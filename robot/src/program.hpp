@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace robotutor {
+	
+	namespace command {
+		
+		class Command;
+		
+		/// Opcodes of compiled scripts.
+		enum class Opcode : std::uint8_t {
+			/// Say a sentence, its bookmarks dispatch the embedded commands.
+			speak,
+			
+			/// Run a command that was not lowered by walking its command tree.
+			call,
+			
+			/// Jump to one of the jump instructions following the branch, as chosen by the command.
+			/**
+			 * The offset holds the number of cases.
+			 * If the command chooses no valid case, the jump after the last case is taken.
+			 */
+			branch,
+			
+			/// Jump relative to the current instruction.
+			jump,
+			
+			/// Stop the engine.
+			stop,
+		};
+		
+		/// A single instruction of a compiled script.
+		struct Instruction {
+			/// The opcode.
+			Opcode op;
+			
+			/// Jump offset or number of cases, depending on the opcode.
+			int offset;
+			
+			/// The command the instruction operates on.
+			Command * command;
+		};
+		
+		/// A compiled script.
+		typedef std::vector<Instruction> Program;
+		
+		/// Compiler that lowers command trees into a flat program.
+		/**
+		 * Commands that know how to lower themselves override Command::compile().
+		 * Everything else is emitted as a call, which runs the command through the tree walker.
+		 */
+		class Compiler {
+			protected:
+				/// The program being generated.
+				Program & program_;
+				
+			public:
+				/// Construct a compiler.
+				/**
+				 * \param program The program to append instructions to.
+				 */
+				explicit Compiler(Program & program) :
+					program_(program) {}
+				
+				/// Compile a command.
+				/**
+				 * \param command The command to compile.
+				 */
+				void compile(Command * command);
+				
+				/// Emit an instruction.
+				/**
+				 * \param op The opcode.
+				 * \param command The command the instruction operates on.
+				 * \param offset The jump offset or number of cases.
+				 * \return The index of the emitted instruction.
+				 */
+				std::size_t emit(Opcode op, Command * command = nullptr, int offset = 0);
+				
+				/// Let a previously emitted jump target the next instruction to be emitted.
+				/**
+				 * \param instruction The index of the jump instruction.
+				 */
+				void patch(std::size_t instruction);
+				
+				/// Emit a branch that executes one of the children of a command.
+				/**
+				 * The children are compiled as cases of the branch.
+				 * Command::branch() chooses the case at run time.
+				 * 
+				 * \param command The command to branch on.
+				 */
+				void branch(Command * command);
+		};
+		
+		/// Compile a command tree.
+		/**
+		 * \param root The root of the command tree.
+		 * \return The compiled program.
+		 */
+		Program compile(Command * root);
+		
+	}
+}
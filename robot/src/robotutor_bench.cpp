@@ -0,0 +1,413 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/make_shared.hpp>
+
+#include "bench_suite.hpp"
+#include "script.hpp"
+#include "script_engine.hpp"
+#include "script_loader.hpp"
+#include "simulated_backend.hpp"
+#include "simulated_clock.hpp"
+#include "script_generator.hpp"
+#include "parser_common.hpp"
+
+
+using namespace robotutor;
+
+namespace {
+	/// Number of allocations made by the process.
+	std::atomic<std::uint64_t> allocations { 0 };
+	
+	/// Number of bytes allocated by the process.
+	std::atomic<std::uint64_t> allocated_bytes { 0 };
+	
+	/// Command that does nothing, standing in for commands that no plugin provides.
+	struct NoOp : public command::Command {
+		std::string name_;
+		
+		NoOp(ScriptEngine & engine, command::Command * parent, std::string const & name) :
+			Command(engine, parent, nullptr),
+			name_(name) {}
+			
+		std::string name() const { return name_; }
+		
+		bool step() { return done_(); }
+	};
+	
+	/// Command appended to every script to end the run.
+	struct BenchDone : public command::Command {
+		std::function<void ()> on_done;
+		
+		BenchDone(ScriptEngine & engine, command::Command * parent, std::function<void ()> on_done) :
+			Command(engine, parent, nullptr),
+			on_done(on_done) {}
+			
+		static std::string static_name() { return "bench done"; }
+		
+		std::string name() const { return static_name(); }
+		
+		bool step() {
+			engine.stop(on_done);
+			setNext_(parent);
+			return false;
+		}
+	};
+	
+	/// Stream buffer that discards everything written to it.
+	struct NullBuffer : public std::streambuf {
+		int overflow(int c) { return traits_type::not_eof(c); }
+	};
+	
+	/// Plugins loaded when no plugin directory is given.
+	/**
+	 * The real behavior and sound commands prefetch on the simulated backend,
+	 * so the prefetch path and the motion and sound start latencies are measured.
+	 */
+	char const * const default_plugins[] = {"lib/behavior.so", "lib/sound.so"};
+	
+	/// Options of the benchmark.
+	struct Options {
+		double speed = 0;
+		unsigned int generated = 500;
+		unsigned int embedded = 0;
+		unsigned int repeat = 5;
+		std::size_t prefetch = 8;
+		std::string plugins;
+		std::string behaviors;
+		std::vector<std::string> files;
+	};
+	
+	void help() {
+		std::cout << "Robotutor benchmark\n";
+		std::cout << "Usage: robotutor-bench <options> [script-file...]\n";
+		std::cout << "       robotutor-bench test [check...]\n";
+		std::cout << "       robotutor-bench micro [benchmark...]\n";
+		std::cout << "Runs scripts on a simulated robot and prints the results as JSON.\n";
+		std::cout << "The test subcommand runs self-checks, the micro subcommand runs micro benchmarks,\n";
+		std::cout << "both only the ones whose name starts with one of the arguments if any are given.\n";
+		std::cout << "Options:\n";
+		std::cout << "-h Print this help message.\n";
+		std::cout << "-s <speed> Run the scripts in real time, this many times faster (default on a virtual clock that skips idle time).\n";
+		std::cout << "-g <sentences> Sentences in the generated script, 0 to skip it (default 500).\n";
+		std::cout << "-c <commands> Extra commands embedded in every generated sentence (default 0).\n";
+		std::cout << "-r <count> Number of times to parse every script, the fastest parse is reported (default 5).\n";
+		std::cout << "-p <instructions> Instructions to scan ahead for behaviors and sounds to prefetch, 0 to disable (default 8).\n";
+		std::cout << "-l <directory> Load plugins from a directory instead of lib/behavior.so and lib/sound.so. Commands no plugin provides are replaced by no-ops.\n";
+		std::cout << "-i <file> Behaviors installed on the simulated robot, one per line with an optional duration in ms (default the behaviors in the repository).\n";
+	}
+	
+	/// Get the CPU time used by the process.
+	double cpuTime() {
+		timespec time;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+		return time.tv_sec + time.tv_nsec * 1e-9;
+	}
+	
+	/// Get the peak resident set size of the process in KiB.
+	long peakRss() {
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_maxrss;
+	}
+	
+	/// Write a string as JSON.
+	std::string quote(std::string const & text) {
+		std::ostringstream result;
+		result << '"';
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				result << '\\' << c;
+			} else if (static_cast<unsigned char>(c) < 0x20) {
+				result << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+			} else {
+				result << c;
+			}
+		}
+		result << '"';
+		return result.str();
+	}
+	
+	/// Write a histogram as JSON.
+	void writeHistogram(std::ostream & out, Histogram const & histogram) {
+		out << "{\"count\": " << histogram.count();
+		out << ", \"mean_us\": " << (histogram.count() ? histogram.sum() / histogram.count() : 0);
+		out << ", \"p50_us\": " << histogram.percentile(0.5);
+		out << ", \"p90_us\": " << histogram.percentile(0.9);
+		out << ", \"p99_us\": " << histogram.percentile(0.99);
+		out << ", \"max_us\": " << histogram.max() << "}";
+	}
+	
+	/// Parse and run one script, and write the results as JSON.
+	/**
+	 * \param out The stream to write the results to.
+	 * \param engine The script engine.
+	 * \param clock The clock of the simulated robot, which runs the IO service of the engine.
+	 * \param work Keeps the IO service running until the script is done.
+	 * \param options The benchmark options.
+	 * \param name The name of the script.
+	 * \param text The script.
+	 */
+	void bench(std::ostream & out, ScriptEngine & engine, SimulatedClock & clock, std::unique_ptr<boost::asio::io_service::work> & work, Options const & options, std::string const & name, std::string text) {
+		for (auto const & command : commandNames(text)) {
+			if (engine.factory.has(command)) continue;
+			engine.factory.add(command, [command] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList && arguments) -> command::Command * {
+				// Like most real commands, only look at the text of the arguments.
+				(void) arguments;
+				return script.create<NoOp>(parent, command);
+			});
+		}
+		text += "\n{" + BenchDone::static_name() + "}";
+		
+		// Parse the script a few times and keep the fastest run.
+		double parse_seconds = 0;
+		AllocationCount parse_allocations{0, 0};
+		std::string image;
+		for (unsigned int i = 0; i < options.repeat; ++i) {
+			AllocationCount before = AllocationCount::now();
+			auto start = std::chrono::steady_clock::now();
+			image = parseScriptImage(text);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			AllocationCount allocations = AllocationCount::now() - before;
+			if (!i || seconds < parse_seconds) {
+				parse_seconds     = seconds;
+				parse_allocations = allocations;
+			}
+		}
+		
+		AllocationCount before_load = AllocationCount::now();
+		auto load_start = std::chrono::steady_clock::now();
+		command::ScriptPtr script = loadScriptImage(engine, image);
+		double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+		AllocationCount load_allocations = AllocationCount::now() - before_load;
+		
+		// Run the script until the final command releases the work and the engine is idle.
+		engine.stats.reset();
+		engine.load(script);
+		engine.ios().reset();
+		work.reset(new boost::asio::io_service::work(engine.ios()));
+		AllocationCount before_run = AllocationCount::now();
+		std::size_t dropped_start = engine.speech->droppedEvents();
+		double cpu_start = cpuTime();
+		auto run_start   = std::chrono::steady_clock::now();
+		boost::posix_time::ptime simulated_start = clock.now();
+		engine.strand().post([&engine] () { engine.start(); });
+		clock.run();
+		double run_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+		double simulated_seconds = clock.isVirtual() ? (clock.now() - simulated_start).total_microseconds() * 1e-6 : run_seconds * options.speed;
+		double cpu_seconds = cpuTime() - cpu_start;
+		AllocationCount run_allocations = AllocationCount::now() - before_run;
+		std::size_t dropped_events = engine.speech->droppedEvents() - dropped_start;
+		engine.load(nullptr);
+		
+		out << "    {\n";
+		out << "      \"name\": " << quote(name) << ",\n";
+		out << "      \"bytes\": " << text.size() << ",\n";
+		out << "      \"parse\": {\"seconds\": " << parse_seconds << ", \"mb_per_second\": " << text.size() / parse_seconds / 1e6;
+		out << ", \"allocations\": " << parse_allocations.count << ", \"allocated_bytes\": " << parse_allocations.bytes << "},\n";
+		out << "      \"load\": {\"seconds\": " << load_seconds;
+		out << ", \"allocations\": " << load_allocations.count << ", \"allocated_bytes\": " << load_allocations.bytes << "},\n";
+		out << "      \"run\": {\"seconds\": " << run_seconds << ", \"simulated_seconds\": " << simulated_seconds << ", \"cpu_seconds\": " << cpu_seconds;
+		out << ", \"allocations\": " << run_allocations.count << ", \"allocated_bytes\": " << run_allocations.bytes;
+		out << ", \"dropped_events\": " << dropped_events << "},\n";
+		out << "      \"histograms\": {";
+		bool first = true;
+		engine.stats.visit([&out, &first] (std::string const & name, Histogram const & histogram) {
+			out << (first ? "\n" : ",\n") << "        " << quote(name) << ": ";
+			writeHistogram(out, histogram);
+			first = false;
+		});
+		out << "\n      }\n";
+		out << "    }";
+	}
+}
+
+/// Find the names of all commands used in a script.
+/**
+ * Follows the parser closely enough to find the names, without validating the script.
+ */
+std::set<std::string> robotutor::commandNames(std::string const & script) {
+	std::set<std::string> names;
+	for (std::size_t i = 0; i < script.size(); ++i) {
+		if (script[i] == '\\' && i + 1 < script.size() && (script[i + 1] == '{' || script[i + 1] == '}' || script[i + 1] == '|')) {
+			++i;
+		} else if (script[i] == '{') {
+			std::string name;
+			for (++i; i < script.size() && (parser::isLowerAlpha(script[i]) || parser::isDigit(script[i]) || parser::isSpace(script[i])); ++i) {
+				if (!parser::isSpace(script[i])) {
+					name.push_back(script[i]);
+				} else if (name.size() && name.back() != ' ') {
+					name.push_back(' ');
+				}
+			}
+			parser::trim(name);
+			names.insert(name);
+			--i;
+		}
+	}
+	return names;
+}
+
+/// Get the current allocation counters.
+AllocationCount AllocationCount::now() {
+	return {allocations.load(std::memory_order_relaxed), allocated_bytes.load(std::memory_order_relaxed)};
+}
+
+/// Count all allocations of the process.
+void * operator new(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+	if (void * result = std::malloc(size ? size : 1)) return result;
+	throw std::bad_alloc();
+}
+
+void operator delete(void * pointer) noexcept {
+	std::free(pointer);
+}
+
+void operator delete(void * pointer, std::size_t) noexcept {
+	std::free(pointer);
+}
+
+int main(int argc, char ** argv) {
+	if (argc > 1 && std::string(argv[1]) == "test")  return runTests({argv + 2, argv + argc});
+	if (argc > 1 && std::string(argv[1]) == "micro") return runMicroBenchmarks({argv + 2, argv + argc});
+	
+	Options options;
+	int i = 1;
+	while (i < argc && argv[i][0] == '-') {
+		switch (argv[i][1]) {
+			case 'h':
+			case 'H':
+				help();
+				return 1;
+			case 's':
+			case 'S':
+				options.speed = std::max(1e-3, std::atof(argv[++i]));
+				break;
+			case 'g':
+			case 'G':
+				options.generated = std::atoi(argv[++i]);
+				break;
+			case 'c':
+			case 'C':
+				options.embedded = std::atoi(argv[++i]);
+				break;
+			case 'r':
+			case 'R':
+				options.repeat = std::max(1, std::atoi(argv[++i]));
+				break;
+			case 'p':
+			case 'P':
+				options.prefetch = std::atoi(argv[++i]);
+				break;
+			case 'l':
+			case 'L':
+				options.plugins = argv[++i];
+				break;
+			case 'i':
+			case 'I':
+				options.behaviors = argv[++i];
+				break;
+			default:
+				std::cerr << "Unknown option `" << argv[i] << "'.\n";
+				help();
+				return 1;
+		}
+		i++;
+	}
+	for (; i < argc; ++i) options.files.push_back(argv[i]);
+	
+	if (options.files.empty() && !options.generated) {
+		help();
+		return 1;
+	}
+	
+	boost::asio::io_service ios;
+	auto clock   = options.speed ? boost::make_shared<SimulatedClock>(ios, options.speed) : boost::make_shared<SimulatedClock>(ios);
+	auto backend = boost::make_shared<SimulatedBackend>(clock);
+	if (!options.behaviors.empty()) {
+		std::ifstream stream(options.behaviors);
+		try {
+			if (!stream) throw std::runtime_error("Failed to open `" + options.behaviors + "'.");
+			backend->loadBehaviors(stream);
+		} catch (std::exception const & e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+	}
+	ScriptEngine engine(ios, backend, 0);
+	engine.prefetchDepth(options.prefetch);
+	if (!options.plugins.empty()) {
+		engine.loadPlugins(options.plugins);
+	} else {
+		for (char const * plugin : default_plugins) {
+			if (!engine.loadPlugin(plugin)) std::cerr << "Failed to load `" << plugin << "', its commands are replaced by no-ops." << std::endl;
+		}
+	}
+	std::unique_ptr<boost::asio::io_service::work> work;
+	engine.factory.add(BenchDone::static_name(), [&work] (command::Script & script, command::Command * parent, Plugin *, command::ArgumentList && arguments) -> command::Command * {
+		if (arguments.size()) throw std::runtime_error("Command `" + BenchDone::static_name() + "' takes zero arguments.");
+		return script.create<BenchDone>(parent, [&work] () { work.reset(); });
+	});
+	
+	std::ostringstream out;
+	out << "{\n";
+	out << "  \"clock\": " << (clock->isVirtual() ? "\"virtual\"" : "\"real\"") << ",\n";
+	if (!clock->isVirtual()) out << "  \"speed\": " << options.speed << ",\n";
+	out << "  \"scripts\": [\n";
+	
+	// The engines log to standard output, which would end up in the results and in the timings.
+	NullBuffer null_buffer;
+	std::streambuf * stdout_buffer = std::cout.rdbuf(&null_buffer);
+	
+	bool first = true;
+	try {
+		for (auto const & file : options.files) {
+			std::ifstream stream(file);
+			if (!stream.good()) throw std::runtime_error("Failed to read `" + file + "'.");
+			std::stringstream buffer;
+			buffer << stream.rdbuf();
+			
+			if (!first) out << ",\n";
+			bench(out, engine, *clock, work, options, file, buffer.str());
+			first = false;
+		}
+		
+		if (options.generated) {
+			if (!first) out << ",\n";
+			bench(out, engine, *clock, work, options, "generated", generateScript(options.generated, options.embedded));
+		}
+	} catch (std::exception const & e) {
+		std::cout.rdbuf(stdout_buffer);
+		std::cerr << "Error: " << e.what() << std::endl;
+		return -1;
+	}
+	
+	out << "\n  ],\n";
+	out << "  \"peak_rss_kib\": " << peakRss() << "\n";
+	out << "}\n";
+	std::cout.rdbuf(stdout_buffer);
+	std::cout << out.str() << std::flush;
+	
+	engine.join();
+	return 0;
+}
@@ -1,6 +1,12 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <iomanip>
 #include <sstream>
 #include <fstream>
+#include <map>
 #include <stdexcept>
 #include <thread>
 #include <functional>
@@ -8,6 +14,7 @@
 #include <boost/asio/io_service.hpp>
 
 #include "robotutor_protocol.hpp"
+#include "script_cache.hpp"
 
 
 using namespace robotutor;
@@ -35,6 +42,170 @@ namespace {
 		}
 	}
 	
+	/// Get a percentile from the buckets of a histogram.
+	/**
+	 * \param histogram The histogram.
+	 * \param fraction The percentile as fraction.
+	 * \return The upper bound of the bucket holding the percentile, in microseconds.
+	 */
+	std::uint64_t percentile(HistogramReport const & histogram, double fraction) {
+		std::uint64_t target = histogram.count() * fraction;
+		std::uint64_t seen   = 0;
+		for (int i = 0; i < histogram.buckets_size(); ++i) {
+			seen += histogram.buckets(i);
+			if (seen > target) return i ? std::uint64_t(1) << i : 0;
+		}
+		return histogram.max();
+	}
+	
+	/// Print the statistics received from the server.
+	void onStats(SharedClient client, RobotMessage && message) {
+		if (!message.has_stats()) return;
+		
+		std::cout << std::left << std::setw(32) << "name" << std::right;
+		std::cout << std::setw(10) << "count" << std::setw(12) << "mean us" << std::setw(12) << "p50 us";
+		std::cout << std::setw(12) << "p99 us" << std::setw(12) << "max us" << "\n";
+		for (auto const & histogram : message.stats().histograms()) {
+			std::uint64_t mean = histogram.count() ? histogram.sum() / histogram.count() : 0;
+			std::cout << std::left << std::setw(32) << histogram.name() << std::right;
+			std::cout << std::setw(10) << histogram.count() << std::setw(12) << mean;
+			std::cout << std::setw(12) << percentile(histogram, 0.5) << std::setw(12) << percentile(histogram, 0.99);
+			std::cout << std::setw(12) << histogram.max() << "\n";
+		}
+		std::cout << std::flush;
+		stop(0);
+	}
+	
+	void onRequestSent(SharedClient client, Client::ErrorCode const & error) {
+		if (error) {
+			std::cout << "Error sending message: " << error.message() << std::endl;
+			stop(-3);
+		}
+	}
+	
+	/// An image being received from the server.
+	struct ReceivedImage {
+		/// The JPEG data received so far.
+		std::string jpeg;
+		
+		/// The size of the image in bytes.
+		std::size_t size = 0;
+		
+		/// The dimensions of the image.
+		unsigned int width = 0, height = 0;
+		
+		/// The capture time in microseconds since the epoch.
+		std::uint64_t captured = 0;
+	};
+	
+	/// Images being received, by ID.
+	std::map<unsigned int, ReceivedImage> images;
+	
+	/// Number of images still to receive.
+	unsigned int images_wanted = 0;
+	
+	/// Number of complete images received.
+	unsigned int images_received = 0;
+	
+	/// Sum and maximum of the capture to receipt latencies, in microseconds.
+	std::uint64_t latency_sum = 0, latency_max = 0;
+	
+	/// Collect image chunks and report the latency of every complete image.
+	void onImage(SharedClient client, RobotMessage && message) {
+		if (message.has_image_chunk()) {
+			ImageChunk const & chunk = message.image_chunk();
+			ReceivedImage & image = images[chunk.id()];
+			if (chunk.offset() == 0) {
+				image.size     = chunk.size();
+				image.width    = chunk.width();
+				image.height   = chunk.height();
+				image.captured = chunk.captured();
+				image.jpeg.reserve(image.size);
+			}
+			if (chunk.offset() != image.jpeg.size()) {
+				std::cout << "Image " << chunk.id() << ": unexpected chunk at offset " << chunk.offset() << "." << std::endl;
+				return stop(-4);
+			}
+			image.jpeg.append(chunk.data());
+		}
+		
+		if (message.has_show_image() && message.show_image().has_image()) {
+			auto image = images.find(message.show_image().image());
+			if (image == images.end() || image->second.jpeg.size() != image->second.size) {
+				std::cout << "Image " << message.show_image().image() << ": incomplete." << std::endl;
+				return stop(-4);
+			}
+			
+			std::uint64_t now     = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+			std::uint64_t latency = now - image->second.captured;
+			latency_sum += latency;
+			latency_max  = std::max(latency_max, latency);
+			std::cout << "Image " << image->first << ": " << image->second.width << "x" << image->second.height << ", ";
+			std::cout << image->second.size << " bytes, " << latency << " us after capture." << std::endl;
+			images.erase(image);
+			
+			if (++images_received == images_wanted) {
+				std::cout << images_received << " images, mean latency " << latency_sum / images_received << " us, max " << latency_max << " us." << std::endl;
+				stop(0);
+			}
+		}
+	}
+	
+	/// Request image settings and images from the server.
+	/**
+	 * Usage: images [count] [width height [quality]]
+	 * Runs a script that shows the requested number of images.
+	 */
+	void requestImages(SharedClient client) {
+		images_wanted = argc > 3 ? std::max(1, std::atoi(argv[3])) : 1;
+		client->on_message = onImage;
+		
+		if (argc > 5) {
+			ClientMessage message;
+			message.mutable_image_settings()->set_width(std::atoi(argv[4]));
+			message.mutable_image_settings()->set_height(std::atoi(argv[5]));
+			if (argc > 6) message.mutable_image_settings()->set_quality(std::atoi(argv[6]));
+			client->sendMessage(message, onRequestSent);
+		}
+		
+		std::string script;
+		for (unsigned int i = 0; i < images_wanted; ++i) script += "{show image}\n";
+		ClientMessage message;
+		message.mutable_run()->set_script(script);
+		client->sendMessage(message, onRequestSent);
+	}
+	
+	/// Number of sound level messages still to receive, or 0 to keep receiving.
+	unsigned int levels_wanted = 0;
+	
+	/// Print the sound levels received from the server.
+	void onSoundLevels(SharedClient client, RobotMessage && message) {
+		if (!message.has_sound_levels()) return;
+		SoundLevels const & levels = message.sound_levels();
+		
+		std::uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		std::cout << levels.rate() << " Hz, " << (now - levels.time()) << " us after measuring:";
+		for (auto level : levels.levels()) std::cout << " " << level;
+		std::cout << std::endl;
+		
+		if (levels_wanted && --levels_wanted == 0) stop(0);
+	}
+	
+	/// Subscribe to the sound level.
+	/**
+	 * Usage: levels [rate [batch [count]]]
+	 * Prints every received message, until count messages have been received.
+	 */
+	void requestSoundLevels(SharedClient client) {
+		levels_wanted = argc > 5 ? std::atoi(argv[5]) : 0;
+		client->on_message = onSoundLevels;
+		
+		ClientMessage message;
+		message.mutable_sound_levels()->set_rate(argc > 3 ? std::atoi(argv[3]) : 10);
+		if (argc > 4) message.mutable_sound_levels()->set_batch(std::atoi(argv[4]));
+		client->sendMessage(message, onRequestSent);
+	}
+	
 	void readScript(SharedClient client) {
 		std::stringstream buffer;
 		if (argc > 3) {
@@ -56,6 +227,37 @@ namespace {
 		});
 	}
 	
+	/// Parse a script and store it in a script cache, without contacting the server.
+	/**
+	 * Usage: compile script-file [cache-directory]
+	 * Copy the resulting file to the cache directory of the server to skip parsing there.
+	 */
+	int compileScript(int argc, char ** argv) {
+		if (argc < 3) {
+			std::cout << "Usage: " << std::string(argv[0]) << " compile script-file [cache-directory]" << std::endl;
+			return -1;
+		}
+		
+		std::ifstream file(argv[2]);
+		if (!file.good()) {
+			std::cout << "Failed to read input file." << std::endl;
+			return -2;
+		}
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		std::string script = buffer.str();
+		
+		ScriptCache cache(argc > 3 ? argv[3] : "cache");
+		try {
+			cache.compile(script);
+		} catch (std::exception const & e) {
+			std::cout << "Error parsing script: " << e.what() << std::endl;
+			return -3;
+		}
+		std::cout << "Script compiled to " << cache.path(script) << "." << std::endl;
+		return 0;
+	}
+	
 	void onConnect(SharedClient client, Client::ErrorCode const & error) {
 		std::string command(argv[2]);
 		if (error) {
@@ -77,6 +279,15 @@ namespace {
 			ClientMessage message;
 			message.mutable_resume();
 			client->sendMessage(message, onMessageSent);
+		} else if (command == "stats") {
+			ClientMessage message;
+			message.mutable_stats()->set_reset(argc > 3 && std::string(argv[3]) == "reset");
+			client->on_message = onStats;
+			client->sendMessage(message, onRequestSent);
+		} else if (command == "images") {
+			requestImages(client);
+		} else if (command == "levels") {
+			requestSoundLevels(client);
 		}
 	}
 }
@@ -85,8 +296,14 @@ int main(int argc, char ** argv) {
 	::argc = argc;
 	::argv = argv;
 	
+	if (argc > 1 && std::string(argv[1]) == "compile") return compileScript(argc, argv);
+	
 	if (argc < 3) {
 		std::cout << "Usage: " << std::string(argv[0]) << " server-ip command [options]" << std::endl;
+		std::cout << "       " << std::string(argv[0]) << " server-ip stats [reset]" << std::endl;
+		std::cout << "       " << std::string(argv[0]) << " server-ip images [count] [width height [quality]]" << std::endl;
+		std::cout << "       " << std::string(argv[0]) << " server-ip levels [rate [batch [count]]]" << std::endl;
+		std::cout << "       " << std::string(argv[0]) << " compile script-file [cache-directory]" << std::endl;
 		return -1;
 	}
 	
@@ -1,29 +1,75 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <functional>
+#include <thread>
+#include <vector>
 
 #include <boost/asio/io_service.hpp>
+#include <boost/make_shared.hpp>
 
 #include <alcommon/albroker.h>
 #include <alcommon/albrokermanager.h>
 
 #include "script_engine.hpp"
+#include "naoqi_backend.hpp"
+#include "simulated_backend.hpp"
 #include "noise_detector.hpp"
+#include "pcm_file_source.hpp"
 #include "messages.pb.h"
 
 
 using namespace robotutor;
 
+/// Default number of threads running the IO service.
+/**
+ * One thread runs the script engine strand,
+ * the other keeps networking and blocking plugin work going next to it.
+ */
+unsigned int const IO_THREADS = 2;
+
 void help() {
 	std::cout << "Robotutor server v0.7b\n";
 	std::cout << "Usage: robotutor-server <options>\n";
 	std::cout << "Options:\n";
 	std::cout << "-h Print this help message.\n";
 	std::cout << "-a <address> The address to bind the server to.\n";
+	std::cout << "-b <ms> Time to wait for a behavior to be acknowledged (default " << BEHAVIOR_TIMEOUT << ").\n";
+	std::cout << "-t <threads> Number of threads running the IO service (default " << IO_THREADS << ").\n";
+	std::cout << "-p <file> Replay a raw 16 bit 16000 Hz mono PCM file instead of recording the microphones.\n";
+	std::cout << "-s <speed> Simulate the robot instead of connecting to naoqi, running <speed> times faster than real time.\n";
+	std::cout << "-d <ms> Duration of behaviors when simulating the robot (default 2000).\n";
+	std::cout << "-i <file> Behaviors installed on the simulated robot, one per line with an optional duration in ms (default the behaviors in the repository).\n";
+	std::cout << "-c <directory> Directory to cache parsed scripts in (default cache).\n";
+	std::cout << "-v Print loaded scripts.\n";
+	std::cout << "-q <KiB> Outbound data to queue for a slow client before disconnecting it, 0 for no limit (default " << ascf::default_high_water_mark / 1024 << ").\n";
 }
 
 boost::shared_ptr<NoiseDetector> noise_detector;
 
+/// Run the IO service until it is stopped.
+/**
+ * Errors from handlers are reported and the thread keeps running.
+ * 
+ * \param ios The IO service to run.
+ */
+void runIo(boost::asio::io_service & ios) {
+	while (!ios.stopped()) {
+		try {
+			ios.run();
+			
+		} catch (ServerError const & e) {
+			std::cout << "Remote endpoint shutdown." << std::endl;
+			e.connection->close();
+			
+		} catch (std::exception const & e) {
+			std::cout << "Error: " << e.what() << std::endl;
+		}
+	}
+}
+
 //void my_handler(int s) {
 //	noise_detector->unsubscribe();
 //	exit(0);
@@ -32,6 +78,15 @@ boost::shared_ptr<NoiseDetector> noise_detector;
 int main(int argc, char ** argv) {
 	// Get nao host from command line.
 	std::string nao_host = "localhost";
+	int behavior_timeout = BEHAVIOR_TIMEOUT;
+	std::size_t high_water_mark = ascf::default_high_water_mark;
+	unsigned int io_threads = IO_THREADS;
+	std::string pcm_file;
+	double simulation_speed = 0;
+	int behavior_duration = 2000;
+	std::string behaviors_file;
+	std::string cache_directory = "cache";
+	bool verbose = false;
 	
 //	struct sigaction sigint_handler;
 //	sigint_handler.sa_handler = my_handler;
@@ -55,6 +110,42 @@ int main(int argc, char ** argv) {
 			case 'A':
 				nao_host = argv[++i];
 				break;
+			case 'q':
+			case 'Q':
+				high_water_mark = std::strtoul(argv[++i], nullptr, 10) * 1024;
+				break;
+			case 'b':
+			case 'B':
+				behavior_timeout = std::atoi(argv[++i]);
+				break;
+			case 't':
+			case 'T':
+				io_threads = std::max(1, std::atoi(argv[++i]));
+				break;
+			case 'p':
+			case 'P':
+				pcm_file = argv[++i];
+				break;
+			case 's':
+			case 'S':
+				simulation_speed = std::atof(argv[++i]);
+				break;
+			case 'd':
+			case 'D':
+				behavior_duration = std::atoi(argv[++i]);
+				break;
+			case 'i':
+			case 'I':
+				behaviors_file = argv[++i];
+				break;
+			case 'c':
+			case 'C':
+				cache_directory = argv[++i];
+				break;
+			case 'v':
+			case 'V':
+				verbose = true;
+				break;
 		}
 		i++;
 	}
@@ -62,22 +153,57 @@ int main(int argc, char ** argv) {
 	// The main IO service.
 	boost::asio::io_service ios;
 	
-	// Try to create a broker.
+	// Simulate the robot, or try to create a broker to talk to it.
 	boost::shared_ptr<AL::ALBroker> broker;
-	try {
-		broker = AL::ALBroker::createBroker("robotutor", "0.0.0.0", 54000, nao_host, 9559);
-		AL::ALBrokerManager::setInstance(broker->fBrokerManager.lock());
-		AL::ALBrokerManager::getInstance()->addBroker(broker);
-	} catch (...) {
-		// Documentation doesn't tell us what to catch.....
-		std::cerr << "Failed to connect to robot." << std::endl;
-		return -2;
+	boost::shared_ptr<Backend> backend;
+	if (simulation_speed > 0) {
+		auto simulated = boost::make_shared<SimulatedBackend>(ios, simulation_speed);
+		simulated->behavior_duration = boost::posix_time::milliseconds(behavior_duration);
+		if (!behaviors_file.empty()) {
+			std::ifstream stream(behaviors_file);
+			try {
+				if (!stream) throw std::runtime_error("Failed to open `" + behaviors_file + "'.");
+				simulated->loadBehaviors(stream);
+			} catch (std::exception const & e) {
+				std::cerr << e.what() << std::endl;
+				return -3;
+			}
+		}
+		backend = simulated;
+		std::cout << "Simulating the robot at " << simulation_speed << " times real time." << std::endl;
+	} else {
+		try {
+			broker = AL::ALBroker::createBroker("robotutor", "0.0.0.0", 54000, nao_host, 9559);
+			AL::ALBrokerManager::setInstance(broker->fBrokerManager.lock());
+			AL::ALBrokerManager::getInstance()->addBroker(broker);
+		} catch (...) {
+			// Documentation doesn't tell us what to catch.....
+			std::cerr << "Failed to connect to robot." << std::endl;
+			return -2;
+		}
+		backend = boost::make_shared<NaoqiBackend>(broker);
 	}
 	
-//	noise_detector = NoiseDetector::create(ios, broker, "NoiseDetector");
-	
 	// Initialize the script engine.
-	ScriptEngine engine(ios, broker);
+	ScriptEngine engine(ios, backend);
+	
+	// Replay a recording, or record the microphones of the robot.
+	if (!pcm_file.empty()) {
+		try {
+			engine.audio = boost::make_shared<PcmFileSource>(pcm_file, 16000, 1);
+		} catch (std::exception const & e) {
+			std::cerr << e.what() << std::endl;
+			return -3;
+		}
+	} else if (broker) {
+		noise_detector = NoiseDetector::create(ios, broker, "NoiseDetector");
+		engine.audio   = noise_detector;
+	}
+	
+	engine.cache_directory = cache_directory;
+	engine.verbose         = verbose;
+	engine.behavior.timeout(boost::posix_time::milliseconds(behavior_timeout));
+	engine.server.highWaterMark(high_water_mark, ascf::OverflowPolicy::disconnect);
 	
 	// Load plugins.
 	std::cout << "Loaded " << engine.loadPlugins("lib") << " plugins." << std::endl;
@@ -88,29 +214,22 @@ int main(int argc, char ** argv) {
 	};
 	
 	// Function that deals with a noisy classroom.
-	//auto onNoise = [&engine] (int level) {
+	//auto onNoise = [&engine] (unsigned int channel, float level) {
 	//	std::cout << "Noise detected." << std::endl;
 	//};
 	
-	// Run the IO service.
-	while (true) {
-		try {
-			ios.run();
-			
-		} catch (ServerError const & e) {
-			std::cout << "Remote endpoint shutdown." << std::endl;
-			e.connection->close();
-			
-		} catch (std::exception const & e) {
-			ios.reset();
-			std::cout << "Error: " << e.what() << std::endl;
-		}
+	// Run the IO service on a pool of threads, the engine keeps its own state on a strand.
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < io_threads; ++i) {
+		threads.emplace_back([&ios] () { runIo(ios); });
 	}
+	runIo(ios);
+	for (auto & thread : threads) thread.join();
 	
 	// Make sure all threads are joined before exiting
 	engine.join();
 	
-	broker->shutdown();
+	if (broker) broker->shutdown();
 	
 	return 0;
 }
@@ -0,0 +1,30 @@
+#include "script.hpp"
+
+
+namespace robotutor {
+	
+	namespace command {
+		
+		/// Destroy all commands of the script.
+		/**
+		 * Commands are destroyed in reverse order of creation.
+		 * The memory is released in one go when the arena is destroyed.
+		 */
+		Script::~Script() {
+			for (auto i = commands_.rbegin(); i != commands_.rend(); ++i) {
+				(*i)->~Command();
+			}
+		}
+		
+		/// Write a script to a stream.
+		/**
+		 * \param stream The stream to write to.
+		 * \param script The script to write.
+		 */
+		std::ostream & operator << (std::ostream & stream, Script const & script) {
+			if (script.root()) stream << *script.root();
+			return stream;
+		}
+		
+	}
+}
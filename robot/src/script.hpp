@@ -0,0 +1,95 @@
+#pragma once
+#include <memory>
+#include <new>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "command.hpp"
+
+
+namespace robotutor {
+	
+	class ScriptEngine;
+	
+	namespace command {
+		
+		/// A loaded script.
+		/**
+		 * The script owns all commands of one parsed script.
+		 * Commands are allocated from an arena and destroyed together with the script,
+		 * so the command tree itself only holds plain pointers.
+		 */
+		class Script {
+			public:
+				/// The associated script engine.
+				ScriptEngine & engine;
+				
+			protected:
+				/// Arena holding the commands.
+				Arena arena_;
+				
+				/// All commands in the script, in order of creation.
+				std::vector<Command *> commands_;
+				
+				/// The root command.
+				Command * root_ = nullptr;
+				
+			public:
+				/// Construct an empty script.
+				/**
+				 * \param engine The script engine to create commands for.
+				 */
+				explicit Script(ScriptEngine & engine) :
+					engine(engine) {}
+				
+				Script(Script const &)             = delete;
+				Script & operator = (Script const &) = delete;
+				
+				/// Destroy all commands of the script.
+				~Script();
+				
+				/// Create a command owned by the script.
+				/**
+				 * The script engine is passed as first argument to the constructor of the command.
+				 * 
+				 * \param args The remaining arguments for the constructor of the command.
+				 * \return A pointer to the new command, valid as long as the script exists.
+				 */
+				template<typename T, typename... Args>
+				T * create(Args && ... args) {
+					void * memory = arena_.allocate(sizeof(T), alignof(T));
+					T * command = new (memory) T(engine, std::forward<Args>(args)...);
+					commands_.push_back(command);
+					return command;
+				}
+				
+				/// Get the root command.
+				Command * root() const { return root_; }
+				
+				/// Set the root command.
+				/**
+				 * \param root The new root command, which must be owned by the script.
+				 */
+				void root(Command * root) { root_ = root; }
+				
+				/// Get the number of commands in the script.
+				std::size_t size() const { return commands_.size(); }
+				
+				/// Get the arena holding the commands.
+				Arena const & arena() const { return arena_; }
+		};
+		
+		/// Shared pointer to a script.
+		typedef std::shared_ptr<Script> ScriptPtr;
+		
+		/// Write a script to a stream.
+		/**
+		 * \param stream The stream to write to.
+		 * \param script The script to write.
+		 */
+		std::ostream & operator << (std::ostream & stream, Script const & script);
+		
+	}
+}
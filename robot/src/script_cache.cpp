@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include "script_cache.hpp"
+#include "script_image.hpp"
+#include "script_loader.hpp"
+
+
+namespace robotutor {
+	
+	namespace {
+		/// Magic bytes at the start of a cache file.
+		char const magic[4] = {'R', 'T', 'S', 'C'};
+		
+		/// Version of the cache file format.
+		std::uint32_t const version = 4;
+		
+		/// Number of bytes to parse between progress reports.
+		std::size_t const progress_interval = 64 * 1024;
+		
+		/// Size of the header of a cache file.
+		std::size_t const header_size = 4 + 4 + 8 + 8 + 8;
+		
+		/// Append a little endian integer to a string.
+		/**
+		 * \param buffer The string to append to.
+		 * \param value The value to append.
+		 * \param size The size of the integer in bytes.
+		 */
+		void writeInteger(std::string & buffer, std::uint64_t value, int size) {
+			for (int i = 0; i < size; ++i) buffer.push_back(char((value >> (8 * i)) & 0xff));
+		}
+		
+		/// Read a little endian integer.
+		/**
+		 * \param data The start of the integer.
+		 * \param size The size of the integer in bytes.
+		 * \return The read value.
+		 */
+		std::uint64_t readInteger(char const * data, int size) {
+			std::uint64_t result = 0;
+			for (int i = 0; i < size; ++i) result |= std::uint64_t(static_cast<unsigned char>(data[i])) << (8 * i);
+			return result;
+		}
+		
+		/// Hash a range of bytes with 64 bit FNV-1a.
+		/**
+		 * \param data The start of the range.
+		 * \param size The size of the range.
+		 * \return The hash.
+		 */
+		std::uint64_t fnv1a(char const * data, std::size_t size) {
+			std::uint64_t result = 14695981039346656037ull;
+			for (std::size_t i = 0; i < size; ++i) {
+				result ^= static_cast<unsigned char>(data[i]);
+				result *= 1099511628211ull;
+			}
+			return result;
+		}
+		
+		/// Read only memory mapping of a file.
+		class MappedFile {
+			protected:
+				/// The mapped memory.
+				void * data_ = MAP_FAILED;
+				
+				/// The size of the mapped memory.
+				std::size_t size_ = 0;
+				
+			public:
+				/// Map a file.
+				/**
+				 * If the file can't be mapped, the mapping is invalid.
+				 * 
+				 * \param path The path of the file.
+				 */
+				explicit MappedFile(std::string const & path) {
+					int fd = ::open(path.c_str(), O_RDONLY);
+					if (fd < 0) return;
+					
+					struct stat info;
+					if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+						size_ = info.st_size;
+						data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+					}
+					::close(fd);
+				}
+				
+				MappedFile(MappedFile const &) = delete;
+				MappedFile & operator = (MappedFile const &) = delete;
+				
+				/// Unmap the file.
+				~MappedFile() {
+					if (data_ != MAP_FAILED) ::munmap(data_, size_);
+				}
+				
+				/// Check if the file is mapped.
+				bool valid() const { return data_ != MAP_FAILED; }
+				
+				/// Get the mapped memory.
+				char const * data() const { return static_cast<char const *>(data_); }
+				
+				/// Get the size of the mapped memory.
+				std::size_t size() const { return size_; }
+		};
+		
+		/// Builder that only checks the structure of an image, including the images of arguments.
+		struct Validator : public image::Builder {
+			void speech(boost::string_ref, std::vector<std::uint32_t> const &) override {}
+			
+			void command(boost::string_ref, std::size_t) override {}
+			
+			void argument(boost::string_ref, char const * data, std::size_t size) override {
+				image::read(data, size, *this);
+			}
+			
+			void frame(std::size_t) override {}
+		};
+	}
+	
+	/// Construct a script cache.
+	/**
+	 * The directory is created when the first entry is stored.
+	 * 
+	 * \param directory The directory holding the cache files.
+	 */
+	ScriptCache::ScriptCache(std::string const & directory) :
+		directory_(directory) {}
+	
+	/// Hash a script text.
+	/**
+	 * \param text The script text.
+	 * \return The hash of the text.
+	 */
+	std::uint64_t ScriptCache::hash(std::string const & text) {
+		return fnv1a(text.data(), text.size());
+	}
+	
+	/// Get the path of the cache file for a hash of a script text.
+	/**
+	 * \param hash The hash of the script text.
+	 * \return The path of the cache file.
+	 */
+	std::string ScriptCache::path(std::uint64_t hash) const {
+		std::ostringstream result;
+		result << directory_ << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".rtsc";
+		return result.str();
+	}
+	
+	/// Get the image of a script, parsing it only if it isn't in the cache yet.
+	/**
+	 * Newly parsed scripts are added to the cache.
+	 * A cache file that is not a valid image is replaced by parsing the script again.
+	 * No commands are created, so this can run on any thread.
+	 * 
+	 * \param text The script text.
+	 * \param progress Callback to report parsing progress, or a null function.
+	 * \return The image of the script, or an image without owner if parsing was cancelled.
+	 */
+	ScriptCache::Image ScriptCache::image(std::string const & text, ProgressHandler const & progress) {
+		std::uint64_t text_hash = hash(text);
+		Image result;
+		
+		auto file = std::make_shared<MappedFile>(path(text_hash));
+		if (file->valid() && file->size() >= header_size
+			&& std::memcmp(file->data(), magic, 4) == 0
+			&& readInteger(file->data() + 4, 4) == version
+			&& readInteger(file->data() + 8, 8) == text_hash
+			&& readInteger(file->data() + 16, 8) == text.size()
+			&& readInteger(file->data() + 24, 8) == file->size() - header_size
+		) {
+			try {
+				// Read the whole image here, so loading it on the strand can't fail on a damaged file.
+				Validator validator;
+				image::read(file->data() + header_size, file->size() - header_size, validator);
+				result.owner = file;
+				result.data  = file->data() + header_size;
+				result.size  = file->size() - header_size;
+				return result;
+			} catch (std::exception const &) {
+				// Fall through to parsing the script again.
+			}
+		}
+		file.reset();
+		
+		auto parsed = std::make_shared<std::string>(compile_(text, text_hash, progress));
+		if (parsed->empty()) return result;
+		result.owner = parsed;
+		result.data  = parsed->data();
+		result.size  = parsed->size();
+		return result;
+	}
+	
+	/// Load a script, parsing it only if it isn't in the cache yet.
+	/**
+	 * Newly parsed scripts are added to the cache.
+	 * The commands are created by the factory of the engine, so this must run on the strand of the engine.
+	 * 
+	 * \param engine The script engine to create the commands for.
+	 * \param text The script text.
+	 * \param progress Callback to report parsing progress, or a null function.
+	 * \return The loaded script, or a null pointer if parsing was cancelled.
+	 */
+	command::ScriptPtr ScriptCache::load(ScriptEngine & engine, std::string const & text, ProgressHandler const & progress) {
+		Image script = image(text, progress);
+		if (!script.owner) return nullptr;
+		return loadScriptImage(engine, script.data, script.size);
+	}
+	
+	/// Parse a script and store it in the cache.
+	/**
+	 * Failure to write the cache file is not an error,
+	 * the script will simply be parsed again the next time.
+	 * 
+	 * \param text The script text.
+	 * \param hash The hash of the script text.
+	 * \param progress Callback to report parsing progress, or a null function.
+	 * \return The image of the parsed script, or an empty string if parsing was cancelled.
+	 */
+	std::string ScriptCache::compile_(std::string const & text, std::uint64_t hash, ProgressHandler const & progress) {
+		std::string image;
+		if (progress) {
+			ScriptParser parser;
+			for (std::size_t parsed = 0; parsed < text.size();) {
+				std::size_t chunk = std::min(progress_interval, text.size() - parsed);
+				parse(parser, text.begin() + parsed, text.begin() + parsed + chunk);
+				parsed += chunk;
+				if (!progress(parsed, text.size())) return std::string();
+			}
+			image = parser.result();
+		} else {
+			image = parseScriptImage(text);
+		}
+		
+		store_(hash, text.size(), image);
+		return image;
+	}
+	
+	/// Store a script image in the cache.
+	/**
+	 * The file is written under a temporary name and renamed when complete,
+	 * so a concurrent load never sees a partial file.
+	 * The temporary name is unique per thread, so parallel stores of the same script don't clash.
+	 * The temporary file is removed again if writing or renaming it fails.
+	 * 
+	 * \param hash The hash of the script text.
+	 * \param text_size The size of the script text.
+	 * \param image The image of the parsed script.
+	 * \return True if the image was stored.
+	 */
+	bool ScriptCache::store_(std::uint64_t hash, std::size_t text_size, std::string const & image) {
+		boost::system::error_code error;
+		boost::filesystem::create_directories(directory_, error);
+		if (error) return false;
+		
+		std::string header(magic, 4);
+		writeInteger(header, version, 4);
+		writeInteger(header, hash, 8);
+		writeInteger(header, text_size, 8);
+		writeInteger(header, image.size(), 8);
+		
+		std::string target    = path(hash);
+		std::ostringstream temporary_name;
+		temporary_name << target << "." << std::this_thread::get_id() << ".tmp";
+		std::string temporary = temporary_name.str();
+		bool written;
+		{
+			std::ofstream stream(temporary, std::ios::binary | std::ios::trunc);
+			stream.write(header.data(), header.size());
+			stream.write(image.data(), image.size());
+			stream.close();
+			written = !stream.fail();
+		}
+		if (written && std::rename(temporary.c_str(), target.c_str()) == 0) return true;
+		std::remove(temporary.c_str());
+		return false;
+	}
+	
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "script.hpp"
+
+namespace robotutor {
+	
+	class ScriptEngine;
+	
+	/// On-disk cache of parsed scripts.
+	/**
+	 * The cache holds script images, keyed by a hash of the script text.
+	 * Images don't depend on the loaded plugins, since commands are only created when an image is loaded.
+	 * 
+	 * Every entry is a single file that is memory mapped when it is loaded.
+	 * A file consists of a header followed by the script image:
+	 *  - the magic bytes "RTSC",
+	 *  - the format version as 32 bit little endian integer,
+	 *  - the hash and size of the script text as 64 bit little endian integers,
+	 *  - the size of the image as 64 bit little endian integer.
+	 * 
+	 * The image itself is not checksummed, so a hit costs a single hash of the text.
+	 * Files are only ever renamed into place when complete, and loading still checks every size it reads.
+	 */
+	class ScriptCache {
+		public:
+			/// Callback to report parsing progress.
+			/**
+			 * Receives the number of parsed bytes and the total size of the script.
+			 * Parsing is cancelled if the callback returns false.
+			 */
+			typedef std::function<bool (std::size_t parsed, std::size_t total)> ProgressHandler;
+			
+			/// The image of a script, mapped from a cache file or freshly parsed.
+			struct Image {
+				/// Keeps the memory of the image alive, null if there is no image.
+				std::shared_ptr<void const> owner;
+				
+				/// The start of the image.
+				char const * data = nullptr;
+				
+				/// The size of the image in bytes.
+				std::size_t size = 0;
+			};
+			
+		protected:
+			/// The directory holding the cache files.
+			std::string directory_;
+			
+		public:
+			/// Construct a script cache.
+			/**
+			 * The directory is created when the first entry is stored.
+			 * 
+			 * \param directory The directory holding the cache files.
+			 */
+			explicit ScriptCache(std::string const & directory);
+			
+			/// Get the directory holding the cache files.
+			std::string const & directory() const { return directory_; }
+			
+			/// Hash a script text.
+			/**
+			 * \param text The script text.
+			 * \return The hash of the text.
+			 */
+			static std::uint64_t hash(std::string const & text);
+			
+			/// Get the path of the cache file for a script text.
+			/**
+			 * \param text The script text.
+			 * \return The path of the cache file.
+			 */
+			std::string path(std::string const & text) const { return path(hash(text)); }
+			
+			/// Get the path of the cache file for a hash of a script text.
+			/**
+			 * \param hash The hash of the script text.
+			 * \return The path of the cache file.
+			 */
+			std::string path(std::uint64_t hash) const;
+			
+			/// Get the image of a script, parsing it only if it isn't in the cache yet.
+			/**
+			 * Newly parsed scripts are added to the cache.
+			 * A cache file that is not a valid image is replaced by parsing the script again.
+			 * No commands are created, so this can run on any thread.
+			 * 
+			 * \param text The script text.
+			 * \param progress Callback to report parsing progress, or a null function.
+			 * \return The image of the script, or an image without owner if parsing was cancelled.
+			 */
+			Image image(std::string const & text, ProgressHandler const & progress = nullptr);
+			
+			/// Load a script, parsing it only if it isn't in the cache yet.
+			/**
+			 * Newly parsed scripts are added to the cache.
+			 * The commands are created by the factory of the engine, so this must run on the strand of the engine.
+			 * 
+			 * \param engine The script engine to create the commands for.
+			 * \param text The script text.
+			 * \param progress Callback to report parsing progress, or a null function.
+			 * \return The loaded script, or a null pointer if parsing was cancelled.
+			 */
+			command::ScriptPtr load(ScriptEngine & engine, std::string const & text, ProgressHandler const & progress = nullptr);
+			
+			/// Parse a script and store it in the cache.
+			/**
+			 * \param text The script text.
+			 * \param progress Callback to report parsing progress, or a null function.
+			 * \return The image of the parsed script, or an empty string if parsing was cancelled.
+			 */
+			std::string compile(std::string const & text, ProgressHandler const & progress = nullptr) {
+				return compile_(text, hash(text), progress);
+			}
+			
+		protected:
+			/// Parse a script and store it in the cache.
+			/**
+			 * \param text The script text.
+			 * \param hash The hash of the script text.
+			 * \param progress Callback to report parsing progress, or a null function.
+			 * \return The image of the parsed script, or an empty string if parsing was cancelled.
+			 */
+			std::string compile_(std::string const & text, std::uint64_t hash, ProgressHandler const & progress);
+			
+			/// Store a script image in the cache.
+			/**
+			 * \param hash The hash of the script text.
+			 * \param text_size The size of the script text.
+			 * \param image The image of the parsed script.
+			 * \return True if the image was stored.
+			 */
+			bool store_(std::uint64_t hash, std::size_t text_size, std::string const & image);
+	};
+	
+}
@@ -1,31 +1,59 @@
 #include <boost/filesystem.hpp>
+#include <boost/make_shared.hpp>
 
 #include "script_engine.hpp"
 #include "plugin.hpp"
+#include "core_commands.hpp"
 
 namespace robotutor {
 	
 	/// Construct the script engine.
 	/**
-	 * \param broker The ALBroker to use for communicating with naoqi.
+	 * \param ios The IO service to use.
+	 * \param backend The backend providing the services of the robot.
+	 * \param port The TCP port to accept clients on, or 0 to not accept clients.
 	 */
-	ScriptEngine::ScriptEngine(boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker) :
-		broker(broker),
-		speech(SpeechEngine::create(ios, broker, "RTISE")),
-		behavior(this, ios, broker, random),
+	ScriptEngine::ScriptEngine(boost::asio::io_service & ios, boost::shared_ptr<Backend> backend, unsigned short port) :
+		strand_(ios),
+		backend(backend),
+		broker(backend->broker()),
+		speech(boost::make_shared<SpeechEngine>(strand_, backend->createTts(ios))),
+		behavior(this, ios, backend, random),
 		server(ios),
 		factory(*this),
-		behavior_done(false),
 		ios_(ios)
 	{
-		server.listenIp4(8311);
+		speech->stats = &stats;
+		if (port) server.listenIp4(port);
 		server.on_message = std::bind(&ScriptEngine::handleMessage_, this, std::placeholders::_1, std::placeholders::_2);
 	}
 	
+	/// Destruct the script engine.
+	/**
+	 * The loaded script and the command factory hold code of the plugins,
+	 * so they are released before the plugins are unloaded.
+	 */
+	ScriptEngine::~ScriptEngine() {
+		load(nullptr);
+		factory.clear();
+		plugins_.clear();
+	}
+	
 	/// Load a script.
-	void ScriptEngine::load(std::shared_ptr<command::Command> script) {
-		root_    = script;
-		current_ = root_.get();
+	/**
+	 * The previously loaded script is released.
+	 * 
+	 * \param script The script to load, or a null pointer to unload the current script.
+	 */
+	void ScriptEngine::load(command::ScriptPtr script) {
+		evictAll_();
+		++generation_;
+		script_  = script;
+		program_ = command::compile(script_ ? script_->root() : nullptr);
+		pc_      = 0;
+		calling_ = false;
+		return_  = nullptr;
+		current_ = nullptr;
 	}
 	
 	/// Join any background threads created by the engine.
@@ -35,7 +63,6 @@ namespace robotutor {
 	 */
 	void ScriptEngine::join() {
 		speech->join();
-		behavior.join();
 		if (wait_thread_.joinable()) wait_thread_.join();
 		for (auto & plugin : plugins_) plugin->join();
 	}
@@ -97,13 +124,30 @@ namespace robotutor {
 		return total;
 	}
 	
+	/// Add a plugin that is linked into the program instead of loaded from a shared library.
+	/**
+	 * Like loading a plugin, this must happen before the IO service runs.
+	 * 
+	 * \param plugin The plugin.
+	 */
+	void ScriptEngine::addPlugin(std::shared_ptr<Plugin> plugin) {
+		plugins_.push_back(plugin);
+	}
+	
 	/// Handle messages by passing them to all registered plugins.
 	/**
+	 * Messages arrive on the strand of the connection,
+	 * the plugins are invoked on the strand of the engine.
+	 * 
 	 * \param connection The connection that sent the message.
 	 * \param message The message.
 	 */
 	void ScriptEngine::handleMessage_(SharedServerConnection connection, ClientMessage && message) {
-		for (auto & plugin : plugins_) plugin->handleMessage(connection, message);
+		auto shared = std::make_shared<ClientMessage>();
+		shared->Swap(&message);
+		strand_.post([this, connection, shared] () {
+			for (auto & plugin : plugins_) plugin->handleMessage(connection, *shared);
+		});
 	}
 	
 	/// Wait for the engine to stop cleanly.
@@ -112,14 +156,125 @@ namespace robotutor {
 	 */
 	void ScriptEngine::wait_(std::function<void ()> handler) {
 		speech->join();
-		behavior.join();
 		started_ = false;
-		if (handler) ios_.post(handler);
+		if (handler) strand_.post(handler);
+	}
+	
+	/// Get the speech commands that are certain to follow the current speak instruction.
+	/**
+	 * Only consecutive speak instructions qualify.
+	 * The chain also ends after a sentence with embedded commands,
+	 * since those may hold up the script until they are done.
+	 * 
+	 * \return The upcoming speech commands, in order.
+	 */
+	std::vector<command::Speech *> ScriptEngine::upcoming_() const {
+		std::vector<command::Speech *> result;
+		for (std::size_t i = pc_; i + 1 < program_.size() && result.size() < speech->lookahead(); ++i) {
+			if (!program_[i].command->children.empty() || program_[i + 1].op != command::Opcode::speak) break;
+			result.push_back(static_cast<command::Speech *>(program_[i + 1].command));
+		}
+		return result;
+	}
+	
+	/// Prefetch the commands of upcoming instructions and evict those of passed instructions.
+	/**
+	 * Commands embedded in a sentence are prefetched with the sentence.
+	 * Commands that run on the tree walker are prefetched, but their children aren't,
+	 * since those may be lowered into instructions of their own.
+	 */
+	void ScriptEngine::prefetch_() {
+		// After a jump back, start over from the new position.
+		if (pc_ < prefetch_pc_) evictAll_();
+		prefetch_pc_ = pc_;
+		
+		while (!prefetched_.empty() && prefetched_.front().first < pc_) {
+			prefetched_.front().second->evict();
+			prefetched_.pop_front();
+		}
+		
+		auto prefetch = [this] (std::size_t index, command::Command * command) {
+			if (command->prefetch()) prefetched_.emplace_back(index, command);
+		};
+		
+		if (prefetch_end_ < pc_) prefetch_end_ = pc_;
+		for (; prefetch_end_ < program_.size() && prefetch_end_ < pc_ + prefetch_depth_; ++prefetch_end_) {
+			command::Instruction const & instruction = program_[prefetch_end_];
+			if (instruction.op == command::Opcode::speak) {
+				for (auto child : instruction.command->children) prefetch(prefetch_end_, child);
+			} else if (instruction.op == command::Opcode::call) {
+				prefetch(prefetch_end_, instruction.command);
+			}
+		}
+	}
+	
+	/// Evict all prefetched commands.
+	void ScriptEngine::evictAll_() {
+		for (auto & entry : prefetched_) entry.second->evict();
+		prefetched_.clear();
+		prefetch_end_ = 0;
+		prefetch_pc_  = 0;
 	}
 	
 	/// Run the script.
+	/**
+	 * Runs the compiled program until a command has to wait for an asynchronous operation.
+	 */
 	void ScriptEngine::continue_() {
-		while (current_ && current_->step());
+		while (true) {
+			// Commands that weren't lowered run on the tree walker until they return to their parent.
+			if (calling_) {
+				if (current_ && current_ != return_) {
+					// Commands not created by the factory get their histogram on their first step.
+					// Look it up before stepping, the step may release the command.
+					if (!current_->steps) current_->steps = &stats.steps(current_->name());
+					Histogram * histogram = current_->steps;
+					Stats::Clock::time_point start = Stats::Clock::now();
+					bool proceed = current_->step();
+					histogram->record(Stats::Clock::now() - start);
+					if (proceed) continue;
+					return;
+				}
+				calling_ = false;
+				current_ = nullptr;
+				++pc_;
+			}
+			
+			if (pc_ >= program_.size()) return;
+			command::Instruction const & instruction = program_[pc_];
+			
+			switch (instruction.op) {
+				case command::Opcode::speak:
+					prefetch_();
+					speech->prefetch(upcoming_());
+					current_ = instruction.command;
+					return_  = instruction.command->parent;
+					calling_ = true;
+					break;
+					
+				case command::Opcode::call:
+					prefetch_();
+					current_ = instruction.command;
+					return_  = instruction.command->parent;
+					calling_ = true;
+					break;
+					
+				case command::Opcode::branch: {
+					int branch = instruction.command->branch();
+					pc_ += 1 + (branch >= 0 && branch < instruction.offset ? branch : instruction.offset);
+					break;
+				}
+				
+				case command::Opcode::jump:
+					pc_ += instruction.offset;
+					break;
+					
+				case command::Opcode::stop:
+					++pc_;
+					stop();
+					return;
+			}
+		}
 	}
 	
 }
@@ -1,5 +1,7 @@
 #pragma once
 #include <atomic>
+#include <deque>
+#include <string>
 #include <thread>
 #include <functional>
 
@@ -7,9 +9,14 @@
 
 #include "command.hpp"
 #include "command_factory.hpp"
+#include "script.hpp"
+#include "program.hpp"
+#include "audio_source.hpp"
+#include "backend.hpp"
 #include "speech_engine.hpp"
 #include "behavior_engine.hpp"
 #include "robotutor_protocol.hpp"
+#include "stats.hpp"
 
 namespace AL {
 	class ALBroker;
@@ -20,12 +27,31 @@ namespace robotutor {
 	/// Collection of engines required by commands.
 	/**
 	 * Commands get access to the script engine during executing.
+	 * 
+	 * The IO service may be run by multiple threads.
+	 * Script execution, speech and behavior events and plugin message handlers
+	 * are all serialized on the strand of the engine.
 	 */
 	class ScriptEngine {
 		friend class command::Command;
+		protected:
+			/// Strand to serialize all script execution on.
+			/**
+			 * Declared before the engines, since they are constructed with it.
+			 */
+			boost::asio::io_service::strand strand_;
+			
 		public:
+			/// Latency statistics.
+			/**
+			 * Declared before the factory, which resolves the step histogram of every command it registers.
+			 */
+			Stats stats;
 			
-			/// The AL broker for naoqi communication.
+			/// The backend providing the services of the robot.
+			boost::shared_ptr<Backend> backend;
+			
+			/// The AL broker for naoqi communication, null when the backend doesn't use naoqi.
 			boost::shared_ptr<AL::ALBroker> broker;
 			
 			/// The text-to-speech engine.
@@ -34,6 +60,9 @@ namespace robotutor {
 			/// The behavior engine.
 			BehaviorEngine behavior;
 			
+			/// Source of recorded audio, may be null.
+			boost::shared_ptr<AudioSource> audio;
+			
 			/// The server engine.
 			Server server;
 			
@@ -43,7 +72,15 @@ namespace robotutor {
 			/// Random number generator.
 			boost::random::mt19937 random;
 			
-			bool behavior_done;
+			/// Directory to cache parsed scripts in.
+			/**
+			 * Relative paths are taken from the working directory of the process.
+			 */
+			std::string cache_directory { "cache" };
+			
+			/// If true, loaded scripts and other debug output are printed.
+			bool verbose { false };
+			
 		protected:
 			/// The IO service to use.
 			boost::asio::io_service & ios_;
@@ -51,12 +88,42 @@ namespace robotutor {
 			/// Registered plugins.
 			std::vector<std::shared_ptr<Plugin>> plugins_;
 			
-			/// The root command.
-			std::shared_ptr<command::Command> root_ { nullptr };
+			/// The loaded script.
+			command::ScriptPtr script_ { nullptr };
+			
+			/// The compiled form of the loaded script.
+			command::Program program_;
+			
+			/// Index of the current instruction.
+			std::size_t pc_ { 0 };
+			
+			/// True while a command is run by walking the command tree.
+			bool calling_ { false };
+			
+			/// The command that the tree walker returns to when a call is done.
+			command::Command * return_ { nullptr };
 			
 			/// The current command.
 			command::Command * current_ { nullptr };
 			
+			/// Prefetched commands with the index of the instruction they were found at, in program order.
+			std::deque<std::pair<std::size_t, command::Command *>> prefetched_;
+			
+			/// Index of the first instruction that hasn't been scanned for commands to prefetch.
+			std::size_t prefetch_end_ { 0 };
+			
+			/// Index of the instruction at the last prefetch, to detect jumps back.
+			std::size_t prefetch_pc_ { 0 };
+			
+			/// Number of instructions to scan ahead for commands to prefetch.
+			std::size_t prefetch_depth_ { 8 };
+			
+			/// Number of times a script was loaded, so completions meant for an earlier script can be recognized.
+			/**
+			 * Only used on the strand of the engine.
+			 */
+			unsigned int generation_ { 0 };
+			
 			/// True if the engine is started.
 			std::atomic_bool started_ { false };
 			
@@ -66,12 +133,26 @@ namespace robotutor {
 		public:
 			/// Construct the script engine.
 			/**
-			 * \param broker The ALBroker to use for communicating with naoqi.
+			 * \param ios The IO service to use.
+			 * \param backend The backend providing the services of the robot.
+			 * \param port The TCP port to accept clients on, or 0 to not accept clients.
+			 */
+			ScriptEngine(boost::asio::io_service & ios, boost::shared_ptr<Backend> backend, unsigned short port = 8311);
+			
+			/// Destruct the script engine.
+			/**
+			 * The loaded script and the command factory hold code of the plugins,
+			 * so they are released before the plugins are unloaded.
 			 */
-			ScriptEngine(boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker);
+			~ScriptEngine();
 			
 			/// Load a script.
-			void load(std::shared_ptr<command::Command> script);
+			/**
+			 * The previously loaded script is released.
+			 * 
+			 * \param script The script to load, or a null pointer to unload the current script.
+			 */
+			void load(command::ScriptPtr script);
 			
 			/// Get the IO service used by the engine.
 			/**
@@ -79,12 +160,37 @@ namespace robotutor {
 			 */
 			boost::asio::io_service & ios() { return ios_; }
 			
+			/// Get the strand that serializes script execution.
+			/**
+			 * Asynchronous operations that continue the script must complete on this strand.
+			 * 
+			 * \return The strand.
+			 */
+			boost::asio::io_service::strand & strand() { return strand_; }
+			
 			/// Get the current command.
 			/**
-			 * \return The command currently executing.
+			 * \return The command currently executing, or a null pointer between instructions.
 			 */
 			command::Command * current() { return current_; }
 			
+			/// Get the number of times a script was loaded.
+			/**
+			 * Must be called on the strand of the engine.
+			 * 
+			 * \return The number of calls to load() so far.
+			 */
+			unsigned int generation() const { return generation_; }
+			
+			/// Get the number of instructions to scan ahead for commands to prefetch.
+			std::size_t prefetchDepth() const { return prefetch_depth_; }
+			
+			/// Set the number of instructions to scan ahead for commands to prefetch.
+			/**
+			 * \param depth The number of instructions, or zero to disable prefetching.
+			 */
+			void prefetchDepth(std::size_t depth) { prefetch_depth_ = depth; }
+			
 			/// Check if the engine is executing a script.
 			/**
 			 * \return True if the engine is currently executing a script.
@@ -121,6 +227,14 @@ namespace robotutor {
 			 */
 			unsigned int loadPlugins(std::string const & directory);
 			
+			/// Add a plugin that is linked into the program instead of loaded from a shared library.
+			/**
+			 * Like loading a plugin, this must happen before the IO service runs.
+			 * 
+			 * \param plugin The plugin.
+			 */
+			void addPlugin(std::shared_ptr<Plugin> plugin);
+			
 		protected:
 			/// Handle messages by passing them to all registered message handlers.
 			/**
@@ -135,7 +249,22 @@ namespace robotutor {
 			 */
 			void wait_(std::function<void ()> callback = nullptr);
 			
+			/// Get the speech commands that are certain to follow the current speak instruction.
+			/**
+			 * \return The upcoming speech commands, in order.
+			 */
+			std::vector<command::Speech *> upcoming_() const;
+			
+			/// Prefetch the commands of upcoming instructions and evict those of passed instructions.
+			void prefetch_();
+			
+			/// Evict all prefetched commands.
+			void evictAll_();
+			
 			/// Continue the script.
+			/**
+			 * Runs the compiled program until a command has to wait for an asynchronous operation.
+			 */
 			void continue_();
 	};
 	
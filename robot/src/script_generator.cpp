@@ -0,0 +1,60 @@
+#include <boost/random/mersenne_twister.hpp>
+
+#include "script_generator.hpp"
+
+
+namespace robotutor {
+	
+	/// Generate a script with a mix of sentences, embedded commands, arguments and comments.
+	/**
+	 * The script is the same for the same parameters, so benchmark results can be compared.
+	 * 
+	 * \param sentences The number of sentences.
+	 * \param embedded The number of extra commands to embed in every sentence.
+	 * \return The script.
+	 */
+	std::string generateScript(unsigned int sentences, unsigned int embedded) {
+		boost::random::mt19937 random(42);
+		char const * words[] = {"robot", "tutor", "lecture", "camera", "microphone", "question", "answer", "students", "today", "walk", "sit", "dance"};
+		char const * behaviors[] = {"Capisce", "ConvergeHands", "HandOverLeft", "HandOverRight", "PushAsideBoth", "SpreadBoth", "SpreadLeft", "SpreadRight"};
+		std::string script;
+		for (unsigned int i = 0; i < sentences; ++i) {
+			if (random() % 10 == 0) script += "# A comment line.\n";
+			if (random() % 8 == 0) script += "\\pau=500\\\n";
+			unsigned int length = 4 + random() % 12;
+			for (unsigned int w = 0; w < length; ++w) {
+				script += words[random() % 12];
+				script += ' ';
+				for (unsigned int c = w * embedded / length; c < (w + 1) * embedded / length; ++c) script += "{bench mark} ";
+				if (random() % 10 == 0) script += "{behavior|robotutor/generic/" + std::string(behaviors[random() % 8]) + "} ";
+				if (random() % 25 == 0) script += "{slide} ";
+				if (random() % 40 == 0) script += "{sound|/home/nao/sounds/" + std::string(words[random() % 12]) + ".wav} ";
+			}
+			script += i % 3 ? ".\n" : "!\n";
+			if (random() % 20 == 0) script += "{random behavior|robotutor/generic/}\n";
+		}
+		return script;
+	}
+	
+	/// Generate a script of sentences nested in command arguments to a fixed depth.
+	/**
+	 * Every sentence is wrapped in `depth' commands, each taking the next level as its only argument.
+	 * 
+	 * \param depth The nesting depth of every sentence, at least 1.
+	 * \param size The minimum size of the script in bytes.
+	 * \return The script.
+	 */
+	std::string generateNestedScript(unsigned int depth, std::size_t size) {
+		std::string sentence;
+		for (unsigned int i = 0; i < depth; ++i) sentence += "{nest|";
+		sentence += "robot tutor lecture.";
+		sentence.append(depth, '}');
+		sentence += '\n';
+		
+		std::string script;
+		script.reserve(size + sentence.size());
+		while (script.size() < size) script += sentence;
+		return script;
+	}
+	
+}
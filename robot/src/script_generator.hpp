@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+namespace robotutor {
+	
+	/// Generate a script with a mix of sentences, embedded commands, arguments and comments.
+	/**
+	 * The script is the same for the same parameters, so benchmark results can be compared.
+	 * 
+	 * \param sentences The number of sentences.
+	 * \param embedded The number of extra commands to embed in every sentence.
+	 * \return The script.
+	 */
+	std::string generateScript(unsigned int sentences, unsigned int embedded);
+	
+	/// Generate a script of sentences nested in command arguments to a fixed depth.
+	/**
+	 * Every sentence is wrapped in `depth' commands, each taking the next level as its only argument.
+	 * 
+	 * \param depth The nesting depth of every sentence, at least 1.
+	 * \param size The minimum size of the script in bytes.
+	 * \return The script.
+	 */
+	std::string generateNestedScript(unsigned int depth, std::size_t size);
+	
+}
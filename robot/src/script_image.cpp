@@ -0,0 +1,205 @@
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "script_image.hpp"
+#include "parser_common.hpp"
+
+
+namespace robotutor {
+	namespace image {
+		
+		namespace {
+			/// Reader for the fields of a script image.
+			struct Reader {
+				/// The current position.
+				unsigned char const * position;
+				
+				/// The end of the image.
+				unsigned char const * end;
+				
+				/// Check if the whole image has been read.
+				bool done() const { return position == end; }
+				
+				/// Make sure a number of bytes is available.
+				void require(std::size_t size) const {
+					if (std::size_t(end - position) < size) throw std::runtime_error("Script image is truncated.");
+				}
+				
+				/// Read an operation.
+				Op op() {
+					require(1);
+					return Op(*position++);
+				}
+				
+				/// Read a size.
+				std::uint32_t size() {
+					require(4);
+					std::uint32_t result = 0;
+					for (int i = 0; i < 4; ++i) result |= std::uint32_t(*position++) << (8 * i);
+					return result;
+				}
+				
+				/// Read a string without copying it.
+				/**
+				 * The result points into the image, so it is only valid as long as the image is.
+				 */
+				boost::string_ref view() {
+					std::uint32_t length = size();
+					require(length);
+					boost::string_ref result(reinterpret_cast<char const *>(position), length);
+					position += length;
+					return result;
+				}
+			};
+			
+			/// Builder writing an image as script text.
+			class Writer : public Builder {
+				protected:
+					/// Stack of written commands.
+					std::vector<std::string> commands_;
+					
+					/// Stack of written arguments.
+					std::vector<std::string> arguments_;
+					
+				public:
+					/// Get the text of the root command, once the whole image has been read.
+					std::string const & root() const { return commands_.back(); }
+					
+					/// Write a sentence with its embedded commands at their offsets.
+					void speech(boost::string_ref text, std::vector<std::uint32_t> const & marks) override {
+						std::ostringstream stream;
+						std::size_t first    = commands_.size() - marks.size();
+						std::size_t position = 0;
+						for (std::size_t i = 0; i < marks.size(); ++i) {
+							parser::writeText(stream, text.substr(position, marks[i] - position));
+							stream << commands_[first + i];
+							position = marks[i];
+						}
+						parser::writeText(stream, text.substr(position));
+						commands_.resize(first);
+						commands_.push_back(stream.str());
+					}
+					
+					/// Write a command with its arguments.
+					void command(boost::string_ref name, std::size_t count) override {
+						std::string result = "{" + name.to_string();
+						for (auto i = arguments_.end() - count; i != arguments_.end(); ++i) result += "|" + *i;
+						result += "}";
+						arguments_.resize(arguments_.size() - count);
+						commands_.push_back(std::move(result));
+					}
+					
+					/// Write an argument from its image.
+					void argument(boost::string_ref, char const * data, std::size_t size) override {
+						std::ostringstream stream;
+						write(stream, data, size);
+						arguments_.push_back(stream.str());
+					}
+					
+					/// Write a frame as execute command, unless it has only one command.
+					void frame(std::size_t count) override {
+						if (count == 1) return;
+						std::string result = "{execute";
+						for (auto i = commands_.end() - count; i != commands_.end(); ++i) result += "|" + *i;
+						result += "}";
+						commands_.resize(commands_.size() - count);
+						commands_.push_back(std::move(result));
+					}
+			};
+		}
+		
+		/// Read an image.
+		/**
+		 * Throws if the image is malformed.
+		 * The strings passed to the builder point into the image.
+		 * 
+		 * \param data The start of the image.
+		 * \param size The size of the image in bytes.
+		 * \param builder The builder to pass the operations to.
+		 */
+		void read(char const * data, std::size_t size, Builder & builder) {
+			Reader reader{reinterpret_cast<unsigned char const *>(data), reinterpret_cast<unsigned char const *>(data) + size};
+			
+			// Only the depth of the stacks is tracked, the builder keeps the values.
+			std::size_t commands  = 0;
+			std::size_t arguments = 0;
+			std::vector<std::uint32_t> marks;
+			
+			while (!reader.done()) {
+				switch (reader.op()) {
+					case Op::speech: {
+						boost::string_ref text = reader.view();
+						std::uint32_t count    = reader.size();
+						if (commands < count) throw std::runtime_error("Script image is corrupt.");
+						
+						// Marks must be sorted and inside the text.
+						marks.clear();
+						std::uint32_t last = 0;
+						for (std::uint32_t i = 0; i < count; ++i) {
+							std::uint32_t offset = reader.size();
+							if (offset < last || offset > text.size()) throw std::runtime_error("Script image is corrupt.");
+							marks.push_back(offset);
+							last = offset;
+						}
+						
+						builder.speech(text, marks);
+						commands = commands - count + 1;
+						break;
+					}
+					
+					case Op::command: {
+						boost::string_ref name = reader.view();
+						std::uint32_t count    = reader.size();
+						if (arguments < count) throw std::runtime_error("Script image is corrupt.");
+						builder.command(name, count);
+						arguments -= count;
+						++commands;
+						break;
+					}
+					
+					// The image of the argument is skipped, it is only read when asked for.
+					case Op::argument: {
+						std::uint32_t length = reader.size();
+						reader.require(length);
+						char const * argument = reinterpret_cast<char const *>(reader.position);
+						reader.position += length;
+						builder.argument(reader.view(), argument, length);
+						++arguments;
+						break;
+					}
+					
+					case Op::frame: {
+						std::uint32_t count = reader.size();
+						if (commands < count || (count == 1 && commands == 0)) throw std::runtime_error("Script image is corrupt.");
+						builder.frame(count);
+						commands = commands - count + 1;
+						break;
+					}
+					
+					default:
+						throw std::runtime_error("Script image is corrupt.");
+				}
+			}
+			
+			if (commands != 1 || arguments) throw std::runtime_error("Script image is corrupt.");
+		}
+		
+		/// Write an image as script text.
+		/**
+		 * The text is the same as writing the loaded script, with frames written as execute commands.
+		 * Parsing the text gives an image that writes the same text again.
+		 * Throws if the image is malformed.
+		 * 
+		 * \param stream The stream to write to.
+		 * \param data The start of the image.
+		 * \param size The size of the image in bytes.
+		 */
+		void write(std::ostream & stream, char const * data, std::size_t size) {
+			Writer writer;
+			read(data, size, writer);
+			stream << writer.root();
+		}
+		
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+namespace robotutor {
+	
+	/// Binary image of a parsed script.
+	/**
+	 * The image describes the command tree of a script without depending on any plugin,
+	 * so it can be produced and read without a script engine and stored for later use.
+	 * Commands are only created when the image is loaded with loadScriptImage().
+	 * 
+	 * The image is a sequence of operations in post order.
+	 * Loading it runs a small stack machine:
+	 *  - speech <text> <n> <offset>...: pop n commands and push a sentence with those commands as bookmarked children,
+	 *    each triggered at the given character offset in the text.
+	 *  - command <name> <n>: pop n arguments and push the command created by the factory.
+	 *  - argument <n> <image> <text>: push an argument with the given literal text.
+	 *    The n bytes of image are a complete image for the argument,
+	 *    which is only loaded when the command asks for the argument as script.
+	 *  - frame <n>: pop n commands and push them wrapped in an execute command, unless n is one.
+	 * 
+	 * Sizes are stored as 32 bit little endian integers, strings as a size followed by the characters.
+	 */
+	namespace image {
+		
+		/// Operations in a script image.
+		enum class Op : std::uint8_t {
+			speech   = 1,
+			command  = 2,
+			argument = 3,
+			frame    = 4,
+		};
+		
+		/// Append an operation to an image.
+		/**
+		 * \param image The image to append to.
+		 * \param op The operation.
+		 */
+		inline void writeOp(std::string & image, Op op) {
+			image.push_back(char(op));
+		}
+		
+		/// Append a size to an image.
+		/**
+		 * \param image The image to append to.
+		 * \param value The size.
+		 */
+		inline void writeSize(std::string & image, std::uint32_t value) {
+			for (int i = 0; i < 4; ++i) image.push_back(char((value >> (8 * i)) & 0xff));
+		}
+		
+		/// Append a string to an image.
+		/**
+		 * \param image The image to append to.
+		 * \param value The string.
+		 */
+		inline void writeString(std::string & image, std::string const & value) {
+			writeSize(image, value.size());
+			image.append(value);
+		}
+		
+		/// Receiver for the operations read from an image.
+		/**
+		 * The reader checks the structure of the image before passing an operation on,
+		 * so a builder can rely on the counts it gets matching what it was given before.
+		 */
+		class Builder {
+			public:
+				/// Virtual destructor.
+				virtual ~Builder() {}
+				
+				/// Handle a sentence.
+				/**
+				 * \param text The text of the sentence.
+				 * \param marks The sorted offsets in the text of the last marks.size() commands, which the sentence takes.
+				 */
+				virtual void speech(boost::string_ref text, std::vector<std::uint32_t> const & marks) = 0;
+				
+				/// Handle a command.
+				/**
+				 * \param name The name of the command.
+				 * \param arguments The number of arguments the command takes.
+				 */
+				virtual void command(boost::string_ref name, std::size_t arguments) = 0;
+				
+				/// Handle an argument.
+				/**
+				 * The image of the argument is not checked yet, it can be read with read() when needed.
+				 * 
+				 * \param text The literal text of the argument.
+				 * \param data The start of the image of the argument.
+				 * \param size The size of the image of the argument in bytes.
+				 */
+				virtual void argument(boost::string_ref text, char const * data, std::size_t size) = 0;
+				
+				/// Handle the end of a frame.
+				/**
+				 * \param count The number of commands in the frame, which the frame takes.
+				 */
+				virtual void frame(std::size_t count) = 0;
+		};
+		
+		/// Read an image.
+		/**
+		 * Throws if the image is malformed.
+		 * The strings passed to the builder point into the image.
+		 * 
+		 * \param data The start of the image.
+		 * \param size The size of the image in bytes.
+		 * \param builder The builder to pass the operations to.
+		 */
+		void read(char const * data, std::size_t size, Builder & builder);
+		
+		/// Write an image as script text.
+		/**
+		 * The text is the same as writing the loaded script, with frames written as execute commands.
+		 * Parsing the text gives an image that writes the same text again.
+		 * Throws if the image is malformed.
+		 * 
+		 * \param stream The stream to write to.
+		 * \param data The start of the image.
+		 * \param size The size of the image in bytes.
+		 */
+		void write(std::ostream & stream, char const * data, std::size_t size);
+		
+	}
+	
+}
@@ -0,0 +1,143 @@
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "script_loader.hpp"
+#include "script_engine.hpp"
+#include "core_commands.hpp"
+
+
+namespace robotutor {
+	
+	namespace {
+		/// Builder creating the commands of an image in a script.
+		/**
+		 * The commands of arguments are not created, only the arguments themselves.
+		 */
+		class Loader : public image::Builder {
+			protected:
+				/// The script to create the commands in.
+				command::Script & script_;
+				
+				/// The script engine to create the commands for.
+				ScriptEngine & engine_;
+				
+				/// Stack of created commands.
+				std::vector<command::Command *> commands_;
+				
+				/// Stack of read arguments.
+				command::ArgumentList arguments_;
+				
+				/// Step histogram of sentences, resolved for the first sentence.
+				Histogram * speech_steps_ = nullptr;
+				
+				/// Step histogram of frames, resolved for the first frame.
+				Histogram * execute_steps_ = nullptr;
+				
+			public:
+				/// Construct a loader.
+				/**
+				 * \param script The script to create the commands in.
+				 */
+				explicit Loader(command::Script & script) :
+					script_(script),
+					engine_(script.engine) {}
+				
+				/// Get the root command, once the whole image has been read.
+				command::Command * root() const { return commands_.back(); }
+				
+				/// Create a sentence.
+				void speech(boost::string_ref text, std::vector<std::uint32_t> const & marks) override {
+					auto speech = script_.create<command::Speech>(nullptr, text.to_string());
+					if (!speech_steps_) speech_steps_ = &engine_.stats.steps(speech->name());
+					speech->steps = speech_steps_;
+					popChildren_(marks.size(), speech);
+					
+					speech->marks.reserve(marks.size());
+					for (std::uint32_t i = 0; i < marks.size(); ++i) speech->marks.push_back({marks[i], i});
+					commands_.push_back(speech);
+				}
+				
+				/// Create a command with the factory.
+				void command(boost::string_ref name, std::size_t count) override {
+					command::ArgumentList arguments(std::make_move_iterator(arguments_.end() - count), std::make_move_iterator(arguments_.end()));
+					arguments_.erase(arguments_.end() - count, arguments_.end());
+					commands_.push_back(engine_.factory.create(script_, nullptr, name, std::move(arguments)));
+				}
+				
+				/// Keep an argument, its commands are only created when asked for.
+				void argument(boost::string_ref text, char const * data, std::size_t size) override {
+					arguments_.emplace_back(text.to_string(), script_, data, size);
+				}
+				
+				/// Wrap the commands of a frame in an execute command, unless there is only one.
+				void frame(std::size_t count) override {
+					if (count == 1) return;
+					auto execute = script_.create<command::Execute>(nullptr);
+					if (!execute_steps_) execute_steps_ = &engine_.stats.steps(command::Execute::static_name());
+					execute->steps = execute_steps_;
+					popChildren_(count, execute);
+					commands_.push_back(execute);
+				}
+				
+			protected:
+				/// Pop a number of commands and give them a parent.
+				/**
+				 * \param count The number of commands to pop.
+				 * \param parent The new parent of the commands.
+				 */
+				void popChildren_(std::size_t count, command::Command * parent) {
+					for (auto i = commands_.end() - count; i != commands_.end(); ++i) {
+						(*i)->parent = parent;
+						parent->children.push_back(*i);
+					}
+					commands_.resize(commands_.size() - count);
+				}
+		};
+		
+		/// Load the commands of a binary image into a script.
+		/**
+		 * \param script The script to create the commands in.
+		 * \param data The start of the image.
+		 * \param size The size of the image in bytes.
+		 * \return The root command of the image.
+		 */
+		command::Command * loadCommands(command::Script & script, char const * data, std::size_t size) {
+			Loader loader(script);
+			image::read(data, size, loader);
+			return loader.root();
+		}
+	}
+	
+	namespace command {
+		/// Get the argument parsed as script.
+		/**
+		 * The commands are created on the first call.
+		 * The image of the argument points into the image being loaded,
+		 * so this may only be called while the command is being created.
+		 * 
+		 * \return The root command of the argument.
+		 */
+		Command * Argument::script() {
+			if (!script_) script_ = loadCommands(*owner_, image_, size_);
+			return script_;
+		}
+	}
+	
+	/// Load a script from a binary image.
+	/**
+	 * Throws if the image is malformed or uses unknown commands.
+	 * Arguments are only checked when a command asks for their commands.
+	 * 
+	 * \param engine The script engine to create the commands for.
+	 * \param data The start of the image.
+	 * \param size The size of the image in bytes.
+	 * \return The loaded script.
+	 */
+	command::ScriptPtr loadScriptImage(ScriptEngine & engine, char const * data, std::size_t size) {
+		auto script = std::make_shared<command::Script>(engine);
+		script->root(loadCommands(*script, data, size));
+		return script;
+	}
+	
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include "script.hpp"
+#include "script_image.hpp"
+#include "script_parser.hpp"
+
+namespace robotutor {
+	
+	class ScriptEngine;
+	
+	/// Load a script from a binary image.
+	/**
+	 * Throws if the image is malformed or uses unknown commands.
+	 * Arguments are only checked when a command asks for their commands.
+	 * 
+	 * \param engine The script engine to create the commands for.
+	 * \param data The start of the image.
+	 * \param size The size of the image in bytes.
+	 * \return The loaded script.
+	 */
+	command::ScriptPtr loadScriptImage(ScriptEngine & engine, char const * data, std::size_t size);
+	
+	/// Load a script from a binary image.
+	/**
+	 * \param engine The script engine to create the commands for.
+	 * \param image The image.
+	 * \return The loaded script.
+	 */
+	inline command::ScriptPtr loadScriptImage(ScriptEngine & engine, std::string const & image) {
+		return loadScriptImage(engine, image.data(), image.size());
+	}
+	
+	/// Parse a script.
+	/**
+	 * \param engine The script engine to create the commands for.
+	 * \param args The arguments to parse(parser, args...).
+	 * \return The parsed script.
+	 */
+	template<typename... Args>
+	command::ScriptPtr parseScript(ScriptEngine & engine, Args&&... args) {
+		return loadScriptImage(engine, parseScriptImage(std::forward<Args>(args)...));
+	}
+	
+}
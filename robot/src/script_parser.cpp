@@ -1,9 +1,6 @@
 #include <memory>
 #include <stdexcept>
 
-#include <boost/lexical_cast.hpp>
-
-#include "script_engine.hpp"
 #include "script_parser.hpp"
 #include "parser_common.hpp"
 
@@ -29,13 +26,19 @@ namespace robotutor {
 					return false;
 			}
 		}
+		
+		/// Check if a character can be escaped with a backslash.
+		/**
+		 * \param c The character to check.
+		 * \return True if the character is an escapable special character.
+		 */
+		bool isEscapable(char c) {
+			return c == '{' || c == '}' || c == '|';
+		}
 	}
 	
 	/// Construct a script parser.
-	/**
-	 * \param engine The script engine to create commands for.
-	 */
-	ScriptParser::ScriptParser(ScriptEngine & engine) : engine_(engine) {
+	ScriptParser::ScriptParser() {
 		reset();
 	}
 	
@@ -43,13 +46,13 @@ namespace robotutor {
 	void ScriptParser::reset() {
 		state_ = State::text;
 		
-		root_     = std::make_shared<command::Execute>(engine_, nullptr);
-		sentence_ = std::make_shared<command::Speech>(engine_, root_.get());
+		image_.clear();
 		
-		command_name_.clear();
-		command_args_.clear();
-		current_arg_.clear();
-		level_ = 0;
+		depth_ = 0;
+		if (frames_.empty()) frames_.emplace_back();
+		resetFrame_(frames_[0]);
+		comment_level_ = 0;
+		escape_        = false;
 	}
 	
 	/// Get the parse result.
@@ -57,49 +60,95 @@ namespace robotutor {
 	 * May throw an exception if the parser is not in a valid state to return a result.
 	 * If no exception is thrown, the parser is reset as if a call to reset() has been made.
 	 * 
-	 * \return A shared pointer holding the parsed executable.
+	 * \return The image of the parsed script.
 	 */
-	command::SharedPtr ScriptParser::result() {
+	std::string ScriptParser::result() {
 		// Make sure the parser isn't in the middle of something.
-		if (state_ != State::text) {
+		// A comment on the last line doesn't need a trailing newline.
+		if (state_ == State::command_name || depth_) {
 			throw std::runtime_error("Parser requires more input before returning a result.");
 		}
 		
-		// Flush the final sentence.
-		if (sentence_->text.size()) flushSentence_();
-		
-		command::SharedPtr result;
-		// If we read exactly one command, just return that instead.
-		if (root_->children.size() == 1) {
-			result = root_->children[0];
-			result->parent = nullptr;
-		// Otherwise, return the aggregate command.
-		} else {
-			result = root_;
+		// A backslash at the very end is plain text.
+		if (escape_) {
+			escape_ = false;
+			text_(frame_(), '\\');
 		}
 		
+		finishFrame_();
+		std::string result = std::move(image_);
 		reset();
 		return result;
 	}
 	
+	/// Add a character to the text of a frame.
+	/**
+	 * \param frame The frame currently being parsed.
+	 * \param c The character.
+	 */
+	inline void ScriptParser::text_(Frame & frame, char c) {
+		if (depth_) frame.text.push_back(c);
+		
+		// Ignore whitespace as long as the sentence is empty.
+		if (isSpace(c) && !frame.sentence) return;
+		
+		frame.sentence = true;
+		frame.sentence_text.push_back(c);
+		if (endsSentence(c)) {
+			flushSentence_();
+		}
+	}
+	
 	/// Parse one character of input.
 	/**
 	 * \param c The input character.
 	 * \return bool True if the parser is done.
 	 */
 	bool ScriptParser::consume(char c) {
+		Frame & frame = frame_();
+		
 		switch (state_) {
 			// Parsing comments.
 			case State::comment:
+				// Inside an argument, a pipe symbol or closing curly bracket still ends the argument,
+				// unless it belongs to a bracket opened in the comment.
+				if (depth_) {
+					if (!comment_level_ && (c == '|' || c == '}')) {
+						state_ = State::text;
+						return consume(c);
+					} else if (c == '{') {
+						++comment_level_;
+					} else if (c == '}') {
+						--comment_level_;
+					}
+				}
+				
 				// Read endline to end comment state.
-				if (c == '\n')
-					state_ = State::text;
+				if (c == '\n') {
+					state_         = State::text;
+					comment_level_ = 0;
+				}
 				return false;
 				
 			// Parsing normal text.
 			case State::text:
+				// A backslash followed by a special character makes it literal text.
+				// Otherwise the backslash is text itself and the character is handled normally.
+				if (escape_) {
+					escape_ = false;
+					if (isEscapable(c)) {
+						text_(frame, c);
+						return false;
+					}
+					text_(frame, '\\');
+				}
+				
+				if (c == '\\') {
+					escape_ = true;
+					return false;
+					
 				// A hashtag starts a comment line.
-				if (c == '#') {
+				} else if (c == '#') {
 					state_ = State::comment;
 					return false;
 					
@@ -108,25 +157,33 @@ namespace robotutor {
 					state_ = State::command_name;
 					return false;
 					
-				// Ignore whitespace as long as the sentence is empty.
-				} else if (isSpace(c) && !sentence_->text.size()) {
+				// Pipe symbol in an argument starts the next argument.
+				} else if (c == '|' && depth_) {
+					popFrame_();
+					pushFrame_();
 					return false;
 					
-				// The rest is text.
-				} else {
-					sentence_->text.push_back(c);
-					if (endsSentence(c)) {
-						flushSentence_();
-					}
+				// Closing curly bracket in an argument ends the command.
+				} else if (c == '}' && depth_) {
+					popFrame_();
+					flushCommand_();
 					return false;
+					
+				// Anywhere else it has no matching opening bracket.
+				} else if (c == '}') {
+					throw std::runtime_error("Unmatched closing curly bracket encountered.");
 				}
 				
+				// The rest is text.
+				text_(frame, c);
+				return false;
+				
 			// Parsing a command name.
 			case State::command_name:
 				// Pipe symbol starts the argument list.
 				if (c == '|') {
-					state_ = State::command_args;
-					level_ = 0;
+					state_ = State::text;
+					pushFrame_();
 					return false;
 					
 				// A closing curly bracket closes the command.
@@ -137,13 +194,13 @@ namespace robotutor {
 					
 				// Lower case alpha characters, digits and normal spaces can be part of the name.
 				} else if (isLowerAlpha(c) || isDigit(c)) {
-					command_name_.push_back(c);
+					frame.command_name.push_back(c);
 					return false;
 					
 				// Fold any whitespace in the middle of a name into a single space.
 				} else if (isSpace(c)) {
-					if (command_name_.size() && command_name_.back() != ' ') {
-						command_name_.push_back(' ');
+					if (frame.command_name.size() && frame.command_name.back() != ' ') {
+						frame.command_name.push_back(' ');
 					}
 					return false;
 					
@@ -152,65 +209,105 @@ namespace robotutor {
 					throw std::runtime_error("Illegal character encountered in command name.");
 				}
 				
-			// Gather arguments.
-			case State::command_args:
-				// Closing curly bracket on level 0 ends the command.
-				if (c == '}' && !level_) {
-					flushArgument_();
-					flushCommand_();
-					state_ = State::text;
-					return false;
-				// Pipe symbol on level 0 ends the argument.
-				} else if (c == '|' && !level_) {
-					flushArgument_();
-					return false;
-				// Opening curly bracket increases the level.
-				} else if (c == '{') {
-					++level_;
-					current_arg_.push_back(c);
-					return false;
-				// Closing curly bracket increases the level.
-				} else if (c == '}') {
-					--level_;
-					current_arg_.push_back(c);
-					return false;
-				// Anything else is just input.
-				} else {
-					current_arg_.push_back(c);
-					return false;
-				}
-				
 			// Can't happen, but g++ won't shut up about it.
 			default:
 				throw std::logic_error("Parser in invalid state.");
 		}
 	}
 	
-	/// Flush the last read sentence
-	void ScriptParser::flushSentence_() {
-		root_->children.push_back(sentence_);
-		sentence_ = std::make_shared<command::Speech>(engine_, root_.get());
+	/// Prepare a frame to parse a new script.
+	/**
+	 * \param frame The frame to prepare.
+	 */
+	void ScriptParser::resetFrame_(Frame & frame) {
+		frame.items    = 0;
+		frame.sentence = false;
+		frame.sentence_text.clear();
+		frame.sentence_marks.clear();
+		frame.text.clear();
+		frame.command_name.clear();
+		frame.command_args = 0;
+		frame.image_start  = 0;
+	}
+	
+	/// Push a new frame for a command argument.
+	/**
+	 * The argument operation is written up front with room for the size of its image,
+	 * which is filled in by popFrame_().
+	 */
+	void ScriptParser::pushFrame_() {
+		image::writeOp(image_, image::Op::argument);
+		image::writeSize(image_, 0);
+		
+		if (++depth_ == frames_.size()) frames_.emplace_back();
+		resetFrame_(frames_[depth_]);
+		frame_().image_start = image_.size();
 	}
 	
-	/// Flush the last read command argument.
-	void ScriptParser::flushArgument_() {
-		command_args_.push_back(current_arg_);
-		current_arg_.clear();
-		level_ = 0;
+	/// Pop the current frame and add it as argument to the command of the parent frame.
+	void ScriptParser::popFrame_() {
+		finishFrame_();
+		
+		// Fill in the size of the image of the argument.
+		std::size_t start = frame_().image_start;
+		std::uint32_t size = image_.size() - start;
+		for (int i = 0; i < 4; ++i) image_[start - 4 + i] = char((size >> (8 * i)) & 0xff);
+		image::writeString(image_, frame_().text);
+		
+		--depth_;
+		++frame_().command_args;
+	}
+	
+	/// Finish the current frame by writing its root command.
+	/**
+	 * If the frame has exactly one command, that command is the root.
+	 * Otherwise the commands are wrapped in an aggregate command.
+	 */
+	void ScriptParser::finishFrame_() {
+		Frame & frame = frame_();
+		
+		// Flush the final sentence.
+		if (frame.sentence) flushSentence_();
+		
+		image::writeOp(image_, image::Op::frame);
+		image::writeSize(image_, frame.items);
+		frame.items = 0;
+	}
+	
+	/// Flush the last read sentence
+	/**
+	 * The commands embedded in the sentence have already been written,
+	 * so the sentence only needs to be written after them, followed by the offsets of the commands.
+	 */
+	void ScriptParser::flushSentence_() {
+		Frame & frame = frame_();
+		image::writeOp(image_, image::Op::speech);
+		image::writeString(image_, frame.sentence_text);
+		image::writeSize(image_, frame.sentence_marks.size());
+		for (std::uint32_t offset : frame.sentence_marks) image::writeSize(image_, offset);
+		++frame.items;
+		
+		frame.sentence = false;
+		frame.sentence_text.clear();
+		frame.sentence_marks.clear();
 	}
 	
 	/// Flush the recently parsed command.
 	void ScriptParser::flushCommand_() {
-		trim(command_name_);
-		if (sentence_->text.size()) {
-			sentence_->children.push_back(engine_.factory.create(sentence_.get(), std::move(command_name_), std::move(command_args_)));
-			sentence_->text += "\\mrk=" + boost::lexical_cast<std::string>(sentence_->children.size()) + "\\";
+		Frame & frame = frame_();
+		trim(frame.command_name);
+		image::writeOp(image_, image::Op::command);
+		image::writeString(image_, frame.command_name);
+		image::writeSize(image_, frame.command_args);
+		
+		if (frame.sentence) {
+			frame.sentence_marks.push_back(frame.sentence_text.size());
 		} else {
-			root_->children.push_back(engine_.factory.create(root_.get(), std::move(command_name_), std::move(command_args_)));
+			++frame.items;
 		}
 		
-		command_name_.clear();
-		command_args_.clear();
+		frame.command_name.clear();
+		frame.command_args = 0;
 	}
 	
 }
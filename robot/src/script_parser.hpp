@@ -1,20 +1,26 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
 
 #include "parse.hpp"
-#include "command_factory.hpp"
-#include "command.hpp"
-#include "core_commands.hpp"
+#include "script_image.hpp"
 
 namespace robotutor {
 	
-	class ScriptEngine;
-	
 	/// Parser for text executables.
 	/**
 	 * This parser will read an entire text executable from the input.
+	 * The result is a binary script image, which can be loaded with loadScriptImage().
+	 * The parser doesn't create any commands, so it can be used without a script engine.
+	 * 
+	 * A backslash before a curly bracket or pipe symbol makes that character literal text.
+	 * Any other backslash is kept as is, so text-to-speech tags like \\pau=500\\ keep working.
+	 * 
+	 * Command arguments are parsed in the same pass as the surrounding script.
+	 * Every argument that is being read gets its own frame on an explicit stack,
+	 * so nested commands never need to be copied and parsed again.
 	 */
 	class ScriptParser {
 		protected:
@@ -22,37 +28,66 @@ namespace robotutor {
 			enum class State {
 				text,
 				command_name,
-				command_args,
 				comment,
 			} state_;
 			
-			/// Script engine to create commands for.
-			ScriptEngine & engine_;
-			
-			/// Buffer for the root command.
-			std::shared_ptr<command::Execute> root_;
+			/// Parser frame for a script or a command argument being read.
+			struct Frame {
+				/// Number of commands written for the top level of the frame.
+				std::size_t items;
+				
+				/// True if a sentence is currently being parsed.
+				/**
+				 * Only set once the sentence has some text.
+				 */
+				bool sentence;
+				
+				/// Text of the sentence currently being parsed.
+				std::string sentence_text;
+				
+				/// Offsets in the sentence text of the commands embedded in the sentence currently being parsed.
+				std::vector<std::uint32_t> sentence_marks;
+				
+				/// Literal text of the frame, excluding embedded commands and comments.
+				/**
+				 * Only kept for argument frames.
+				 */
+				std::string text;
+				
+				/// Name of the command currently being parsed.
+				std::string command_name;
+				
+				/// Number of arguments for the command currently being parsed.
+				std::size_t command_args;
+				
+				/// Offset in the image where the image of the frame starts.
+				/**
+				 * Only used for argument frames.
+				 */
+				std::size_t image_start;
+			};
 			
-			/// Sentence currently being parsed.
-			std::shared_ptr<command::Speech> sentence_;
+			/// The script image being written.
+			std::string image_;
 			
-			/// Name of the command currently being parsed.
-			std::string command_name_;
+			/// Stack of parser frames.
+			/**
+			 * Frames above the current depth are kept around to reuse their buffers.
+			 */
+			std::vector<Frame> frames_;
 			
-			/// Argument currently being read.
-			std::string current_arg_;
+			/// Index of the frame currently being parsed.
+			std::size_t depth_;
 			
-			/// Arguments for the command currently being parsed.
-			std::vector<std::string> command_args_;
+			/// The level of curly brackets in a comment inside an argument.
+			unsigned int comment_level_;
 			
-			/// The level of nested commands in an argument.
-			unsigned int level_;
+			/// True if the previous character was a backslash that may start an escape sequence.
+			bool escape_;
 			
 		public:
 			/// Construct a script parser.
-			/**
-			 * \param engine The script engine to create commands for.
-			 */
-			ScriptParser(ScriptEngine & engine);
+			ScriptParser();
 			
 			/// Reset the parser so that it can parse a new command.
 			void reset();
@@ -62,9 +97,9 @@ namespace robotutor {
 			 * May throw an exception if the parser is not in a valid state to return a result.
 			 * If no exception is thrown, the parser is reset.
 			 * 
-			 * \return A shared pointer holding the parsed executable.
+			 * \return The image of the parsed script.
 			 */
-			command::SharedPtr result();
+			std::string result();
 			
 			/// Parse one character of input.
 			/**
@@ -74,29 +109,49 @@ namespace robotutor {
 			bool consume(char c);
 			
 		protected:
+			/// Get the frame currently being parsed.
+			Frame & frame_() { return frames_[depth_]; }
+			
+			/// Prepare a frame to parse a new script.
+			/**
+			 * \param frame The frame to prepare.
+			 */
+			void resetFrame_(Frame & frame);
+			
+			/// Push a new frame for a command argument.
+			void pushFrame_();
+			
+			/// Pop the current frame and add it as argument to the command of the parent frame.
+			void popFrame_();
+			
+			/// Finish the current frame by writing its root command.
+			void finishFrame_();
+			
+			/// Add a character to the text of a frame.
+			/**
+			 * \param frame The frame currently being parsed.
+			 * \param c The character.
+			 */
+			void text_(Frame & frame, char c);
+			
 			/// Flush the last read sentence.
 			void flushSentence_();
 			
-			/// Flush the last read command argument.
-			void flushArgument_();
-			
 			/// Flush the recently parsed command.
 			void flushCommand_();
 	};
 	
 	
-	/// Parse a script.
+	/// Parse a script into a script image.
 	/**
-	 * \param factory The command factory to use.
 	 * \param args The arguments to parse(parser, args...).
-	 * \return The parsed script.
+	 * \return The image of the parsed script.
 	 */
 	template<typename... Args>
-	command::SharedPtr parseScript(ScriptEngine & engine, Args&&... args) {
-		ScriptParser parser(engine);
+	std::string parseScriptImage(Args&&... args) {
+		ScriptParser parser;
 		parse(parser, std::forward<Args>(args)...);
 		return parser.result();
 	}
 	
-	
 }
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/make_shared.hpp>
+
+#include "simulated_backend.hpp"
+#include "simulated_tts.hpp"
+
+
+namespace robotutor {
+	
+	namespace {
+		/// The behaviors shipped in the behaviors directory of the repository.
+		char const * const default_behaviors[] = {
+			"robotutor/generic/Capisce",
+			"robotutor/generic/ConvergeHands",
+			"robotutor/generic/HandOverLeft",
+			"robotutor/generic/HandOverRight",
+			"robotutor/generic/PushAsideBoth",
+			"robotutor/generic/PushAsideLeft",
+			"robotutor/generic/PushAsideRight",
+			"robotutor/generic/SpreadBoth",
+			"robotutor/generic/SpreadLeft",
+			"robotutor/generic/SpreadRight",
+			"robotutor/special/HelloEverybody",
+			"robotutor/special/MotorOn",
+			"robotutor/special/Quiet",
+			"robotutor/special/RaiseHandSitting",
+			"robotutor/special/SideStepRight",
+			"robotutor/special/SitDown",
+			"robotutor/special/SitDownAndDie",
+			"robotutor/special/Squat",
+			"robotutor/special/SquatAndDie",
+			"robotutor/special/StandUp",
+			"robotutor/special/Twinkle",
+			"robotutor/specific/BodyBuilder",
+			"robotutor/specific/Bow",
+			"robotutor/specific/Facepalm",
+			"robotutor/specific/HelloEverybody",
+			"robotutor/specific/Me",
+			"robotutor/specific/PointForward",
+			"robotutor/specific/PointOutCameras",
+			"robotutor/specific/Quiet",
+			"robotutor/specific/RandomNo",
+			"robotutor/specific/RandomYes",
+			"robotutor/specific/ShowBiceps",
+			"robotutor/specific/ShowLeft",
+			"robotutor/specific/ShowRight",
+			"robotutor/specific/SideStepRight",
+			"robotutor/specific/SoccerKick",
+			"robotutor/specific/Twinkle",
+		};
+	}
+	
+	/// Construct the backend on a clock following real time.
+	/**
+	 * \param ios The IO service to run timers on.
+	 * \param speed How many times faster than real time the simulation runs.
+	 */
+	SimulatedBackend::SimulatedBackend(boost::asio::io_service & ios, double speed) :
+		SimulatedBackend(boost::make_shared<SimulatedClock>(ios, speed)) {}
+	
+	/// Construct the backend on a given clock.
+	/**
+	 * \param clock The clock timing the simulation.
+	 */
+	SimulatedBackend::SimulatedBackend(boost::shared_ptr<SimulatedClock> clock) :
+		clock(clock)
+	{
+		for (char const * name : default_behaviors) behaviors[name] = boost::posix_time::not_a_date_time;
+	}
+	
+	/// Replace the installed behaviors with a list read from a stream.
+	/**
+	 * Every line holds the name of a behavior, optionally followed by its duration in milliseconds.
+	 * Empty lines and lines starting with # are skipped.
+	 * Throws if a duration is not a number.
+	 * 
+	 * \param stream The stream to read from.
+	 */
+	void SimulatedBackend::loadBehaviors(std::istream & stream) {
+		behaviors.clear();
+		std::string line;
+		while (std::getline(stream, line)) {
+			std::istringstream fields(line);
+			std::string name;
+			if (!(fields >> name) || name[0] == '#') continue;
+			
+			long milliseconds;
+			if (fields >> milliseconds) {
+				behaviors[name] = boost::posix_time::milliseconds(milliseconds);
+			} else if (fields.eof()) {
+				behaviors[name] = boost::posix_time::not_a_date_time;
+			} else {
+				throw std::runtime_error("Invalid duration for behavior `" + name + "'.");
+			}
+		}
+	}
+	
+	/// Create a simulated text-to-speech backend.
+	/**
+	 * \param ios The IO service to use for events.
+	 * \return The text-to-speech backend.
+	 */
+	boost::shared_ptr<TtsBackend> SimulatedBackend::createTts(boost::asio::io_service & ios) {
+		return boost::make_shared<SimulatedTts>(ios, clock, synthesis_delay, character_duration);
+	}
+	
+	/// Get the names of all installed behaviors.
+	std::vector<std::string> SimulatedBackend::installedBehaviors() {
+		std::vector<std::string> result;
+		result.reserve(behaviors.size());
+		for (auto const & behavior : behaviors) result.push_back(behavior.first);
+		return result;
+	}
+	
+	/// Start loading a behavior.
+	/**
+	 * Loaded behaviors stay loaded.
+	 * 
+	 * \param name The name of the behavior.
+	 */
+	void SimulatedBackend::preloadBehavior(std::string const & name) {
+		if (!loaded_behaviors_.count(name)) loaded_behaviors_[name] = clock->now() + clock->scale(behavior_load_time);
+	}
+	
+	/// Run a behavior.
+	/**
+	 * The behavior starts once it is loaded,
+	 * and the done handler is invoked once the duration of the behavior has passed.
+	 * 
+	 * \param name The name of the behavior.
+	 * \param on_start Callback to invoke when the motion starts.
+	 * \param on_done Callback to invoke when the behavior is done.
+	 */
+	void SimulatedBackend::runBehavior(std::string const & name, StartHandler on_start, DoneHandler on_done) {
+		auto behavior = behaviors.find(name);
+		bool known = behavior != behaviors.end() && !behavior->second.is_special();
+		boost::posix_time::time_duration duration = clock->scale(known ? behavior->second : behavior_duration);
+		boost::posix_time::ptime start = startTime_(loaded_behaviors_, name, behavior_load_time);
+		loaded_behaviors_[name] = start;
+		
+		boost::shared_ptr<SimulatedClock> clock = this->clock;
+		clock->at(start, [clock, start, duration, on_start, on_done] () {
+			if (on_start) on_start();
+			clock->at(start + duration, [on_done] () {
+				if (on_done) on_done();
+			});
+		});
+	}
+	
+	/// Start loading a sound file.
+	/**
+	 * \param file The path of the file on the robot.
+	 */
+	void SimulatedBackend::preloadSound(std::string const & file) {
+		if (sound_users_[file]++ == 0) loaded_sounds_[file] = clock->now() + clock->scale(sound_load_time);
+	}
+	
+	/// Forget a preloaded sound file.
+	/**
+	 * \param file The path of the file on the robot.
+	 */
+	void SimulatedBackend::unloadSound(std::string const & file) {
+		auto users = sound_users_.find(file);
+		if (users == sound_users_.end() || --users->second) return;
+		sound_users_.erase(users);
+		loaded_sounds_.erase(file);
+	}
+	
+	/// Play a sound file.
+	/**
+	 * Nothing is played, there are no speakers to play it on.
+	 * The start handler is invoked once the file is loaded.
+	 * 
+	 * \param file The path of the file on the robot.
+	 * \param on_start Callback to invoke when the sound starts playing, may be empty.
+	 */
+	void SimulatedBackend::playSound(std::string const & file, StartHandler on_start) {
+		if (!on_start) return;
+		clock->at(startTime_(loaded_sounds_, file, sound_load_time), on_start);
+	}
+	
+	/// Get the time at which a behavior or sound can start.
+	/**
+	 * \param loaded The times at which preloaded items are loaded.
+	 * \param name The name of the item.
+	 * \param load_time Time needed to load the item if it wasn't preloaded.
+	 * \return The time at which the item starts.
+	 */
+	boost::posix_time::ptime SimulatedBackend::startTime_(std::map<std::string, boost::posix_time::ptime> const & loaded, std::string const & name, boost::posix_time::time_duration load_time) const {
+		auto item = loaded.find(name);
+		if (item == loaded.end()) return clock->now() + clock->scale(load_time);
+		return std::max(clock->now(), item->second);
+	}
+	
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <istream>
+#include <map>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "backend.hpp"
+#include "simulated_clock.hpp"
+
+namespace robotutor {
+	
+	/// Backend that simulates a robot.
+	/**
+	 * Speech is timed by a SimulatedTts and behaviors finish after a configured duration,
+	 * without any client having to acknowledge them.
+	 * Behaviors and sounds take a while to load before they start, unless they were preloaded in time.
+	 * All modeled durations are timed on a simulated clock,
+	 * so a script can be replayed faster than real time, or on virtual time independent of the machine.
+	 * 
+	 * The backend is only used from the strand of the script engine, so it needs no locking.
+	 */
+	class SimulatedBackend : public Backend {
+		public:
+			/// The clock timing the simulation.
+			boost::shared_ptr<SimulatedClock> clock;
+			
+			/// Time needed to synthesize a sentence before it can be spoken.
+			boost::posix_time::time_duration synthesis_delay = boost::posix_time::milliseconds(300);
+			
+			/// Time needed to speak one character.
+			boost::posix_time::time_duration character_duration = boost::posix_time::milliseconds(60);
+			
+			/// Duration of behaviors that are not in the behaviors map or have no duration of their own.
+			boost::posix_time::time_duration behavior_duration = boost::posix_time::seconds(2);
+			
+			/// Installed behaviors and their durations.
+			/**
+			 * Holds the behaviors shipped in the behaviors directory of the repository by default.
+			 * Behaviors with a duration of not_a_date_time take behavior_duration.
+			 */
+			std::map<std::string, boost::posix_time::time_duration> behaviors;
+			
+			/// Time needed to load a behavior before it starts.
+			boost::posix_time::time_duration behavior_load_time = boost::posix_time::milliseconds(400);
+			
+			/// Time needed to load a sound file before it starts.
+			boost::posix_time::time_duration sound_load_time = boost::posix_time::milliseconds(200);
+			
+			/// Construct the backend on a clock following real time.
+			/**
+			 * \param ios The IO service to run timers on.
+			 * \param speed How many times faster than real time the simulation runs.
+			 */
+			SimulatedBackend(boost::asio::io_service & ios, double speed = 1);
+			
+			/// Construct the backend on a given clock.
+			/**
+			 * \param clock The clock timing the simulation.
+			 */
+			explicit SimulatedBackend(boost::shared_ptr<SimulatedClock> clock);
+			
+			/// Replace the installed behaviors with a list read from a stream.
+			/**
+			 * Every line holds the name of a behavior, optionally followed by its duration in milliseconds.
+			 * Empty lines and lines starting with # are skipped.
+			 * Throws if a duration is not a number.
+			 * 
+			 * \param stream The stream to read from.
+			 */
+			void loadBehaviors(std::istream & stream);
+			
+			/// Create a simulated text-to-speech backend.
+			/**
+			 * \param ios The IO service to use for events.
+			 * \return The text-to-speech backend.
+			 */
+			boost::shared_ptr<TtsBackend> createTts(boost::asio::io_service & ios) override;
+			
+			/// Get the names of all installed behaviors.
+			std::vector<std::string> installedBehaviors() override;
+			
+			/// Start loading a behavior.
+			/**
+			 * Loaded behaviors stay loaded.
+			 * 
+			 * \param name The name of the behavior.
+			 */
+			void preloadBehavior(std::string const & name) override;
+			
+			/// Run a behavior.
+			/**
+			 * The behavior starts once it is loaded,
+			 * and the done handler is invoked once the duration of the behavior has passed.
+			 * 
+			 * \param name The name of the behavior.
+			 * \param on_start Callback to invoke when the motion starts.
+			 * \param on_done Callback to invoke when the behavior is done.
+			 */
+			void runBehavior(std::string const & name, StartHandler on_start, DoneHandler on_done) override;
+			
+			/// Start loading a sound file.
+			/**
+			 * \param file The path of the file on the robot.
+			 */
+			void preloadSound(std::string const & file) override;
+			
+			/// Forget a preloaded sound file.
+			/**
+			 * \param file The path of the file on the robot.
+			 */
+			void unloadSound(std::string const & file) override;
+			
+			/// Play a sound file.
+			/**
+			 * Nothing is played, there are no speakers to play it on.
+			 * The start handler is invoked once the file is loaded.
+			 * 
+			 * \param file The path of the file on the robot.
+			 * \param on_start Callback to invoke when the sound starts playing, may be empty.
+			 */
+			void playSound(std::string const & file, StartHandler on_start) override;
+			
+			/// Stop all playing sounds.
+			void stopSounds() override {}
+			
+		protected:
+			/// Times at which preloaded behaviors are loaded.
+			std::map<std::string, boost::posix_time::ptime> loaded_behaviors_;
+			
+			/// Times at which preloaded sounds are loaded.
+			std::map<std::string, boost::posix_time::ptime> loaded_sounds_;
+			
+			/// Number of unmatched preloadSound() calls per sound.
+			std::map<std::string, unsigned int> sound_users_;
+			
+			/// Get the time at which a behavior or sound can start.
+			/**
+			 * \param loaded The times at which preloaded items are loaded.
+			 * \param name The name of the item.
+			 * \param load_time Time needed to load the item if it wasn't preloaded.
+			 * \return The time at which the item starts.
+			 */
+			boost::posix_time::ptime startTime_(std::map<std::string, boost::posix_time::ptime> const & loaded, std::string const & name, boost::posix_time::time_duration load_time) const;
+	};
+	
+}
@@ -0,0 +1,40 @@
+#include <opencv2/core/core.hpp>
+
+#include "simulated_camera.hpp"
+
+
+namespace robotutor {
+	
+	/// Construct the source.
+	/**
+	 * \param width The width of the images.
+	 * \param height The height of the images.
+	 */
+	SimulatedCamera::SimulatedCamera(int width, int height) :
+		width_(width),
+		height_(height) {}
+	
+	/// Grab a frame.
+	/**
+	 * Draws diagonal color gradients, shifted by the frame number.
+	 * 
+	 * \param frame The frame to write the image to, in BGR colorspace.
+	 * \return True.
+	 */
+	bool SimulatedCamera::grab(cv::Mat & frame) {
+		frame.create(height_, width_, CV_8UC3);
+		unsigned int shift = frames_++ * 8;
+		
+		for (int y = 0; y < height_; ++y) {
+			unsigned char * pixel = frame.ptr<unsigned char>(y);
+			for (int x = 0; x < width_; ++x) {
+				*pixel++ = (x + shift) & 0xff;
+				*pixel++ = (y + shift) & 0xff;
+				*pixel++ = (x + y) & 0xff;
+			}
+		}
+		
+		return true;
+	}
+	
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "camera_source.hpp"
+
+namespace robotutor {
+	
+	/// Camera source that draws a test pattern instead of using a camera.
+	/**
+	 * The pattern moves a little with every frame,
+	 * so consecutive images differ like they would with a real camera.
+	 */
+	class SimulatedCamera : public CameraSource {
+		protected:
+			/// Width of the images.
+			int width_;
+			
+			/// Height of the images.
+			int height_;
+			
+			/// Number of frames grabbed so far.
+			unsigned int frames_ = 0;
+			
+		public:
+			/// Construct the source.
+			/**
+			 * \param width The width of the images.
+			 * \param height The height of the images.
+			 */
+			SimulatedCamera(int width, int height);
+			
+			/// Grab a frame.
+			/**
+			 * \param frame The frame to write the image to, in BGR colorspace.
+			 * \return True.
+			 */
+			bool grab(cv::Mat & frame) override;
+			
+			/// Get the number of frames grabbed so far.
+			/**
+			 * \return The number of frames.
+			 */
+			unsigned int frames() const { return frames_; }
+	};
+	
+}
@@ -0,0 +1,152 @@
+#include <algorithm>
+
+#include <boost/make_shared.hpp>
+
+#include "simulated_clock.hpp"
+
+
+namespace robotutor {
+	
+	/// Construct a clock following real time.
+	/**
+	 * \param ios The IO service to run handlers on.
+	 * \param speed How many times faster than real time the simulation runs.
+	 */
+	SimulatedClock::SimulatedClock(boost::asio::io_service & ios, double speed) :
+		ios_(ios),
+		virtual_(false),
+		speed_(speed) {}
+	
+	/// Construct a virtual clock.
+	/**
+	 * Virtual time starts at the current real time.
+	 * The IO service must be run with run() of the clock.
+	 * 
+	 * \param ios The IO service to run handlers on.
+	 */
+	SimulatedClock::SimulatedClock(boost::asio::io_service & ios) :
+		ios_(ios),
+		virtual_(true),
+		speed_(1),
+		now_(boost::posix_time::microsec_clock::universal_time()) {}
+	
+	/// Get the current time.
+	boost::posix_time::ptime SimulatedClock::now() {
+		if (!virtual_) return boost::posix_time::microsec_clock::universal_time();
+		std::lock_guard<std::mutex> lock(mutex_);
+		return now_;
+	}
+	
+	/// Convert a modeled duration to a duration of the clock.
+	/**
+	 * \param duration The modeled duration.
+	 * \return The duration divided by the speed in real time mode, or the duration itself in virtual mode.
+	 */
+	boost::posix_time::time_duration SimulatedClock::scale(boost::posix_time::time_duration duration) const {
+		if (virtual_) return duration;
+		return boost::posix_time::microseconds(static_cast<long>(duration.total_microseconds() / speed_));
+	}
+	
+	/// Start a timer.
+	/**
+	 * \param time The time at which the timer expires.
+	 * \param handler The handler to post to the IO service when the timer expires.
+	 * \return The ID of the timer.
+	 */
+	std::uint64_t SimulatedClock::at(boost::posix_time::ptime time, Handler handler) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::uint64_t id = ++last_id_;
+		
+		if (virtual_) {
+			events_.emplace(std::make_pair(time, id), std::move(handler));
+			expiry_[id] = time;
+			if (!work_) work_.reset(new boost::asio::io_service::work(ios_));
+			
+			// run() can only notice the timer once the IO service wakes up.
+			if (waiting_) {
+				waiting_ = false;
+				ios_.post([] () {});
+			}
+			return id;
+		}
+		
+		auto timer = boost::make_shared<boost::asio::deadline_timer>(ios_);
+		timers_[id] = timer;
+		timer->expires_at(time);
+		timer->async_wait([this, id, handler] (boost::system::error_code const & error) {
+			if (error) return;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				timers_.erase(id);
+			}
+			handler();
+		});
+		return id;
+	}
+	
+	/// Cancel a timer.
+	/**
+	 * The handler is not invoked, unless it was already posted.
+	 * Cancelling a timer that already expired does nothing.
+	 * 
+	 * \param timer The ID of the timer.
+	 */
+	void SimulatedClock::cancel(std::uint64_t timer) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (virtual_) {
+			auto time = expiry_.find(timer);
+			if (time == expiry_.end()) return;
+			events_.erase(std::make_pair(time->second, timer));
+			expiry_.erase(time);
+			if (events_.empty()) work_.reset();
+			return;
+		}
+		
+		auto pending = timers_.find(timer);
+		if (pending == timers_.end()) return;
+		pending->second->cancel();
+		timers_.erase(pending);
+	}
+	
+	/// Run the IO service until it runs out of work or is stopped.
+	/**
+	 * In virtual mode, time jumps to the earliest timer whenever no handler is ready.
+	 * 
+	 * \return The number of handlers that were run.
+	 */
+	std::size_t SimulatedClock::run() {
+		if (!virtual_) return ios_.run();
+		
+		std::size_t handlers = 0;
+		while (!ios_.stopped()) {
+			std::size_t ran = ios_.poll();
+			handlers += ran;
+			if (ran || advance_()) continue;
+			
+			// Nothing to do until another thread posts something or starts a timer.
+			handlers += ios_.run_one();
+		}
+		return handlers;
+	}
+	
+	/// Expire the earliest virtual timer.
+	/**
+	 * If no virtual timer is pending, the next timer to start will wake up the IO service.
+	 * 
+	 * \return False if no virtual timer is pending.
+	 */
+	bool SimulatedClock::advance_() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		waiting_ = events_.empty();
+		if (waiting_) return false;
+		
+		auto event = events_.begin();
+		now_ = std::max(now_, event->first.first);
+		ios_.post(std::move(event->second));
+		expiry_.erase(event->first.second);
+		events_.erase(event);
+		if (events_.empty()) work_.reset();
+		return true;
+	}
+	
+}
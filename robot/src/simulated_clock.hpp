@@ -0,0 +1,132 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace robotutor {
+	
+	/// Clock driving the simulated robot.
+	/**
+	 * In real time mode, timers are deadline timers on the IO service
+	 * and modeled durations are divided by the speed.
+	 * 
+	 * In virtual mode, time only moves when run() finds nothing else ready to run on the IO service,
+	 * and then jumps straight to the earliest timer.
+	 * A replay takes no longer than the work it causes,
+	 * and the simulated timing doesn't depend on the speed or load of the machine.
+	 * 
+	 * Handlers of expired timers are posted to the IO service.
+	 */
+	class SimulatedClock {
+		public:
+			/// Handler to invoke when a timer expires.
+			typedef std::function<void ()> Handler;
+		
+		protected:
+			/// The IO service to run handlers on.
+			boost::asio::io_service & ios_;
+			
+			/// True if time only moves when the IO service is idle.
+			bool virtual_;
+			
+			/// How many times faster than real time the simulation runs, in real time mode.
+			double speed_;
+			
+			/// Mutex protecting the timers and the virtual time.
+			std::mutex mutex_;
+			
+			/// The current virtual time.
+			boost::posix_time::ptime now_;
+			
+			/// ID of the last started timer.
+			std::uint64_t last_id_ = 0;
+			
+			/// Pending virtual timers, ordered by expiry time and then by the order they were started in.
+			std::map<std::pair<boost::posix_time::ptime, std::uint64_t>, Handler> events_;
+			
+			/// Expiry times of the pending virtual timers by ID.
+			std::map<std::uint64_t, boost::posix_time::ptime> expiry_;
+			
+			/// Pending real timers by ID.
+			std::map<std::uint64_t, boost::shared_ptr<boost::asio::deadline_timer>> timers_;
+			
+			/// Keeps the IO service from running out of work while virtual timers are pending.
+			std::unique_ptr<boost::asio::io_service::work> work_;
+			
+			/// True while run() waits for the IO service, so a new timer has to wake it up.
+			bool waiting_ = false;
+		
+		public:
+			/// Construct a clock following real time.
+			/**
+			 * \param ios The IO service to run handlers on.
+			 * \param speed How many times faster than real time the simulation runs.
+			 */
+			SimulatedClock(boost::asio::io_service & ios, double speed);
+			
+			/// Construct a virtual clock.
+			/**
+			 * Virtual time starts at the current real time.
+			 * The IO service must be run with run() of the clock.
+			 * 
+			 * \param ios The IO service to run handlers on.
+			 */
+			explicit SimulatedClock(boost::asio::io_service & ios);
+			
+			/// Check if the clock is virtual.
+			bool isVirtual() const { return virtual_; }
+			
+			/// Get the current time.
+			boost::posix_time::ptime now();
+			
+			/// Convert a modeled duration to a duration of the clock.
+			/**
+			 * \param duration The modeled duration.
+			 * \return The duration divided by the speed in real time mode, or the duration itself in virtual mode.
+			 */
+			boost::posix_time::time_duration scale(boost::posix_time::time_duration duration) const;
+			
+			/// Start a timer.
+			/**
+			 * \param time The time at which the timer expires.
+			 * \param handler The handler to post to the IO service when the timer expires.
+			 * \return The ID of the timer.
+			 */
+			std::uint64_t at(boost::posix_time::ptime time, Handler handler);
+			
+			/// Cancel a timer.
+			/**
+			 * The handler is not invoked, unless it was already posted.
+			 * Cancelling a timer that already expired does nothing.
+			 * 
+			 * \param timer The ID of the timer.
+			 */
+			void cancel(std::uint64_t timer);
+			
+			/// Run the IO service until it runs out of work or is stopped.
+			/**
+			 * In virtual mode, time jumps to the earliest timer whenever no handler is ready.
+			 * 
+			 * \return The number of handlers that were run.
+			 */
+			std::size_t run();
+		
+		protected:
+			/// Expire the earliest virtual timer.
+			/**
+			 * If no virtual timer is pending, the next timer to start will wake up the IO service.
+			 * 
+			 * \return False if no virtual timer is pending.
+			 */
+			bool advance_();
+	};
+	
+}
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+
+#include <boost/asio/io_service.hpp>
+
+#include "simulated_tts.hpp"
+
+
+namespace robotutor {
+	
+	/// Construct the backend.
+	/**
+	 * \param ios The IO service to report events on.
+	 * \param clock The clock to time the events on.
+	 * \param synthesis_delay Time needed to synthesize a job before it can play.
+	 * \param character_duration Time needed to speak one character.
+	 */
+	SimulatedTts::SimulatedTts(boost::asio::io_service & ios, boost::shared_ptr<SimulatedClock> clock, boost::posix_time::time_duration synthesis_delay, boost::posix_time::time_duration character_duration) :
+		strand_(ios),
+		clock_(clock),
+		synthesis_delay(synthesis_delay),
+		character_duration(character_duration) {}
+	
+	/// Cancel the timer of the playing job.
+	/**
+	 * The clock outlives the backend, so its timer must not fire anymore.
+	 */
+	SimulatedTts::~SimulatedTts() {
+		clock_->cancel(timer_);
+	}
+	
+	/// Queue a text to be spoken.
+	/**
+	 * \param text The text, which may contain TTS markup and bookmarks.
+	 * \return The ID of the job.
+	 */
+	int SimulatedTts::say(std::string const & text) {
+		Job job{++last_id_, text, clock_->now() + clock_->scale(synthesis_delay)};
+		strand_.dispatch([this, job] () {
+			jobs_.push_back(job);
+			if (!playing_) start_();
+		});
+		return job.id;
+	}
+	
+	/// Stop a job, whether it is being spoken or still queued.
+	/**
+	 * \param job The ID of the job.
+	 */
+	void SimulatedTts::stop(int job) {
+		strand_.dispatch([this, job] () {
+			for (auto i = jobs_.begin(); i != jobs_.end(); ++i) {
+				if (i->id != job) continue;
+				
+				bool was_playing = playing_ && i == jobs_.begin();
+				jobs_.erase(i);
+				if (on_done) on_done(job);
+				
+				if (was_playing) {
+					++generation_;
+					clock_->cancel(timer_);
+					start_();
+				}
+				return;
+			}
+		});
+	}
+	
+	/// Start playing the first queued job, if any.
+	/**
+	 * Computes the times of all bookmarks and the end of the job.
+	 * Markup between backslashes takes no time, except for pauses.
+	 * Other characters take character_duration each.
+	 */
+	void SimulatedTts::start_() {
+		playing_ = !jobs_.empty();
+		if (!playing_) return;
+		
+		Job const & job = jobs_.front();
+		boost::posix_time::ptime time = std::max(clock_->now(), job.ready);
+		boost::posix_time::time_duration character = clock_->scale(character_duration);
+		
+		events_.clear();
+		next_event_ = 0;
+		for (std::size_t i = 0; i < job.text.size(); ++i) {
+			if (job.text[i] != '\\') {
+				time += character;
+				continue;
+			}
+			
+			std::size_t end = job.text.find('\\', i + 1);
+			if (end == std::string::npos) break;
+			if (job.text.compare(i + 1, 4, "mrk=") == 0) {
+				events_.emplace_back(time, std::atoi(job.text.c_str() + i + 5));
+			} else if (job.text.compare(i + 1, 4, "pau=") == 0) {
+				time += clock_->scale(boost::posix_time::milliseconds(std::atoi(job.text.c_str() + i + 5)));
+			}
+			i = end;
+		}
+		events_.emplace_back(time, -1);
+		
+		schedule_();
+	}
+	
+	/// Wait for the next event of the playing job.
+	void SimulatedTts::schedule_() {
+		timer_ = clock_->at(events_[next_event_].first, strand_.wrap(std::bind(&SimulatedTts::handleTimer_, this, generation_)));
+	}
+	
+	/// Handle a timer event.
+	/**
+	 * \param generation The generation the timer was started for.
+	 */
+	void SimulatedTts::handleTimer_(unsigned int generation) {
+		if (generation != generation_) return;
+		
+		int bookmark = events_[next_event_++].second;
+		if (bookmark >= 0) {
+			if (on_bookmark) on_bookmark(bookmark);
+			schedule_();
+			
+		} else {
+			int job = jobs_.front().id;
+			jobs_.pop_front();
+			++generation_;
+			if (on_done) on_done(job);
+			start_();
+		}
+	}
+	
+}
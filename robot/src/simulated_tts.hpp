@@ -0,0 +1,130 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/strand.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "simulated_clock.hpp"
+#include "tts_backend.hpp"
+
+namespace boost {
+	namespace asio {
+		class io_service;
+	}
+}
+
+namespace robotutor {
+	
+	/// Text-to-speech backend that only simulates speaking.
+	/**
+	 * Every job needs a fixed synthesis delay after it was queued before it can start playing,
+	 * and takes a fixed time per spoken character to play.
+	 * Pause tags (\\pau=<ms>\\) take the time they ask for.
+	 * Bookmarks fire at the time their position in the text is reached.
+	 * All durations are taken on a simulated clock, which may run faster than real time or on virtual time.
+	 * Synthesis of a queued job overlaps with playing the jobs before it, like a real TTS engine would.
+	 * 
+	 * All state is kept on a strand of the IO service, events are reported from that strand.
+	 */
+	class SimulatedTts : public TtsBackend {
+		protected:
+			/// A queued job.
+			struct Job {
+				/// The ID of the job.
+				int id;
+				
+				/// The text of the job.
+				std::string text;
+				
+				/// The time at which synthesis of the job is done.
+				boost::posix_time::ptime ready;
+			};
+			
+			/// Strand serializing access to the jobs.
+			boost::asio::io_service::strand strand_;
+			
+			/// The clock to time the events on.
+			boost::shared_ptr<SimulatedClock> clock_;
+			
+			/// ID of the timer for the next event.
+			std::uint64_t timer_ = 0;
+			
+			/// Jobs that haven't finished yet, the first one is playing.
+			std::deque<Job> jobs_;
+			
+			/// True if the first job is playing.
+			bool playing_ = false;
+			
+			/// Events of the playing job, as pairs of time and bookmark, where a negative bookmark means done.
+			std::vector<std::pair<boost::posix_time::ptime, int>> events_;
+			
+			/// Index of the next event to fire.
+			std::size_t next_event_ = 0;
+			
+			/// Incremented when the playing job changes, to ignore stale timer callbacks.
+			unsigned int generation_ = 0;
+			
+			/// ID of the last queued job.
+			std::atomic<int> last_id_ { 0 };
+			
+		public:
+			/// Time needed to synthesize a job before it can play.
+			boost::posix_time::time_duration synthesis_delay;
+			
+			/// Time needed to speak one character.
+			boost::posix_time::time_duration character_duration;
+			
+			/// Construct the backend.
+			/**
+			 * \param ios The IO service to report events on.
+			 * \param clock The clock to time the events on.
+			 * \param synthesis_delay Time needed to synthesize a job before it can play.
+			 * \param character_duration Time needed to speak one character.
+			 */
+			SimulatedTts(
+				boost::asio::io_service & ios,
+				boost::shared_ptr<SimulatedClock> clock,
+				boost::posix_time::time_duration synthesis_delay    = boost::posix_time::milliseconds(300),
+				boost::posix_time::time_duration character_duration = boost::posix_time::milliseconds(60)
+			);
+			
+			/// Cancel the timer of the playing job.
+			/**
+			 * The clock outlives the backend, so its timer must not fire anymore.
+			 */
+			~SimulatedTts();
+			
+			/// Queue a text to be spoken.
+			/**
+			 * \param text The text, which may contain TTS markup and bookmarks.
+			 * \return The ID of the job.
+			 */
+			int say(std::string const & text);
+			
+			/// Stop a job, whether it is being spoken or still queued.
+			/**
+			 * \param job The ID of the job.
+			 */
+			void stop(int job);
+			
+		protected:
+			/// Start playing the first queued job, if any.
+			void start_();
+			
+			/// Wait for the next event of the playing job.
+			void schedule_();
+			
+			/// Handle a timer event.
+			/**
+			 * \param generation The generation the timer was started for.
+			 */
+			void handleTimer_(unsigned int generation);
+	};
+	
+}
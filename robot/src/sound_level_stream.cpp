@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+
+#include "sound_level_stream.hpp"
+
+
+namespace robotutor {
+	
+	/// Construct a sound level stream.
+	/**
+	 * \param sample_rate The sample rate of the audio, in Hz.
+	 */
+	SoundLevelStream::SoundLevelStream(unsigned int sample_rate) :
+		sample_rate_(sample_rate),
+		block_frames_(std::max(1u, sample_rate / base_rate)) {}
+	
+	/// Subscribe a client, change its subscription or unsubscribe it.
+	/**
+	 * The rate is rounded to a whole divisor of the base rate.
+	 * 
+	 * \param connection The connection to the client.
+	 * \param rate The number of levels per second, or 0 to unsubscribe.
+	 * \param batch The number of levels per message, or 0 for the default.
+	 */
+	void SoundLevelStream::subscribe(SharedServerConnection connection, unsigned int rate, unsigned int batch) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto subscriber = std::find_if(subscribers_.begin(), subscribers_.end(), [&connection] (Subscriber const & subscriber) {
+			return subscriber.connection.lock() == connection;
+		});
+		
+		if (!rate) {
+			if (subscriber != subscribers_.end()) subscribers_.erase(subscriber);
+			return;
+		}
+		
+		if (subscriber == subscribers_.end()) {
+			subscribers_.emplace_back();
+			subscriber = std::prev(subscribers_.end());
+			subscriber->connection = connection;
+		}
+		
+		subscriber->decimation = std::max(1u, (base_rate + rate / 2) / rate);
+		subscriber->batch      = batch ? batch : default_batch;
+		subscriber->blocks     = 0;
+		subscriber->window     = 0;
+		subscriber->message.Clear();
+		subscriber->message.mutable_sound_levels()->set_rate(base_rate / subscriber->decimation);
+	}
+	
+	/// Get the number of subscribed clients.
+	/**
+	 * \return The number of subscribers.
+	 */
+	std::size_t SoundLevelStream::subscribers() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return subscribers_.size();
+	}
+	
+	/// Process a recorded buffer.
+	/**
+	 * Should always be called from the same thread.
+	 * 
+	 * \param samples The interleaved samples.
+	 * \param frames The number of samples per channel.
+	 * \param channels The number of channels.
+	 */
+	void SoundLevelStream::process(std::int16_t const * samples, std::size_t frames, unsigned int channels) {
+		if (channels != channels_) {
+			channels_ = channels;
+			pending_.clear();
+			levels_.resize(channels);
+		}
+		
+		pending_.insert(pending_.end(), samples, samples + frames * channels);
+		
+		std::size_t const block = block_frames_ * channels;
+		std::size_t offset      = 0;
+		for (; offset + block <= pending_.size(); offset += block) {
+			measureLevels(pending_.data() + offset, block_frames_, channels, levels_.data());
+			
+			float rms = 0;
+			for (auto const & level : levels_) rms = std::max(rms, level.rms);
+			publish_(std::min<std::uint32_t>(1000, std::lround(rms * 1000)));
+		}
+		pending_.erase(pending_.begin(), pending_.begin() + offset);
+	}
+	
+	/// Add the level of a block to the windows of the subscribers, and send full batches.
+	/**
+	 * Subscribers whose connection is gone are removed.
+	 * 
+	 * \param level The level of the block in thousandths of full scale.
+	 */
+	void SoundLevelStream::publish_(std::uint32_t level) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto subscriber = subscribers_.begin(); subscriber != subscribers_.end();) {
+			SharedServerConnection connection = subscriber->connection.lock();
+			if (!connection) {
+				subscriber = subscribers_.erase(subscriber);
+				continue;
+			}
+			
+			subscriber->window = std::max(subscriber->window, level);
+			if (++subscriber->blocks == subscriber->decimation) {
+				SoundLevels & levels = *subscriber->message.mutable_sound_levels();
+				levels.add_levels(subscriber->window);
+				subscriber->blocks = 0;
+				subscriber->window = 0;
+				
+				if (unsigned(levels.levels_size()) >= subscriber->batch) {
+					levels.set_time(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+					connection->sendMessage(subscriber->message);
+					levels.clear_levels();
+				}
+			}
+			++subscriber;
+		}
+	}
+	
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "audio_level.hpp"
+#include "robotutor_protocol.hpp"
+
+namespace robotutor {
+	
+	/// Publishes the recorded sound level to subscribed clients.
+	/**
+	 * Buffers are cut in blocks of 1 / base_rate seconds,
+	 * and the RMS level of the loudest channel is taken for every block.
+	 * Every subscriber gets the maximum over a window of blocks at the rate it asked for,
+	 * and receives the levels in batches to keep the number of messages down.
+	 * 
+	 * Buffers are processed and levels are sent from the thread of the audio source,
+	 * so the stream never waits for or delays the script engine.
+	 */
+	class SoundLevelStream {
+		public:
+			/// The rate at which levels are measured, in levels per second.
+			static unsigned int const base_rate = 50;
+			
+			/// The number of levels per message if a subscriber doesn't ask for a batch size.
+			static unsigned int const default_batch = 5;
+			
+		protected:
+			/// A subscribed client.
+			struct Subscriber {
+				/// The connection to the client.
+				std::weak_ptr<ServerConnection> connection;
+				
+				/// The number of blocks per level.
+				unsigned int decimation;
+				
+				/// The number of levels per message.
+				unsigned int batch;
+				
+				/// The number of blocks in the current window.
+				unsigned int blocks;
+				
+				/// The highest level in the current window.
+				std::uint32_t window;
+				
+				/// The message being filled with levels.
+				RobotMessage message;
+			};
+			
+			/// The sample rate of the audio.
+			unsigned int sample_rate_;
+			
+			/// The number of samples per channel in a block.
+			std::size_t block_frames_;
+			
+			/// The number of channels of the pending samples.
+			unsigned int channels_ = 0;
+			
+			/// Samples that didn't fill a complete block yet.
+			std::vector<std::int16_t> pending_;
+			
+			/// Scratch space for the levels of a block.
+			std::vector<ChannelLevel> levels_;
+			
+			/// Mutex protecting the subscribers.
+			std::mutex mutex_;
+			
+			/// The subscribed clients.
+			std::vector<Subscriber> subscribers_;
+			
+		public:
+			/// Construct a sound level stream.
+			/**
+			 * \param sample_rate The sample rate of the audio, in Hz.
+			 */
+			SoundLevelStream(unsigned int sample_rate);
+			
+			/// Subscribe a client, change its subscription or unsubscribe it.
+			/**
+			 * The rate is rounded to a whole divisor of the base rate.
+			 * 
+			 * \param connection The connection to the client.
+			 * \param rate The number of levels per second, or 0 to unsubscribe.
+			 * \param batch The number of levels per message, or 0 for the default.
+			 */
+			void subscribe(SharedServerConnection connection, unsigned int rate, unsigned int batch);
+			
+			/// Get the number of subscribed clients.
+			/**
+			 * \return The number of subscribers.
+			 */
+			std::size_t subscribers();
+			
+			/// Process a recorded buffer.
+			/**
+			 * Should always be called from the same thread.
+			 * 
+			 * \param samples The interleaved samples.
+			 * \param frames The number of samples per channel.
+			 * \param channels The number of channels.
+			 */
+			void process(std::int16_t const * samples, std::size_t frames, unsigned int channels);
+			
+		protected:
+			/// Add the level of a block to the windows of the subscribers, and send full batches.
+			/**
+			 * \param level The level of the block in thousandths of full scale.
+			 */
+			void publish_(std::uint32_t level);
+	};
+	
+}
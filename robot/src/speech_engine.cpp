@@ -1,123 +1,289 @@
-#include <boost/asio/io_service.hpp>
+#include <iostream>
 
-#include <alcommon/albroker.h>
-#include <alproxies/almemoryproxy.h>
+#include <boost/asio/io_service.hpp>
 
 #include "speech_engine.hpp"
 #include "core_commands.hpp"
 
 
 namespace robotutor {
+	
 	/// Construct the speech engine.
-	SpeechEngine::SpeechEngine(boost::shared_ptr<AL::ALBroker> broker, std::string const & name) :
-		AL::ALModule(broker, name)
+	/**
+	 * \param strand The strand of the script engine.
+	 * \param backend The TTS backend to use.
+	 */
+	SpeechEngine::SpeechEngine(boost::asio::io_service::strand & strand, boost::shared_ptr<TtsBackend> backend) :
+		strand_(&strand),
+		backend_(backend),
+		events_(256),
+		lost_done_(-1)
 	{
-		setModuleDescription("RoboTutor Interrupting Speech Engine");
+		backend_->on_bookmark = [this] (int bookmark) {
+			pushEvent_({TtsEvent::Type::bookmark, bookmark, Stats::Clock::now()});
+		};
 		
-		functionName("onBookmark", getName(), "Handle bookmarks.");
-		BIND_METHOD(SpeechEngine::onBookmark);
+		backend_->on_done = [this] (int id) {
+			pushEvent_({TtsEvent::Type::done, id, Stats::Clock::time_point()});
+		};
 	}
 	
 	/// Deconstruct the speech engine.
 	SpeechEngine::~SpeechEngine() {
-		memory_->unsubscribeToEvent("ALTextToSpeech/CurrentBookMark", getName());
-	}
-	
-	/// Create a speech engine.
-	boost::shared_ptr<SpeechEngine> SpeechEngine::create(boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker, std::string const & name) {
-		boost::shared_ptr<SpeechEngine> result = ALModule::createModule<SpeechEngine>(broker, name);
-		result->ios_    = &ios;
-		return result;
-	}
-	
-	/// Initialize the module.
-	void SpeechEngine::init() {
-		memory_ = getParentBroker()->getMemoryProxy();
-		tts_ = AL::ALTextToSpeechProxy(getParentBroker());
-		tts_.enableNotifications();
-		
-		memory_->subscribeToEvent("ALTextToSpeech/CurrentBookMark", getName(), "onBookmark");
+		backend_->on_bookmark = nullptr;
+		backend_->on_done     = nullptr;
 	}
 	
-	/// Join the background thread to ensure we can safely be destructed.
+	/// Wait for the TTS backend to finish.
 	/**
 	 * Make sure that the IO service has already been stopped,
 	 * or it may still process events that use the speech engine.
 	 */
 	void SpeechEngine::join() {
-		if (wait_thread_.joinable()) wait_thread_.join();
+		backend_->join();
+	}
+	
+	/// Announce the speech commands that will follow the next command that is said.
+	/**
+	 * The next call to say() queues up to lookahead() of them with the TTS backend.
+	 * 
+	 * \param commands The upcoming speech commands, in order.
+	 */
+	void SpeechEngine::prefetch(std::vector<command::Speech *> commands) {
+		upcoming_ = std::move(commands);
 	}
 	
 	/// Execute a speech command.
 	/**
 	 * May not be called while the engine is already executing a job.
+	 * If the command was queued ahead, the queued job is used.
+	 * Otherwise anything queued ahead is stale and gets flushed.
+	 * 
+	 * Bookmarks the queued job already reached are delivered before this returns,
+	 * followed by the done handler if the job already finished.
+	 * The caller must be ready for its handlers to be invoked from inside this call.
 	 * 
 	 * \param command The speech command to execute.
 	 * \param bookmark_handler Callback to invoke when a bookmark is encountered.
 	 * \param done_handler Callback to invoke when the job is finished.
 	 */
 	void SpeechEngine::say(command::Speech & command, SpeechJob::BookmarkHandler bookmark_handler, SpeechJob::DoneHandler done_handler) {
-		cancel();
-		if (wait_thread_.joinable()) wait_thread_.join();
+		Stats::Clock::time_point now = Stats::Clock::now();
+		if (stats && last_finished_ != Stats::Clock::time_point()) stats->speech_gap.record(now - last_finished_);
+		last_finished_ = Stats::Clock::time_point();
 		
-		int job_id = tts_.post.say(command.text);
-		auto job = std::make_shared<SpeechJob>(&command, job_id, bookmark_handler, done_handler);
-		std::cout << "Job started: " << job << " " << command.text << std::endl;
+		std::shared_ptr<SpeechJob> job;
+		if (!pipeline_.empty() && pipeline_.front()->command == &command) {
+			job = pipeline_.front();
+			pipeline_.pop_front();
+		} else {
+			cancel();
+			job = submit_(command);
+		}
+		
+		job->on_bookmark = bookmark_handler;
+		job->on_done     = done_handler;
+		job->started     = now;
 		job_ = job;
-		wait_thread_ = std::thread([this, job] () {
-			wait_(job);
-		});
+		std::cout << "Job started: " << job << " " << command.text << std::endl;
+		
+		// Keep the pipeline filled with the upcoming commands.
+		for (std::size_t i = 0; i < pipeline_.size(); ++i) {
+			if (i >= upcoming_.size() || pipeline_[i]->command != upcoming_[i]) {
+				flushPipeline_();
+				break;
+			}
+		}
+		for (std::size_t i = pipeline_.size(); i < upcoming_.size() && i < lookahead_; ++i) {
+			pipeline_.push_back(submit_(*upcoming_[i]));
+		}
+		upcoming_.clear();
+		
+		// Deliver events that arrived before the command started the job, in order and before returning,
+		// so that no event drained later can overtake them.
+		// The handlers may run the script further, which can cancel the job.
+		std::vector<std::pair<unsigned int, Stats::Clock::time_point>> pending;
+		pending.swap(job->pending_bookmarks);
+		for (auto bookmark : pending) {
+			if (job != job_ || job->closed) return;
+			if (stats) stats->bookmark_latency.record(Stats::Clock::now() - bookmark.second);
+			job->on_bookmark(bookmark.first);
+		}
+		if (job->finished && job == job_) finishJob_(job);
 	}
 	
-	/// Cancel the current job.
+	/// Cancel the current job and all jobs queued ahead.
 	void SpeechEngine::cancel() {
+		last_finished_ = Stats::Clock::time_point();
 		if (job_) {
-			tts_.stop(job_->id);
-			job_->on_done(true);
-			job_->id = 0;
+			backend_->stop(job_->id);
+			if (!job_->closed) {
+				job_->closed = true;
+				job_->on_done(true);
+			}
+			job_ = nullptr;
 		}
+		flushPipeline_();
 	}
 	
-	/// Called when a bookmark is encountered.
-	void SpeechEngine::onBookmark(std::string const & eventName, int const & value, std::string const & subscriberIndentifier) {
-		// Post the event to the io_service.
-		ios_->post([this, value] () {
-			handleBookmark_(value);
-		});
+	/// Queue a job with the TTS backend.
+	/**
+	 * \param command The command to queue.
+	 * \return The new job.
+	 */
+	std::shared_ptr<SpeechJob> SpeechEngine::submit_(command::Speech & command) {
+		unsigned int base = next_mark_base_;
+		
+		// Leave plenty of room before the numbers overflow what the TTS engine accepts.
+		next_mark_base_ += command.marks.size();
+		if (next_mark_base_ > (1u << 30)) next_mark_base_ = 0;
+		
+		int id = backend_->say(command.markup(base));
+		return std::make_shared<SpeechJob>(&command, id, base);
+	}
+	
+	/// Stop all jobs queued ahead.
+	void SpeechEngine::flushPipeline_() {
+		for (auto & job : pipeline_) {
+			job->closed = true;
+			backend_->stop(job->id);
+		}
+		pipeline_.clear();
 	}
 	
-	/// Wait for a job and post the event.
+	/// Find the job a bookmark belongs to.
 	/**
-	 * \param job The job ID.
+	 * \param bookmark The number of the bookmark as reported by the backend.
+	 * \return The job, or a null pointer.
 	 */
-	void SpeechEngine::wait_(std::shared_ptr<SpeechJob> job) {
-		tts_.wait(job->id, 0);
-		ios_->post([this, job] () {
-			handleJobDone_(job);
+	std::shared_ptr<SpeechJob> SpeechEngine::findMark_(unsigned int bookmark) {
+		auto contains = [bookmark] (std::shared_ptr<SpeechJob> const & job) {
+			return bookmark > job->mark_base && bookmark <= job->mark_base + job->command->marks.size();
+		};
+		
+		if (job_ && contains(job_)) return job_;
+		for (auto & job : pipeline_) {
+			if (contains(job)) return job;
+		}
+		return nullptr;
+	}
+	
+	/// Queue an event from the backend and wake up the strand if needed.
+	/**
+	 * Called from the threads of the backend, possibly at the same time.
+	 * Only the first event of a batch posts a handler, the rest is picked up by the same drain.
+	 * 
+	 * \param event The event.
+	 */
+	void SpeechEngine::pushEvent_(TtsEvent const & event) {
+		bool wake;
+		if (!events_.tryPush(event, wake)) {
+			if (event.type != TtsEvent::Type::done) return;
+			
+			// A lost done event would leave the script waiting forever, so remember the highest lost job.
+			int lost = lost_done_.load(std::memory_order_relaxed);
+			while (lost < event.value && !lost_done_.compare_exchange_weak(lost, event.value, std::memory_order_relaxed)) {}
+			wake = events_.wake();
+		}
+		
+		if (wake) {
+			strand_->post([this] () {
+				drainEvents_();
+			});
+		}
+	}
+	
+	/// Handle all queued events from the backend.
+	void SpeechEngine::drainEvents_() {
+		events_.drain([this] (TtsEvent const & event) {
+			if (event.type == TtsEvent::Type::bookmark) {
+				handleBookmark_(event.value, event.time);
+			} else {
+				handleJobDone_(event.value);
+			}
 		});
+		
+		int lost = lost_done_.exchange(-1, std::memory_order_relaxed);
+		if (lost >= 0) handleLostDone_(lost);
+		
+		std::size_t dropped = events_.dropped();
+		if (dropped != reported_drops_) {
+			std::cerr << "Speech engine dropped " << dropped - reported_drops_ << " TTS events because its event queue was full." << std::endl;
+			reported_drops_ = dropped;
+		}
 	}
 	
 	/// Called when a bookmark is encountered.
 	/**
 	 * \param bookmark The number of the bookmark.
+	 * \param time The time the backend reported the bookmark.
 	 */
-	void SpeechEngine::handleBookmark_(int bookmark) {
+	void SpeechEngine::handleBookmark_(int bookmark, Stats::Clock::time_point time) {
 		// Bookmark 0 gets abused, so we ignore that one.
-		if (bookmark > 0 && job_ && job_->id) {
-			job_->on_bookmark(static_cast<unsigned int>(bookmark));
+		if (bookmark <= 0) return;
+		
+		auto job = findMark_(bookmark);
+		if (!job || job->closed) return;
+		
+		unsigned int local = bookmark - job->mark_base;
+		if (job == job_) {
+			if (stats) stats->bookmark_latency.record(Stats::Clock::now() - time);
+			job->on_bookmark(local);
+		} else {
+			job->pending_bookmarks.emplace_back(local, time);
 		}
 	}
 	
 	/// Called when a job is done.
-	void SpeechEngine::handleJobDone_(std::shared_ptr<SpeechJob> job) {
+	/**
+	 * \param id The ID of the finished job.
+	 */
+	void SpeechEngine::handleJobDone_(int id) {
+		if (job_ && job_->id == id) {
+			finishJob_(job_);
+			return;
+		}
+		
+		// A job queued ahead finished before its command started it.
+		for (auto & job : pipeline_) {
+			if (job->id == id) job->finished = true;
+		}
+	}
+	
+	/// Handle done events that didn't fit in the event queue.
+	/**
+	 * The backend speaks jobs in order and job IDs only go up,
+	 * so every job up to the highest lost ID has finished.
+	 * 
+	 * \param id The highest ID of the jobs whose done event was lost.
+	 */
+	void SpeechEngine::handleLostDone_(int id) {
+		std::cerr << "Speech engine recovered TTS done events that didn't fit in its event queue." << std::endl;
+		
+		// Mark queued jobs first, the done handler of the current job may start the next one.
+		for (auto & job : pipeline_) {
+			if (job->id <= id) job->finished = true;
+		}
+		if (job_ && job_->id <= id) finishJob_(job_);
+	}
+	
+	/// Finish the current job and invoke its done handler.
+	/**
+	 * \param job The job to finish.
+	 */
+	void SpeechEngine::finishJob_(std::shared_ptr<SpeechJob> job) {
 		std::cout << "Job finished. Current: " << job_ << ". Finished: " << job << "." << std::endl;
+		job->finished = true;
+		
 		// Unset the current job so that the done handler can safely start a new job.
-		if (job == job_) job_ = std::shared_ptr<SpeechJob>();
+		if (job == job_) job_ = nullptr;
 		
 		// If the job hasn't been cancelled, invoke the done handler.
-		if (job->id) {
+		if (!job->closed) {
+			last_finished_ = Stats::Clock::now();
+			if (stats) stats->speech_duration.record(last_finished_ - job->started);
+			job->closed = true;
 			job->on_done(false);
-			job->id = 0;
 		}
 	}
 	
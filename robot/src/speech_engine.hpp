@@ -1,27 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <string>
 #include <functional>
 #include <memory>
-#include <thread>
+#include <vector>
 
-#include <boost/signal.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/strand.hpp>
 
-#include <alcommon/almodule.h>
-#include <alproxies/altexttospeechproxy.h>
+#include "event_queue.hpp"
+#include "tts_backend.hpp"
+#include "stats.hpp"
 
 
-namespace boost {
-	namespace asio {
-		class io_service;
-	}
-}
-
-namespace AL {
-	class ALBroker;
-	class ALMemoryProxy;
-}
-
 namespace robotutor {
 	
 	class ScriptEngine;
@@ -38,55 +31,115 @@ namespace robotutor {
 		/// The speech command that initiated the job.
 		command::Speech * command;
 		
-		/// The job ID from the TTS proxy.
+		/// The job ID from the TTS backend.
 		int id;
 		
+		/// Offset added to the bookmarks of the command to make them unique between queued jobs.
+		unsigned int mark_base;
+		
 		/// Callback for bookmarks.
 		BookmarkHandler on_bookmark;
 		
 		/// Callback for when the job is done or interrupted.
 		DoneHandler on_done;
 		
+		/// True if the TTS backend finished the job.
+		bool finished = false;
+		
+		/// True if the done handler was invoked or the job was cancelled.
+		bool closed = false;
+		
+		/// Bookmarks encountered before the command started the job, with the time they were reported.
+		std::vector<std::pair<unsigned int, Stats::Clock::time_point>> pending_bookmarks;
+		
+		/// The time the command started the job.
+		Stats::Clock::time_point started;
+		
 		/// Construct a speech job.
 		/**
 		 * \param command The speech command that initiated the job.
-		 * \param id The job ID from the TTS proxy.
-		 * \param on_bookmark Callback for bookmarks.
-		 * \param on_done Callback for when the job is done or interrupted.
+		 * \param id The job ID from the TTS backend.
+		 * \param mark_base Offset added to the bookmarks of the command.
 		 */
-		SpeechJob(command::Speech * command, int id, BookmarkHandler on_bookmark, DoneHandler on_done) :
+		SpeechJob(command::Speech * command, int id, unsigned int mark_base) :
 			command(command),
 			id(id),
-			on_bookmark(on_bookmark),
-			on_done(on_done) {}
+			mark_base(mark_base) {}
 	};
 	
-	/// Speech engine to execute command::Text.
-	class SpeechEngine : public AL::ALModule {
+	/// Event reported by the TTS backend.
+	struct TtsEvent {
+		/// The kind of event.
+		enum class Type {
+			bookmark,
+			done,
+		} type;
+		
+		/// The number of the bookmark, or the ID of the finished job.
+		int value;
 		
+		/// The time the backend reported the event.
+		Stats::Clock::time_point time;
+	};
+	
+	/// Speech engine to execute command::Text.
+	/**
+	 * The engine can queue upcoming sentences with the TTS backend while the current one plays,
+	 * so the backend doesn't need to start from scratch between sentences.
+	 * Bookmarks of queued sentences are numbered from different bases so they can be told apart.
+	 * 
+	 * Events from the backend are passed through a lock-free queue and drained on the strand in batches.
+	 * Bookmarks that don't fit in the queue are dropped, done events are never lost:
+	 * the highest job ID of a done event that didn't fit is kept next to the queue,
+	 * and every job up to it is finished by the next drain.
+	 */
+	class SpeechEngine {
+		public:
+			/// Statistics to record latencies in, or a null pointer.
+			Stats * stats = nullptr;
+			
+			
 		protected:
-			/// IO service to perform asynchronous work.
-			boost::asio::io_service * ios_;
+			/// Strand of the script engine, all work is done on it.
+			boost::asio::io_service::strand * strand_;
+			
+			/// The TTS backend.
+			boost::shared_ptr<TtsBackend> backend_;
 			
 			/// The currently running job.
 			std::shared_ptr<SpeechJob> job_;
 			
-			/// Memory proxy to receive callbacks.
-			boost::shared_ptr<AL::ALMemoryProxy> memory_;
+			/// Jobs queued ahead of their command, in the order they will be spoken.
+			std::deque<std::shared_ptr<SpeechJob>> pipeline_;
 			
-			/// TTS proxy to do the actual synthesizing.
-			AL::ALTextToSpeechProxy tts_;
+			/// Speech commands expected to follow the next command that is said.
+			std::vector<command::Speech *> upcoming_;
 			
-			/// Thread to wait for job completion.
-			std::thread wait_thread_;
+			/// Maximum number of jobs to queue ahead.
+			std::size_t lookahead_ = 2;
+			
+			/// Bookmark offset for the next job.
+			unsigned int next_mark_base_ = 0;
+			
+			/// The time the last job finished, if no job was started since.
+			Stats::Clock::time_point last_finished_;
+			
+			/// Events from the backend waiting to be handled on the strand.
+			EventQueue<TtsEvent> events_;
+			
+			/// Highest ID of a job whose done event didn't fit in the event queue, or -1.
+			std::atomic<int> lost_done_;
+			
+			/// The number of dropped events that have been reported.
+			std::size_t reported_drops_ = 0;
 			
 		public:
 			/// Construct the speech engine.
 			/**
-			 * \param broker The broker to use.
-			 * \param name The name of the module.
+			 * \param strand The strand of the script engine.
+			 * \param backend The TTS backend to use.
 			 */
-			SpeechEngine(boost::shared_ptr<AL::ALBroker> broker, std::string const & name);
+			SpeechEngine(boost::asio::io_service::strand & strand, boost::shared_ptr<TtsBackend> backend);
 			
 			/// Deconstruct the speech engine.
 			virtual ~SpeechEngine();
@@ -97,27 +150,44 @@ namespace robotutor {
 			 */
 			std::shared_ptr<SpeechJob> job() { return job_; }
 			
-			/// Create a speech engine.
+			/// Get the TTS backend.
+			boost::shared_ptr<TtsBackend> backend() { return backend_; }
+			
+			/// Get the number of backend events dropped because the event queue was full.
 			/**
-			 * \param ios The IO service to use.
-			 * \param broker The broker to use.
-			 * \param name The name of the module.
+			 * Includes done events that didn't fit, even though their jobs are still finished.
 			 */
-			static boost::shared_ptr<SpeechEngine> create(boost::asio::io_service & ios, boost::shared_ptr<AL::ALBroker> broker, std::string const & name);
+			std::size_t droppedEvents() const { return events_.dropped(); }
 			
-			/// Initialize the module.
-			void init();
+			/// Get the maximum number of jobs to queue ahead.
+			std::size_t lookahead() const { return lookahead_; }
 			
-			/// Join the background thread to ensure we can safely be destructed.
+			/// Set the maximum number of jobs to queue ahead.
+			/**
+			 * \param lookahead The maximum number of jobs, or zero to only queue jobs when they are said.
+			 */
+			void lookahead(std::size_t lookahead) { lookahead_ = lookahead; }
+			
+			/// Wait for the TTS backend to finish.
 			/**
 			 * Make sure that the IO service has already been stopped,
 			 * or it may still process events that use the speech engine.
 			 */
 			void join();
 			
+			/// Announce the speech commands that will follow the next command that is said.
+			/**
+			 * The next call to say() queues up to lookahead() of them with the TTS backend.
+			 * 
+			 * \param commands The upcoming speech commands, in order.
+			 */
+			void prefetch(std::vector<command::Speech *> commands);
+			
 			/// Execute a speech command.
 			/**
 			 * May not be called while the engine is already executing a job.
+			 * If the command was queued ahead, the queued job is used.
+			 * Events the queued job already produced are delivered before this returns.
 			 * 
 			 * \param command The speech command to execute.
 			 * \param bookmark_handler Callback to invoke when a bookmark is encountered.
@@ -125,27 +195,60 @@ namespace robotutor {
 			 */
 			void say(command::Speech & command, SpeechJob::BookmarkHandler bookmark_handler, SpeechJob::DoneHandler done_handler);
 			
-			/// Cancel the current job.
+			/// Cancel the current job and all jobs queued ahead.
 			void cancel();
 			
-			/// Called when a bookmark is encountered.
-			void onBookmark(std::string const & eventName, int const & value, std::string const & subscriberIndentifier);
-			
 		protected:
-			/// Wait for a job and post the event.
+			/// Queue a job with the TTS backend.
+			/**
+			 * \param command The command to queue.
+			 * \return The new job.
+			 */
+			std::shared_ptr<SpeechJob> submit_(command::Speech & command);
+			
+			/// Stop all jobs queued ahead.
+			void flushPipeline_();
+			
+			/// Find the job a bookmark belongs to.
 			/**
-			 * \param job The job ID.
+			 * \param bookmark The number of the bookmark as reported by the backend.
+			 * \return The job, or a null pointer.
 			 */
-			void wait_(std::shared_ptr<SpeechJob> job);
+			std::shared_ptr<SpeechJob> findMark_(unsigned int bookmark);
+			
+			/// Queue an event from the backend and wake up the strand if needed.
+			/**
+			 * \param event The event.
+			 */
+			void pushEvent_(TtsEvent const & event);
+			
+			/// Handle all queued events from the backend.
+			void drainEvents_();
 			
 			/// Handle a bookmark.
 			/**
 			 * \param bookmark The number of the bookmark.
+			 * \param time The time the backend reported the bookmark.
 			 */
-			void handleBookmark_(int bookmark);
+			void handleBookmark_(int bookmark, Stats::Clock::time_point time);
 			
 			/// Handle the text done event.
-			void handleJobDone_(std::shared_ptr<SpeechJob> job);
+			/**
+			 * \param id The ID of the finished job.
+			 */
+			void handleJobDone_(int id);
 			
+			/// Handle done events that didn't fit in the event queue.
+			/**
+			 * \param id The highest ID of the jobs whose done event was lost.
+			 */
+			void handleLostDone_(int id);
+			
+			/// Finish the current job and invoke its done handler.
+			/**
+			 * \param job The job to finish.
+			 */
+			void finishJob_(std::shared_ptr<SpeechJob> job);
+		
 	};
 }
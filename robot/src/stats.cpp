@@ -0,0 +1,96 @@
+#include <algorithm>
+
+#include "stats.hpp"
+
+
+namespace robotutor {
+	
+	constexpr unsigned int Histogram::buckets;
+	
+	/// Record a sample.
+	/**
+	 * \param us The sample in microseconds.
+	 */
+	void Histogram::record(std::uint64_t us) {
+		unsigned int index = 0;
+		while (index + 1 < buckets && (std::uint64_t(1) << index) <= us) ++index;
+		
+		buckets_[index].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(us, std::memory_order_relaxed);
+		
+		std::uint64_t max = max_.load(std::memory_order_relaxed);
+		while (us > max && !max_.compare_exchange_weak(max, us, std::memory_order_relaxed));
+	}
+	
+	/// Remove all samples.
+	void Histogram::reset() {
+		for (auto & bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+		count_.store(0, std::memory_order_relaxed);
+		sum_.store(0, std::memory_order_relaxed);
+		max_.store(0, std::memory_order_relaxed);
+	}
+	
+	/// Get a percentile from the buckets.
+	/**
+	 * \param fraction The percentile as fraction.
+	 * \return The upper bound of the bucket holding the percentile, at most the largest sample, in microseconds.
+	 */
+	std::uint64_t Histogram::percentile(double fraction) const {
+		std::uint64_t target = count() * fraction;
+		std::uint64_t seen   = 0;
+		for (unsigned int i = 0; i < buckets; ++i) {
+			seen += bucket(i);
+			if (seen > target) return std::min(i ? std::uint64_t(1) << i : 0, max());
+		}
+		return max();
+	}
+	
+	/// Get the step histogram for a command name.
+	/**
+	 * The histogram is created the first time a name is seen and lives as long as the statistics.
+	 * 
+	 * \param name The name of the command.
+	 * \return The histogram.
+	 */
+	Histogram & Stats::steps(std::string const & name) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto & entry = steps_[name];
+		if (!entry) entry.reset(new Histogram);
+		return *entry;
+	}
+	
+	/// Visit all histograms.
+	/**
+	 * Step histograms are named "step/" followed by the command name.
+	 * 
+	 * \param visitor The function to call for every histogram.
+	 */
+	void Stats::visit(Visitor visitor) const {
+		visitor("bookmark_latency",  bookmark_latency);
+		visitor("speech_gap",        speech_gap);
+		visitor("speech_duration",   speech_duration);
+		visitor("behavior_wait",     behavior_wait);
+		visitor("behavior_duration", behavior_duration);
+		visitor("motion_start",      motion_start);
+		visitor("sound_start",       sound_start);
+		
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto const & entry : steps_) visitor("step/" + entry.first, *entry.second);
+	}
+	
+	/// Remove all samples from all histograms.
+	void Stats::reset() {
+		bookmark_latency.reset();
+		speech_gap.reset();
+		speech_duration.reset();
+		behavior_wait.reset();
+		behavior_duration.reset();
+		motion_start.reset();
+		sound_start.reset();
+		
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto & entry : steps_) entry.second->reset();
+	}
+	
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace robotutor {
+	
+	/// Histogram of durations in microseconds.
+	/**
+	 * Samples are counted in power of two buckets: bucket 0 holds samples of 0 us,
+	 * bucket i holds samples from 2^(i-1) up to 2^i us and the last bucket holds everything larger.
+	 * Recording only uses relaxed atomic operations, so it is safe from any thread and never blocks.
+	 */
+	class Histogram {
+		public:
+			/// The number of buckets.
+			static constexpr unsigned int buckets = 32;
+			
+		protected:
+			/// Number of samples per bucket.
+			std::atomic<std::uint64_t> buckets_[buckets];
+			
+			/// Total number of samples.
+			std::atomic<std::uint64_t> count_;
+			
+			/// Sum of all samples.
+			std::atomic<std::uint64_t> sum_;
+			
+			/// Largest sample.
+			std::atomic<std::uint64_t> max_;
+			
+		public:
+			/// Construct an empty histogram.
+			Histogram() { reset(); }
+			
+			/// Record a sample.
+			/**
+			 * \param us The sample in microseconds.
+			 */
+			void record(std::uint64_t us);
+			
+			/// Record a duration.
+			/**
+			 * \param duration The duration.
+			 */
+			template<typename Rep, typename Period>
+			void record(std::chrono::duration<Rep, Period> duration) {
+				auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+				record(us < 0 ? 0 : std::uint64_t(us));
+			}
+			
+			/// Remove all samples.
+			void reset();
+			
+			/// Get the number of samples in a bucket.
+			std::uint64_t bucket(unsigned int index) const { return buckets_[index].load(std::memory_order_relaxed); }
+			
+			/// Get the total number of samples.
+			std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+			
+			/// Get the sum of all samples.
+			std::uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+			
+			/// Get the largest sample.
+			std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+			
+			/// Get a percentile from the buckets.
+			/**
+			 * \param fraction The percentile as fraction.
+			 * \return The upper bound of the bucket holding the percentile, at most the largest sample, in microseconds.
+			 */
+			std::uint64_t percentile(double fraction) const;
+	};
+	
+	/// Latency statistics of the engines.
+	class Stats {
+		public:
+			/// Clock used for all measurements.
+			typedef std::chrono::steady_clock Clock;
+			
+			/// Callback to enumerate histograms.
+			typedef std::function<void (std::string const & name, Histogram const & histogram)> Visitor;
+			
+			/// Time between the TTS engine reaching a bookmark and the script engine handling it.
+			Histogram bookmark_latency;
+			
+			/// Time between a speech job finishing and the next one being started by the script.
+			Histogram speech_gap;
+			
+			/// Time between a speech command starting and its job finishing.
+			Histogram speech_duration;
+			
+			/// Time a behavior spent in the queue before it was sent.
+			Histogram behavior_wait;
+			
+			/// Time between sending a behavior and it being acknowledged.
+			Histogram behavior_duration;
+			
+			/// Time between a behavior command running and the motion starting, for backends that report it.
+			Histogram motion_start;
+			
+			/// Time between a sound command running and the sound starting.
+			Histogram sound_start;
+			
+		protected:
+			/// Mutex protecting the list of command histograms.
+			mutable std::mutex mutex_;
+			
+			/// Step durations per command name.
+			std::map<std::string, std::unique_ptr<Histogram>> steps_;
+			
+		public:
+			/// Get the step histogram for a command name.
+			/**
+			 * The histogram is created the first time a name is seen and lives as long as the statistics.
+			 * Resolving takes a lock, so callers should resolve once and keep the histogram,
+			 * recording into it is lock free.
+			 * 
+			 * \param name The name of the command.
+			 * \return The histogram.
+			 */
+			Histogram & steps(std::string const & name);
+			
+			/// Visit all histograms.
+			/**
+			 * Step histograms are named "step/" followed by the command name.
+			 * 
+			 * \param visitor The function to call for every histogram.
+			 */
+			void visit(Visitor visitor) const;
+			
+			/// Remove all samples from all histograms.
+			void reset();
+	};
+	
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <functional>
+#include <string>
+
+
+namespace robotutor {
+	
+	/// Interface for text-to-speech backends used by the speech engine.
+	/**
+	 * Backends queue texts and speak them one after the other, and job IDs only go up.
+	 * Events may be reported from any thread, also from several threads at the same time:
+	 * the speech engine hands them to its strand through a lock-free multi-producer queue.
+	 */
+	class TtsBackend {
+		public:
+			/// Callback for bookmarks, receives the number of the bookmark.
+			typedef std::function<void (int bookmark)> BookmarkHandler;
+			
+			/// Callback for finished jobs, receives the job ID.
+			typedef std::function<void (int job)> DoneHandler;
+			
+			/// Called when a bookmark is encountered.
+			BookmarkHandler on_bookmark;
+			
+			/// Called when a job finished or was stopped.
+			DoneHandler on_done;
+			
+			/// Virtual destructor.
+			virtual ~TtsBackend() {}
+			
+			/// Queue a text to be spoken.
+			/**
+			 * \param text The text, which may contain TTS markup and bookmarks.
+			 * \return The ID of the job.
+			 */
+			virtual int say(std::string const & text) = 0;
+			
+			/// Stop a job, whether it is being spoken or still queued.
+			/**
+			 * \param job The ID of the job.
+			 */
+			virtual void stop(int job) = 0;
+			
+			/// Block until all queued jobs have finished.
+			virtual void join() {}
+	};
+	
+}